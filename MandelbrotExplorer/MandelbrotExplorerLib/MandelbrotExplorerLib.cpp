@@ -4,6 +4,66 @@
 #include <glm/glm.hpp>
 #include <string>
 #include "mandelbrot_parameters.h"
+#include "perturbation.h"
+#include "perturbation_gpu.h"
+#include "mandelbrot_cpu.h"
+#include "kernel_selector.h"
+#include "palette.h"
+
+namespace
+{
+	// Push constants for one frame, laid out for whichever shaders are loaded.
+	struct frame_push_data
+	{
+		mandelbrot_parameter_info info;
+		mandelbrot_compute_info computeInfo;
+		mandelbrot_ff_parameter_info ffInfo;
+		mandelbrot_ff_compute_info ffComputeInfo;
+
+		void* fragment;
+		const void* compute;
+
+		frame_push_data(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds, bool floatFloat, bool usesCompute)
+			: info(info), computeInfo(info), ffInfo(info, bounds), ffComputeInfo(info, bounds)
+		{
+			// With a compute shader, the fragment shader only colors, and doesn't care about precision.
+			fragment = floatFloat && !usesCompute ? (void*)&ffInfo : (void*)&this->info;
+			compute = floatFloat ? (const void*)&ffComputeInfo : (const void*)&computeInfo;
+		}
+	};
+
+	// What LoadShaders() will load on a device that runs compute shaders (almost all of them),
+	// for the renderer to compile while it sets the device up.
+	std::vector<shader_source> startup_shaders()
+	{
+		return {
+			{ "custom_fragment_shader", mandelbrot_parameter_info::MANDELBROT_COLOR_SHADER, shaderc_shader_kind::shaderc_fragment_shader },
+			{ "custom_compute_shader", mandelbrot_compute_info::MANDELBROT_COMPUTE_SHADER, shaderc_shader_kind::shaderc_compute_shader }
+		};
+	}
+}
+
+// A frame for the CPU to compute: what MandelbrotRenderer::Draw() was asked for, and once
+// _cpuTask's done, the results. The worker only touches it while it's running.
+struct cpu_frame
+{
+	uint64_t number = 0;
+	mandelbrot_parameter_info info;
+	mandelbrot_precise_bounds bounds;
+
+	// The perturbation engine, or else cpu_renderer in precision.
+	bool perturbation = false;
+	cpu_precision precision = cpu_precision::float64;
+	perturbation_options options;
+	bool set_view = false;
+
+	iteration_buffer iterations;
+
+	cpu_frame(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds)
+		: info(info), bounds(bounds)
+	{
+	}
+};
 
 namespace MandelbrotExplorerLib
 {
@@ -11,11 +71,120 @@ namespace MandelbrotExplorerLib
 
 	MandelbrotRenderer::MandelbrotRenderer(System::IntPtr hinstance, System::IntPtr hwnd, bool debug)
 	{
+		System::Diagnostics::Stopwatch^ stopwatch = System::Diagnostics::Stopwatch::StartNew();
+
+		try
+		{
+			_native_renderer = new vulkan_renderer((HINSTANCE)hinstance.ToPointer(), (HWND)hwnd.ToPointer(), debug, startup_shaders());
+
+			System::Diagnostics::Stopwatch^ loadStopwatch = System::Diagnostics::Stopwatch::StartNew();
+			LoadShaders(_loadedPrecision);
+			_startupLoadShadersMilliseconds = loadStopwatch->Elapsed.TotalMilliseconds;
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+
+		_startupMilliseconds = stopwatch->Elapsed.TotalMilliseconds;
+	}
+
+	MandelbrotRenderer::MandelbrotRenderer(System::UInt32 width, System::UInt32 height, bool debug)
+	{
+		System::Diagnostics::Stopwatch^ stopwatch = System::Diagnostics::Stopwatch::StartNew();
+
 		try
 		{
-			_native_renderer = new vulkan_renderer((HINSTANCE)hinstance.ToPointer(), (HWND)hwnd.ToPointer(), debug);
+			_native_renderer = new vulkan_renderer(width, height, debug, startup_shaders());
+
+			System::Diagnostics::Stopwatch^ loadStopwatch = System::Diagnostics::Stopwatch::StartNew();
+			LoadShaders(_loadedPrecision);
+			_startupLoadShadersMilliseconds = loadStopwatch->Elapsed.TotalMilliseconds;
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+
+		_startupMilliseconds = stopwatch->Elapsed.TotalMilliseconds;
+	}
+
+	void MandelbrotRenderer::LoadShaders(ShaderPrecision precision)
+	{
+		// Prefer running the escape-time loop in a compute shader, leaving the
+		// fragment shader to color its results. Fall back on doing everything
+		// in the fragment shader where the graphics queue can't run compute work.
+		bool floatFloat = precision == ShaderPrecision::FloatFloat;
+
+		if (_native_renderer->supports_compute())
+		{
+			_native_renderer->load_fragment_shader(mandelbrot_parameter_info::MANDELBROT_COLOR_SHADER, sizeof(mandelbrot_parameter_info));
+
+			if (floatFloat)
+				_native_renderer->load_compute_shader(mandelbrot_ff_compute_info::MANDELBROT_FF_COMPUTE_SHADER, sizeof(mandelbrot_ff_compute_info), sizeof(mandelbrot_pixel_result), "float-float");
+			else
+				_native_renderer->load_compute_shader(mandelbrot_compute_info::MANDELBROT_COMPUTE_SHADER, sizeof(mandelbrot_compute_info), sizeof(mandelbrot_pixel_result), "float32");
+		}
+		else if (floatFloat)
+		{
+			_native_renderer->load_fragment_shader(mandelbrot_ff_parameter_info::MANDELBROT_FF_FRAGMENT_SHADER, sizeof(mandelbrot_ff_parameter_info));
+		}
+		else
+		{
 			_native_renderer->load_fragment_shader(mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER, sizeof(mandelbrot_parameter_info));
 		}
+
+		_loadedPrecision = precision;
+	}
+
+	void MandelbrotRenderer::Specialize(const mandelbrot_parameter_info& info, bool compute)
+	{
+		// Only settings that held for the last frame as well get pipelines of their own,
+		// so that dragging a slider through a range of iteration counts doesn't build one
+		// for every frame. Zero leaves a value to the push constants. The values are the
+		// same either way, so both kinds of pipeline draw exactly the same frame.
+		bool settled = _specializeShaders &&
+			info.max_iterations == _lastMaxIterations &&
+			info.bailout_radius == _lastBailoutRadius &&
+			info.gradient_length == _lastGradientLength;
+
+		_lastMaxIterations = info.max_iterations;
+		_lastBailoutRadius = info.bailout_radius;
+		_lastGradientLength = info.gradient_length;
+
+		uint32_t bailoutRadius;
+		memcpy(&bailoutRadius, &info.bailout_radius, sizeof(bailoutRadius));
+
+		uint32_t maxIterations = settled ? info.max_iterations : 0;
+		uint32_t gradientLength = settled ? info.gradient_length : 0;
+		bailoutRadius = settled ? bailoutRadius : 0;
+
+		_native_renderer->set_fragment_specialization({ maxIterations, gradientLength, bailoutRadius, _smoothing ? VK_TRUE : VK_FALSE });
+
+		// The compute shader's only ever changed alongside the push constants it's drawn
+		// with, never in the middle of a refinement.
+		if (compute && _native_renderer->supports_compute())
+			_native_renderer->set_compute_specialization({ maxIterations, bailoutRadius });
+	}
+
+	void MandelbrotRenderer::UseShaderPrecision(ShaderPrecision precision)
+	{
+		if (precision != _loadedPrecision)
+			LoadShaders(precision);
+	}
+
+	void MandelbrotRenderer::Precision::set(ShaderPrecision value)
+	{
+		_shaderPrecision = value;
+
+		// The Automatic engine loads whichever it needs when it needs it.
+		if (_engine != RenderEngine::Shader)
+			return;
+
+		try
+		{
+			UseShaderPrecision(value);
+		}
 		catch (const std::runtime_error& err)
 		{
 			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
@@ -26,9 +195,25 @@ namespace MandelbrotExplorerLib
 	{
 		if (!_disposed)
 		{
+			// Waits for the frame the CPU's computing, if any, ignoring anything it threw.
+			delete _cpuTask;
+			_cpuTask = nullptr;
+			delete _cpuRunning;
+			_cpuRunning = nullptr;
+			delete _cpuQueued;
+			_cpuQueued = nullptr;
+
 			_native_renderer->dispose();
 			_cachedMessages = GetDebugMessages();
+			delete _perturbationDevice;
+			_perturbationDevice = nullptr;
 			delete _native_renderer;
+			delete _perturbation;
+			_perturbation = nullptr;
+			delete _cpu;
+			_cpu = nullptr;
+			delete _palette;
+			_palette = nullptr;
 			_disposed = true;
 		}
 	}
@@ -38,7 +223,7 @@ namespace MandelbrotExplorerLib
 		if (_disposed)
 			return _cachedMessages;
 
-		const std::vector<debug_message>& nativeMessages = _native_renderer->debug_messages();
+		std::vector<debug_message> nativeMessages = _native_renderer->debug_messages();
 		int size = nativeMessages.size();
 		array<DebugMessage^>^ managedMessages = gcnew array<DebugMessage^>(size);
 
@@ -68,14 +253,13 @@ namespace MandelbrotExplorerLib
 		return System::ValueTuple<System::UInt32, System::UInt32>(extent.width, extent.height);
 	}
 
-	void MandelbrotRenderer::Draw()
+	void MandelbrotRenderer::FillParameters(mandelbrot_parameter_info& info)
 	{
-		mandelbrot_parameter_info info;
-
-		info.top = this->Top;
-		info.left = this->Left;
-		info.right = this->Right;
-		info.bottom = this->Bottom;
+		// The shaders only work in float. See mandelbrot_precise_bounds for the rest.
+		info.top = (float)this->Top;
+		info.left = (float)this->Left;
+		info.right = (float)this->Right;
+		info.bottom = (float)this->Bottom;
 
 		VkExtent2D extent = _native_renderer->surface_extent();
 		info.surface_width = (float)extent.width;
@@ -86,24 +270,932 @@ namespace MandelbrotExplorerLib
 		info.fill_color = this->FillColor;
 		info.gradient_period_factor = this->GradientPeriodFactor;
 
-		int length = mandelbrot_parameter_info::GRADIENT_CAPACITY;
-		length = std::min(length, this->Gradient->Length);
+		info.gradient_length = this->Gradient->Length;
+
+		UpdatePalette();
+	}
+
+	void MandelbrotRenderer::UpdatePalette()
+	{
+		array<System::UInt32>^ gradient = this->Gradient;
+		uint32_t size = std::max(_paletteSize, 1u);
+
+		bool changed =
+			_paletteGradient == nullptr ||
+			_paletteGradient->Length != gradient->Length ||
+			_paletteSrgb != _srgbGradient ||
+			_paletteBuiltSize != size;
+
+		for (int i = 0; !changed && i < gradient->Length; i++)
+			changed = _paletteGradient[i] != gradient[i];
+
+		if (!changed)
+			return;
+
+		// Kept as a copy, since whoever set the Gradient can still change what's in it.
+		_paletteGradient = safe_cast<array<System::UInt32>^>(gradient->Clone());
+		_paletteSrgb = _srgbGradient;
+		_paletteBuiltSize = size;
+
+		std::vector<uint32_t> colors(gradient->Length);
+
+		for (int i = 0; i < gradient->Length; i++)
+			colors[i] = gradient[i];
+
+		if (_palette == nullptr)
+			_palette = new palette();
+
+		_palette->build(colors.data(), uint32_t(colors.size()), size, _srgbGradient);
+
+		try
+		{
+			_native_renderer->set_palette(_palette->colors().data(), _palette->size() * sizeof(palette_color));
+		}
+		catch (const std::runtime_error& err)
+		{
+			_paletteGradient = nullptr;
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	mandelbrot_precise_bounds MandelbrotRenderer::PreciseBounds()
+	{
+		return mandelbrot_precise_bounds(this->Top, this->Left, this->Right, this->Bottom);
+	}
+
+	RenderKernel MandelbrotRenderer::ChooseKernel(const mandelbrot_parameter_info& info)
+	{
+		switch (_engine)
+		{
+		case RenderEngine::Shader:
+			return _shaderPrecision == ShaderPrecision::FloatFloat ? RenderKernel::FloatFloat : RenderKernel::Float;
+
+		case RenderEngine::Perturbation:
+		case RenderEngine::GpuPerturbation:
+			// Both show their results through the compute path. Without it,
+			// the shaders draw as deep as they can instead.
+			if (!_native_renderer->supports_compute())
+				return RenderKernel::FloatFloat;
+
+			return RenderKernel::Perturbation;
+		}
+
+		// Everything but the shaders shows its results through the compute path.
+		kernel_selection_options options;
+		options.allow_cpu = _native_renderer->supports_compute();
+
+		// Top, Left, Right and Bottom don't describe a precise view at all.
+		if (_preciseViewSet && options.allow_cpu)
+			return RenderKernel::Perturbation;
+
+		kernel_selector selector(options);
+		kernel_estimate estimate = selector.choose(PreciseBounds(), (uint32_t)info.surface_width, (uint32_t)info.surface_height);
+
+		switch (estimate.kernel)
+		{
+		case escape_kernel::float32: return RenderKernel::Float;
+		case escape_kernel::float_float: return RenderKernel::FloatFloat;
+		case escape_kernel::float64: return RenderKernel::Double;
+		case escape_kernel::double_double: return RenderKernel::DoubleDouble;
+		default: return RenderKernel::Perturbation;
+		}
+	}
+
+	bool MandelbrotRenderer::ShaderFrameReusable(RenderKernel kernel)
+	{
+		if (kernel != _lastFrameKernel)
+			return false;
+
+		return kernel == RenderKernel::Float || kernel == RenderKernel::FloatFloat;
+	}
+
+	FrameCompletion^ MandelbrotRenderer::Draw()
+	{
+		mandelbrot_parameter_info info;
+		FillParameters(info);
+
+		RenderKernel kernel = ChooseKernel(info);
+		_lastFrameKernel = kernel;
+
+		if (kernel != RenderKernel::Float && kernel != RenderKernel::FloatFloat)
+		{
+			// The perturbation engine's GPU passes keep to the same budget as the shaders.
+			progressive_options options;
+			options.budget_milliseconds = this->SubmissionBudgetMilliseconds;
+
+			try
+			{
+				_native_renderer->set_progressive(ProgressiveFor(kernel), options);
+
+				// Everything else is computed on the CPU, off this thread.
+				if (_engine != RenderEngine::GpuPerturbation)
+					return StartCpuFrame(info, kernel);
+
+				DropCpuFrames();
+				Specialize(info, false);
+				DrawPerturbation(info);
+			}
+			catch (const std::runtime_error& err)
+			{
+				throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+			}
+
+			return this->LastFrame;
+		}
+
+		// The shaders draw over whatever the CPU was computing.
+		DropCpuFrames();
+
+		bool floatFloat = kernel == RenderKernel::FloatFloat;
+		frame_push_data push(info, PreciseBounds(), floatFloat, _native_renderer->supports_compute());
+
+		progressive_options options;
+		options.budget_milliseconds = this->SubmissionBudgetMilliseconds;
+
+		try
+		{
+			UseShaderPrecision(floatFloat ? ShaderPrecision::FloatFloat : ShaderPrecision::Float);
+			Specialize(info, true);
+			_native_renderer->set_progressive(ProgressiveFor(kernel), options);
+			UpdateCacheView();
+			_native_renderer->draw_frame(push.fragment, push.compute);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+
+		return this->LastFrame;
+	}
+
+	void MandelbrotRenderer::Pan(System::Int32 deltaX, System::Int32 deltaY)
+	{
+		mandelbrot_parameter_info info;
+		FillParameters(info);
+
+		// The perturbation engine's frames are centered on the reference, which moves with the view,
+		// and the other kernels don't keep frames to move. Nor is there any reusing a frame
+		// the shaders drew in the other precision.
+		RenderKernel kernel = ChooseKernel(info);
+
+		if (!ShaderFrameReusable(kernel))
+		{
+			Draw();
+			return;
+		}
+
+		_lastFrameKernel = kernel;
+		frame_push_data push(info, PreciseBounds(), kernel == RenderKernel::FloatFloat, _native_renderer->supports_compute());
+
+		progressive_options options;
+		options.budget_milliseconds = this->SubmissionBudgetMilliseconds;
+
+		try
+		{
+			DropCpuFrames();
+			Specialize(info, true);
+			_native_renderer->set_progressive(ProgressiveFor(kernel), options);
+			UpdateCacheView();
+			_native_renderer->pan_frame(deltaX, deltaY, push.fragment, push.compute);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	void MandelbrotRenderer::ZoomPreview(System::Single scale, System::Int32 pixelX, System::Int32 pixelY)
+	{
+		mandelbrot_parameter_info info;
+		FillParameters(info);
+
+		RenderKernel kernel = ChooseKernel(info);
+
+		if (!ShaderFrameReusable(kernel))
+		{
+			Draw();
+			return;
+		}
+
+		_lastFrameKernel = kernel;
+		frame_push_data push(info, PreciseBounds(), kernel == RenderKernel::FloatFloat, _native_renderer->supports_compute());
+
+		progressive_options options;
+		options.budget_milliseconds = this->SubmissionBudgetMilliseconds;
+
+		bool previewed = false;
+
+		try
+		{
+			DropCpuFrames();
+			Specialize(info, true);
+			_native_renderer->set_progressive(ProgressiveFor(kernel), options);
+			UpdateCacheView();
+			previewed = _native_renderer->preview_zoom(scale, (float)pixelX, (float)pixelY, push.fragment, push.compute);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+
+		// Nothing to preview from, so draw from scratch.
+		if (!previewed)
+			Draw();
+	}
+
+	bool MandelbrotRenderer::ProgressiveFor(RenderKernel kernel)
+	{
+		// Only the plain float shader is cheap enough to be trusted with a whole frame in one
+		// submission. Anything heavier could run long enough for the driver to time out.
+		return this->Progressive || kernel != RenderKernel::Float;
+	}
+
+	bool MandelbrotRenderer::Refine()
+	{
+		try
+		{
+			return _native_renderer->refine_frame();
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	void MandelbrotRenderer::Recolor()
+	{
+		mandelbrot_parameter_info info;
+		FillParameters(info);
+
+		// A frame the CPU's still computing is colored when it's shown, with whatever
+		// the colors are by then. FillParameters() has brought the palette up to date.
+		if (_cpuRunning != nullptr || _cpuQueued != nullptr)
+			return;
 
-		info.gradient_length = length;
+		bool recolored = false;
 
-		for (int i = 0; i < length; i++)
-			info.gradient[i] = this->Gradient[i];
+		try
+		{
+			Specialize(info, false);
+			recolored = _native_renderer->recolor_frame(&info);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+
+		// Nothing to recolor yet (or no compute shader to have stored it), so draw from scratch.
+		if (!recolored)
+			Draw();
+	}
+
+	perturbation_engine& MandelbrotRenderer::Perturbation()
+	{
+		if (_perturbation == nullptr)
+			_perturbation = new perturbation_engine();
+
+		return *_perturbation;
+	}
+
+	perturbation_engine* MandelbrotRenderer::FinishedPerturbation()
+	{
+		// The engine's statistics are only settled once the CPU's done with it.
+		FinishCpuFrames();
+		return _perturbation;
+	}
+
+	perturbation_options MandelbrotRenderer::PerturbationOptions()
+	{
+		perturbation_options options = Perturbation().options();
+		options.rebase = _perturbationRebasing;
+		options.stream_references = _streamReferenceOrbits;
+
+		switch (_skipping)
+		{
+		case IterationSkipping::Bla: options.skipping = iteration_skipping_method::bla; break;
+		case IterationSkipping::Series: options.skipping = iteration_skipping_method::series; break;
+		default: options.skipping = iteration_skipping_method::none; break;
+		}
+
+		switch (_deltas)
+		{
+		case PerturbationDeltas::Float: options.deltas = delta_format::float32; break;
+		case PerturbationDeltas::Double: options.deltas = delta_format::float64; break;
+		case PerturbationDeltas::FloatExp: options.deltas = delta_format::extended; break;
+		default: options.deltas = delta_format::automatic; break;
+		}
+
+		return options;
+	}
+
+	void MandelbrotRenderer::DrawPerturbation(mandelbrot_parameter_info& info)
+	{
+		// The GPU engine's passes go through the renderer, so unlike the CPU's frames,
+		// they're run on this thread. The results are left in the iteration buffer, for
+		// the color shader to color.
+		perturbation_engine& engine = Perturbation();
+
+		if (!_preciseViewSet)
+			engine.set_view(PreciseBounds());
+
+		engine.set_options(PerturbationOptions());
+
+		if (_perturbationDevice == nullptr)
+			_perturbationDevice = new vulkan_perturbation_device(*_native_renderer);
+
+		engine.iterate(info, *_perturbationDevice);
+		_perturbationPixels = (System::UInt64)info.surface_width * (System::UInt64)info.surface_height;
+		_native_renderer->present_iteration_buffer(&info);
+	}
+
+	FrameCompletion^ MandelbrotRenderer::StartCpuFrame(const mandelbrot_parameter_info& info, RenderKernel kernel)
+	{
+		cpu_frame* frame = new cpu_frame(info, PreciseBounds());
+		frame->number = ++_cpuFrames;
+		frame->perturbation = kernel == RenderKernel::Perturbation;
+		frame->precision = kernel == RenderKernel::DoubleDouble ? cpu_precision::double_double : cpu_precision::float64;
+
+		if (frame->perturbation)
+		{
+			frame->options = PerturbationOptions();
+			frame->set_view = !_preciseViewSet;
+		}
+
+		// Whatever was waiting its turn is out of date now.
+		delete _cpuQueued;
+		_cpuQueued = frame;
+
+		PollCpuFrames();
+		return gcnew FrameCompletion(this, 0, frame->number);
+	}
+
+	void MandelbrotRenderer::LaunchCpuFrame(cpu_frame* frame)
+	{
+		// Nothing else is using the engines while nothing's running, so they're set up here.
+		cpu_renderer* cpu = nullptr;
+		perturbation_engine* engine = nullptr;
+
+		if (frame->perturbation)
+		{
+			engine = &Perturbation();
+
+			if (frame->set_view)
+				engine->set_view(frame->bounds);
+
+			engine->set_options(frame->options);
+		}
+		else
+		{
+			if (_cpu == nullptr)
+				_cpu = new cpu_renderer();
+
+			cpu = _cpu;
+			cpu->set_precision(frame->precision);
+		}
+
+		if (_cpuTask == nullptr)
+			_cpuTask = new background_task();
+
+		_cpuRunning = frame;
+
+		_cpuTask->start([frame, cpu, engine]()
+		{
+			if (engine != nullptr)
+				engine->iterate(frame->info, frame->iterations);
+			else
+				cpu->iterate(frame->info, frame->bounds, frame->iterations);
+		});
+	}
 
-		for (int i = length; i < mandelbrot_parameter_info::GRADIENT_CAPACITY; i++)
-			info.gradient[i] = 0x00FF00;
+	void MandelbrotRenderer::PresentCpuFrame()
+	{
+		cpu_frame* frame = _cpuRunning;
+		_cpuRunning = nullptr;
 
 		try
 		{
-			_native_renderer->draw_frame(&info);
+			_cpuTask->wait();
+
+			// Drawn with the colors as they are now, which Recolor() may have changed since.
+			mandelbrot_parameter_info info = frame->info;
+			mandelbrot_parameter_info current;
+			FillParameters(current);
+			info.fill_color = current.fill_color;
+			info.gradient_period_factor = current.gradient_period_factor;
+			info.gradient_length = current.gradient_length;
+
+			// Laid out the way the compute shader writes them, so the color shader can't tell
+			// the difference. Nothing reads the magnitude.
+			const iteration_buffer& iterations = frame->iterations;
+			std::vector<mandelbrot_pixel_result> results(iterations.values.size());
+
+			for (size_t i = 0; i < results.size(); i++)
+			{
+				results[i].smooth_iteration = iterations.values[i];
+				results[i].magnitude = 0.0f;
+			}
+
+			// If the surface changed size in the meantime, there's a fresh Draw() on its way anyway.
+			Specialize(info, false);
+			_native_renderer->present_results(results.data(), iterations.width, iterations.height, &info);
 		}
 		catch (const std::runtime_error& err)
 		{
+			delete frame;
 			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
 		}
+
+		if (frame->perturbation)
+			_perturbationPixels = frame->iterations.values.size();
+
+		_cpuPresented = frame->number;
+		_cpuPresentedFrame = _native_renderer->submitted_frame();
+		delete frame;
+	}
+
+	void MandelbrotRenderer::PollCpuFrames()
+	{
+		if (_cpuRunning != nullptr && _cpuTask->finished())
+			PresentCpuFrame();
+
+		if (_cpuRunning == nullptr && _cpuQueued != nullptr)
+		{
+			cpu_frame* next = _cpuQueued;
+			_cpuQueued = nullptr;
+			LaunchCpuFrame(next);
+		}
+	}
+
+	void MandelbrotRenderer::FinishCpuFrames()
+	{
+		while (_cpuRunning != nullptr || _cpuQueued != nullptr)
+		{
+			if (_cpuRunning != nullptr)
+				PresentCpuFrame();
+
+			PollCpuFrames();
+		}
+	}
+
+	void MandelbrotRenderer::DropCpuFrames()
+	{
+		delete _cpuQueued;
+		_cpuQueued = nullptr;
+
+		if (_cpuRunning == nullptr)
+			return;
+
+		// There's no stopping it partway, so it's waited for, and its results thrown away.
+		cpu_frame* frame = _cpuRunning;
+		_cpuRunning = nullptr;
+
+		try
+		{
+			_cpuTask->wait();
+		}
+		catch (const std::runtime_error&)
+		{
+		}
+
+		delete frame;
+	}
+
+	bool MandelbrotRenderer::CpuFramePending(System::UInt64 cpuFrame)
+	{
+		return (_cpuRunning != nullptr && _cpuRunning->number == cpuFrame) ||
+			(_cpuQueued != nullptr && _cpuQueued->number == cpuFrame);
+	}
+
+	bool MandelbrotRenderer::CpuFrameFinished(System::UInt64 cpuFrame, System::UInt64% frame)
+	{
+		if (_disposed)
+			return true;
+
+		PollCpuFrames();
+
+		if (CpuFramePending(cpuFrame))
+			return false;
+
+		// Dropped frames were never handed to the GPU, and leave frame at 0.
+		if (cpuFrame == _cpuPresented)
+			frame = _cpuPresentedFrame;
+
+		return true;
+	}
+
+	void MandelbrotRenderer::WaitForCpuFrame(System::UInt64 cpuFrame, System::UInt64% frame)
+	{
+		if (_disposed)
+			return;
+
+		if (CpuFramePending(cpuFrame))
+			FinishCpuFrames();
+
+		if (cpuFrame == _cpuPresented)
+			frame = _cpuPresentedFrame;
+	}
+
+	void MandelbrotRenderer::SetPreciseView(String^ centerX, String^ centerY, String^ height)
+	{
+		try
+		{
+			FinishCpuFrames();
+			Perturbation().set_view(marshal_as<std::string>(centerX), marshal_as<std::string>(centerY), marshal_as<std::string>(height));
+			_preciseViewSet = true;
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	void MandelbrotRenderer::ClearPreciseView()
+	{
+		_preciseViewSet = false;
+	}
+
+	String^ MandelbrotRenderer::PreciseCenterX::get()
+	{
+		if (FinishedPerturbation() == nullptr)
+			return "";
+
+		return marshal_as<System::String^>(_perturbation->center_real().to_string());
+	}
+
+	String^ MandelbrotRenderer::PreciseCenterY::get()
+	{
+		if (FinishedPerturbation() == nullptr)
+			return "";
+
+		return marshal_as<System::String^>(_perturbation->center_imag().to_string());
+	}
+
+	System::UInt32 MandelbrotRenderer::ReferenceOrbitLength::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0 : (System::UInt32)_perturbation->reference().size();
+	}
+
+	double MandelbrotRenderer::LastFrameReferenceMilliseconds::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0.0 : _perturbation->statistics().reference_milliseconds;
+	}
+
+	double MandelbrotRenderer::LastFrameStreamedReferenceMilliseconds::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0.0 : _perturbation->statistics().streamed_reference_milliseconds;
+	}
+
+	double MandelbrotRenderer::LastFramePerturbationMilliseconds::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0.0 : _perturbation->statistics().pixel_milliseconds;
+	}
+
+	System::UInt64 MandelbrotRenderer::LastFrameGlitchedPixels::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0 : _perturbation->statistics().glitched_pixels;
+	}
+
+	System::UInt32 MandelbrotRenderer::LastFrameSecondaryReferences::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0 : _perturbation->statistics().secondary_references;
+	}
+
+	System::UInt64 MandelbrotRenderer::LastFrameUnresolvedPixels::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0 : _perturbation->statistics().unresolved_pixels;
+	}
+
+	System::UInt64 MandelbrotRenderer::LastFrameRebases::get()
+	{
+		return FinishedPerturbation() == nullptr ? 0 : _perturbation->statistics().rebases;
+	}
+
+	double MandelbrotRenderer::LastFrameIterationsPerPixel::get()
+	{
+		if (FinishedPerturbation() == nullptr || _perturbationPixels == 0)
+			return 0.0;
+
+		return (double)_perturbation->statistics().iterations / _perturbationPixels;
+	}
+
+	double MandelbrotRenderer::LastFrameIterationsSkippedPerPixel::get()
+	{
+		if (FinishedPerturbation() == nullptr || _perturbationPixels == 0)
+			return 0.0;
+
+		return (double)_perturbation->statistics().skipped_iterations / _perturbationPixels;
+	}
+
+	PerturbationDeltas MandelbrotRenderer::LastFrameDeltas::get()
+	{
+		if (FinishedPerturbation() == nullptr)
+			return PerturbationDeltas::Double;
+
+		switch (_perturbation->statistics().deltas)
+		{
+		case delta_format::float32: return PerturbationDeltas::Float;
+		case delta_format::extended: return PerturbationDeltas::FloatExp;
+		default: return PerturbationDeltas::Double;
+		}
+	}
+
+	void MandelbrotRenderer::SetWorkgroupSize(System::UInt32 width, System::UInt32 height)
+	{
+		try
+		{
+			_native_renderer->set_workgroup_size(width, height);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	void MandelbrotRenderer::SetGridPosition(System::Int32 zoomLevel, double pixelSize, System::Int64 originX, System::Int64 originY)
+	{
+		_gridPositionSet = true;
+		_gridZoomLevel = zoomLevel;
+		_gridPixelSize = pixelSize;
+		_gridOriginX = originX;
+		_gridOriginY = originY;
+	}
+
+	void MandelbrotRenderer::ClearGridPosition()
+	{
+		_gridPositionSet = false;
+	}
+
+	void MandelbrotRenderer::UpdateCacheView()
+	{
+		if (!_gridPositionSet)
+		{
+			_native_renderer->clear_cache_view();
+			return;
+		}
+
+		tile_cache_view view;
+		view.zoom_level = _gridZoomLevel;
+		view.pixel_size = _gridPixelSize;
+		view.origin_x = _gridOriginX;
+		view.origin_y = _gridOriginY;
+		view.max_iterations = this->MaxIterations;
+		view.bailout_radius = this->BailoutRadius;
+
+		_native_renderer->set_cache_view(view);
+	}
+
+	void MandelbrotRenderer::ClearTileCache()
+	{
+		_native_renderer->cache().clear();
+	}
+
+	void MandelbrotRenderer::OpenTileStore(String^ directory)
+	{
+		// The native side takes UTF-8 paths, so that any directory name survives the trip.
+		array<System::Byte>^ bytes = System::Text::Encoding::UTF8->GetBytes(directory);
+		std::string path;
+
+		if (bytes->Length > 0)
+		{
+			pin_ptr<System::Byte> pinned = &bytes[0];
+			path.assign((const char*)pinned, bytes->Length);
+		}
+
+		try
+		{
+			_native_renderer->open_tile_store(path);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	void MandelbrotRenderer::CloseTileStore()
+	{
+		_native_renderer->close_tile_store();
+	}
+
+	void MandelbrotRenderer::ClearTileStore()
+	{
+		try
+		{
+			_native_renderer->store().clear();
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	System::UInt64 MandelbrotRenderer::TileStoreCapacityBytes::get()
+	{
+		return _native_renderer->store().capacity_bytes();
+	}
+
+	void MandelbrotRenderer::TileStoreCapacityBytes::set(System::UInt64 value)
+	{
+		_native_renderer->store().set_capacity(value);
+	}
+
+	System::UInt64 MandelbrotRenderer::TileStoreHits::get()
+	{
+		return _native_renderer->store().statistics().hits;
+	}
+
+	System::UInt64 MandelbrotRenderer::TileStoreTileCount::get()
+	{
+		return _native_renderer->store().tile_count();
+	}
+
+	System::UInt64 MandelbrotRenderer::TileStoreEvictions::get()
+	{
+		return _native_renderer->store().statistics().evictions;
+	}
+
+	void MandelbrotRenderer::SetShaderCacheDirectory(String^ directory)
+	{
+		std::string path;
+
+		if (directory != nullptr && directory->Length > 0)
+		{
+			array<System::Byte>^ bytes = System::Text::Encoding::UTF8->GetBytes(directory);
+			pin_ptr<System::Byte> pinned = &bytes[0];
+			path.assign((const char*)pinned, bytes->Length);
+		}
+
+		vulkan_renderer::set_shader_cache_directory(path);
+	}
+
+	System::UInt32 MandelbrotRenderer::ShaderCacheHits::get()
+	{
+		return _native_renderer->shader_statistics().spirv_hits;
+	}
+
+	System::UInt32 MandelbrotRenderer::ShaderCacheMisses::get()
+	{
+		return _native_renderer->shader_statistics().spirv_misses;
+	}
+
+	bool MandelbrotRenderer::PipelineCacheLoaded::get()
+	{
+		return _native_renderer->shader_statistics().pipeline_cache_loaded;
+	}
+
+	System::UInt64 MandelbrotRenderer::TileCacheBudgetBytes::get()
+	{
+		return _native_renderer->cache().budget_bytes();
+	}
+
+	void MandelbrotRenderer::TileCacheBudgetBytes::set(System::UInt64 value)
+	{
+		_native_renderer->cache().set_budget((size_t)value);
+	}
+
+	System::UInt64 MandelbrotRenderer::TileCacheHits::get()
+	{
+		return _native_renderer->cache().statistics().hits;
+	}
+
+	System::UInt64 MandelbrotRenderer::TileCacheMisses::get()
+	{
+		return _native_renderer->cache().statistics().misses;
+	}
+
+	double MandelbrotRenderer::StartupMilliseconds::get()
+	{
+		return _startupMilliseconds;
+	}
+
+	double MandelbrotRenderer::StartupInstanceMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().instance_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupDeviceMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().device_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupResourcesMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().resources_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupShaderCompileMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().shader_compile_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupPipelineMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().pipeline_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupShaderWaitMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().shader_wait_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupPipelineWaitMilliseconds::get()
+	{
+		return _native_renderer->setup_statistics().pipeline_wait_milliseconds;
+	}
+
+	double MandelbrotRenderer::StartupLoadShadersMilliseconds::get()
+	{
+		return _startupLoadShadersMilliseconds;
+	}
+
+	System::UInt32 MandelbrotRenderer::LastFrameSubmissions::get()
+	{
+		return _native_renderer->progressive_frame_statistics().submissions;
+	}
+
+	double MandelbrotRenderer::LastFrameLongestSubmissionMilliseconds::get()
+	{
+		return _native_renderer->progressive_frame_statistics().longest_submission_milliseconds;
+	}
+
+	FrameCompletion^ MandelbrotRenderer::LastFrame::get()
+	{
+		// A frame the CPU's still computing comes after whatever the GPU has.
+		if (!_disposed && (_cpuRunning != nullptr || _cpuQueued != nullptr))
+			return gcnew FrameCompletion(this, 0, _cpuFrames);
+
+		return gcnew FrameCompletion(this, _disposed ? 0 : _native_renderer->submitted_frame());
+	}
+
+	System::UInt32 MandelbrotRenderer::FramesInFlight::get()
+	{
+		return _native_renderer->frames_in_flight();
+	}
+
+	void MandelbrotRenderer::FramesInFlight::set(System::UInt32 value)
+	{
+		try
+		{
+			_native_renderer->set_frames_in_flight(value);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+	}
+
+	bool MandelbrotRenderer::FrameFinished(System::UInt64 frame)
+	{
+		// Disposing of the renderer waits for the device to go idle.
+		return _disposed || _native_renderer->frame_finished(frame);
+	}
+
+	void MandelbrotRenderer::WaitForFrame(System::UInt64 frame)
+	{
+		if (!_disposed)
+			_native_renderer->wait_for_frame(frame);
+	}
+
+	bool FrameCompletion::IsCompleted::get()
+	{
+		if (_cpuFrame != 0 && _frame == 0 && !_renderer->CpuFrameFinished(_cpuFrame, _frame))
+			return false;
+
+		return _renderer->FrameFinished(_frame);
+	}
+
+	void FrameCompletion::Wait()
+	{
+		if (_cpuFrame != 0 && _frame == 0)
+			_renderer->WaitForCpuFrame(_cpuFrame, _frame);
+
+		_renderer->WaitForFrame(_frame);
+	}
+
+	array<System::Byte>^ MandelbrotRenderer::ReadPixels()
+	{
+		std::vector<uint8_t> pixels;
+
+		// The last frame drawn may still be on the CPU.
+		FinishCpuFrames();
+
+		try
+		{
+			_native_renderer->read_pixels(pixels);
+		}
+		catch (const std::runtime_error& err)
+		{
+			throw gcnew System::Exception(marshal_as<System::String^>(err.what()));
+		}
+
+		int size = (int)pixels.size();
+		array<System::Byte>^ managedPixels = gcnew array<System::Byte>(size);
+
+		if (size > 0)
+		{
+			pin_ptr<System::Byte> destination = &managedPixels[0];
+			memcpy(destination, pixels.data(), size);
+		}
+
+		return managedPixels;
 	}
 }
\ No newline at end of file
@@ -1,6 +1,16 @@
 #pragma once
 #include "mandelbrot_native.h"
 
+struct mandelbrot_parameter_info;
+struct mandelbrot_precise_bounds;
+class perturbation_engine;
+class vulkan_perturbation_device;
+class cpu_renderer;
+class palette;
+class background_task;
+struct cpu_frame;
+struct perturbation_options;
+
 using namespace System;
 using namespace System::Collections::Generic;
 using namespace System::Drawing;
@@ -23,6 +33,134 @@ namespace MandelbrotExplorerLib
 		DeviceAddressBinding = 0x00000008
 	};
 
+	// Number format the shaders run the escape-time loop in.
+	public enum class ShaderPrecision
+	{
+		// Fastest, but blocky past a zoom of about 1e-5.
+		Float,
+
+		// Emulated double, from pairs of floats. Several times slower,
+		// but good to about 1e-13, on any device.
+		FloatFloat
+	};
+
+	// What computes each frame's escape times.
+	public enum class RenderEngine
+	{
+		// The shaders, in whichever Precision is selected.
+		Shader,
+
+		// Perturbation theory, on the CPU: a single reference orbit in as much precision
+		// as the zoom needs, with every pixel iterated as a double-precision offset from it,
+		// or past a view height of about 1e-290, as a double with an exponent of its own.
+		// Use SetPreciseView() for views that Top, Left, Right and Bottom can't express.
+		// Computed on a thread of its own, like the Automatic engine's CPU kernels. Needs a
+		// device that supports compute; without one, the FloatFloat shader draws instead.
+		Perturbation,
+
+		// The same, with the pixels iterated by a compute shader instead. Only the reference
+		// orbits are computed on the CPU, and each is uploaded to the GPU once, for as many
+		// frames as use it. Deltas are floats, or past a view height of about 1e-16, floats
+		// with an exponent of their own. Faster than the CPU by far, but their 24 bits are
+		// noticeably noisier near the boundary. Series skipping is replaced with Bla.
+		// Falls back on the FloatFloat shader the same way.
+		GpuPerturbation,
+
+		// Whichever RenderKernel is cheapest while still precise enough for the view,
+		// judged afresh every frame from Top, Left, Right, Bottom and the surface size.
+		// Perturbation once SetPreciseView() is used. The shaders' Precision is ignored.
+		// Past what the shaders can draw, the frame's computed on the CPU, on a thread of its
+		// own: Draw() returns straight away, and the frame's shown once its FrameCompletion
+		// finds it finished. The default.
+		Automatic
+	};
+
+	// What computed a frame's escape times, cheapest first.
+	public enum class RenderKernel
+	{
+		// The shaders, in float or float-float.
+		Float,
+		FloatFloat,
+
+		// The CPU, in double or double-double. Only chosen by the Automatic engine,
+		// on a device that supports compute.
+		Double,
+		DoubleDouble,
+
+		// The Perturbation or GpuPerturbation engine. The Automatic engine uses the CPU's.
+		Perturbation
+	};
+
+	// What the perturbation engine holds each pixel's offset from the reference orbit in.
+	public enum class PerturbationDeltas
+	{
+		// Double, or FloatExp once the view's too deep for doubles.
+		Automatic,
+
+		// No faster than Double on the CPU, and less accurate. For comparison.
+		// The GPU engine's usual deltas.
+		Float,
+
+		// CPU only. The GPU engine takes it for Automatic.
+		Double,
+
+		// A double mantissa (a float one on the GPU) with a separate 32-bit exponent,
+		// for views of any depth.
+		FloatExp
+	};
+
+	// How the perturbation engine skips the iterations where every pixel follows
+	// the reference orbit in lockstep.
+	public enum class IterationSkipping
+	{
+		None,
+
+		// Bivariate linear approximation: jumps of up to thousands of iterations at a time,
+		// anywhere along the orbit where a pixel's still close enough to the reference.
+		Bla,
+
+		// Series approximation: one jump over the start of the orbit, shared by every pixel.
+		Series
+	};
+
+	ref class MandelbrotRenderer;
+
+	// A frame on its way through the GPU. Drawing doesn't wait for the GPU to finish a frame,
+	// only for it to be handed over, so the UI can get on with the next one in the meantime.
+	// This is for whoever does need to know when it's finished. Frames finish in the order
+	// they were drawn, so a frame that's finished means every one before it has too.
+	//
+	// A frame the CPU computes isn't handed to the GPU until it's been computed. Checking
+	// IsCompleted is what hands it over, on the calling thread, once the CPU's done; Frame
+	// is 0 until then. A CPU frame that's replaced by another drawing before it's shown
+	// counts as completed.
+	public ref class FrameCompletion
+	{
+	public:
+
+		property System::UInt64 Frame { System::UInt64 get() { return _frame; } }
+		property bool IsCompleted { bool get(); }
+		void Wait();
+
+	internal:
+
+		FrameCompletion(MandelbrotRenderer^ renderer, System::UInt64 frame)
+			: _renderer(renderer), _frame(frame), _cpuFrame(0)
+		{
+		}
+
+		FrameCompletion(MandelbrotRenderer^ renderer, System::UInt64 frame, System::UInt64 cpuFrame)
+			: _renderer(renderer), _frame(frame), _cpuFrame(cpuFrame)
+		{
+		}
+
+	private:
+
+		MandelbrotRenderer^ _renderer;
+		System::UInt64 _frame;
+		System::UInt64 _cpuFrame;
+	};
+
 	public ref class DebugMessage
 	{
 	public:
@@ -42,28 +180,361 @@ namespace MandelbrotExplorerLib
 		}
 
 		MandelbrotRenderer(System::IntPtr hinstance, System::IntPtr hwnd, bool debug);
+
+		// Headless renderer. Draws into an offscreen image
+		// whose pixels can be fetched with ReadPixels().
+		MandelbrotRenderer(System::UInt32 width, System::UInt32 height, bool debug);
 		~MandelbrotRenderer();
 
 		void RefreshSurface();
 		System::ValueTuple<System::UInt32, System::UInt32> GetSurfaceExtent();
-		void Draw();
+
+		// Returns once the frame's been handed to the GPU, without waiting for it to be drawn.
+		// A frame for the CPU to compute isn't even waited for that long: see FrameCompletion.
+		FrameCompletion^ Draw();
+
+		// Draws the last frame moved deltaX pixels right and deltaY pixels down.
+		// Top, Left, Right and Bottom must already have been moved by exactly that many pixels,
+		// with nothing else changed. Only the newly uncovered edges of the frame are computed.
+		void Pan(System::Int32 deltaX, System::Int32 deltaY);
+
+		// For zooming to the current Top, Left, Right and Bottom from a view scale times their size,
+		// keeping pixel (pixelX, pixelY) in place. Shows the last frame scaled up or down
+		// straight away, then leaves Refine() to compute the new view properly.
+		// Falls back on Draw() when there's no previous frame to scale.
+		void ZoomPreview(System::Single scale, System::Int32 pixelX, System::Int32 pixelY);
+
+		// Computes and shows one submission's worth of the view ZoomPreview() started,
+		// coarse passes first. Returns whether there's more to do. Any drawing cancels it.
+		bool Refine();
+
+		// Draws the last frame again with the current FillColor, Gradient and GradientPeriodFactor,
+		// reusing its iteration counts. Much cheaper than Draw() when only the coloring changed.
+		// Falls back on Draw() when there's no previous frame to reuse.
+		void Recolor();
+
+		// Where the view sits on the tile cache's world grid: world pixel (originX, originY)
+		// at the top-left corner of the surface, with pixels pixelSize wide and high.
+		// Left must be originX * pixelSize and Top must be -originY * pixelSize.
+		// Once set, frames reuse tiles computed before at the same zoom level,
+		// MaxIterations and BailoutRadius, and add their own tiles to the cache.
+		void SetGridPosition(System::Int32 zoomLevel, double pixelSize, System::Int64 originX, System::Int64 originY);
+		void ClearGridPosition();
+		void ClearTileCache();
+
+		// The view for the perturbation engine, as decimal strings: its center, and its height
+		// (top minus bottom) in the complex plane, e.g. SetPreciseView("-0.75", "0.1", "1e-250").
+		// Its width follows from the surface's aspect ratio. Until it's set, or once it's cleared,
+		// the perturbation engine draws Top, Left, Right and Bottom instead.
+		void SetPreciseView(String^ centerX, String^ centerY, String^ height);
+		void ClearPreciseView();
+
+		// Keeps computed tiles in files under directory (which must exist) as well,
+		// so that coming back to a place in a later session doesn't compute it again.
+		void OpenTileStore(String^ directory);
+		void CloseTileStore();
+		void ClearTileStore();
+
+		// Size of the compute shader's workgroups, in pixels.
+		// Has no effect on devices that render without a compute shader.
+		void SetWorkgroupSize(System::UInt32 width, System::UInt32 height);
+
+		// The last drawn frame of a headless renderer, as 4-byte BGRA pixels.
+		// Waits for the frame to finish, if it hasn't already.
+		array<System::Byte>^ ReadPixels();
+
+		// The last frame handed to the GPU, by Draw() or anything else that draws,
+		// or the last one Draw() gave the CPU, if it hasn't been shown yet.
+		property FrameCompletion^ LastFrame { FrameCompletion^ get(); }
+
+		// How many frames can be waiting on the GPU at once before drawing another has to wait for
+		// the oldest of them to finish: between 1 and 4, 2 to begin with. More lets the UI run further
+		// ahead of the GPU when frames are slow to draw, at the cost of showing them later.
+		property System::UInt32 FramesInFlight
+		{
+			System::UInt32 get();
+			void set(System::UInt32 value);
+		}
 
 		array<DebugMessage^>^ GetDebugMessages();
 
-		property float Top;
-		property float Left;
-		property float Right;
-		property float Bottom;
+		// Kept in double precision, for engines that can make use of it.
+		property double Top;
+		property double Left;
+		property double Right;
+		property double Bottom;
 		property float BailoutRadius;
 		property System::UInt32 MaxIterations;
 		property System::UInt32 FillColor;
 		property float GradientPeriodFactor;
 		property array<System::UInt32>^ Gradient;
 
+		// How many colors the Gradient's blended out to, ahead of time, for the shaders to look
+		// pixels up in. The Gradient itself can be as long as it likes. Changing either this or
+		// the Gradient rebuilds the table on the next frame; a Recolor() shows the change.
+		property System::UInt32 PaletteSize
+		{
+			System::UInt32 get() { return _paletteSize; }
+			void set(System::UInt32 value) { _paletteSize = value; }
+		}
+
+		// Takes the Gradient's colors as sRGB and blends between them in linear light, rather than
+		// blending the raw values as it always has. Evener-looking gradients, but different ones.
+		property bool SrgbGradient
+		{
+			bool get() { return _srgbGradient; }
+			void set(bool value) { _srgbGradient = value; }
+		}
+
+		// Interpolates between colors within each iteration. Without it, every pixel that
+		// escaped on the same iteration gets the same color. A Recolor() shows the change.
+		property bool Smoothing
+		{
+			bool get() { return _smoothing; }
+			void set(bool value) { _smoothing = value; }
+		}
+
+		// Builds shader pipelines with MaxIterations, BailoutRadius and the gradient's length
+		// as constants, for the shaders' compiler to optimize around, once they've stayed
+		// the same for a frame. A few such pipelines are kept, for going back to.
+		property bool SpecializeShaders
+		{
+			bool get() { return _specializeShaders; }
+			void set(bool value) { _specializeShaders = value; }
+		}
+
+		// For the Shader engine. Changing it reloads the shaders, as does the Automatic engine
+		// choosing the other one, so the next frame has to be drawn from scratch with Draw().
+		property ShaderPrecision Precision
+		{
+			ShaderPrecision get() { return _shaderPrecision; }
+			void set(ShaderPrecision value);
+		}
+
+		// Automatic unless set otherwise. Pan() and ZoomPreview() just draw from scratch
+		// with anything but the shaders. Recolor() works with any of them.
+		property RenderEngine Engine
+		{
+			RenderEngine get() { return _engine; }
+			void set(RenderEngine value) { _engine = value; }
+		}
+
+		// What computed the last frame. With the Automatic engine, the kernel it chose.
+		property RenderKernel LastFrameKernel
+		{
+			RenderKernel get() { return _lastFrameKernel; }
+		}
+
+		// The perturbation engine's view center, to every digit it holds.
+		property String^ PreciseCenterX { String^ get(); }
+		property String^ PreciseCenterY { String^ get(); }
+
+		// How the last frame the perturbation engine drew went. A reference orbit is only
+		// computed when the center, MaxIterations or BailoutRadius changes. These, and the
+		// precise center, wait for any frame the CPU's still computing, and show it.
+		property System::UInt32 ReferenceOrbitLength { System::UInt32 get(); }
+		property double LastFrameReferenceMilliseconds { double get(); }
+		property double LastFramePerturbationMilliseconds { double get(); }
+
+		// Whether new reference orbits are computed alongside the pixels that iterate them,
+		// rather than before. On by default. Only the Perturbation engine streams them,
+		// and not with Series skipping. Of LastFrameReferenceMilliseconds, the time spent
+		// streaming is LastFrameStreamedReferenceMilliseconds, and it's part of
+		// LastFramePerturbationMilliseconds as well.
+		property bool StreamReferenceOrbits
+		{
+			bool get() { return _streamReferenceOrbits; }
+			void set(bool value) { _streamReferenceOrbits = value; }
+		}
+
+		property double LastFrameStreamedReferenceMilliseconds { double get(); }
+
+		// Pixels the reference orbit was a poor fit for, by Pauldelbrot's criterion, and the number
+		// of times they were rendered again against secondary references of their own. A location
+		// that needs many is expensive because of them. Pixels still glitched after that are
+		// drawn as interior.
+		property System::UInt64 LastFrameGlitchedPixels { System::UInt64 get(); }
+		property System::UInt32 LastFrameSecondaryReferences { System::UInt32 get(); }
+		property System::UInt64 LastFrameUnresolvedPixels { System::UInt64 get(); }
+
+		// Whether pixels whose orbits stray from the reference's are rebased onto the start
+		// of the reference orbit (Zhuoran's method), which avoids nearly all glitches.
+		// On by default. Without it, glitches are left to secondary references.
+		property bool PerturbationRebasing
+		{
+			bool get() { return _perturbationRebasing; }
+			void set(bool value) { _perturbationRebasing = value; }
+		}
+
+		property System::UInt64 LastFrameRebases { System::UInt64 get(); }
+
+		// Bla unless set otherwise. The skip tables are built along with each reference orbit,
+		// and again whenever the view's size changes.
+		property IterationSkipping Skipping
+		{
+			IterationSkipping get() { return _skipping; }
+			void set(IterationSkipping value) { _skipping = value; }
+		}
+
+		// Of the iterations each pixel needed, on average, how many were skipped over.
+		// Only counted on the CPU.
+		property double LastFrameIterationsPerPixel { double get(); }
+		property double LastFrameIterationsSkippedPerPixel { double get(); }
+
+		// Automatic unless set otherwise. LastFrameDeltas is what was actually used, never Automatic.
+		property PerturbationDeltas Deltas
+		{
+			PerturbationDeltas get() { return _deltas; }
+			void set(PerturbationDeltas value) { _deltas = value; }
+		}
+
+		property PerturbationDeltas LastFrameDeltas { PerturbationDeltas get(); }
+
+		// Splits each frame into tiles drawn over several short GPU submissions,
+		// each one aiming to finish within SubmissionBudgetMilliseconds.
+		// Frames drawn with anything heavier than the Float kernel always are.
+		property bool Progressive;
+
+		property double SubmissionBudgetMilliseconds
+		{
+			double get() { return _submissionBudgetMilliseconds; }
+			void set(double value) { _submissionBudgetMilliseconds = value; }
+		}
+
+		// Least recently used tiles are thrown out once the cache grows past this.
+		property System::UInt64 TileCacheBudgetBytes
+		{
+			System::UInt64 get();
+			void set(System::UInt64 value);
+		}
+
+		property System::UInt64 TileCacheHits { System::UInt64 get(); }
+		property System::UInt64 TileCacheMisses { System::UInt64 get(); }
+
+		// The tile store's tile file doesn't grow past this. Once it's that big,
+		// new tiles replace the least recently used ones.
+		property System::UInt64 TileStoreCapacityBytes
+		{
+			System::UInt64 get();
+			void set(System::UInt64 value);
+		}
+
+		property System::UInt64 TileStoreHits { System::UInt64 get(); }
+		property System::UInt64 TileStoreTileCount { System::UInt64 get(); }
+		property System::UInt64 TileStoreEvictions { System::UInt64 get(); }
+
+		// Keeps compiled shaders and built pipelines in files under directory (which must exist),
+		// so that renderers created afterwards, in this process or a later one, don't compile
+		// or build them again. Only affects renderers created after it's called; null or
+		// empty turns it off again.
+		static void SetShaderCacheDirectory(String^ directory);
+
+		// Shaders this renderer found in the shader cache, and shaders it had to compile.
+		property System::UInt32 ShaderCacheHits { System::UInt32 get(); }
+		property System::UInt32 ShaderCacheMisses { System::UInt32 get(); }
+
+		// Whether this renderer started with pipelines saved by an earlier one on the same device and driver.
+		property bool PipelineCacheLoaded { bool get(); }
+
+		// Where the time went while this renderer was being created, for cutting the time to
+		// the first frame. Shaders are compiled, and the pipeline built, in the background while
+		// the device and target are set up; the waits are how long the constructor then sat idle
+		// for them. LoadShaders is the Mandelbrot shaders being loaded once the device was ready,
+		// and StartupMilliseconds covers everything, it included.
+		property double StartupMilliseconds { double get(); }
+		property double StartupInstanceMilliseconds { double get(); }
+		property double StartupDeviceMilliseconds { double get(); }
+		property double StartupResourcesMilliseconds { double get(); }
+		property double StartupShaderCompileMilliseconds { double get(); }
+		property double StartupPipelineMilliseconds { double get(); }
+		property double StartupShaderWaitMilliseconds { double get(); }
+		property double StartupPipelineWaitMilliseconds { double get(); }
+		property double StartupLoadShadersMilliseconds { double get(); }
+
+		// How the last progressive frame was split up.
+		property System::UInt32 LastFrameSubmissions { System::UInt32 get(); }
+		property double LastFrameLongestSubmissionMilliseconds { double get(); }
+
+	internal:
+
+		bool FrameFinished(System::UInt64 frame);
+		void WaitForFrame(System::UInt64 frame);
+		bool CpuFrameFinished(System::UInt64 cpuFrame, System::UInt64% frame);
+		void WaitForCpuFrame(System::UInt64 cpuFrame, System::UInt64% frame);
+
 	private:
 
+		void LoadShaders(ShaderPrecision precision);
+		void Specialize(const mandelbrot_parameter_info& info, bool compute);
+		void UseShaderPrecision(ShaderPrecision precision);
+		RenderKernel ChooseKernel(const mandelbrot_parameter_info& info);
+		bool ShaderFrameReusable(RenderKernel kernel);
+		bool ProgressiveFor(RenderKernel kernel);
+		void FillParameters(mandelbrot_parameter_info& info);
+		void UpdatePalette();
+		mandelbrot_precise_bounds PreciseBounds();
+		void UpdateCacheView();
+		void DrawPerturbation(mandelbrot_parameter_info& info);
+		perturbation_options PerturbationOptions();
+		perturbation_engine& Perturbation();
+		perturbation_engine* FinishedPerturbation();
+
+		// Frames the CPU computes, on _cpuTask's thread. One's computed at a time, and the
+		// latest one drawn since it started waits its turn; any others are dropped. Each is
+		// presented on the UI thread once it's done, when it's next checked on.
+		FrameCompletion^ StartCpuFrame(const mandelbrot_parameter_info& info, RenderKernel kernel);
+		void LaunchCpuFrame(cpu_frame* frame);
+		void PresentCpuFrame();
+		void PollCpuFrames();
+		void FinishCpuFrames();
+		void DropCpuFrames();
+		bool CpuFramePending(System::UInt64 cpuFrame);
+
 		bool _disposed = false;
+		ShaderPrecision _shaderPrecision = ShaderPrecision::Float;
+		ShaderPrecision _loadedPrecision = ShaderPrecision::Float;
+		RenderEngine _engine = RenderEngine::Automatic;
+		RenderKernel _lastFrameKernel = RenderKernel::Float;
+		double _submissionBudgetMilliseconds = 4.0;
+		double _startupMilliseconds = 0.0;
+		bool _smoothing = true;
+		bool _specializeShaders = true;
+		bool _srgbGradient = false;
+		System::UInt32 _paletteSize = 4096;
+
+		// What the palette was last built from, for UpdatePalette() to tell whether it's changed.
+		array<System::UInt32>^ _paletteGradient = nullptr;
+		bool _paletteSrgb = false;
+		System::UInt32 _paletteBuiltSize = 0;
+		palette* _palette = nullptr;
+
+		// What the last frame was drawn with, for Specialize() to tell whether it's changed.
+		System::UInt32 _lastMaxIterations = 0;
+		float _lastBailoutRadius = 0.0f;
+		System::UInt32 _lastGradientLength = 0;
+		double _startupLoadShadersMilliseconds = 0.0;
+
+		bool _gridPositionSet = false;
+		System::Int32 _gridZoomLevel = 0;
+		double _gridPixelSize = 0.0;
+		System::Int64 _gridOriginX = 0;
+		System::Int64 _gridOriginY = 0;
 		vulkan_renderer* _native_renderer = nullptr;
+		perturbation_engine* _perturbation = nullptr;
+		vulkan_perturbation_device* _perturbationDevice = nullptr;
+		cpu_renderer* _cpu = nullptr;
+		background_task* _cpuTask = nullptr;
+		cpu_frame* _cpuRunning = nullptr;
+		cpu_frame* _cpuQueued = nullptr;
+		System::UInt64 _cpuFrames = 0;			// numbered from 1, apart from the GPU's.
+		System::UInt64 _cpuPresented = 0;		// the last one shown,
+		System::UInt64 _cpuPresentedFrame = 0;	// and the GPU frame that showed it.
+		bool _preciseViewSet = false;
+		bool _perturbationRebasing = true;
+		bool _streamReferenceOrbits = true;
+		IterationSkipping _skipping = IterationSkipping::Bla;
+		PerturbationDeltas _deltas = PerturbationDeltas::Automatic;
+		System::UInt64 _perturbationPixels = 0;
 		array<DebugMessage^>^ _cachedMessages = nullptr;
 	};
 }
@@ -0,0 +1,66 @@
+#include "pch.h"
+#include "background_task.h"
+#include <thread>
+#include <atomic>
+#include <exception>
+
+struct background_task::state
+{
+	std::thread thread;
+	std::exception_ptr error;
+	std::atomic<bool> running{ false };
+};
+
+background_task::background_task()
+	: _state(new state())
+{
+}
+
+background_task::~background_task()
+{
+	if (_state->thread.joinable())
+		_state->thread.join();
+}
+
+void background_task::start(std::function<void()> work)
+{
+	if (_state->thread.joinable())
+		_state->thread.join();
+
+	_state->error = nullptr;
+	_state->running = true;
+
+	state* taskState = _state.get();
+
+	_state->thread = std::thread([taskState, work]()
+	{
+		try
+		{
+			work();
+		}
+		catch (...)
+		{
+			taskState->error = std::current_exception();
+		}
+
+		taskState->running = false;
+	});
+}
+
+void background_task::wait()
+{
+	if (_state->thread.joinable())
+		_state->thread.join();
+
+	if (_state->error)
+	{
+		std::exception_ptr error = _state->error;
+		_state->error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+bool background_task::finished() const
+{
+	return !_state->running;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "pch.h"
+#include <memory>
+#include <functional>
+
+// Runs one piece of work on a thread of its own, for overlapping steps that
+// don't depend on each other, such as compiling shaders while the device is
+// being set up. Like tile_scheduler, it keeps <thread> out of this header,
+// which is included from C++/CLI code.
+class background_task
+{
+public:
+
+	background_task();
+
+	// Waits for the work to finish, ignoring anything it threw.
+	~background_task();
+
+	background_task(const background_task&) = delete;
+	background_task& operator=(const background_task&) = delete;
+
+	// Only one piece of work at a time: anything started earlier is waited for first.
+	void start(std::function<void()> work);
+
+	// Blocks until the work's done, then rethrows whatever it threw.
+	// Does nothing if nothing was started.
+	void wait();
+
+	// Whether the work's done (or nothing was started), without blocking.
+	// wait() still has to be called to find out whether it threw.
+	bool finished() const;
+
+private:
+
+	struct state;
+	std::unique_ptr<state> _state;
+};
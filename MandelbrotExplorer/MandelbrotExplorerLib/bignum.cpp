@@ -0,0 +1,544 @@
+#include "pch.h"
+#include "bignum.h"
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+	bool is_digit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	void overflow()
+	{
+		throw std::runtime_error("Number too large for a bignum. Magnitudes must stay below 2^32.");
+	}
+}
+
+bignum::bignum(uint32_t fractionWords)
+	: _words(fractionWords + 1, 0)
+{
+}
+
+bignum bignum::parse(const std::string& text, uint32_t fractionWords)
+{
+	std::string error = "Couldn't read \"" + text + "\" as a number.";
+
+	size_t i = 0;
+	size_t n = text.size();
+
+	while (i < n && is_space(text[i]))
+		i++;
+
+	bool negative = false;
+
+	if (i < n && (text[i] == '+' || text[i] == '-'))
+	{
+		negative = text[i] == '-';
+		i++;
+	}
+
+	std::string digits;
+	size_t integerDigits = 0;
+
+	while (i < n && is_digit(text[i]))
+	{
+		digits += text[i++];
+		integerDigits++;
+	}
+
+	if (i < n && text[i] == '.')
+	{
+		i++;
+
+		while (i < n && is_digit(text[i]))
+			digits += text[i++];
+	}
+
+	if (digits.empty())
+		throw std::runtime_error(error);
+
+	// Far bigger exponents than this only ever mean zero or an overflow,
+	// so there's no need to keep counting past it.
+	const long long EXPONENT_LIMIT = 1000000000;
+	long long exponent = 0;
+
+	if (i < n && (text[i] == 'e' || text[i] == 'E'))
+	{
+		i++;
+		bool exponentNegative = false;
+
+		if (i < n && (text[i] == '+' || text[i] == '-'))
+		{
+			exponentNegative = text[i] == '-';
+			i++;
+		}
+
+		if (i >= n || !is_digit(text[i]))
+			throw std::runtime_error(error);
+
+		while (i < n && is_digit(text[i]))
+		{
+			exponent = std::min(exponent * 10 + (text[i++] - '0'), EXPONENT_LIMIT);
+		}
+
+		if (exponentNegative)
+			exponent = -exponent;
+	}
+
+	while (i < n && is_space(text[i]))
+		i++;
+
+	if (i != n)
+		throw std::runtime_error(error);
+
+	// The number is 0.digits x 10^point. Split the digits at the decimal point,
+	// padding with zeros on whichever side falls short.
+	long long point = (long long)integerDigits + exponent;
+
+	// Work with two extra words, so that the errors of the many divisions by ten
+	// below all end up beneath the words that are kept. Digits beyond what
+	// the working words can resolve make no difference.
+	uint32_t workingWords = fractionWords + 2;
+	size_t usefulDigits = (size_t)std::ceil(workingWords * 32 * 0.30103) + 2;
+
+	std::string integerPart;
+	std::string fractionPart;
+
+	if (point < -(long long)usefulDigits)
+	{
+		return bignum(fractionWords);
+	}
+	else if (point <= 0)
+	{
+		fractionPart = std::string((size_t)-point, '0') + digits;
+	}
+	else if (point >= (long long)digits.size())
+	{
+		integerPart = digits + std::string((size_t)std::min(point - (long long)digits.size(), (long long)64), '0');
+	}
+	else
+	{
+		integerPart = digits.substr(0, (size_t)point);
+		fractionPart = digits.substr((size_t)point);
+	}
+
+	bignum result(workingWords);
+
+	for (char c : integerPart)
+	{
+		result.multiply_small(10);
+		result.add_to_integer((uint32_t)(c - '0'));
+	}
+
+	if (fractionPart.size() > usefulDigits)
+		fractionPart.resize(usefulDigits);
+
+	// Horner's method, from the last digit back: f = (d + f) / 10.
+	bignum fraction(workingWords);
+
+	for (size_t d = fractionPart.size(); d-- > 0;)
+	{
+		fraction.add_to_integer((uint32_t)(fractionPart[d] - '0'));
+		fraction.divide_small(10);
+	}
+
+	result = result + fraction;
+	result._negative = negative;
+	result.normalize_zero();
+
+	return result.with_fraction_words(fractionWords);
+}
+
+bignum bignum::from_double(double value, uint32_t fractionWords)
+{
+	if (!std::isfinite(value))
+		throw std::runtime_error("Can't make a bignum from an infinity or NaN.");
+
+	bignum result(fractionWords);
+	double remaining = std::fabs(value);
+
+	if (remaining >= 4294967296.0)
+		overflow();
+
+	// Peel off 32 bits at a time. Scaling by 2^32 and subtracting
+	// the integer part are both exact, so nothing's lost along the way.
+	for (uint32_t i = fractionWords + 1; i-- > 0 && remaining != 0.0;)
+	{
+		double word = std::floor(remaining);
+		result._words[i] = (uint32_t)word;
+		remaining = std::ldexp(remaining - word, 32);
+	}
+
+	result._negative = value < 0.0;
+	result.normalize_zero();
+	return result;
+}
+
+bignum bignum::from_double(double value, int32_t exponent, uint32_t fractionWords)
+{
+	if (!std::isfinite(value))
+		throw std::runtime_error("Can't make a bignum from an infinity or NaN.");
+
+	bignum result(fractionWords);
+
+	// As a 53-bit integer times a power of two, then as that integer's
+	// lowest bit's position among the words.
+	int valueExponent = 0;
+	double fraction = std::frexp(std::fabs(value), &valueExponent);
+	uint64_t integer = (uint64_t)std::ldexp(fraction, 53);
+	int64_t position = (int64_t)exponent + valueExponent - 53 + 32 * (int64_t)fractionWords;
+
+	if (integer == 0)
+		return result;
+
+	if (position < 0)
+	{
+		// Truncate the bits that fall off the end.
+		integer = position > -64 ? integer >> -position : 0;
+		position = 0;
+	}
+
+	if (integer != 0)
+	{
+		// The integer spans up to three words, however it's aligned.
+		int64_t index = position / 32;
+		int shift = (int)(position % 32);
+		uint32_t parts[3] =
+		{
+			(uint32_t)(integer << shift),
+			(uint32_t)(shift > 0 ? integer >> (32 - shift) : integer >> 32),
+			(uint32_t)(shift > 0 ? integer >> (64 - shift) : 0)
+		};
+
+		for (int64_t k = 0; k < 3; k++)
+		{
+			if (parts[k] == 0)
+				continue;
+
+			if (index + k >= (int64_t)result._words.size())
+				overflow();
+
+			result._words[(size_t)(index + k)] = parts[k];
+		}
+	}
+
+	result._negative = value < 0.0;
+	result.normalize_zero();
+	return result;
+}
+
+uint32_t bignum::words_for(double resolution)
+{
+	if (!(resolution > 0.0))
+		throw std::runtime_error("A bignum's resolution must be greater than zero.");
+
+	// ceil(-log2(resolution)), exactly.
+	return words_for_exponent(std::ilogb(resolution));
+}
+
+uint32_t bignum::words_for_exponent(int32_t exponent)
+{
+	uint32_t bits = exponent < 0 ? (uint32_t)-(int64_t)exponent : 0;
+	return (bits + 31) / 32 + 2;
+}
+
+bool bignum::is_zero() const
+{
+	for (uint32_t word : _words)
+	{
+		if (word != 0)
+			return false;
+	}
+
+	return true;
+}
+
+bignum bignum::with_fraction_words(uint32_t fractionWords) const
+{
+	// Line the integer words up, then copy as much of the fraction as fits.
+	bignum result(fractionWords);
+	uint32_t ours = fraction_words();
+	uint32_t shared = std::min(ours, fractionWords);
+
+	result._words[fractionWords] = _words[ours];
+
+	for (uint32_t k = 1; k <= shared; k++)
+		result._words[fractionWords - k] = _words[ours - k];
+
+	result._negative = _negative;
+	result.normalize_zero();
+	return result;
+}
+
+double bignum::to_double() const
+{
+	int top = (int)_words.size() - 1;
+
+	while (top >= 0 && _words[top] == 0)
+		top--;
+
+	if (top < 0)
+		return 0.0;
+
+	// Three words are more than a double's 53 bits.
+	int lowest = std::max(top - 2, 0);
+	double value = 0.0;
+
+	for (int i = top; i >= lowest; i--)
+		value = value * 4294967296.0 + _words[i];
+
+	value = std::ldexp(value, 32 * (lowest - (int)fraction_words()));
+	return _negative ? -value : value;
+}
+
+double bignum::to_double(int32_t& exponent) const
+{
+	int top = (int)_words.size() - 1;
+
+	while (top >= 0 && _words[top] == 0)
+		top--;
+
+	if (top < 0)
+	{
+		exponent = 0;
+		return 0.0;
+	}
+
+	// The same as above, leaving the power of two separate.
+	int lowest = std::max(top - 2, 0);
+	double value = 0.0;
+
+	for (int i = top; i >= lowest; i--)
+		value = value * 4294967296.0 + _words[i];
+
+	exponent = 32 * (lowest - (int32_t)fraction_words());
+	return _negative ? -value : value;
+}
+
+std::string bignum::to_string() const
+{
+	std::string text = _negative ? "-" : "";
+	text += std::to_string(_words.back());
+
+	bignum fraction = *this;
+	fraction._words.back() = 0;
+
+	std::string digits;
+	size_t digitCount = (size_t)std::ceil(fraction_words() * 32 * 0.30103);
+
+	// Each multiplication by ten pushes the next digit into the integer word.
+	for (size_t i = 0; i < digitCount && !fraction.is_zero(); i++)
+	{
+		fraction.multiply_small(10);
+		digits += (char)('0' + fraction._words.back());
+		fraction._words.back() = 0;
+	}
+
+	while (!digits.empty() && digits.back() == '0')
+		digits.pop_back();
+
+	if (!digits.empty())
+		text += "." + digits;
+
+	return text;
+}
+
+bignum bignum::operator-() const
+{
+	bignum result = *this;
+	result._negative = !_negative;
+	result.normalize_zero();
+	return result;
+}
+
+bignum bignum::operator+(const bignum& other) const
+{
+	check_precision(other);
+	bignum result(fraction_words());
+
+	if (_negative == other._negative)
+	{
+		add_magnitudes(_words, other._words, result._words);
+		result._negative = _negative;
+	}
+	else if (compare_magnitudes(_words, other._words) >= 0)
+	{
+		subtract_magnitudes(_words, other._words, result._words);
+		result._negative = _negative;
+	}
+	else
+	{
+		subtract_magnitudes(other._words, _words, result._words);
+		result._negative = other._negative;
+	}
+
+	result.normalize_zero();
+	return result;
+}
+
+bignum bignum::operator-(const bignum& other) const
+{
+	return *this + (-other);
+}
+
+bignum bignum::operator*(const bignum& other) const
+{
+	check_precision(other);
+
+	// Schoolbook multiplication into a double-length product, of which the
+	// middle words are the result: the lowest fraction_words() words fall off the end,
+	// and anything in the very top word is an overflow. No product of two words plus
+	// two more words can overflow 64 bits, so the carries always fit.
+	uint32_t fractionWords = fraction_words();
+	size_t n = _words.size();
+	std::vector<uint32_t> product(2 * n, 0);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		uint64_t a = _words[i];
+
+		if (a == 0)
+			continue;
+
+		uint64_t carry = 0;
+
+		for (size_t j = 0; j < n; j++)
+		{
+			uint64_t t = a * other._words[j] + product[i + j] + carry;
+			product[i + j] = (uint32_t)t;
+			carry = t >> 32;
+		}
+
+		product[i + n] = (uint32_t)carry;
+	}
+
+	if (product[2 * n - 1] != 0)
+		overflow();
+
+	bignum result(fractionWords);
+	std::copy(product.begin() + fractionWords, product.begin() + fractionWords + n, result._words.begin());
+
+	result._negative = _negative != other._negative;
+	result.normalize_zero();
+	return result;
+}
+
+bignum bignum::twice() const
+{
+	if (_words.back() & 0x80000000u)
+		overflow();
+
+	bignum result = *this;
+	uint32_t carry = 0;
+
+	for (uint32_t& word : result._words)
+	{
+		uint32_t next = word >> 31;
+		word = (word << 1) | carry;
+		carry = next;
+	}
+
+	return result;
+}
+
+bool bignum::operator==(const bignum& other) const
+{
+	return _negative == other._negative && _words == other._words;
+}
+
+void bignum::check_precision(const bignum& other) const
+{
+	if (_words.size() != other._words.size())
+		throw std::runtime_error("bignum operands have different precisions.");
+}
+
+void bignum::normalize_zero()
+{
+	// There's only one zero.
+	if (_negative && is_zero())
+		_negative = false;
+}
+
+int bignum::compare_magnitudes(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+	for (size_t i = a.size(); i-- > 0;)
+	{
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+
+	return 0;
+}
+
+void bignum::add_magnitudes(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& result)
+{
+	uint64_t carry = 0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		uint64_t t = (uint64_t)a[i] + b[i] + carry;
+		result[i] = (uint32_t)t;
+		carry = t >> 32;
+	}
+
+	if (carry != 0)
+		overflow();
+}
+
+void bignum::subtract_magnitudes(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& result)
+{
+	// |a| >= |b|, so the last borrow is always zero.
+	uint64_t borrow = 0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		uint64_t t = (uint64_t)a[i] - b[i] - borrow;
+		result[i] = (uint32_t)t;
+		borrow = (t >> 32) & 1;
+	}
+}
+
+void bignum::multiply_small(uint32_t factor)
+{
+	uint64_t carry = 0;
+
+	for (uint32_t& word : _words)
+	{
+		uint64_t t = (uint64_t)word * factor + carry;
+		word = (uint32_t)t;
+		carry = t >> 32;
+	}
+
+	if (carry != 0)
+		overflow();
+}
+
+void bignum::divide_small(uint32_t divisor)
+{
+	uint64_t remainder = 0;
+
+	for (size_t i = _words.size(); i-- > 0;)
+	{
+		uint64_t t = (remainder << 32) | _words[i];
+		_words[i] = (uint32_t)(t / divisor);
+		remainder = t % divisor;
+	}
+}
+
+void bignum::add_to_integer(uint32_t value)
+{
+	uint32_t& integer = _words.back();
+
+	if (integer > UINT32_MAX - value)
+		overflow();
+
+	integer += value;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// A signed fixed-point number with as many bits after the point as asked for.
+// double_double runs out at a zoom of around 1e-30; this doesn't run out at all,
+// it just gets slower. It's only meant for the handful of numbers that really need
+// it, like the perturbation engine's view center and reference orbit.
+//
+// The magnitude is kept in 32-bit words, least significant first. The last word is
+// the integer part and the rest are the fraction, so magnitudes have to stay below 2^32.
+// Anything bigger throws. Results are truncated towards zero, never rounded.
+//
+// Both operands of +, - and * must have the same number of fraction words.
+class bignum
+{
+public:
+
+	explicit bignum(uint32_t fractionWords = 2);
+
+	// Reads a decimal number, with an optional sign, fraction and exponent,
+	// e.g. "-1.25", "0.75e-300" or "3E+2". Throws if text isn't one.
+	static bignum parse(const std::string& text, uint32_t fractionWords);
+
+	// Exact, unless value has bits below the last fraction word.
+	static bignum from_double(double value, uint32_t fractionWords);
+
+	// value * 2^exponent, for numbers beyond a double's range, e.g. a floatexp's.
+	// Bits below the last fraction word are truncated.
+	static bignum from_double(double value, int32_t exponent, uint32_t fractionWords);
+
+	// Fraction words needed to tell apart numbers resolution apart,
+	// with a couple of words to spare for rounding errors to accumulate in.
+	static uint32_t words_for(double resolution);
+
+	// The same, for a resolution of 2^exponent, which may be far below anything a double can hold.
+	static uint32_t words_for_exponent(int32_t exponent);
+
+	uint32_t fraction_words() const { return (uint32_t)_words.size() - 1; }
+	bool negative() const { return _negative; }
+	bool is_zero() const;
+
+	// The same number with more or fewer fraction words.
+	bignum with_fraction_words(uint32_t fractionWords) const;
+
+	double to_double() const;
+
+	// The number as mantissa * 2^exponent, for numbers too small to be a double.
+	double to_double(int32_t& exponent) const;
+
+	// Every digit the fraction words can hold, with trailing zeros trimmed.
+	std::string to_string() const;
+
+	bignum operator-() const;
+	bignum operator+(const bignum& other) const;
+	bignum operator-(const bignum& other) const;
+	bignum operator*(const bignum& other) const;
+
+	// Multiplying by two is exact (unless it overflows).
+	bignum twice() const;
+
+	bool operator==(const bignum& other) const;
+	bool operator!=(const bignum& other) const { return !(*this == other); }
+
+private:
+
+	void check_precision(const bignum& other) const;
+	void normalize_zero();
+
+	static int compare_magnitudes(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+	static void add_magnitudes(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& result);
+	static void subtract_magnitudes(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& result);
+
+	// In-place arithmetic on the magnitude with small integers, for parsing and printing.
+	void multiply_small(uint32_t factor);
+	void divide_small(uint32_t divisor);
+	void add_to_integer(uint32_t value);
+
+	bool _negative = false;
+	std::vector<uint32_t> _words;
+};
@@ -0,0 +1,30 @@
+#include "pch.h"
+#include "debug_message_log.h"
+#include <mutex>
+
+struct debug_message_log::state
+{
+	mutable std::mutex mutex;
+	std::vector<debug_message> messages;
+};
+
+debug_message_log::debug_message_log()
+	: _state(new state())
+{
+}
+
+debug_message_log::~debug_message_log()
+{
+}
+
+void debug_message_log::add(const debug_message& message)
+{
+	std::lock_guard<std::mutex> lock(_state->mutex);
+	_state->messages.push_back(message);
+}
+
+std::vector<debug_message> debug_message_log::messages() const
+{
+	std::lock_guard<std::mutex> lock(_state->mutex);
+	return _state->messages;
+}
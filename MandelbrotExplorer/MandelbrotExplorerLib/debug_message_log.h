@@ -0,0 +1,37 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <string>
+#include <memory>
+
+struct debug_message
+{
+	std::string text;
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+	VkDebugUtilsMessageTypeFlagsEXT type;
+};
+
+// The validation layer's messages, as they arrive. The layer calls back on whichever
+// thread made the Vulkan call, and setup makes some of those on background threads,
+// so adding and reading are both locked. Like background_task, it keeps <mutex>
+// out of this header, which is included from C++/CLI code.
+class debug_message_log
+{
+public:
+
+	debug_message_log();
+	~debug_message_log();
+
+	debug_message_log(const debug_message_log&) = delete;
+	debug_message_log& operator=(const debug_message_log&) = delete;
+
+	void add(const debug_message& message);
+
+	// A copy of every message so far, taken under the lock.
+	std::vector<debug_message> messages() const;
+
+private:
+
+	struct state;
+	std::unique_ptr<state> _state;
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <cmath>
+
+// An unevaluated sum of two doubles, hi + lo, with |lo| no more than half an ulp of hi.
+// That's about 106 bits of mantissa, enough for zooms down to around 1e-30,
+// using nothing but ordinary double arithmetic.
+//
+// These are the "sloppy" algorithms from Hida, Li & Bailey's QD library. Adding
+// numbers of opposite sign loses some relative precision to cancellation,
+// but never more absolute precision than the inputs had to begin with, and
+// absolute precision is all the escape-time loop cares about.
+//
+// The SIMD kernels in mandelbrot_cpu_*.cpp perform exactly the same operations
+// in exactly the same order, lane by lane, so that every instruction set produces
+// the same image. Anything changed here has to be changed there too.
+struct double_double
+{
+	double hi;
+	double lo;
+
+	double_double() : hi(0.0), lo(0.0) {}
+	double_double(double value) : hi(value), lo(0.0) {}
+	double_double(double high, double low) : hi(high), lo(low) {}
+
+	explicit operator double() const { return hi + lo; }
+};
+
+// s + e == a + b exactly. No conditions on a or b.
+inline double_double two_sum(double a, double b)
+{
+	double s = a + b;
+	double bb = s - a;
+	double e = (a - (s - bb)) + (b - bb);
+	return double_double(s, e);
+}
+
+// s + e == a + b exactly, as long as |a| >= |b|.
+inline double_double quick_two_sum(double a, double b)
+{
+	double s = a + b;
+	double e = b - (s - a);
+	return double_double(s, e);
+}
+
+inline double_double operator+(const double_double& a, const double_double& b)
+{
+	double_double s = two_sum(a.hi, b.hi);
+	return quick_two_sum(s.hi, s.lo + (a.lo + b.lo));
+}
+
+inline double_double operator-(const double_double& a)
+{
+	return double_double(-a.hi, -a.lo);
+}
+
+inline double_double operator-(const double_double& a, const double_double& b)
+{
+	return a + (-b);
+}
+
+// The product's rounding error, a.hi * b.hi - p, comes out of a single FMA exactly.
+inline double_double operator*(const double_double& a, const double_double& b)
+{
+	double p = a.hi * b.hi;
+	double e = std::fma(a.hi, b.hi, -p);
+	e = std::fma(a.hi, b.lo, std::fma(a.lo, b.hi, e));
+	return quick_two_sum(p, e);
+}
+
+inline double_double sqr(const double_double& a)
+{
+	double p = a.hi * a.hi;
+	double e = std::fma(a.hi, a.hi, -p);
+	e = std::fma(a.hi + a.hi, a.lo, e);
+	return quick_two_sum(p, e);
+}
+
+// Multiplying by two is exact.
+inline double_double twice(const double_double& a)
+{
+	return double_double(a.hi + a.hi, a.lo + a.lo);
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+// Where the exponent lives in the IEEE formats floatexp keeps its mantissas in.
+// (Enums rather than static consts, which std::min() and std::max() would need defined somewhere.)
+template <typename T> struct floatexp_traits;
+
+template <> struct floatexp_traits<double>
+{
+	typedef uint64_t bits;
+	enum { MANTISSA_BITS = 52, BIAS = 1023, MAX_BIASED = 2047 };
+};
+
+template <> struct floatexp_traits<float>
+{
+	typedef uint32_t bits;
+	enum { MANTISSA_BITS = 23, BIAS = 127, MAX_BIASED = 255 };
+};
+
+// A float or double mantissa with an exponent of its own, mantissa * 2^exponent, for numbers
+// far smaller (or larger) than a double can hold. Past a zoom of about 1e-300 the perturbation
+// engine's deltas underflow a double, but they only ever need a double's precision, not a bignum's.
+//
+// The mantissa is kept between 1 and 2 in magnitude (or 0). Every operation renormalizes
+// by copying the IEEE exponent bits out of the mantissa into the exponent, and replacing
+// them with 0. That's a couple of integer operations and selects, with no branches and
+// no calls to frexp() or ldexp(), so loops of them vectorize, as normalize() below does.
+//
+// Denormal mantissas are taken for 0, and infinities and NaNs aren't handled at all.
+// Neither ever comes out of normalized arithmetic on finite numbers.
+template <typename T>
+struct floatexp
+{
+	typedef floatexp_traits<T> traits;
+	typedef typename traits::bits bits;
+
+	// Exponent of 0. Low enough that 0 loses every comparison of exponents,
+	// and high enough that adding two of them can't overflow.
+	enum : int32_t { ZERO_EXPONENT = INT32_MIN / 4 };
+
+	T mantissa;
+	int32_t exponent;
+
+	floatexp() : mantissa(0), exponent(ZERO_EXPONENT) {}
+
+	// Not explicit, so that doubles mix freely with floatexps in arithmetic.
+	floatexp(double value)
+	{
+		// Split the double first, since it may be out of T's range.
+		floatexp<double> split = floatexp<double>::normalized(value, 0);
+		*this = normalized((T)split.mantissa, split.exponent);
+	}
+
+	// A pair that's already normalized, taken as it is.
+	static floatexp raw(T mantissa, int32_t exponent)
+	{
+		floatexp result;
+		result.mantissa = mantissa;
+		result.exponent = exponent;
+		return result;
+	}
+
+	static floatexp normalized(T mantissa, int32_t exponent)
+	{
+		bits b;
+		std::memcpy(&b, &mantissa, sizeof(b));
+
+		const bits exponentMask = (bits)traits::MAX_BIASED << traits::MANTISSA_BITS;
+		int32_t biased = (int32_t)((b & exponentMask) >> traits::MANTISSA_BITS);
+		b = (b & ~exponentMask) | ((bits)traits::BIAS << traits::MANTISSA_BITS);
+
+		T scaled;
+		std::memcpy(&scaled, &b, sizeof(b));
+
+		bool zero = biased == 0;
+
+		floatexp result;
+		result.mantissa = zero ? T(0) : scaled;
+		result.exponent = zero ? (int32_t)ZERO_EXPONENT : exponent + biased - (int32_t)traits::BIAS;
+		return result;
+	}
+
+	// 2^power as a T, for powers within T's normal range; 0 below it and infinity above.
+	static T power_of_two(int32_t power)
+	{
+		int32_t biased = std::min(std::max(power + (int32_t)traits::BIAS, 0), (int32_t)traits::MAX_BIASED);
+		bits b = (bits)biased << traits::MANTISSA_BITS;
+
+		T value;
+		std::memcpy(&value, &b, sizeof(b));
+		return value;
+	}
+
+	// Underflows to 0 and overflows to infinity.
+	double to_double() const
+	{
+		int32_t power = std::min(std::max(exponent, -1023), 1024);
+		return (double)mantissa * floatexp<double>::power_of_two(power);
+	}
+
+	floatexp operator-() const
+	{
+		floatexp result = *this;
+		result.mantissa = -mantissa;
+		return result;
+	}
+
+	friend floatexp operator*(const floatexp& a, const floatexp& b)
+	{
+		return normalized(a.mantissa * b.mantissa, a.exponent + b.exponent);
+	}
+
+	friend floatexp operator/(const floatexp& a, const floatexp& b)
+	{
+		return normalized(a.mantissa / b.mantissa, a.exponent - b.exponent);
+	}
+
+	// Lines both mantissas up with the larger exponent. A mantissa shifted by more
+	// than 64 places is below the other's precision anyway, so the shift is capped there,
+	// which keeps power_of_two() in range and 0 from contributing anything.
+	friend floatexp operator+(const floatexp& a, const floatexp& b)
+	{
+		int32_t exponent = std::max(a.exponent, b.exponent);
+		T ma = a.mantissa * power_of_two(std::max(a.exponent - exponent, -64));
+		T mb = b.mantissa * power_of_two(std::max(b.exponent - exponent, -64));
+		return normalized(ma + mb, exponent);
+	}
+
+	friend floatexp operator-(const floatexp& a, const floatexp& b)
+	{
+		return a + (-b);
+	}
+
+	friend bool operator<(const floatexp& a, const floatexp& b)
+	{
+		return (a - b).mantissa < 0;
+	}
+
+	friend bool operator>=(const floatexp& a, const floatexp& b)
+	{
+		return !(a < b);
+	}
+};
+
+// Normalizes count mantissa/exponent pairs in place, e.g. a row's worth of pixel offsets
+// computed as plain mantissas against one shared exponent. Written as a straight loop over
+// arrays, with no branches, so the compiler turns it into SIMD code.
+template <typename T>
+inline void normalize(T* mantissas, int32_t* exponents, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		floatexp<T> value = floatexp<T>::normalized(mantissas[i], exponents[i]);
+		mantissas[i] = value.mantissa;
+		exponents[i] = value.exponent;
+	}
+}
+
+// So that code templated on its number type can convert any of them.
+inline double to_double(float value) { return value; }
+inline double to_double(double value) { return value; }
+
+template <typename T>
+inline double to_double(const floatexp<T>& value)
+{
+	return value.to_double();
+}
+
+// Reads a decimal number like "1.5e-400", however small or large its exponent.
+inline floatexp<double> parse_floatexp(const std::string& text)
+{
+	std::string error = "Couldn't read \"" + text + "\" as a number.";
+
+	// strtod() rounds correctly, so use its answer wherever it has one.
+	char* end = nullptr;
+	double value = std::strtod(text.c_str(), &end);
+
+	if (!text.empty() && end != text.c_str() && *end == '\0' && std::isnormal(value))
+		return floatexp<double>(value);
+
+	// The mantissa is well within a double's range once the exponent's taken off.
+	size_t e = text.find_first_of("eE");
+	std::string mantissaText = text.substr(0, e);
+
+	double mantissa = std::strtod(mantissaText.c_str(), &end);
+
+	if (mantissaText.empty() || end == mantissaText.c_str() || *end != '\0' || !std::isfinite(mantissa))
+		throw std::runtime_error(error);
+
+	long decimalExponent = 0;
+
+	if (e != std::string::npos)
+	{
+		std::string exponentText = text.substr(e + 1);
+		decimalExponent = std::strtol(exponentText.c_str(), &end, 10);
+
+		if (exponentText.empty() || *end != '\0' || std::labs(decimalExponent) > 100000000)
+			throw std::runtime_error(error);
+	}
+
+	// 10^|exponent| by repeated squaring.
+	floatexp<double> result(mantissa);
+	floatexp<double> power(10.0);
+	floatexp<double> scale(1.0);
+
+	for (long n = std::labs(decimalExponent); n > 0; n >>= 1)
+	{
+		if (n & 1)
+			scale = scale * power;
+
+		power = power * power;
+	}
+
+	return decimalExponent < 0 ? result / scale : result * scale;
+}
@@ -0,0 +1,293 @@
+#include "pch.h"
+#include "iteration_skipping.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// Steps per scheduler tile when building a level. Each step's only a handful of
+	// multiplications, so anything much smaller spends more time scheduling than building.
+	const uint32_t BUILD_CHUNK = 4096;
+
+	std::vector<tile> chunks(size_t count)
+	{
+		std::vector<tile> tiles;
+
+		for (size_t start = 0; start < count; start += BUILD_CHUNK)
+		{
+			tile t = { (uint32_t)start, 0, (uint32_t)std::min((size_t)BUILD_CHUNK, count - start), 1 };
+			tiles.push_back(t);
+		}
+
+		return tiles;
+	}
+
+	bla_step merge(const bla_step& x, const bla_step& y, double maxDc)
+	{
+		bla_step z;
+		z.ar = y.ar * x.ar - y.ai * x.ai;
+		z.ai = y.ar * x.ai + y.ai * x.ar;
+		z.br = (y.ar * x.br - y.ai * x.bi) + y.br;
+		z.bi = (y.ar * x.bi + y.ai * x.br) + y.bi;
+		z.length = x.length + y.length;
+
+		// After x, d has become a_x d + b_x dc, which still has to be within y's radius.
+		double ax = std::hypot(x.ar, x.ai);
+		double bx = std::hypot(x.br, x.bi);
+		double rx = std::sqrt(x.radius_squared);
+		double ry = std::sqrt(y.radius_squared);
+		double radius;
+
+		if (ax > 0.0)
+			radius = std::max(0.0, (ry - bx * maxDc) / ax);
+		else
+			radius = bx * maxDc < ry ? rx : 0.0;
+
+		// Once a and b overflow, the radius comes out as 0 or NaN. Either way the step's no use.
+		radius = std::min(rx, radius);
+		z.radius_squared = radius > 0.0 ? radius * radius : 0.0;
+
+		return z;
+	}
+
+	// From reference index m = j + 1 to m + 1.
+	bla_step single_step(const std::vector<double>& real, const std::vector<double>& imag, size_t j, double epsilon)
+	{
+		size_t m = j + 1;
+
+		bla_step step;
+		step.ar = 2.0 * real[m];
+		step.ai = 2.0 * imag[m];
+		step.br = 1.0;
+		step.bi = 0.0;
+		step.length = 1;
+
+		double radius = epsilon * std::hypot(step.ar, step.ai);
+		step.radius_squared = radius * radius;
+		return step;
+	}
+}
+
+void bla_table::build(const std::vector<double>& real, const std::vector<double>& imag,
+	double maxDc, double epsilon, tile_scheduler& scheduler)
+{
+	_levels.clear();
+
+	// Single steps from m = 1 up to the one that lands on the orbit's last element.
+	size_t size = real.size();
+
+	if (size < 3)
+		return;
+
+	_levels.emplace_back(size - 2);
+
+	scheduler.run(chunks(size - 2), [&](const tile& t)
+	{
+		std::vector<bla_step>& steps = _levels[0];
+
+		for (size_t j = t.left; j < (size_t)t.left + t.width; j++)
+			steps[j] = single_step(real, imag, j, epsilon);
+	});
+
+	while (_levels.back().size() > 1)
+	{
+		const std::vector<bla_step>& below = _levels.back();
+		std::vector<bla_step> level((below.size() + 1) / 2);
+
+		scheduler.run(chunks(level.size()), [&](const tile& t)
+		{
+			for (size_t j = t.left; j < (size_t)t.left + t.width; j++)
+			{
+				// An odd step out at the end just carries up as it is.
+				if (2 * j + 1 < below.size())
+					level[j] = merge(below[2 * j], below[2 * j + 1], maxDc);
+				else
+					level[j] = below[2 * j];
+			}
+		});
+
+		_levels.push_back(std::move(level));
+	}
+}
+
+void bla_table::clear()
+{
+	_levels.clear();
+}
+
+void bla_table::start(size_t capacity, double maxDc, double epsilon)
+{
+	_levels.clear();
+	_maxDc = maxDc;
+	_epsilon = epsilon;
+
+	if (capacity < 3)
+		return;
+
+	// Every level the longest possible orbit would have. Reserving doesn't touch the memory,
+	// so an orbit that turns out shorter only ever uses what it needs.
+	size_t size = capacity - 2;
+
+	while (true)
+	{
+		_levels.emplace_back();
+		_levels.back().reserve(size);
+
+		if (size <= 1)
+			break;
+
+		size = (size + 1) / 2;
+	}
+}
+
+void bla_table::extend(const std::vector<double>& real, const std::vector<double>& imag, size_t available)
+{
+	if (_levels.empty())
+		return;
+
+	// Single steps landing on elements that exist...
+	std::vector<bla_step>& singles = _levels[0];
+
+	while (singles.size() + 2 < available && singles.size() < singles.capacity())
+		singles.push_back(single_step(real, imag, singles.size(), _epsilon));
+
+	// ...and above them, every pair that's complete. A level can never outgrow what start()
+	// reserved for it, but the checks keep it that way should available ever be too big.
+	for (size_t level = 1; level < _levels.size(); level++)
+	{
+		const std::vector<bla_step>& below = _levels[level - 1];
+		std::vector<bla_step>& steps = _levels[level];
+
+		while (2 * steps.size() + 1 < below.size() && steps.size() < steps.capacity())
+			steps.push_back(merge(below[2 * steps.size()], below[2 * steps.size() + 1], _maxDc));
+	}
+}
+
+void bla_table::finish(const std::vector<double>& real, const std::vector<double>& imag)
+{
+	extend(real, imag, real.size());
+
+	// An odd step out at the end carries up as it is, and may complete a pair on the level above.
+	for (size_t level = 1; level < _levels.size(); level++)
+	{
+		const std::vector<bla_step>& below = _levels[level - 1];
+		std::vector<bla_step>& steps = _levels[level];
+
+		while (2 * steps.size() + 1 < below.size())
+			steps.push_back(merge(below[2 * steps.size()], below[2 * steps.size() + 1], _maxDc));
+
+		if (2 * steps.size() < below.size())
+			steps.push_back(below[2 * steps.size()]);
+	}
+}
+
+void bla_table::trim()
+{
+	// build() stops at the first level of a single step, or makes none at all for an orbit too short.
+	for (size_t level = 0; level < _levels.size(); level++)
+	{
+		if (_levels[level].size() <= 1)
+		{
+			_levels.resize(_levels[level].empty() ? level : level + 1);
+			break;
+		}
+	}
+}
+
+void series_approximation::build(const std::vector<double>& real, const std::vector<double>& imag,
+	double maxDc, uint32_t terms, double tolerance)
+{
+	clear();
+
+	size_t size = real.size();
+
+	if (terms < 2 || size < 3 || !(maxDc > 0.0))
+		return;
+
+	_radius = maxDc;
+
+	// d_0 = 0, so every coefficient starts at 0.
+	std::vector<double> br(terms, 0.0);
+	std::vector<double> bi(terms, 0.0);
+	std::vector<double> nextR(terms);
+	std::vector<double> nextI(terms);
+
+	// Stop short of the orbit's last element, so that pixels have a reference to carry on with.
+	for (size_t n = 0; n + 2 < size; n++)
+	{
+		double zr = real[n];
+		double zi = imag[n];
+
+		// b_1' = 2 Z b_1 + max|dc|
+		nextR[0] = 2.0 * (zr * br[0] - zi * bi[0]) + maxDc;
+		nextI[0] = 2.0 * (zr * bi[0] + zi * br[0]);
+
+		// b_k' = 2 Z b_k + sum over i + j = k of b_i b_j
+		for (uint32_t k = 1; k < terms; k++)
+		{
+			double sumR = 0.0;
+			double sumI = 0.0;
+
+			for (uint32_t i = 0; i < k; i++)
+			{
+				uint32_t j = k - 1 - i;
+				sumR += br[i] * br[j] - bi[i] * bi[j];
+				sumI += br[i] * bi[j] + bi[i] * br[j];
+			}
+
+			nextR[k] = 2.0 * (zr * br[k] - zi * bi[k]) + sumR;
+			nextI[k] = 2.0 * (zr * bi[k] + zi * br[k]) + sumI;
+		}
+
+		// The scaled terms are largest at the edge of the view, where |dc / max|dc|| = 1.
+		// Once the last one there is no longer negligible beside the first, neither are
+		// the ones that were left off.
+		double first = nextR[0] * nextR[0] + nextI[0] * nextI[0];
+		double last = nextR[terms - 1] * nextR[terms - 1] + nextI[terms - 1] * nextI[terms - 1];
+
+		if (!(last <= tolerance * tolerance * first))
+			break;
+
+		br.swap(nextR);
+		bi.swap(nextI);
+		_skip = (uint32_t)(n + 1);
+	}
+
+	_real = br;
+	_imag = bi;
+}
+
+void series_approximation::clear()
+{
+	_real.clear();
+	_imag.clear();
+	_radius = 1.0;
+	_skip = 0;
+}
+
+void series_approximation::evaluate(double dcr, double dci, double& dr, double& di) const
+{
+	if (_skip == 0)
+	{
+		dr = 0.0;
+		di = 0.0;
+		return;
+	}
+
+	// Horner's method in t = dc / max|dc|.
+	double tr = dcr / _radius;
+	double ti = dci / _radius;
+	size_t k = _real.size() - 1;
+	double sr = _real[k];
+	double si = _imag[k];
+
+	while (k-- > 0)
+	{
+		double nextR = sr * tr - si * ti + _real[k];
+		si = sr * ti + si * tr + _imag[k];
+		sr = nextR;
+	}
+
+	dr = sr * tr - si * ti;
+	di = sr * ti + si * tr;
+}
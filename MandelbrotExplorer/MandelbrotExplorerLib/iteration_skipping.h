@@ -0,0 +1,136 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <cstdint>
+#include "tile_scheduler.h"
+
+// Ways for the perturbation engine to skip over the early iterations of each pixel,
+// where every pixel follows the reference orbit so closely that
+//
+//   d_n+1 = 2 Z_n d_n + d_n^2 + dc
+//
+// is linear in d and dc for all practical purposes. Both are built from the reference
+// orbit (and the largest dc any pixel has), and are kept with it.
+
+// One step of a bivariate linear approximation: jumping from reference index m to
+// m + length takes d to a d + b dc, as long as |d| < radius when setting off.
+struct bla_step
+{
+	double ar;
+	double ai;
+	double br;
+	double bi;
+	double radius_squared;
+	uint32_t length;
+};
+
+// Bivariate linear approximation (BLA), after Zhuoran. Level 0 holds single steps:
+// a = 2 Z_m, b = 1, valid while the dropped d^2 is under epsilon times the 2 Z_m d kept.
+// Each level above merges pairs of steps from the level below, so level L jumps 2^L
+// iterations at once, from any reference index m with m - 1 a multiple of 2^L.
+// (Z_0 = 0, so there's nothing to approximate from m = 0.)
+//
+// Merging x, then y:  a = a_y a_x,  b = a_y b_x + b_y,
+//                     radius = min(radius_x, (radius_y - |b_x| max|dc|) / |a_x|).
+class bla_table
+{
+public:
+
+	// Each level is built in parallel, a chunk of steps per scheduler tile.
+	void build(const std::vector<double>& real, const std::vector<double>& imag,
+		double maxDc, double epsilon, tile_scheduler& scheduler);
+	void clear();
+
+	// Or built a step at a time alongside an orbit that's still being computed, for pixels to
+	// use while it is. start() makes room for an orbit of up to capacity elements, so that the
+	// levels never move. extend() builds every step the orbit's first `available` elements
+	// make possible, and finish() the odd steps out at the end of each level once the orbit's
+	// complete, which leaves exactly what build() would have. Only trim() afterwards changes
+	// the number of levels, so it mustn't run while pixels are still looking steps up.
+	void start(size_t capacity, double maxDc, double epsilon);
+	void extend(const std::vector<double>& real, const std::vector<double>& imag, size_t available);
+	void finish(const std::vector<double>& real, const std::vector<double>& imag);
+	void trim();
+
+	bool empty() const { return _levels.empty(); }
+	size_t level_count() const { return _levels.size(); }
+	const std::vector<bla_step>& level(size_t index) const { return _levels[index]; }
+
+	// The longest step that can be taken from reference index m with a delta of
+	// squared magnitude dSquared, no longer than maxLength. Null if there's none
+	// longer than a single iteration.
+	//
+	// Between start() and trim(), available has to be the number of orbit elements extend()
+	// was last given (or fewer): only steps landing short of it are there to take.
+	const bla_step* lookup(size_t m, double dSquared, uint32_t maxLength, size_t available = SIZE_MAX) const
+	{
+		if (m == 0)
+			return nullptr;
+
+		size_t offset = m - 1;
+		const bla_step* longest = nullptr;
+
+		// Merging only ever shrinks the radius, so a level's never any use where the level below
+		// it isn't. Climb from level 1 until a step doesn't apply, or doesn't start here.
+		for (size_t level = 1; level < _levels.size() && ((offset >> (level - 1)) & 1) == 0; level++)
+		{
+			const std::vector<bla_step>& steps = _levels[level];
+			size_t index = offset >> level;
+
+			// Every step that lands on an element that's been computed exists. Reading the size
+			// of a level that's still growing would race with extend(), so that's only checked
+			// once the table's complete.
+			if (available != SIZE_MAX ? m + ((size_t)1 << level) >= available : index >= steps.size())
+				break;
+
+			const bla_step& step = steps[index];
+
+			if (!(dSquared < step.radius_squared) || step.length > maxLength)
+				break;
+
+			longest = &step;
+		}
+
+		return longest;
+	}
+
+private:
+
+	std::vector<std::vector<bla_step>> _levels;
+
+	// What start() was given.
+	double _maxDc = 0.0;
+	double _epsilon = 0.0;
+};
+
+// Series approximation: d_n as a polynomial in dc, the same for every pixel,
+//
+//   d_n = a_1 dc + a_2 dc^2 + ... + a_K dc^K,
+//
+// with the coefficients iterated along the reference orbit for as long as the last of them
+// stays negligible. Every pixel then starts at that iteration. Unlike BLA, it only skips
+// the iterations at the start, but it needs no lookups at all.
+//
+// At deep zooms a_k grows like max|dc|^-k, far beyond a double's range, so the coefficients
+// are kept scaled by max|dc|^k, and the polynomial is evaluated in dc / max|dc|.
+class series_approximation
+{
+public:
+
+	void build(const std::vector<double>& real, const std::vector<double>& imag,
+		double maxDc, uint32_t terms, double tolerance);
+	void clear();
+
+	// Iterations every pixel can skip.
+	uint32_t skip() const { return _skip; }
+
+	// d at iteration skip().
+	void evaluate(double dcr, double dci, double& dr, double& di) const;
+
+private:
+
+	std::vector<double> _real;
+	std::vector<double> _imag;
+	double _radius = 1.0;
+	uint32_t _skip = 0;
+};
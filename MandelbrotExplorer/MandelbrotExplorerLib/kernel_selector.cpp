@@ -0,0 +1,92 @@
+#include "pch.h"
+#include "kernel_selector.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// Orbits that haven't escaped stay within |z| <= 2, and the ones that have
+	// are done with, so no kernel ever holds anything much larger than this
+	// apart from the view's own coordinates.
+	const double ORBIT_MAGNITUDE = 2.0;
+}
+
+kernel_selector::kernel_selector(const kernel_selection_options& options)
+	: _options(options)
+{
+}
+
+uint32_t kernel_selector::precision_bits(escape_kernel kernel)
+{
+	switch (kernel)
+	{
+	case escape_kernel::float32: return 24;
+
+	// Nominally 48, but the shaders' float-float arithmetic isn't exactly rounded
+	// on every device, and loses a few of them.
+	case escape_kernel::float_float: return 44;
+	case escape_kernel::float64: return 53;
+
+	// Likewise 106 nominally.
+	case escape_kernel::double_double: return 104;
+	default: return 0;
+	}
+}
+
+const char* kernel_selector::kernel_name(escape_kernel kernel)
+{
+	switch (kernel)
+	{
+	case escape_kernel::float32: return "float32";
+	case escape_kernel::float_float: return "float-float";
+	case escape_kernel::float64: return "float64";
+	case escape_kernel::double_double: return "double-double";
+	default: return "perturbation";
+	}
+}
+
+kernel_estimate kernel_selector::estimate(escape_kernel kernel, const mandelbrot_precise_bounds& bounds, uint32_t width, uint32_t height)
+{
+	kernel_estimate result;
+	result.kernel = kernel;
+
+	// Pixels are square, so either side gives the spacing. The larger of the two
+	// is kinder to a surface whose aspect ratio doesn't quite match its bounds.
+	double viewWidth = std::fabs((bounds.right - bounds.left).hi);
+	double viewHeight = std::fabs((bounds.top - bounds.bottom).hi);
+	result.spacing = std::max(viewWidth / std::max(width, 1u), viewHeight / std::max(height, 1u));
+
+	if (kernel == escape_kernel::perturbation)
+	{
+		// Relative to the deltas themselves, which are never coarser than a double.
+		result.relative_error = std::ldexp(1.0, -53);
+		return result;
+	}
+
+	double magnitude = std::max(
+		std::max(std::fabs(bounds.left.hi), std::fabs(bounds.right.hi)),
+		std::max(std::fabs(bounds.top.hi), std::fabs(bounds.bottom.hi)));
+
+	double error = std::ldexp(std::max(magnitude, ORBIT_MAGNITUDE), -(int)precision_bits(kernel));
+
+	// A view too small for a double to express at all is infinitely too fine for any of these.
+	result.relative_error = result.spacing > 0.0 ? error / result.spacing : INFINITY;
+	return result;
+}
+
+kernel_estimate kernel_selector::choose(const mandelbrot_precise_bounds& bounds, uint32_t width, uint32_t height) const
+{
+	double tolerance = std::ldexp(1.0, -(int)_options.headroom_bits);
+	escape_kernel last = _options.allow_cpu ? escape_kernel::perturbation : escape_kernel::float_float;
+
+	for (int k = (int)escape_kernel::float32; k < (int)last; k++)
+	{
+		kernel_estimate result = estimate((escape_kernel)k, bounds, width, height);
+
+		if (result.relative_error <= tolerance)
+			return result;
+	}
+
+	// Without the CPU kernels, float-float is as good as it gets, even if it isn't good enough.
+	return estimate(last, bounds, width, height);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "pch.h"
+#include <cstdint>
+#include "mandelbrot_parameters.h"
+
+// Every way there is to compute a frame's escape times, cheapest first.
+// Each one holds coordinates and orbits in more bits than the one before.
+enum class escape_kernel
+{
+	float32,		// The shaders, in float.
+	float_float,	// The shaders, in float-float.
+	float64,		// cpu_renderer, in double.
+	double_double,	// cpu_renderer, in double-double.
+	perturbation	// perturbation_engine, for views of any depth.
+};
+
+struct kernel_selection_options
+{
+	// Whether the kernels that run on the CPU may be chosen. Their results are shown
+	// through the iteration buffer, which needs a device that supports compute.
+	bool allow_cpu = true;
+
+	// How many bits finer than the pixel spacing a kernel's rounding error has to be.
+	// Neighbouring pixels' coordinates come out different with any at all, but rounding
+	// errors in the orbit grow with every iteration, and the smooth coloring shows them
+	// as noise well before pixels collapse into blocks.
+	uint32_t headroom_bits = 4;
+};
+
+// How well a kernel suits a view.
+struct kernel_estimate
+{
+	escape_kernel kernel = escape_kernel::float32;
+
+	// The view's pixel spacing in the complex plane, and the kernel's rounding error
+	// in a pixel's coordinates and orbit as a fraction of it. Anything near 1
+	// leaves neighbouring pixels indistinguishable.
+	double spacing = 0.0;
+	double relative_error = 0.0;
+};
+
+// Picks the cheapest kernel whose rounding error is small enough for a view.
+//
+// A kernel with p bits holds a number of magnitude m to within about m 2^-p, and
+// every coordinate and orbit value it works with is as large as the view's furthest
+// corner from 0, or as |z| gets before escaping, whichever's larger. That's all
+// the error bound is: it has to stay headroom_bits below the spacing between pixels.
+// Perturbation holds each pixel relative to a reference orbit instead, so its error
+// shrinks along with the view, and it suits every view.
+class kernel_selector
+{
+public:
+
+	kernel_selector(const kernel_selection_options& options = kernel_selection_options());
+
+	void set_options(const kernel_selection_options& options) { _options = options; }
+	const kernel_selection_options& options() const { return _options; }
+
+	// For a surface width by height pixels showing bounds.
+	kernel_estimate choose(const mandelbrot_precise_bounds& bounds, uint32_t width, uint32_t height) const;
+
+	// The same for a given kernel, whether or not it would be chosen.
+	static kernel_estimate estimate(escape_kernel kernel, const mandelbrot_precise_bounds& bounds, uint32_t width, uint32_t height);
+
+	// Bits of precision the kernel keeps, in practice. 0 for perturbation, which isn't limited by them.
+	static uint32_t precision_bits(escape_kernel kernel);
+
+	static const char* kernel_name(escape_kernel kernel);
+
+private:
+
+	kernel_selection_options _options;
+};
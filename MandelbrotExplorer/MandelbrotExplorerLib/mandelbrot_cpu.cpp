@@ -0,0 +1,602 @@
+#include "pch.h"
+#include "mandelbrot_cpu.h"
+#include "mandelbrot_cpu_kernels.h"
+#include "double_double.h"
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+#if defined(CPU_KERNELS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+CPU_KERNELS_BEGIN
+
+namespace
+{
+	escape_time_kernel select_kernel(cpu_instruction_set instructionSet)
+	{
+		switch (instructionSet)
+		{
+#ifdef CPU_KERNELS_X86
+		case cpu_instruction_set::sse2: return escape_time_sse2;
+		case cpu_instruction_set::avx2: return escape_time_avx2;
+		case cpu_instruction_set::avx512: return escape_time_avx512;
+#endif
+		default: return escape_time_scalar;
+		}
+	}
+
+	escape_time_wide_kernel select_wide_kernel(cpu_instruction_set instructionSet, cpu_precision precision)
+	{
+		bool doubleDouble = precision == cpu_precision::double_double;
+
+		switch (instructionSet)
+		{
+#ifdef CPU_KERNELS_X86
+		case cpu_instruction_set::avx2: return doubleDouble ? escape_time_dd_avx2 : escape_time_f64_avx2;
+		case cpu_instruction_set::avx512: return doubleDouble ? escape_time_dd_avx512 : escape_time_f64_avx512;
+#endif
+		default: return doubleDouble ? escape_time_dd_scalar : escape_time_f64_scalar;
+		}
+	}
+
+	// Linearly interpolates the real-valued bailout iteration
+	// over log(m1), log(bailout_radius), and log(m2),
+	// the same way the shader does.
+	void smooth_row(
+		const mandelbrot_parameter_info& info,
+		const std::vector<uint32_t>& iterations,
+		const std::vector<float>& m1,
+		const std::vector<float>& m2,
+		uint32_t width,
+		float* values)
+	{
+		for (uint32_t i = 0; i < width; i++)
+		{
+			if (iterations[i] < info.max_iterations)
+			{
+				float invm1 = 1.0f / m1[i];
+				float delta = 1.0f - std::log(info.bailout_radius * invm1) / std::log(m2[i] * invm1);
+				values[i] = float(iterations[i]) - delta;
+			}
+			else
+			{
+				values[i] = iteration_buffer::INTERIOR;
+			}
+		}
+	}
+
+	// GLSL's mix(), evaluated the same way the shader does.
+	inline float mix(float a, float b, float t)
+	{
+		return a * (1.0f - t) + b * t;
+	}
+
+	inline float unpack_channel(uint32_t color, int shift)
+	{
+		return float((color >> shift) & 0xFF) / 255.0f;
+	}
+
+	// The shader writes linear colors into B8G8R8A8_SRGB images, and the hardware
+	// applies the sRGB transfer function on store. Do the same here, through a table,
+	// so CPU renders come out byte-for-byte comparable to GPU renders.
+	const int SRGB_TABLE_SIZE = 4096;
+
+	struct srgb_table
+	{
+		uint8_t values[SRGB_TABLE_SIZE + 1];
+
+		srgb_table()
+		{
+			for (int i = 0; i <= SRGB_TABLE_SIZE; i++)
+			{
+				double linear = (double)i / SRGB_TABLE_SIZE;
+				double encoded = linear <= 0.0031308
+					? linear * 12.92
+					: 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+
+				values[i] = (uint8_t)std::lround(encoded * 255.0);
+			}
+		}
+
+		uint8_t encode(float linear) const
+		{
+			float clamped = std::min(std::max(linear, 0.0f), 1.0f);
+			return values[(int)(clamped * SRGB_TABLE_SIZE + 0.5f)];
+		}
+	};
+
+	const srgb_table SRGB;
+
+	inline uint32_t pack_bgra(float r, float g, float b)
+	{
+		return 0xFF000000u
+			| ((uint32_t)SRGB.encode(r) << 16)
+			| ((uint32_t)SRGB.encode(g) << 8)
+			| ((uint32_t)SRGB.encode(b));
+	}
+
+	inline uint32_t pack_bgra(uint32_t color)
+	{
+		return pack_bgra(unpack_channel(color, 16), unpack_channel(color, 8), unpack_channel(color, 0));
+	}
+}
+
+void escape_time_scalar(const escape_time_row& row)
+{
+	for (uint32_t x = 0; x < row.count; x++)
+	{
+		float cr = row.cr[x];
+		float ci = row.ci;
+		float zr = 0.0f;
+		float zi = 0.0f;
+		float m1 = 0.0f;
+		float m2 = 0.0f;
+		uint32_t iteration = 0;
+
+		if (known_interior(cr, ci))
+		{
+			iteration = row.max_iterations;
+		}
+		else
+		{
+			float check_zr = 0.0f;
+			float check_zi = 0.0f;
+			uint32_t check_window = 1;
+			uint32_t check_steps = 0;
+
+			for (uint32_t i = 0; i < row.max_iterations && m2 < row.bailout_radius; i++)
+			{
+				float zr2 = zr * zr;
+				float zi2 = zi * zi;
+
+				float zr_next = zr2 - zi2 + cr;
+				float zi_next = 2 * zr * zi + ci;
+				zr = zr_next;
+				zi = zi_next;
+				m1 = m2;
+				m2 = zr2 + zi2;
+				iteration = iteration + 1;
+
+				if (zr == check_zr && zi == check_zi)
+				{
+					iteration = row.max_iterations;
+					break;
+				}
+
+				if (++check_steps == check_window)
+				{
+					check_steps = 0;
+					check_window *= 2;
+					check_zr = zr;
+					check_zi = zi;
+				}
+			}
+		}
+
+		row.iterations[x] = iteration;
+		row.m1[x] = m1;
+		row.m2[x] = m2;
+	}
+}
+
+void escape_time_f64_scalar(const escape_time_row_wide& row)
+{
+	for (uint32_t x = 0; x < row.count; x++)
+	{
+		double cr = row.cr_hi[x];
+		double ci = row.ci_hi;
+		double zr = 0.0;
+		double zi = 0.0;
+		double m1 = 0.0;
+		double m2 = 0.0;
+		uint32_t iteration = 0;
+
+		if (known_interior(cr, ci))
+		{
+			iteration = row.max_iterations;
+		}
+		else
+		{
+			double check_zr = 0.0;
+			double check_zi = 0.0;
+			uint32_t check_window = 1;
+			uint32_t check_steps = 0;
+
+			for (uint32_t i = 0; i < row.max_iterations && m2 < row.bailout_radius; i++)
+			{
+				double zr2 = zr * zr;
+				double zi2 = zi * zi;
+
+				double zr_next = zr2 - zi2 + cr;
+				double zi_next = std::fma(zr + zr, zi, ci);
+				zr = zr_next;
+				zi = zi_next;
+				m1 = m2;
+				m2 = zr2 + zi2;
+				iteration = iteration + 1;
+
+				if (zr == check_zr && zi == check_zi)
+				{
+					iteration = row.max_iterations;
+					break;
+				}
+
+				if (++check_steps == check_window)
+				{
+					check_steps = 0;
+					check_window *= 2;
+					check_zr = zr;
+					check_zi = zi;
+				}
+			}
+		}
+
+		row.iterations[x] = iteration;
+		row.m1[x] = (float)m1;
+		row.m2[x] = (float)m2;
+	}
+}
+
+void escape_time_dd_scalar(const escape_time_row_wide& row)
+{
+	const double_double ci(row.ci_hi, row.ci_lo);
+
+	for (uint32_t x = 0; x < row.count; x++)
+	{
+		double_double cr(row.cr_hi[x], row.cr_lo[x]);
+		double_double zr;
+		double_double zi;
+		double m1 = 0.0;
+		double m2 = 0.0;
+		uint32_t iteration = 0;
+
+		if (known_interior(cr.hi, ci.hi))
+		{
+			iteration = row.max_iterations;
+		}
+		else
+		{
+			double_double check_zr;
+			double_double check_zi;
+			uint32_t check_window = 1;
+			uint32_t check_steps = 0;
+
+			for (uint32_t i = 0; i < row.max_iterations && m2 < row.bailout_radius; i++)
+			{
+				double_double zr2 = sqr(zr);
+				double_double zi2 = sqr(zi);
+
+				double_double zr_next = (zr2 - zi2) + cr;
+				double_double zi_next = twice(zr * zi) + ci;
+				zr = zr_next;
+				zi = zi_next;
+
+				// Only ever compared against the bailout radius, so the low halves don't matter.
+				m1 = m2;
+				m2 = zr2.hi + zi2.hi;
+				iteration = iteration + 1;
+
+				if (zr.hi == check_zr.hi && zr.lo == check_zr.lo && zi.hi == check_zi.hi && zi.lo == check_zi.lo)
+				{
+					iteration = row.max_iterations;
+					break;
+				}
+
+				if (++check_steps == check_window)
+				{
+					check_steps = 0;
+					check_window *= 2;
+					check_zr = zr;
+					check_zi = zi;
+				}
+			}
+		}
+
+		row.iterations[x] = iteration;
+		row.m1[x] = (float)m1;
+		row.m2[x] = (float)m2;
+	}
+}
+
+CPU_KERNELS_END
+
+cpu_renderer::cpu_renderer(const tile_scheduler_options& options)
+	: _instructionSet(detect_instruction_set()), _scheduler(new tile_scheduler(options))
+{
+}
+
+cpu_renderer::cpu_renderer(cpu_instruction_set instructionSet, const tile_scheduler_options& options)
+	: _instructionSet(instructionSet)
+{
+	if (!supports(instructionSet))
+	{
+		throw std::runtime_error(std::string("CPU does not support the ") + instruction_set_name(instructionSet) + " instruction set.");
+	}
+
+	_scheduler.reset(new tile_scheduler(options));
+}
+
+cpu_renderer::~cpu_renderer()
+{
+}
+
+uint32_t cpu_renderer::lane_count() const
+{
+	if (_precision != cpu_precision::float32)
+	{
+		switch (_instructionSet)
+		{
+		case cpu_instruction_set::avx2: return 4;
+		case cpu_instruction_set::avx512: return 8;
+		default: return 1;
+		}
+	}
+
+	switch (_instructionSet)
+	{
+	case cpu_instruction_set::sse2: return 4;
+	case cpu_instruction_set::avx2: return 8;
+	case cpu_instruction_set::avx512: return 16;
+	default: return 1;
+	}
+}
+
+cpu_instruction_set cpu_renderer::detect_instruction_set()
+{
+	if (supports(cpu_instruction_set::avx512))
+		return cpu_instruction_set::avx512;
+
+	if (supports(cpu_instruction_set::avx2))
+		return cpu_instruction_set::avx2;
+
+	if (supports(cpu_instruction_set::sse2))
+		return cpu_instruction_set::sse2;
+
+	return cpu_instruction_set::scalar;
+}
+
+bool cpu_renderer::supports(cpu_instruction_set instructionSet)
+{
+	if (instructionSet == cpu_instruction_set::scalar)
+		return true;
+
+#if !defined(CPU_KERNELS_X86)
+	return false;
+#elif defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	bool avx512f = false;
+
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512f = (info[1] & (1 << 16)) != 0;
+	}
+
+	// The CPU having the instructions isn't enough. The OS also has to
+	// save & restore the wider registers on a context switch.
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool osAvx = (xcr0 & 0x06) == 0x06;
+	bool osAvx512 = (xcr0 & 0xE6) == 0xE6;
+
+	switch (instructionSet)
+	{
+	case cpu_instruction_set::sse2: return sse2;
+	case cpu_instruction_set::avx2: return avx && avx2 && fma && osAvx;
+	case cpu_instruction_set::avx512: return avx512f && fma && osAvx512;
+	default: return false;
+	}
+#else
+	// GCC & Clang's builtins also check that the OS saves the wider registers.
+	switch (instructionSet)
+	{
+	case cpu_instruction_set::sse2: return __builtin_cpu_supports("sse2");
+	case cpu_instruction_set::avx2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case cpu_instruction_set::avx512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+	default: return false;
+	}
+#endif
+}
+
+const char* cpu_renderer::instruction_set_name(cpu_instruction_set instructionSet)
+{
+	switch (instructionSet)
+	{
+	case cpu_instruction_set::sse2: return "SSE2";
+	case cpu_instruction_set::avx2: return "AVX2";
+	case cpu_instruction_set::avx512: return "AVX-512";
+	default: return "scalar";
+	}
+}
+
+const char* cpu_renderer::precision_name(cpu_precision precision)
+{
+	switch (precision)
+	{
+	case cpu_precision::float64: return "double";
+	case cpu_precision::double_double: return "double-double";
+	default: return "float";
+	}
+}
+
+void cpu_renderer::iterate(const mandelbrot_parameter_info& info, iteration_buffer& output)
+{
+	iterate(info, mandelbrot_precise_bounds(info), output);
+}
+
+void cpu_renderer::iterate(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds, iteration_buffer& output)
+{
+	uint32_t width = (uint32_t)info.surface_width;
+	uint32_t height = (uint32_t)info.surface_height;
+
+	output.resize(width, height);
+
+	// Tiles never overlap, so workers can all write into output at once.
+	_scheduler->run(width, height, [&](const tile& t)
+	{
+		iterate_rect(info, bounds, t.left, t.top, t.width, t.height, output);
+	});
+}
+
+void cpu_renderer::iterate_rect(
+	const mandelbrot_parameter_info& info,
+	uint32_t left, uint32_t top, uint32_t width, uint32_t height,
+	iteration_buffer& output) const
+{
+	iterate_rect(info, mandelbrot_precise_bounds(info), left, top, width, height, output);
+}
+
+void cpu_renderer::iterate_rect(
+	const mandelbrot_parameter_info& info,
+	const mandelbrot_precise_bounds& bounds,
+	uint32_t left, uint32_t top, uint32_t width, uint32_t height,
+	iteration_buffer& output) const
+{
+	if (width == 0 || height == 0)
+		return;
+
+	if (left + width > output.width || top + height > output.height)
+	{
+		throw std::runtime_error("Iteration rectangle lies outside the output buffer.");
+	}
+
+	// Pad the row out to a whole number of vectors.
+	// The padding pixels just repeat the last real pixel and get thrown away.
+	uint32_t padded = (width + CPU_KERNEL_MAX_LANES - 1) / CPU_KERNEL_MAX_LANES * CPU_KERNEL_MAX_LANES;
+
+	std::vector<uint32_t> iterations(padded);
+	std::vector<float> m1(padded);
+	std::vector<float> m2(padded);
+
+	if (_precision != cpu_precision::float32)
+	{
+		escape_time_wide_kernel kernel = select_wide_kernel(_instructionSet, _precision);
+
+		// Only the bounds need the extra precision. Their differences, and the
+		// offsets of each pixel from them, are tiny by comparison and fit in a double.
+		double viewWidth = (double)(bounds.right - bounds.left);
+		double viewHeight = (double)(bounds.bottom - bounds.top);
+
+		std::vector<double> crHi(padded);
+		std::vector<double> crLo(padded);
+
+		for (uint32_t i = 0; i < padded; i++)
+		{
+			uint32_t x = left + std::min(i, width - 1);
+			double_double cr = bounds.left + double_double(viewWidth * ((x + 0.5) / info.surface_width));
+			crHi[i] = cr.hi;
+			crLo[i] = cr.lo;
+		}
+
+		escape_time_row_wide row{};
+		row.cr_hi = crHi.data();
+		row.cr_lo = crLo.data();
+		row.count = padded;
+		row.bailout_radius = info.bailout_radius;
+		row.max_iterations = info.max_iterations;
+		row.iterations = iterations.data();
+		row.m1 = m1.data();
+		row.m2 = m2.data();
+
+		for (uint32_t y = top; y < top + height; y++)
+		{
+			double_double ci = bounds.top + double_double(viewHeight * ((y + 0.5) / info.surface_height));
+			row.ci_hi = ci.hi;
+			row.ci_lo = ci.lo;
+			kernel(row);
+
+			smooth_row(info, iterations, m1, m2, width, output.row(y) + left);
+		}
+
+		return;
+	}
+
+	escape_time_kernel kernel = select_kernel(_instructionSet);
+	std::vector<float> cr(padded);
+
+	// The shader's gl_FragCoord refers to pixel centers, hence the + 0.5.
+	for (uint32_t i = 0; i < padded; i++)
+	{
+		uint32_t x = left + std::min(i, width - 1);
+		cr[i] = mix(info.left, info.right, (x + 0.5f) / info.surface_width);
+	}
+
+	escape_time_row row{};
+	row.cr = cr.data();
+	row.count = padded;
+	row.bailout_radius = info.bailout_radius;
+	row.max_iterations = info.max_iterations;
+	row.iterations = iterations.data();
+	row.m1 = m1.data();
+	row.m2 = m2.data();
+
+	for (uint32_t y = top; y < top + height; y++)
+	{
+		row.ci = mix(info.top, info.bottom, (y + 0.5f) / info.surface_height);
+		kernel(row);
+
+		smooth_row(info, iterations, m1, m2, width, output.row(y) + left);
+	}
+}
+
+void cpu_renderer::colorize(
+	const mandelbrot_parameter_info& info,
+	const palette& colors,
+	const iteration_buffer& iterations,
+	std::vector<uint32_t>& pixels)
+{
+	pixels.resize(iterations.values.size());
+
+	uint32_t fill = pack_bgra(info.fill_color);
+	uint32_t length = info.gradient_length;
+
+	float F = info.gradient_period_factor;
+	float M = float(info.max_iterations);
+	float L = float(length);
+
+	for (size_t i = 0; i < iterations.values.size(); i++)
+	{
+		float T = iterations.values[i];
+
+		if (T == iteration_buffer::INTERIOR || length == 0)
+		{
+			pixels[i] = fill;
+			continue;
+		}
+
+		// The gradient repeats every P iterations,
+		// with P growing as T approaches max_iterations.
+		float P = mix(L, M * F, (T - 1.0f) / (M - 1.0f));
+		float K = std::floor(T / P);
+
+		float t_mod_p = T - K * P;
+		const palette_color& color = colors.at(t_mod_p / P);
+
+		pixels[i] = pack_bgra(color.r, color.g, color.b);
+	}
+}
+
+void cpu_renderer::render(const mandelbrot_parameter_info& info, const palette& colors, std::vector<uint32_t>& pixels)
+{
+	render(info, mandelbrot_precise_bounds(info), colors, pixels);
+}
+
+void cpu_renderer::render(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds, const palette& colors, std::vector<uint32_t>& pixels)
+{
+	iteration_buffer iterations;
+	iterate(info, bounds, iterations);
+	colorize(info, colors, iterations, pixels);
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "mandelbrot_parameters.h"
+#include "tile_scheduler.h"
+#include "palette.h"
+
+// The raw per-pixel result of the escape-time loop, before any coloring.
+//
+// Escaped pixels hold the smooth (real-valued) iteration count,
+// T = iteration - delta, exactly as the fragment shader computes it.
+// Pixels that never escaped within max_iterations hold INTERIOR.
+struct iteration_buffer
+{
+	static constexpr float INTERIOR = -1.0f;
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<float> values;
+
+	void resize(uint32_t newWidth, uint32_t newHeight)
+	{
+		width = newWidth;
+		height = newHeight;
+		values.resize((size_t)width * height);
+	}
+
+	float* row(uint32_t y) { return values.data() + (size_t)y * width; }
+	const float* row(uint32_t y) const { return values.data() + (size_t)y * width; }
+};
+
+enum class cpu_instruction_set
+{
+	scalar,
+	sse2,
+	avx2,
+	avx512
+};
+
+// Number format the escape-time loop runs in. Each is good for zooming roughly
+// twice as deep as the one before, at several times the cost per iteration.
+enum class cpu_precision
+{
+	float32,		// Same as the shaders. Blocky past a zoom of about 1e-5.
+	float64,		// Good to about 1e-13.
+	double_double	// About 106 bits. Good to about 1e-30.
+};
+
+// Native C++ counterpart to MANDELBROT_FRAGMENT_SHADER, for hosts without a usable GPU.
+//
+// Takes the same mandelbrot_parameter_info the shader receives as push constants
+// and produces the same smooth iteration values and gradient coloring.
+// The escape-time loop runs several pixels of a row at once in SIMD lanes,
+// using the widest instruction set the CPU supports, and the image is split
+// into tiles which a tile_scheduler spreads across every core.
+class cpu_renderer
+{
+public:
+
+	// Picks the best instruction set available on this CPU.
+	cpu_renderer(const tile_scheduler_options& options = tile_scheduler_options());
+
+	// Forces a specific instruction set. Throws if the CPU doesn't support it.
+	cpu_renderer(cpu_instruction_set instructionSet, const tile_scheduler_options& options = tile_scheduler_options());
+
+	~cpu_renderer();
+
+	cpu_instruction_set instruction_set() const { return _instructionSet; }
+
+	// Tile sizes, thread count, and per-thread utilisation of the last frame.
+	const tile_scheduler& scheduler() const { return *_scheduler; }
+
+	// float32 unless set otherwise. The double and double-double kernels use FMA,
+	// so they're only vectorized with AVX2 and AVX-512, and are scalar otherwise.
+	void set_precision(cpu_precision precision) { _precision = precision; }
+	cpu_precision precision() const { return _precision; }
+
+	// Number of pixels the selected kernel iterates at once.
+	uint32_t lane_count() const;
+
+	static cpu_instruction_set detect_instruction_set();
+	static bool supports(cpu_instruction_set instructionSet);
+	static const char* instruction_set_name(cpu_instruction_set instructionSet);
+	static const char* precision_name(cpu_precision precision);
+
+	// Runs the escape-time loop for every pixel of the surface
+	// described by info.surface_width and info.surface_height,
+	// spread across the scheduler's worker threads.
+	void iterate(const mandelbrot_parameter_info& info, iteration_buffer& output);
+
+	// The same, with the view's bounds taken from bounds rather than info's floats,
+	// for the double and double-double precisions to make use of.
+	void iterate(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds, iteration_buffer& output);
+
+	// Runs the escape-time loop for a sub-rectangle of the surface only,
+	// on the calling thread. output must already be sized to the full surface.
+	void iterate_rect(
+		const mandelbrot_parameter_info& info,
+		uint32_t left, uint32_t top, uint32_t width, uint32_t height,
+		iteration_buffer& output) const;
+
+	void iterate_rect(
+		const mandelbrot_parameter_info& info,
+		const mandelbrot_precise_bounds& bounds,
+		uint32_t left, uint32_t top, uint32_t width, uint32_t height,
+		iteration_buffer& output) const;
+
+	// Applies the shader's gradient coloring to previously computed iterations, from the
+	// same palette the shader would be given. Pixels are written as 0xAARRGGBB, i.e. B8G8R8A8
+	// in memory, sRGB encoded the same way the swap chain's B8G8R8A8_SRGB images encode the
+	// shader's output.
+	static void colorize(
+		const mandelbrot_parameter_info& info,
+		const palette& colors,
+		const iteration_buffer& iterations,
+		std::vector<uint32_t>& pixels);
+
+	// iterate() followed by colorize().
+	void render(const mandelbrot_parameter_info& info, const palette& colors, std::vector<uint32_t>& pixels);
+	void render(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds, const palette& colors, std::vector<uint32_t>& pixels);
+
+private:
+
+	cpu_instruction_set _instructionSet;
+	cpu_precision _precision = cpu_precision::float32;
+	std::unique_ptr<tile_scheduler> _scheduler;
+};
@@ -0,0 +1,295 @@
+#include "pch.h"
+#include "mandelbrot_cpu_kernels.h"
+
+#ifdef CPU_KERNELS_X86
+#include <immintrin.h>
+
+CPU_KERNELS_BEGIN
+
+// 8 pixels per vector. Same approach as the SSE2 kernel.
+//
+// FMA is deliberately not used here: fusing zr*zr - zi*zi would round differently
+// than the other kernels, and every instruction set should produce the same image.
+CPU_KERNEL_TARGET("avx2,fma")
+void escape_time_avx2(const escape_time_row& row)
+{
+	const __m256 ci = _mm256_set1_ps(row.ci);
+	const __m256 ci2 = _mm256_mul_ps(ci, ci);
+	const __m256 bailout = _mm256_set1_ps(row.bailout_radius);
+	const __m256 maxIterations = _mm256_castsi256_ps(_mm256_set1_epi32((int)row.max_iterations));
+
+	for (uint32_t x = 0; x < row.count; x += 8)
+	{
+		__m256 cr = _mm256_loadu_ps(row.cr + x);
+		__m256 zr = _mm256_setzero_ps();
+		__m256 zi = _mm256_setzero_ps();
+		__m256 m1 = _mm256_setzero_ps();
+		__m256 m2 = _mm256_setzero_ps();
+		__m256i iteration = _mm256_setzero_si256();
+
+		// Main cardioid & period-2 bulb, same as known_interior().
+		__m256 xr = _mm256_sub_ps(cr, _mm256_set1_ps(0.25f));
+		__m256 q = _mm256_add_ps(_mm256_mul_ps(xr, xr), ci2);
+		__m256 br = _mm256_add_ps(cr, _mm256_set1_ps(1.0f));
+		__m256 interior = _mm256_or_ps(
+			_mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, xr)), _mm256_mul_ps(_mm256_set1_ps(0.25f), ci2), _CMP_LE_OQ),
+			_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(br, br), ci2), _mm256_set1_ps(0.0625f), _CMP_LE_OQ));
+
+		__m256 check_zr = _mm256_setzero_ps();
+		__m256 check_zi = _mm256_setzero_ps();
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__m256 active = _mm256_andnot_ps(interior, _mm256_cmp_ps(m2, bailout, _CMP_LT_OQ));
+
+			if (_mm256_movemask_ps(active) == 0)
+				break;
+
+			__m256 zr2 = _mm256_mul_ps(zr, zr);
+			__m256 zi2 = _mm256_mul_ps(zi, zi);
+
+			__m256 zr_next = _mm256_add_ps(_mm256_sub_ps(zr2, zi2), cr);
+			__m256 zi_next = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(zr, zr), zi), ci);
+
+			zr = _mm256_blendv_ps(zr, zr_next, active);
+			zi = _mm256_blendv_ps(zi, zi_next, active);
+			m1 = _mm256_blendv_ps(m1, m2, active);
+			m2 = _mm256_blendv_ps(m2, _mm256_add_ps(zr2, zi2), active);
+
+			iteration = _mm256_sub_epi32(iteration, _mm256_castps_si256(active));
+
+			__m256 repeated = _mm256_and_ps(active, _mm256_and_ps(
+				_mm256_cmp_ps(zr, check_zr, _CMP_EQ_OQ),
+				_mm256_cmp_ps(zi, check_zi, _CMP_EQ_OQ)));
+			interior = _mm256_or_ps(interior, repeated);
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		iteration = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(iteration), maxIterations, interior));
+
+		_mm256_storeu_si256((__m256i*)(row.iterations + x), iteration);
+		_mm256_storeu_ps(row.m1 + x, m1);
+		_mm256_storeu_ps(row.m2 + x, m2);
+	}
+}
+
+namespace
+{
+	// Packs the 64-bit iteration counts down to 32 bits, and the magnitudes down to floats.
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline void store_wide_results(const escape_time_row_wide& row, uint32_t x, __m256i iteration, __m256d m1, __m256d m2)
+	{
+		__m256i low = _mm256_permutevar8x32_epi32(iteration, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+		_mm_storeu_si128((__m128i*)(row.iterations + x), _mm256_castsi256_si128(low));
+		_mm_storeu_ps(row.m1 + x, _mm256_cvtpd_ps(m1));
+		_mm_storeu_ps(row.m2 + x, _mm256_cvtpd_ps(m2));
+	}
+
+	// Main cardioid & period-2 bulb, same as the double known_interior().
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline __m256d known_interior_pd(__m256d cr, __m256d ci2)
+	{
+		__m256d xr = _mm256_sub_pd(cr, _mm256_set1_pd(0.25));
+		__m256d q = _mm256_add_pd(_mm256_mul_pd(xr, xr), ci2);
+		__m256d br = _mm256_add_pd(cr, _mm256_set1_pd(1.0));
+
+		return _mm256_or_pd(
+			_mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, xr)), _mm256_mul_pd(_mm256_set1_pd(0.25), ci2), _CMP_LE_OQ),
+			_mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(br, br), ci2), _mm256_set1_pd(0.0625), _CMP_LE_OQ));
+	}
+
+	// Four double-doubles. Each function is its double_double.h counterpart, lane by lane.
+	struct dd4
+	{
+		__m256d hi;
+		__m256d lo;
+	};
+
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline dd4 dd4_quick_two_sum(__m256d a, __m256d b)
+	{
+		__m256d s = _mm256_add_pd(a, b);
+		__m256d e = _mm256_sub_pd(b, _mm256_sub_pd(s, a));
+		return dd4{ s, e };
+	}
+
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline dd4 dd4_add(dd4 a, dd4 b)
+	{
+		__m256d s = _mm256_add_pd(a.hi, b.hi);
+		__m256d bb = _mm256_sub_pd(s, a.hi);
+		__m256d e = _mm256_add_pd(_mm256_sub_pd(a.hi, _mm256_sub_pd(s, bb)), _mm256_sub_pd(b.hi, bb));
+		return dd4_quick_two_sum(s, _mm256_add_pd(e, _mm256_add_pd(a.lo, b.lo)));
+	}
+
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline dd4 dd4_sub(dd4 a, dd4 b)
+	{
+		const __m256d sign = _mm256_set1_pd(-0.0);
+		return dd4_add(a, dd4{ _mm256_xor_pd(b.hi, sign), _mm256_xor_pd(b.lo, sign) });
+	}
+
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline dd4 dd4_mul(dd4 a, dd4 b)
+	{
+		__m256d p = _mm256_mul_pd(a.hi, b.hi);
+		__m256d e = _mm256_fmsub_pd(a.hi, b.hi, p);
+		e = _mm256_fmadd_pd(a.hi, b.lo, _mm256_fmadd_pd(a.lo, b.hi, e));
+		return dd4_quick_two_sum(p, e);
+	}
+
+	CPU_KERNEL_TARGET("avx2,fma")
+	inline dd4 dd4_sqr(dd4 a)
+	{
+		__m256d p = _mm256_mul_pd(a.hi, a.hi);
+		__m256d e = _mm256_fmsub_pd(a.hi, a.hi, p);
+		e = _mm256_fmadd_pd(_mm256_add_pd(a.hi, a.hi), a.lo, e);
+		return dd4_quick_two_sum(p, e);
+	}
+}
+
+// 4 pixels per vector, in double precision.
+// Iteration counts are kept in 64-bit lanes, so they can be masked along with the doubles.
+CPU_KERNEL_TARGET("avx2,fma")
+void escape_time_f64_avx2(const escape_time_row_wide& row)
+{
+	const __m256d ci = _mm256_set1_pd(row.ci_hi);
+	const __m256d ci2 = _mm256_mul_pd(ci, ci);
+	const __m256d bailout = _mm256_set1_pd(row.bailout_radius);
+	const __m256i maxIterations = _mm256_set1_epi64x(row.max_iterations);
+
+	for (uint32_t x = 0; x < row.count; x += 4)
+	{
+		__m256d cr = _mm256_loadu_pd(row.cr_hi + x);
+		__m256d zr = _mm256_setzero_pd();
+		__m256d zi = _mm256_setzero_pd();
+		__m256d m1 = _mm256_setzero_pd();
+		__m256d m2 = _mm256_setzero_pd();
+		__m256i iteration = _mm256_setzero_si256();
+
+		__m256d interior = known_interior_pd(cr, ci2);
+
+		__m256d check_zr = _mm256_setzero_pd();
+		__m256d check_zi = _mm256_setzero_pd();
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__m256d active = _mm256_andnot_pd(interior, _mm256_cmp_pd(m2, bailout, _CMP_LT_OQ));
+
+			if (_mm256_movemask_pd(active) == 0)
+				break;
+
+			__m256d zr2 = _mm256_mul_pd(zr, zr);
+			__m256d zi2 = _mm256_mul_pd(zi, zi);
+
+			__m256d zr_next = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), cr);
+			__m256d zi_next = _mm256_fmadd_pd(_mm256_add_pd(zr, zr), zi, ci);
+
+			zr = _mm256_blendv_pd(zr, zr_next, active);
+			zi = _mm256_blendv_pd(zi, zi_next, active);
+			m1 = _mm256_blendv_pd(m1, m2, active);
+			m2 = _mm256_blendv_pd(m2, _mm256_add_pd(zr2, zi2), active);
+
+			iteration = _mm256_sub_epi64(iteration, _mm256_castpd_si256(active));
+
+			__m256d repeated = _mm256_and_pd(active, _mm256_and_pd(
+				_mm256_cmp_pd(zr, check_zr, _CMP_EQ_OQ),
+				_mm256_cmp_pd(zi, check_zi, _CMP_EQ_OQ)));
+			interior = _mm256_or_pd(interior, repeated);
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		iteration = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(iteration), _mm256_castsi256_pd(maxIterations), interior));
+		store_wide_results(row, x, iteration, m1, m2);
+	}
+}
+
+// 4 pixels per vector, in double-double precision.
+// About ten times the work of the double kernel per iteration, most of it FMAs.
+CPU_KERNEL_TARGET("avx2,fma")
+void escape_time_dd_avx2(const escape_time_row_wide& row)
+{
+	const dd4 ci = { _mm256_set1_pd(row.ci_hi), _mm256_set1_pd(row.ci_lo) };
+	const __m256d ci2 = _mm256_mul_pd(ci.hi, ci.hi);
+	const __m256d bailout = _mm256_set1_pd(row.bailout_radius);
+	const __m256i maxIterations = _mm256_set1_epi64x(row.max_iterations);
+
+	for (uint32_t x = 0; x < row.count; x += 4)
+	{
+		dd4 cr = { _mm256_loadu_pd(row.cr_hi + x), _mm256_loadu_pd(row.cr_lo + x) };
+		dd4 zr = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+		dd4 zi = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+		__m256d m1 = _mm256_setzero_pd();
+		__m256d m2 = _mm256_setzero_pd();
+		__m256i iteration = _mm256_setzero_si256();
+
+		__m256d interior = known_interior_pd(cr.hi, ci2);
+
+		dd4 check_zr = zr;
+		dd4 check_zi = zi;
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__m256d active = _mm256_andnot_pd(interior, _mm256_cmp_pd(m2, bailout, _CMP_LT_OQ));
+
+			if (_mm256_movemask_pd(active) == 0)
+				break;
+
+			dd4 zr2 = dd4_sqr(zr);
+			dd4 zi2 = dd4_sqr(zi);
+			dd4 zri = dd4_mul(zr, zi);
+
+			dd4 zr_next = dd4_add(dd4_sub(zr2, zi2), cr);
+			dd4 zi_next = dd4_add(dd4{ _mm256_add_pd(zri.hi, zri.hi), _mm256_add_pd(zri.lo, zri.lo) }, ci);
+
+			zr.hi = _mm256_blendv_pd(zr.hi, zr_next.hi, active);
+			zr.lo = _mm256_blendv_pd(zr.lo, zr_next.lo, active);
+			zi.hi = _mm256_blendv_pd(zi.hi, zi_next.hi, active);
+			zi.lo = _mm256_blendv_pd(zi.lo, zi_next.lo, active);
+			m1 = _mm256_blendv_pd(m1, m2, active);
+			m2 = _mm256_blendv_pd(m2, _mm256_add_pd(zr2.hi, zi2.hi), active);
+
+			iteration = _mm256_sub_epi64(iteration, _mm256_castpd_si256(active));
+
+			__m256d repeated = _mm256_and_pd(
+				_mm256_and_pd(_mm256_cmp_pd(zr.hi, check_zr.hi, _CMP_EQ_OQ), _mm256_cmp_pd(zr.lo, check_zr.lo, _CMP_EQ_OQ)),
+				_mm256_and_pd(_mm256_cmp_pd(zi.hi, check_zi.hi, _CMP_EQ_OQ), _mm256_cmp_pd(zi.lo, check_zi.lo, _CMP_EQ_OQ)));
+			interior = _mm256_or_pd(interior, _mm256_and_pd(active, repeated));
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		iteration = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(iteration), _mm256_castsi256_pd(maxIterations), interior));
+		store_wide_results(row, x, iteration, m1, m2);
+	}
+}
+
+CPU_KERNELS_END
+
+#endif
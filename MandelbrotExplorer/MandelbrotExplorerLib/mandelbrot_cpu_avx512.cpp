@@ -0,0 +1,292 @@
+#include "pch.h"
+#include "mandelbrot_cpu_kernels.h"
+
+#ifdef CPU_KERNELS_X86
+#include <immintrin.h>
+
+CPU_KERNELS_BEGIN
+
+// 16 pixels per vector. AVX-512 has real mask registers,
+// so frozen lanes (escaped, or known never to escape)
+// are simply left out of each masked operation.
+CPU_KERNEL_TARGET("avx512f,fma")
+void escape_time_avx512(const escape_time_row& row)
+{
+	const __m512 ci = _mm512_set1_ps(row.ci);
+	const __m512 ci2 = _mm512_mul_ps(ci, ci);
+	const __m512 bailout = _mm512_set1_ps(row.bailout_radius);
+	const __m512i maxIterations = _mm512_set1_epi32((int)row.max_iterations);
+	const __m512i one = _mm512_set1_epi32(1);
+
+	for (uint32_t x = 0; x < row.count; x += 16)
+	{
+		__m512 cr = _mm512_loadu_ps(row.cr + x);
+		__m512 zr = _mm512_setzero_ps();
+		__m512 zi = _mm512_setzero_ps();
+		__m512 m1 = _mm512_setzero_ps();
+		__m512 m2 = _mm512_setzero_ps();
+		__m512i iteration = _mm512_setzero_si512();
+
+		// Main cardioid & period-2 bulb, same as known_interior().
+		__m512 xr = _mm512_sub_ps(cr, _mm512_set1_ps(0.25f));
+		__m512 q = _mm512_add_ps(_mm512_mul_ps(xr, xr), ci2);
+		__m512 br = _mm512_add_ps(cr, _mm512_set1_ps(1.0f));
+		__mmask16 interior =
+			_mm512_cmp_ps_mask(_mm512_mul_ps(q, _mm512_add_ps(q, xr)), _mm512_mul_ps(_mm512_set1_ps(0.25f), ci2), _CMP_LE_OQ)
+			| _mm512_cmp_ps_mask(_mm512_add_ps(_mm512_mul_ps(br, br), ci2), _mm512_set1_ps(0.0625f), _CMP_LE_OQ);
+
+		__m512 check_zr = _mm512_setzero_ps();
+		__m512 check_zi = _mm512_setzero_ps();
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__mmask16 active = _mm512_mask_cmp_ps_mask((__mmask16)~interior, m2, bailout, _CMP_LT_OQ);
+
+			if (active == 0)
+				break;
+
+			__m512 zr2 = _mm512_mul_ps(zr, zr);
+			__m512 zi2 = _mm512_mul_ps(zi, zi);
+
+			__m512 zr_next = _mm512_add_ps(_mm512_sub_ps(zr2, zi2), cr);
+			__m512 zi_next = _mm512_add_ps(_mm512_mul_ps(_mm512_add_ps(zr, zr), zi), ci);
+
+			zr = _mm512_mask_mov_ps(zr, active, zr_next);
+			zi = _mm512_mask_mov_ps(zi, active, zi_next);
+			m1 = _mm512_mask_mov_ps(m1, active, m2);
+			m2 = _mm512_mask_add_ps(m2, active, zr2, zi2);
+
+			iteration = _mm512_mask_add_epi32(iteration, active, iteration, one);
+
+			interior |= _mm512_mask_cmp_ps_mask(active, zr, check_zr, _CMP_EQ_OQ)
+				& _mm512_cmp_ps_mask(zi, check_zi, _CMP_EQ_OQ);
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		iteration = _mm512_mask_mov_epi32(iteration, interior, maxIterations);
+
+		_mm512_storeu_si512((void*)(row.iterations + x), iteration);
+		_mm512_storeu_ps(row.m1 + x, m1);
+		_mm512_storeu_ps(row.m2 + x, m2);
+	}
+}
+
+namespace
+{
+	// Main cardioid & period-2 bulb, same as the double known_interior().
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline __mmask8 known_interior_pd(__m512d cr, __m512d ci2)
+	{
+		__m512d xr = _mm512_sub_pd(cr, _mm512_set1_pd(0.25));
+		__m512d q = _mm512_add_pd(_mm512_mul_pd(xr, xr), ci2);
+		__m512d br = _mm512_add_pd(cr, _mm512_set1_pd(1.0));
+
+		return _mm512_cmp_pd_mask(_mm512_mul_pd(q, _mm512_add_pd(q, xr)), _mm512_mul_pd(_mm512_set1_pd(0.25), ci2), _CMP_LE_OQ)
+			| _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(br, br), ci2), _mm512_set1_pd(0.0625), _CMP_LE_OQ);
+	}
+
+	// Packs the 64-bit iteration counts down to 32 bits, and the magnitudes down to floats.
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline void store_wide_results(const escape_time_row_wide& row, uint32_t x, __m512i iteration, __m512d m1, __m512d m2)
+	{
+		_mm256_storeu_si256((__m256i*)(row.iterations + x), _mm512_cvtepi64_epi32(iteration));
+		_mm256_storeu_ps(row.m1 + x, _mm512_cvtpd_ps(m1));
+		_mm256_storeu_ps(row.m2 + x, _mm512_cvtpd_ps(m2));
+	}
+
+	// Eight double-doubles. Each function is its double_double.h counterpart, lane by lane.
+	struct dd8
+	{
+		__m512d hi;
+		__m512d lo;
+	};
+
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline dd8 dd8_quick_two_sum(__m512d a, __m512d b)
+	{
+		__m512d s = _mm512_add_pd(a, b);
+		__m512d e = _mm512_sub_pd(b, _mm512_sub_pd(s, a));
+		return dd8{ s, e };
+	}
+
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline dd8 dd8_add(dd8 a, dd8 b)
+	{
+		__m512d s = _mm512_add_pd(a.hi, b.hi);
+		__m512d bb = _mm512_sub_pd(s, a.hi);
+		__m512d e = _mm512_add_pd(_mm512_sub_pd(a.hi, _mm512_sub_pd(s, bb)), _mm512_sub_pd(b.hi, bb));
+		return dd8_quick_two_sum(s, _mm512_add_pd(e, _mm512_add_pd(a.lo, b.lo)));
+	}
+
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline dd8 dd8_sub(dd8 a, dd8 b)
+	{
+		// Flipping the sign bit, as plain negation does. XOR on doubles needs AVX-512DQ.
+		const __m512i sign = _mm512_set1_epi64((long long)0x8000000000000000ull);
+		return dd8_add(a, dd8{
+			_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(b.hi), sign)),
+			_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(b.lo), sign)) });
+	}
+
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline dd8 dd8_mul(dd8 a, dd8 b)
+	{
+		__m512d p = _mm512_mul_pd(a.hi, b.hi);
+		__m512d e = _mm512_fmsub_pd(a.hi, b.hi, p);
+		e = _mm512_fmadd_pd(a.hi, b.lo, _mm512_fmadd_pd(a.lo, b.hi, e));
+		return dd8_quick_two_sum(p, e);
+	}
+
+	CPU_KERNEL_TARGET("avx512f,fma")
+	inline dd8 dd8_sqr(dd8 a)
+	{
+		__m512d p = _mm512_mul_pd(a.hi, a.hi);
+		__m512d e = _mm512_fmsub_pd(a.hi, a.hi, p);
+		e = _mm512_fmadd_pd(_mm512_add_pd(a.hi, a.hi), a.lo, e);
+		return dd8_quick_two_sum(p, e);
+	}
+}
+
+// 8 pixels per vector, in double precision.
+CPU_KERNEL_TARGET("avx512f,fma")
+void escape_time_f64_avx512(const escape_time_row_wide& row)
+{
+	const __m512d ci = _mm512_set1_pd(row.ci_hi);
+	const __m512d ci2 = _mm512_mul_pd(ci, ci);
+	const __m512d bailout = _mm512_set1_pd(row.bailout_radius);
+	const __m512i maxIterations = _mm512_set1_epi64(row.max_iterations);
+	const __m512i one = _mm512_set1_epi64(1);
+
+	for (uint32_t x = 0; x < row.count; x += 8)
+	{
+		__m512d cr = _mm512_loadu_pd(row.cr_hi + x);
+		__m512d zr = _mm512_setzero_pd();
+		__m512d zi = _mm512_setzero_pd();
+		__m512d m1 = _mm512_setzero_pd();
+		__m512d m2 = _mm512_setzero_pd();
+		__m512i iteration = _mm512_setzero_si512();
+
+		__mmask8 interior = known_interior_pd(cr, ci2);
+
+		__m512d check_zr = _mm512_setzero_pd();
+		__m512d check_zi = _mm512_setzero_pd();
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__mmask8 active = _mm512_mask_cmp_pd_mask((__mmask8)~interior, m2, bailout, _CMP_LT_OQ);
+
+			if (active == 0)
+				break;
+
+			__m512d zr2 = _mm512_mul_pd(zr, zr);
+			__m512d zi2 = _mm512_mul_pd(zi, zi);
+
+			__m512d zr_next = _mm512_add_pd(_mm512_sub_pd(zr2, zi2), cr);
+			__m512d zi_next = _mm512_fmadd_pd(_mm512_add_pd(zr, zr), zi, ci);
+
+			zr = _mm512_mask_mov_pd(zr, active, zr_next);
+			zi = _mm512_mask_mov_pd(zi, active, zi_next);
+			m1 = _mm512_mask_mov_pd(m1, active, m2);
+			m2 = _mm512_mask_add_pd(m2, active, zr2, zi2);
+
+			iteration = _mm512_mask_add_epi64(iteration, active, iteration, one);
+
+			interior |= _mm512_mask_cmp_pd_mask(active, zr, check_zr, _CMP_EQ_OQ)
+				& _mm512_cmp_pd_mask(zi, check_zi, _CMP_EQ_OQ);
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		iteration = _mm512_mask_mov_epi64(iteration, interior, maxIterations);
+		store_wide_results(row, x, iteration, m1, m2);
+	}
+}
+
+// 8 pixels per vector, in double-double precision.
+CPU_KERNEL_TARGET("avx512f,fma")
+void escape_time_dd_avx512(const escape_time_row_wide& row)
+{
+	const dd8 ci = { _mm512_set1_pd(row.ci_hi), _mm512_set1_pd(row.ci_lo) };
+	const __m512d ci2 = _mm512_mul_pd(ci.hi, ci.hi);
+	const __m512d bailout = _mm512_set1_pd(row.bailout_radius);
+	const __m512i maxIterations = _mm512_set1_epi64(row.max_iterations);
+	const __m512i one = _mm512_set1_epi64(1);
+
+	for (uint32_t x = 0; x < row.count; x += 8)
+	{
+		dd8 cr = { _mm512_loadu_pd(row.cr_hi + x), _mm512_loadu_pd(row.cr_lo + x) };
+		dd8 zr = { _mm512_setzero_pd(), _mm512_setzero_pd() };
+		dd8 zi = { _mm512_setzero_pd(), _mm512_setzero_pd() };
+		__m512d m1 = _mm512_setzero_pd();
+		__m512d m2 = _mm512_setzero_pd();
+		__m512i iteration = _mm512_setzero_si512();
+
+		__mmask8 interior = known_interior_pd(cr.hi, ci2);
+
+		dd8 check_zr = zr;
+		dd8 check_zi = zi;
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__mmask8 active = _mm512_mask_cmp_pd_mask((__mmask8)~interior, m2, bailout, _CMP_LT_OQ);
+
+			if (active == 0)
+				break;
+
+			dd8 zr2 = dd8_sqr(zr);
+			dd8 zi2 = dd8_sqr(zi);
+			dd8 zri = dd8_mul(zr, zi);
+
+			dd8 zr_next = dd8_add(dd8_sub(zr2, zi2), cr);
+			dd8 zi_next = dd8_add(dd8{ _mm512_add_pd(zri.hi, zri.hi), _mm512_add_pd(zri.lo, zri.lo) }, ci);
+
+			zr.hi = _mm512_mask_mov_pd(zr.hi, active, zr_next.hi);
+			zr.lo = _mm512_mask_mov_pd(zr.lo, active, zr_next.lo);
+			zi.hi = _mm512_mask_mov_pd(zi.hi, active, zi_next.hi);
+			zi.lo = _mm512_mask_mov_pd(zi.lo, active, zi_next.lo);
+			m1 = _mm512_mask_mov_pd(m1, active, m2);
+			m2 = _mm512_mask_add_pd(m2, active, zr2.hi, zi2.hi);
+
+			iteration = _mm512_mask_add_epi64(iteration, active, iteration, one);
+
+			interior |= _mm512_mask_cmp_pd_mask(active, zr.hi, check_zr.hi, _CMP_EQ_OQ)
+				& _mm512_cmp_pd_mask(zr.lo, check_zr.lo, _CMP_EQ_OQ)
+				& _mm512_cmp_pd_mask(zi.hi, check_zi.hi, _CMP_EQ_OQ)
+				& _mm512_cmp_pd_mask(zi.lo, check_zi.lo, _CMP_EQ_OQ);
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		iteration = _mm512_mask_mov_epi64(iteration, interior, maxIterations);
+		store_wide_results(row, x, iteration, m1, m2);
+	}
+}
+
+CPU_KERNELS_END
+
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+
+// Escape-time kernels used by cpu_renderer.
+//
+// Each kernel iterates one row of pixels. The caller computes every pixel's
+// real coordinate up front and pads the row out to a multiple of
+// CPU_KERNEL_MAX_LANES, so kernels never have to deal with a partial vector.
+//
+// Kernels only record where each pixel stopped. Turning that into a smooth
+// iteration value involves a couple of logarithms per pixel, which isn't
+// worth vectorizing next to the thousands of iterations that came before it.
+//
+// Pixels that are never going to escape are the expensive ones, so every kernel
+// takes the same two shortcuts as the fragment shader:
+//
+//  - Points inside the main cardioid or the period-2 bulb are recognised
+//    analytically (see known_interior) and never iterated at all.
+//
+//  - Everywhere else, Brent's cycle detection runs alongside the loop. z is
+//    remembered each time the remembered-window doubles (after 1, 2, 4, 8, ...
+//    iterations). If z ever lands exactly on the remembered value, the orbit
+//    has become periodic in float arithmetic. Every z in that cycle has already
+//    been checked against the bailout radius, so it can never escape.
+//    The comparison is exact rather than within some epsilon, which keeps the
+//    result identical to simply running all max_iterations.
+//
+// Either way the pixel reports iterations == max_iterations, like any other
+// pixel that never escaped.
+
+static const uint32_t CPU_KERNEL_MAX_LANES = 16;
+
+struct escape_time_row
+{
+	const float* cr;			// real coordinate of each pixel, padded to a multiple of CPU_KERNEL_MAX_LANES.
+	float ci;					// imaginary coordinate shared by the whole row.
+	uint32_t count;				// padded number of pixels.
+
+	float bailout_radius;
+	uint32_t max_iterations;
+
+	uint32_t* iterations;		// out: number of iterations performed.
+	float* m1;					// out: square magnitude of z on the iteration just before bailout.
+	float* m2;					// out: square magnitude of z on the iteration of bailout.
+};
+
+// True if c lies inside the main cardioid or the period-2 bulb.
+// The SIMD kernels evaluate exactly the same expressions, lane by lane.
+inline bool known_interior(float cr, float ci)
+{
+	float ci2 = ci * ci;
+	float xr = cr - 0.25f;
+	float q = xr * xr + ci2;
+	float br = cr + 1.0f;
+
+	return q * (q + xr) <= 0.25f * ci2
+		|| br * br + ci2 <= 0.0625f;
+}
+
+typedef void (*escape_time_kernel)(const escape_time_row& row);
+
+// A row for the double and double-double kernels, for going deeper than float allows.
+// Each coordinate is a double-double, hi + lo. The double kernels only read the hi halves.
+//
+// These kernels use FMA wherever it helps: there's no float kernel to agree with
+// at these depths, only each other, and the scalar kernels call std::fma
+// in exactly the places the SIMD kernels use FMA instructions.
+struct escape_time_row_wide
+{
+	const double* cr_hi;		// real coordinate of each pixel, padded to a multiple of CPU_KERNEL_MAX_LANES.
+	const double* cr_lo;
+	double ci_hi;				// imaginary coordinate shared by the whole row.
+	double ci_lo;
+	uint32_t count;				// padded number of pixels.
+
+	double bailout_radius;
+	uint32_t max_iterations;
+
+	uint32_t* iterations;		// out: number of iterations performed.
+	float* m1;					// out: square magnitude of z on the iteration just before bailout.
+	float* m2;					// out: square magnitude of z on the iteration of bailout.
+};
+
+// known_interior() in double precision. Near the cardioid's edge, at the depths the wide
+// kernels are for, the float version could easily get the answer wrong.
+inline bool known_interior(double cr, double ci)
+{
+	double ci2 = ci * ci;
+	double xr = cr - 0.25;
+	double q = xr * xr + ci2;
+	double br = cr + 1.0;
+
+	return q * (q + xr) <= 0.25 * ci2
+		|| br * br + ci2 <= 0.0625;
+}
+
+typedef void (*escape_time_wide_kernel)(const escape_time_row_wide& row);
+
+// The SIMD kernels only exist on x86. Everything else gets the scalar kernel.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_KERNELS_X86
+#endif
+
+void escape_time_scalar(const escape_time_row& row);
+void escape_time_sse2(const escape_time_row& row);
+void escape_time_avx2(const escape_time_row& row);
+void escape_time_avx512(const escape_time_row& row);
+
+// SSE2 has no FMA, so it's left to the scalar kernels at these precisions.
+void escape_time_f64_scalar(const escape_time_row_wide& row);
+void escape_time_f64_avx2(const escape_time_row_wide& row);
+void escape_time_f64_avx512(const escape_time_row_wide& row);
+
+void escape_time_dd_scalar(const escape_time_row_wide& row);
+void escape_time_dd_avx2(const escape_time_row_wide& row);
+void escape_time_dd_avx512(const escape_time_row_wide& row);
+
+// MSVC lets any function use any intrinsic, so the AVX2 and AVX-512 source files
+// are simply built with the matching /arch flag. GCC and Clang need each
+// function to be told which instructions it's allowed to use.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_KERNEL_TARGET(isa)
+#else
+#define CPU_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// Every kernel has to produce the same image, so multiplies and adds must not be
+// fused into FMAs behind our backs. MSVC and Clang won't fuse separate intrinsics,
+// but GCC will whenever the target has FMA. The kernels (and only the kernels) go
+// between CPU_KERNELS_BEGIN and CPU_KERNELS_END, so that nothing else in the file
+// including this header is compiled any differently.
+#if defined(__GNUC__) && !defined(__clang__)
+#define CPU_KERNELS_BEGIN _Pragma("GCC push_options") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define CPU_KERNELS_END _Pragma("GCC pop_options")
+#else
+#define CPU_KERNELS_BEGIN
+#define CPU_KERNELS_END
+#endif
@@ -0,0 +1,91 @@
+#include "pch.h"
+#include "mandelbrot_cpu_kernels.h"
+
+#ifdef CPU_KERNELS_X86
+#include <emmintrin.h>
+
+CPU_KERNELS_BEGIN
+
+// 4 pixels per vector.
+//
+// Each lane follows the shader's loop exactly. Lanes that reach the bailout
+// radius, or that are known never to escape, are frozen with a mask rather
+// than branched around, and the whole vector stops once every lane is frozen.
+CPU_KERNEL_TARGET("sse2")
+void escape_time_sse2(const escape_time_row& row)
+{
+	const __m128 ci = _mm_set1_ps(row.ci);
+	const __m128 ci2 = _mm_mul_ps(ci, ci);
+	const __m128 bailout = _mm_set1_ps(row.bailout_radius);
+	const __m128i maxIterations = _mm_set1_epi32((int)row.max_iterations);
+
+	for (uint32_t x = 0; x < row.count; x += 4)
+	{
+		__m128 cr = _mm_loadu_ps(row.cr + x);
+		__m128 zr = _mm_setzero_ps();
+		__m128 zi = _mm_setzero_ps();
+		__m128 m1 = _mm_setzero_ps();
+		__m128 m2 = _mm_setzero_ps();
+		__m128i iteration = _mm_setzero_si128();
+
+		// Main cardioid & period-2 bulb, same as known_interior().
+		__m128 xr = _mm_sub_ps(cr, _mm_set1_ps(0.25f));
+		__m128 q = _mm_add_ps(_mm_mul_ps(xr, xr), ci2);
+		__m128 br = _mm_add_ps(cr, _mm_set1_ps(1.0f));
+		__m128 interior = _mm_or_ps(
+			_mm_cmple_ps(_mm_mul_ps(q, _mm_add_ps(q, xr)), _mm_mul_ps(_mm_set1_ps(0.25f), ci2)),
+			_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(br, br), ci2), _mm_set1_ps(0.0625f)));
+
+		// Every lane has run the same number of iterations for as long as it's
+		// been active, so all four can share one cycle-detection schedule.
+		__m128 check_zr = _mm_setzero_ps();
+		__m128 check_zi = _mm_setzero_ps();
+		uint32_t check_window = 1;
+		uint32_t check_steps = 0;
+
+		for (uint32_t i = 0; i < row.max_iterations; i++)
+		{
+			__m128 active = _mm_andnot_ps(interior, _mm_cmplt_ps(m2, bailout));
+
+			if (_mm_movemask_ps(active) == 0)
+				break;
+
+			__m128 zr2 = _mm_mul_ps(zr, zr);
+			__m128 zi2 = _mm_mul_ps(zi, zi);
+
+			__m128 zr_next = _mm_add_ps(_mm_sub_ps(zr2, zi2), cr);
+			__m128 zi_next = _mm_add_ps(_mm_mul_ps(_mm_add_ps(zr, zr), zi), ci);
+
+			// SSE2 has no blend instruction, so select with and/andnot/or.
+			zr = _mm_or_ps(_mm_and_ps(active, zr_next), _mm_andnot_ps(active, zr));
+			zi = _mm_or_ps(_mm_and_ps(active, zi_next), _mm_andnot_ps(active, zi));
+			m1 = _mm_or_ps(_mm_and_ps(active, m2), _mm_andnot_ps(active, m1));
+			m2 = _mm_or_ps(_mm_and_ps(active, _mm_add_ps(zr2, zi2)), _mm_andnot_ps(active, m2));
+
+			// Active lanes are all ones (-1), so subtracting the mask counts them up.
+			iteration = _mm_sub_epi32(iteration, _mm_castps_si128(active));
+
+			__m128 repeated = _mm_and_ps(active, _mm_and_ps(_mm_cmpeq_ps(zr, check_zr), _mm_cmpeq_ps(zi, check_zi)));
+			interior = _mm_or_ps(interior, repeated);
+
+			if (++check_steps == check_window)
+			{
+				check_steps = 0;
+				check_window *= 2;
+				check_zr = zr;
+				check_zi = zi;
+			}
+		}
+
+		__m128i interiorLanes = _mm_castps_si128(interior);
+		iteration = _mm_or_si128(_mm_and_si128(interiorLanes, maxIterations), _mm_andnot_si128(interiorLanes, iteration));
+
+		_mm_storeu_si128((__m128i*)(row.iterations + x), iteration);
+		_mm_storeu_ps(row.m1 + x, m1);
+		_mm_storeu_ps(row.m2 + x, m2);
+	}
+}
+
+CPU_KERNELS_END
+
+#endif
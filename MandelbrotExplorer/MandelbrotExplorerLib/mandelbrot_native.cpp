@@ -1,13 +1,67 @@
 #include "pch.h"
 #include "mandelbrot_native.h"
+#include "mandelbrot_parameters.h"
 #include <set>
 #include <iterator>
+#include <cstring>
+#include <cstdlib>
+#include <utility>
+#include <algorithm>
+#include <chrono>
 
-vulkan_renderer::vulkan_renderer(HINSTANCE hinstance, HWND hwnd, bool debug)
+namespace
+{
+	const char* DEFAULT_VERTEX_SHADER =
+		"#version 450                                   \n"
+		"                                               \n"
+		"layout(location = 0) in vec2 inPosition;       \n"
+		"layout(location = 1) in vec3 inColor;          \n"
+		"                                               \n"
+		"layout(location = 0) out vec3 fragColor;       \n"
+		"                                               \n"
+		"void main()                                    \n"
+		"{                                              \n"
+		"    gl_Position = vec4(inPosition, 0.0, 1.0);  \n"
+		"    fragColor = inColor;                       \n"
+		"}                                              \n";
+
+	const char* DEFAULT_FRAGMENT_SHADER =
+		"#version 450                               \n"
+		"layout(location = 0) in vec3 fragColor;    \n"
+		"layout(location = 0) out vec4 outColor;    \n"
+		"                                           \n"
+		"void main() {                              \n"
+		"                                           \n"
+		"    outColor = vec4(fragColor, 1.0f);      \n"
+		"}                                          \n";
+
+	double now_milliseconds()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration<double, std::milli>(now).count();
+	}
+}
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+vulkan_renderer::vulkan_renderer(HINSTANCE hinstance, HWND hwnd, bool debug, const std::vector<shader_source>& precompile)
+{
+	try
+	{
+		setup(hinstance, hwnd, debug, precompile);
+	}
+	catch (const std::runtime_error& err)
+	{
+		cleanup();
+		throw;
+	}
+}
+#endif
+
+vulkan_renderer::vulkan_renderer(uint32_t width, uint32_t height, bool debug, const std::vector<shader_source>& precompile)
 {
 	try
 	{
-		setup(hinstance, hwnd, debug);
+		setup_headless({ width, height }, debug, precompile);
 	}
 	catch (const std::runtime_error& err)
 	{
@@ -27,65 +81,234 @@ void vulkan_renderer::dispose()
 	{
 		vkDeviceWaitIdle(_logicalDevice);
 		cleanup();
+		_tileStore.close();
 		_disposed = true;
 	}
 }
 
-void vulkan_renderer::setup(HINSTANCE hinstance, HWND hwnd, bool debug)
+// Setting up runs on three threads. GLSL compiles without a device, so the shaders are compiled
+// in the background from the very start, while the instance and device are created. Then the
+// graphics pipeline is built in the background while the target creates its images and the
+// buffers are made. Both tasks are locals, so whatever throws, they're finished with before
+// the constructor cleans up after it.
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+void vulkan_renderer::setup(HINSTANCE hinstance, HWND hwnd, bool debug, const std::vector<shader_source>& precompile)
 {
+	double start = now_milliseconds();
+	background_task shaders;
+	start_shader_compilation(shaders, precompile);
+
 	if (debug) 
 		create_vkinstance_with_debugging();
 	else 
 		create_vkinstance();
 
 	create_surface(hwnd, hinstance);
+	double instanceCreated = now_milliseconds();
+	_startup.instance_milliseconds = instanceCreated - start;
+
+	select_physical_device();
+	create_logical_device();
+	create_pipeline_cache();
+	_target = std::make_unique<swapchain_target>(*this);
+	_startup.device_milliseconds = now_milliseconds() - instanceCreated;
+
+	setup_rendering(shaders);
+	_startup.total_milliseconds = now_milliseconds() - start;
+}
+#endif
+
+void vulkan_renderer::setup_headless(VkExtent2D extent, bool debug, const std::vector<shader_source>& precompile)
+{
+	// No window means no surface, no swap chain, and no need
+	// for any of the presentation extensions.
+	_headless = true;
+
+	double start = now_milliseconds();
+	background_task shaders;
+	start_shader_compilation(shaders, precompile);
+
+	if (debug) 
+		create_vkinstance_with_debugging();
+	else 
+		create_vkinstance();
+
+	double instanceCreated = now_milliseconds();
+	_startup.instance_milliseconds = instanceCreated - start;
+
 	select_physical_device();
 	create_logical_device();
-	choose_swap_surface_format();
-	choose_swap_present_mode();
-	choose_swap_extent();
-	create_swap_chain();
-	create_image_views();
+	create_pipeline_cache();
+	_target = std::make_unique<offscreen_target>(*this, extent);
+	_startup.device_milliseconds = now_milliseconds() - instanceCreated;
+
+	setup_rendering(shaders);
+	_startup.total_milliseconds = now_milliseconds() - start;
+}
+
+void vulkan_renderer::start_shader_compilation(background_task& task, const std::vector<shader_source>& precompile)
+{
+	// The cache has to be open before anything's compiled, for the compiler to look in it.
+	std::string directory = shader_cache::default_directory();
+
+	if (!directory.empty())
+		_shaderCache.open(directory);
+
+	std::vector<shader_source> sources = {
+		{ "default_vertex_shader", DEFAULT_VERTEX_SHADER, shaderc_shader_kind::shaderc_vertex_shader },
+		{ "default_fragment_shader", DEFAULT_FRAGMENT_SHADER, shaderc_shader_kind::shaderc_fragment_shader }
+	};
+
+	sources.insert(sources.end(), precompile.begin(), precompile.end());
+
+	task.start([this, sources]()
+	{
+		double start = now_milliseconds();
+
+		for (const shader_source& source : sources)
+			_shaderCache.precompile(source);
+
+		_startup.shader_compile_milliseconds = now_milliseconds() - start;
+	});
+}
+
+void vulkan_renderer::setup_rendering(background_task& shaders)
+{
+	double start = now_milliseconds();
+	shaders.wait();
+	double shadersCompiled = now_milliseconds();
+	_startup.shader_wait_milliseconds = shadersCompiled - start;
+
 	create_vertex_shader();
 	create_fragment_shader();
+
+	// The render pass only needs the target's format, which it chose when it was constructed,
+	// so the pipeline can be built before the target has any images to draw on.
 	create_render_pass();
-	create_framebuffers();			// swapchain framebuffers depend on the render pass.
-	create_graphics_pipeline();
+	create_descriptor_set();
+
+	background_task pipeline;
+
+	pipeline.start([this]()
+	{
+		double start = now_milliseconds();
+		create_graphics_pipeline();
+		_startup.pipeline_milliseconds = now_milliseconds() - start;
+	});
+
+	_target->create(_renderPass);	// target framebuffers depend on the render pass.
 	create_command_pool();
 	create_vertex_buffer();	
 	create_index_buffer();
-	create_command_buffer();
+	_frames.resize(DEFAULT_FRAMES_IN_FLIGHT);
+	create_command_buffers();
 	create_sync_objects();
+	create_batch_resources();
+	create_timestamp_queries(_schedule.options().max_batch_tiles);
+	double resourcesCreated = now_milliseconds();
+	_startup.resources_milliseconds = resourcesCreated - shadersCompiled;
+
+	pipeline.wait();
+	_startup.pipeline_wait_milliseconds = now_milliseconds() - resourcesCreated;
 }
 
 void vulkan_renderer::cleanup_pipeline()
 {
-	if (_graphicsPipeline != nullptr)
-		vkDestroyPipeline(_logicalDevice, _graphicsPipeline, nullptr);
+	destroy_variants(_graphicsVariants);
 
 	if (_pipelineLayout != nullptr)
 		vkDestroyPipelineLayout(_logicalDevice, _pipelineLayout, nullptr);
+
+	_graphicsPipeline = nullptr;
+	_pipelineLayout = nullptr;
 }
 
-void vulkan_renderer::cleanup_swap_chain()
+void vulkan_renderer::cleanup_compute_pipeline()
 {
-	for (auto framebuffer : _swapChainFramebuffers) {
-		vkDestroyFramebuffer(_logicalDevice, framebuffer, nullptr);
+	destroy_variants(_computeVariants);
+
+	if (_computePipelineLayout != nullptr)
+		vkDestroyPipelineLayout(_logicalDevice, _computePipelineLayout, nullptr);
+
+	if (_resamplePipeline != nullptr)
+		vkDestroyPipeline(_logicalDevice, _resamplePipeline, nullptr);
+
+	if (_resamplePipelineLayout != nullptr)
+		vkDestroyPipelineLayout(_logicalDevice, _resamplePipelineLayout, nullptr);
+
+	for (VkPipeline& pipeline : _perturbationPipelines)
+	{
+		if (pipeline != nullptr)
+			vkDestroyPipeline(_logicalDevice, pipeline, nullptr);
+
+		pipeline = nullptr;
 	}
 
-	for (auto imageView : _swapChainImageViews) {
-		vkDestroyImageView(_logicalDevice, imageView, nullptr);
+	if (_perturbationPipelineLayout != nullptr)
+		vkDestroyPipelineLayout(_logicalDevice, _perturbationPipelineLayout, nullptr);
+
+	_computePipeline = nullptr;
+	_computePipelineLayout = nullptr;
+	_resamplePipeline = nullptr;
+	_resamplePipelineLayout = nullptr;
+	_perturbationPipelineLayout = nullptr;
+}
+
+void vulkan_renderer::cleanup_iteration_buffer()
+{
+	if (_iterationBuffer != nullptr)
+		vkDestroyBuffer(_logicalDevice, _iterationBuffer, nullptr);
+
+	if (_iterationBufferMemory != nullptr)
+		vkFreeMemory(_logicalDevice, _iterationBufferMemory, nullptr);
+
+	if (_spareIterationBuffer != nullptr)
+		vkDestroyBuffer(_logicalDevice, _spareIterationBuffer, nullptr);
+
+	if (_spareIterationBufferMemory != nullptr)
+		vkFreeMemory(_logicalDevice, _spareIterationBufferMemory, nullptr);
+
+	if (_glitchBuffer != nullptr)
+	{
+		vkUnmapMemory(_logicalDevice, _glitchBufferMemory);
+		vkDestroyBuffer(_logicalDevice, _glitchBuffer, nullptr);
+		vkFreeMemory(_logicalDevice, _glitchBufferMemory, nullptr);
 	}
 
-	if (_swapChain != nullptr)
-		vkDestroySwapchainKHR(_logicalDevice, _swapChain, nullptr);
+	// The frames' staging buffers are laid out like the iteration buffer, so they go with it,
+	// along with any copies still to be recorded and tiles still waiting in them.
+	// The cache can do without those.
+	for (frame_resources& frame : _frames)
+		cleanup_cache_staging_buffer(frame);
+
+	_shiftCopies.clear();
+	_shiftBackCopies.clear();
+	_cacheFills.clear();
+	_cacheReadbacks.clear();
+
+	_glitchBuffer = nullptr;
+	_glitchBufferMemory = nullptr;
+	_glitchBufferSize = 0;
+	_glitches = nullptr;
+
+	_iterationBuffer = nullptr;
+	_iterationBufferMemory = nullptr;
+	_spareIterationBuffer = nullptr;
+	_spareIterationBufferMemory = nullptr;
+	_iterationBufferSize = 0;
+	_iterationExtent = { 0, 0 };
+	_iterationBufferValid = false;
 }
 
 
 void vulkan_renderer::cleanup()
 {
-	vkDestroySemaphore(_logicalDevice, _renderFinishedSemaphore, nullptr);
-	vkDestroySemaphore(_logicalDevice, _imageAvailableSemaphore, nullptr);
+	cleanup_frame_resources();
+	cleanup_batch_resources();
+
+	if (_timestampQueryPool != nullptr)
+		vkDestroyQueryPool(_logicalDevice, _timestampQueryPool, nullptr);
 
 	if (_indexBuffer != nullptr)
 		vkDestroyBuffer(_logicalDevice, _indexBuffer, nullptr);
@@ -103,11 +326,35 @@ void vulkan_renderer::cleanup()
 		vkDestroyCommandPool(_logicalDevice, _commandPool, nullptr);
 
 	cleanup_pipeline();
+	cleanup_compute_pipeline();
+	destroy_retired_pipelines(true);
+	cleanup_iteration_buffer();
+	cleanup_perturbation();
+	cleanup_palette_buffer();
+
+	if (_descriptorPool != nullptr)
+		vkDestroyDescriptorPool(_logicalDevice, _descriptorPool, nullptr);
+
+	if (_descriptorSetLayout != nullptr)
+		vkDestroyDescriptorSetLayout(_logicalDevice, _descriptorSetLayout, nullptr);
+
+	if (_continueRenderPass != nullptr)
+		vkDestroyRenderPass(_logicalDevice, _continueRenderPass, nullptr);
 
 	if (_renderPass != nullptr)
 		vkDestroyRenderPass(_logicalDevice, _renderPass, nullptr);
 
-	cleanup_swap_chain();
+	if (_target != nullptr)
+	{
+		_target->destroy();
+		_target.reset();
+	}
+
+	if (_computeShader != nullptr)
+		vkDestroyShaderModule(_logicalDevice, _computeShader, nullptr);
+
+	if (_resampleShader != nullptr)
+		vkDestroyShaderModule(_logicalDevice, _resampleShader, nullptr);
 
 	if (_fragmentShader != nullptr)
 		vkDestroyShaderModule(_logicalDevice, _fragmentShader, nullptr);
@@ -115,6 +362,12 @@ void vulkan_renderer::cleanup()
 	if (_vertexShader != nullptr)
 		vkDestroyShaderModule(_logicalDevice, _vertexShader, nullptr);
 
+	if (_pipelineCache != nullptr)
+	{
+		save_pipeline_cache();
+		vkDestroyPipelineCache(_logicalDevice, _pipelineCache, nullptr);
+	}
+
 	if (_logicalDevice != nullptr)
 		vkDestroyDevice(_logicalDevice, nullptr);
 
@@ -144,10 +397,13 @@ void vulkan_renderer::create_vkinstance()
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.apiVersion = VK_API_VERSION_1_0;
 
-	std::vector<const char*> requiredExtensions{
-		"VK_KHR_surface",
-		"VK_KHR_win32_surface"
-	};
+	std::vector<const char*> requiredExtensions;
+
+	if (!_headless)
+	{
+		requiredExtensions.push_back("VK_KHR_surface");
+		requiredExtensions.push_back("VK_KHR_win32_surface");
+	}
 
 	VkInstanceCreateInfo instanceCreateInfo{};
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -174,11 +430,15 @@ void vulkan_renderer::create_vkinstance_with_debugging()
 	appInfo.apiVersion = VK_API_VERSION_1_0;
 
 	std::vector<const char*> requiredExtensions{
-		"VK_KHR_surface",
-		"VK_KHR_win32_surface",
 		"VK_EXT_debug_utils"
 	};
 
+	if (!_headless)
+	{
+		requiredExtensions.push_back("VK_KHR_surface");
+		requiredExtensions.push_back("VK_KHR_win32_surface");
+	}
+
 	std::vector<const char*> requiredLayers{
 		"VK_LAYER_KHRONOS_validation"
 	};
@@ -241,11 +501,12 @@ VKAPI_ATTR VkBool32 VKAPI_CALL vulkan_renderer::debug_callback(
 	message.type = messageType;
 
 	vulkan_renderer* self = static_cast<vulkan_renderer*>(pUserData);
-	self->_messages.push_back(message);
+	self->_messages.add(message);
 
 	return VK_FALSE;
 }
 
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 void vulkan_renderer::create_surface(HWND hwnd, HINSTANCE hinstance)
 {
 	VkWin32SurfaceCreateInfoKHR createInfo{};
@@ -257,6 +518,7 @@ void vulkan_renderer::create_surface(HWND hwnd, HINSTANCE hinstance)
 		throw std::runtime_error("Failed to create window surface!");
 	}
 }
+#endif
 
 void vulkan_renderer::select_physical_device()
 {
@@ -293,7 +555,7 @@ void vulkan_renderer::select_physical_device()
 
 		for (uint32_t i = 0; i < queueFamilyCount; i++)
 		{
-			if (queueFamilies[i].queueFlags && VK_QUEUE_GRAPHICS_BIT)
+			if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
 			{
 				hasGraphicsQueue = true;
 				graphicsIndex = i;
@@ -301,14 +563,23 @@ void vulkan_renderer::select_physical_device()
 			}
 		}
 
-		for (uint32_t i = 0; i < queueFamilyCount; i++)
+		if (_headless)
 		{
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &hasPresentQueue);
-
-			if (hasPresentQueue)
+			// Nothing gets presented, so the graphics queue can stand in for the present queue.
+			hasPresentQueue = hasGraphicsQueue;
+			presentIndex = graphicsIndex;
+		}
+		else
+		{
+			for (uint32_t i = 0; i < queueFamilyCount; i++)
 			{
-				presentIndex = i;
-				break;
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &hasPresentQueue);
+
+				if (hasPresentQueue)
+				{
+					presentIndex = i;
+					break;
+				}
 			}
 		}
 
@@ -332,6 +603,15 @@ void vulkan_renderer::select_physical_device()
 				_graphicsQueueFamilyIndex = graphicsIndex;
 				_presentQueueFamilyIndex = presentIndex;
 			}
+
+			// Virtual GPUs and software implementations (e.g., lavapipe on a
+			// render farm box without a GPU) are only used as a last resort.
+			if (_physicalDevice == nullptr)
+			{
+				_physicalDevice = device;
+				_graphicsQueueFamilyIndex = graphicsIndex;
+				_presentQueueFamilyIndex = presentIndex;
+			}
 		}
 	}
 
@@ -361,8 +641,13 @@ void vulkan_renderer::create_logical_device()
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	// Not every implementation supports 64-bit floats in shaders,
+	// so only ask for them when they're available.
+	VkPhysicalDeviceFeatures supportedFeatures{};
+	vkGetPhysicalDeviceFeatures(_physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures{};
-	deviceFeatures.shaderFloat64 = true;
+	deviceFeatures.shaderFloat64 = supportedFeatures.shaderFloat64;
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -370,9 +655,10 @@ void vulkan_renderer::create_logical_device()
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	const std::vector<const char*> deviceExtensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
-	};
+	std::vector<const char*> deviceExtensions;
+
+	if (!_headless)
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
 	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
@@ -400,225 +686,68 @@ void vulkan_renderer::create_logical_device()
 
 	vkGetDeviceQueue(_logicalDevice, _graphicsQueueFamilyIndex, 0, &_graphicsQueue);
 	vkGetDeviceQueue(_logicalDevice, _presentQueueFamilyIndex, 0, &_presentQueue);
-}
-
-void vulkan_renderer::choose_swap_surface_format()
-{
-	uint32_t formatCount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(_physicalDevice, _surface, &formatCount, nullptr);
-
-	if (formatCount != 0) 
-	{
-		std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(_physicalDevice, _surface, &formatCount, surfaceFormats.data());
 
-		for (VkSurfaceFormatKHR f : surfaceFormats)
-		{
-			if (f.format == VK_FORMAT_B8G8R8A8_SRGB && f.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-			{
-				_selectedSurfaceFormat = f;
-				return;
-			}
-		}
+	// Compute work is recorded into the same command buffers as the drawing,
+	// so it has to run on the graphics queue. Almost every graphics queue
+	// supports compute as well, but Vulkan doesn't promise it.
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
 
-		_selectedSurfaceFormat = surfaceFormats[0];
-		return;
-	}
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilies.data());
 
-	throw std::runtime_error("No surface formats available.");
+	_supportsCompute = (queueFamilies[_graphicsQueueFamilyIndex].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
 }
 
-void vulkan_renderer::choose_swap_present_mode()
+void vulkan_renderer::create_pipeline_cache()
 {
-	uint32_t presentModeCount;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(_physicalDevice, _surface, &presentModeCount, nullptr);
-
-	if (presentModeCount != 0) 
+	// Every pipeline the renderer creates goes through the one cache, so that, with a shader
+	// cache directory set, the next renderer on this device starts with all of them built.
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+	std::vector<uint8_t> data = _shaderCache.load_pipeline_cache(properties);
+
+	VkPipelineCacheCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	if (vkCreatePipelineCache(_logicalDevice, &createInfo, nullptr, &_pipelineCache) != VK_SUCCESS)
 	{
-		std::vector<VkPresentModeKHR> presentModes(presentModeCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(_physicalDevice, _surface, &presentModeCount, presentModes.data());		
-
-		for (VkPresentModeKHR mode : presentModes)
-		{
-			if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
-			{
-				_selectedPresentMode = mode;
-				return;
-			}
-		}
-
-		_selectedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-		return;
-	}
-
-	throw std::runtime_error("No present modes available.");
-}
-
-void vulkan_renderer::choose_swap_extent()
-{
-	VkSurfaceCapabilitiesKHR capabilities;
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_physicalDevice, _surface, &capabilities);
+		// Saved data the driver won't take is no reason not to start. Start without it.
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
 
-	if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
-	{
-		_selectedSwapExtent = capabilities.currentExtent;
-	}
-	else
-	{
-		throw std::runtime_error("Invalid extent.");
+		if (vkCreatePipelineCache(_logicalDevice, &createInfo, nullptr, &_pipelineCache) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create pipeline cache.");
 	}
 }
 
-void vulkan_renderer::recreate_swap_chain()
-{
-	do
-	{
-		choose_swap_extent();
-
-	} while (_selectedSwapExtent.width == 0 || _selectedSwapExtent.height == 0);
-
-	vkDeviceWaitIdle(_logicalDevice);
-
-	cleanup_swap_chain();
-	create_swap_chain();
-	create_image_views();
-	create_framebuffers();
-}
-
-void vulkan_renderer::create_swap_chain()
+void vulkan_renderer::save_pipeline_cache()
 {
-	VkSurfaceCapabilitiesKHR capabilities;
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_physicalDevice, _surface, &capabilities);
-
-	// We need to decide how many images we would like to have in the swap chain.
-	// The implementation specifies the minimum number that it requires to function.
-
-	// Sticking to the minimum means that we may sometimes have to wait 
-	// on the driver to complete internal operations before we can acquire 
-	// another image to render to. Therefore, it is recommended to request
-	// at least one more image than the minimum.
-
-	// Make sure that this +1 doesn't exceed the allowed maximum.
-	// (0 is a special value that means no maximum).
-
-	uint32_t imageCount = capabilities.minImageCount + 1;
-
-	if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount)
-	{
-		imageCount = capabilities.maxImageCount;
-	}
-
-	VkSwapchainCreateInfoKHR createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	createInfo.surface = _surface;
-	createInfo.minImageCount = imageCount;
-	createInfo.imageFormat = _selectedSurfaceFormat.format;
-	createInfo.imageColorSpace = _selectedSurfaceFormat.colorSpace;
-	createInfo.imageExtent = _selectedSwapExtent;
-
-	// Each swap chain image can have many layers to it?
-	createInfo.imageArrayLayers = 1;
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-	uint32_t queueFamilyIndices[]{ _graphicsQueueFamilyIndex, _presentQueueFamilyIndex };
-
-	if (_graphicsQueueFamilyIndex != _presentQueueFamilyIndex)
-	{
-		// If the graphics family and the present family aren't the same,
-		// make it so the swap chain images can be shared across queue families.
-		// Apparently, this option is less performant.
-		// Later sections of the tutorial show how to explicitly do
-		// transfers from the graphics family to the present family.
-
-		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-		createInfo.queueFamilyIndexCount = 2;
-		createInfo.pQueueFamilyIndices = queueFamilyIndices;
-		//             ^
-		// How does Vulkan know which index is for the graphics family
-		// and which index is for the present family?
-		// Oh, it doesn't matter - it just needs a list of which
-		// queue families need to be able to access this image.
-	}
-	else
-	{
-		// Vulkan tutorial says that the present family and the
-		// graphics family are the same on most hardware.
-
-		createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		createInfo.queueFamilyIndexCount = 0;
-		createInfo.pQueueFamilyIndices = nullptr;
-	}
-
-	createInfo.preTransform = capabilities.currentTransform;
-	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	createInfo.presentMode = _selectedPresentMode;
-	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
-
-	// When resizing the window, we'll need to create a new swap chain
-	// but then link back to the old one?
-
-	if (vkCreateSwapchainKHR(_logicalDevice, &createInfo, nullptr, &_swapChain) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create swap chain!");
-	}
+	if (!_shaderCache.is_open())
+		return;
 
-	vkGetSwapchainImagesKHR(_logicalDevice, _swapChain, &imageCount, nullptr);
-	_swapChainImages.resize(imageCount);
-	vkGetSwapchainImagesKHR(_logicalDevice, _swapChain, &imageCount, _swapChainImages.data());
-}
+	size_t size = 0;
 
-void vulkan_renderer::create_image_views()
-{
-	_swapChainImageViews.resize(_swapChainImages.size());
+	if (vkGetPipelineCacheData(_logicalDevice, _pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0)
+		return;
 
-	for (size_t i = 0; i < _swapChainImages.size(); i++)
-	{
-		VkImageViewCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		createInfo.image = _swapChainImages[i];
-		createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		createInfo.format = _selectedSurfaceFormat.format;
-		createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-		createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	std::vector<uint8_t> data(size);
 
-		// Our images will be used as color targets without any
-		// mipmapping levels or multiple layers.
-		createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		createInfo.subresourceRange.baseMipLevel = 0;
-		createInfo.subresourceRange.levelCount = 1;
-		createInfo.subresourceRange.baseArrayLayer = 0;
-		createInfo.subresourceRange.layerCount = 1;
+	if (vkGetPipelineCacheData(_logicalDevice, _pipelineCache, &size, data.data()) != VK_SUCCESS)
+		return;
 
-		// If we were working on a stereographic 3D application,
-		// then you would create a swap chain with multiple layers.
-		// You could then create multiple image views for each image
-		// representing the views for the left and right eyes
-		// by accessing different layers.
+	data.resize(size);
 
-		if (vkCreateImageView(_logicalDevice, &createInfo, nullptr, &_swapChainImageViews[i]) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create image views!");
-		}
-	}
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+	_shaderCache.save_pipeline_cache(properties, data);
 }
 
 VkShaderModule vulkan_renderer::compile_shader(std::string name, std::string source, shaderc_shader_kind kind)
 {
-	shaderc::Compiler compiler;
-	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, name.c_str());
-
-	if (result.GetCompilationStatus() != shaderc_compilation_status::shaderc_compilation_status_success)
-	{
-		std::string message;
-		message = "Failed to compile shader: " + name + "\n";
-		message += result.GetErrorMessage() + "\n";
-
-		throw std::runtime_error(message);
-	}
-
-	std::vector<uint32_t> spirv;
-	std::copy(result.begin(), result.end(), std::back_inserter(spirv));
+	std::vector<uint32_t> spirv = _shaderCache.compile(name, source, kind);
 
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -636,43 +765,18 @@ VkShaderModule vulkan_renderer::compile_shader(std::string name, std::string sou
 
 void vulkan_renderer::create_vertex_shader()
 {
-	std::string vertexShaderSource =
-		"#version 450                                   \n"
-		"                                               \n"
-		"layout(location = 0) in vec2 inPosition;       \n"
-		"layout(location = 1) in vec3 inColor;          \n"
-		"                                               \n"
-		"layout(location = 0) out vec3 fragColor;       \n"
-		"                                               \n"
-		"void main()                                    \n"
-		"{                                              \n"
-		"    gl_Position = vec4(inPosition, 0.0, 1.0);  \n"
-		"    fragColor = inColor;                       \n"
-		"}                                              \n";
-
-
-	_vertexShader = compile_shader("default_vertex_shader", vertexShaderSource, shaderc_shader_kind::shaderc_vertex_shader);
+	_vertexShader = compile_shader("default_vertex_shader", DEFAULT_VERTEX_SHADER, shaderc_shader_kind::shaderc_vertex_shader);
 }
 
 void vulkan_renderer::create_fragment_shader()
 {
-	std::string fragmentShaderSource =
-		"#version 450                               \n"
-		"layout(location = 0) in vec3 fragColor;    \n"
-		"layout(location = 0) out vec4 outColor;    \n"
-		"                                           \n"
-		"void main() {                              \n"
-		"                                           \n"
-		"    outColor = vec4(fragColor, 1.0f);      \n"
-		"}                                          \n";
-
-	_fragmentShader = compile_shader("default_fragment_shader", fragmentShaderSource, shaderc_shader_kind::shaderc_fragment_shader);
+	_fragmentShader = compile_shader("default_fragment_shader", DEFAULT_FRAGMENT_SHADER, shaderc_shader_kind::shaderc_fragment_shader);
 }
 
 void vulkan_renderer::create_render_pass()
 {
 	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = _selectedSurfaceFormat.format;
+	colorAttachment.format = _target->format();
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 
 	// Clear the frame buffer to black before drawing a new frame.
@@ -692,8 +796,10 @@ void vulkan_renderer::create_render_pass()
 	// imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT. 
 
 	// Texturing chapter goes more into how layouts work.
+	//
+	// An offscreen target instead wants the image left ready to be copied out.
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = _target->final_layout();
 
 	// Subpasses and attachment references.
 	// A single render pass can consist of multiple subpasses.
@@ -792,11 +898,151 @@ void vulkan_renderer::create_render_pass()
 
 	if (vkCreateRenderPass(_logicalDevice, &renderPassInfo, nullptr, &_renderPass) != VK_SUCCESS)
 		throw std::runtime_error("failed to create render pass!");
+
+	// Progressive rendering draws a frame over several submissions.
+	// Only the first one clears the image. The rest pick up the image where
+	// the last one left it (in the final layout), and have to wait for
+	// the previous submission's color writes before adding their own.
+	//
+	// Render passes which differ only in load ops and layouts are "compatible",
+	// so the same framebuffers and graphics pipeline work with either one.
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	colorAttachment.initialLayout = _target->final_layout();
+
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	if (vkCreateRenderPass(_logicalDevice, &renderPassInfo, nullptr, &_continueRenderPass) != VK_SUCCESS)
+		throw std::runtime_error("failed to create continuation render pass!");
+}
+
+void vulkan_renderer::create_descriptor_set()
+{
+	// Descriptors are how shaders get at resources other than push constants.
+	// The main one is the iteration buffer, written by the compute shader
+	// and read by the fragment shader that colors it. The second is the spare
+	// iteration buffer, which only the zoom preview's resampling reads from.
+	// The third is the palette the fragment shader colors with.
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[2].binding = 2;
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[2].descriptorCount = 1;
+	bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 3;
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(_logicalDevice, &layoutInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 3;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(_logicalDevice, &poolInfo, nullptr, &_descriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = _descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &_descriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(_logicalDevice, &allocInfo, &_descriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor set!");
+	}
+
+	// The iteration buffers stay out of the set until there's a compute shader to write them.
+	// The palette's there from the start, since fragment shaders that do everything use it too.
+	const float black[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	set_palette(black, sizeof(black));
+}
+
+void vulkan_renderer::set_palette(const void* colors, size_t bytes)
+{
+	if (bytes == 0 || bytes % (4 * sizeof(float)) != 0)
+	{
+		throw std::runtime_error("A palette must hold at least one vec4 color.");
+	}
+
+	// The buffer's sized to fit, so that the shader can take the palette's
+	// length from it. Only a palette of a different length needs a new one.
+	if (_paletteBuffer == nullptr || _paletteBufferSize != bytes)
+	{
+		// Frames still in flight may be reading the old one, and
+		// the descriptor set can't change under them either.
+		wait_for_frame(_submittedFrames);
+		cleanup_palette_buffer();
+
+		// The colors are written by a copy at the start of each frame that follows a change,
+		// so the fragment shader can read them out of device local memory.
+		createBuffer(bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _paletteBuffer, _paletteBufferMemory);
+
+		_paletteBufferSize = bytes;
+
+		VkDescriptorBufferInfo bufferInfo{};
+		bufferInfo.buffer = _paletteBuffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = _descriptorSet;
+		descriptorWrite.dstBinding = 2;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(_logicalDevice, 1, &descriptorWrite, 0, nullptr);
+	}
+
+	// Frames already submitted keep the colors they had.
+	const uint8_t* data = (const uint8_t*)colors;
+	_palette.assign(data, data + bytes);
+	_paletteChanged = true;
+}
+
+void vulkan_renderer::cleanup_palette_buffer()
+{
+	if (_paletteBuffer != nullptr)
+	{
+		vkDestroyBuffer(_logicalDevice, _paletteBuffer, nullptr);
+		vkFreeMemory(_logicalDevice, _paletteBufferMemory, nullptr);
+	}
+
+	_paletteBuffer = nullptr;
+	_paletteBufferMemory = nullptr;
+	_paletteBufferSize = 0;
 }
 
 void vulkan_renderer::recreate_graphics_pipeline()
 {
-	vkDeviceWaitIdle(_logicalDevice);
+	// Every submission ends in a frame's fence, so the last frame finishing means
+	// nothing's using the pipeline anymore.
+	wait_for_frame(_submittedFrames);
 	cleanup_pipeline();
 	create_graphics_pipeline();
 }
@@ -815,6 +1061,19 @@ void vulkan_renderer::create_graphics_pipeline()
 	fragShaderStageInfo.module = _fragmentShader;
 	fragShaderStageInfo.pName = "main";
 
+	// The fragment shader's specialization constants, one word each from constant_id 0.
+	// Each set of values makes a pipeline of its own: see set_fragment_specialization().
+	std::vector<VkSpecializationMapEntry> mapEntries = specialization_entries(_fragmentSpecialization.size(), 0);
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = (uint32_t)mapEntries.size();
+	specializationInfo.pMapEntries = mapEntries.data();
+	specializationInfo.dataSize = _fragmentSpecialization.size() * sizeof(uint32_t);
+	specializationInfo.pData = _fragmentSpecialization.data();
+
+	if (!_fragmentSpecialization.empty())
+		fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
 	auto bindingDescription = Vertex::getBindingDescription();
@@ -945,11 +1204,16 @@ void vulkan_renderer::create_graphics_pipeline()
 
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;
+
+	// The iteration buffer's set is always part of the layout. A fragment shader
+	// that doesn't use it (i.e., without a compute shader) simply ignores it.
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_descriptorSetLayout;
+
+	VkPushConstantRange push_constant{};
 
 	if (_pushDataSize > 0)
 	{
-		VkPushConstantRange push_constant;
 		push_constant.offset = 0;
 		push_constant.size = _pushDataSize;
 		push_constant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -962,7 +1226,9 @@ void vulkan_renderer::create_graphics_pipeline()
 		pipelineLayoutInfo.pushConstantRangeCount = 0;
 	}
 
-	if (vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS)
+	// Every variant of the pipeline shares the one layout, made along with the first.
+	if (_pipelineLayout == nullptr &&
+		vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to create pipeline layout!");
 	}
@@ -1002,53 +1268,338 @@ void vulkan_renderer::create_graphics_pipeline()
 	// & using two completely separate pipelines, if they're similar. 
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-	// Separate chapter on pipeline caches. For now we're not using them.
 	// Caches can save information for more efficient pipeline creation later.
-	if (vkCreateGraphicsPipelines(_logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_graphicsPipeline) != VK_SUCCESS)
+	// Ours is kept on disk between runs: see create_pipeline_cache().
+	VkPipeline pipeline;
+
+	if (vkCreateGraphicsPipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+
+	add_variant(_graphicsVariants, _fragmentSpecialization, pipeline);
+	_graphicsPipeline = pipeline;
+}
+
+void vulkan_renderer::create_compute_pipeline()
+{
+	// A compute pipeline is much simpler than a graphics pipeline.
+	// There's no fixed-function state at all, just the one shader stage.
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = _computePushDataSize;
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+	if (_computePipelineLayout == nullptr &&
+		vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &_computePipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create compute pipeline layout!");
+	}
+
+	// The workgroup size is baked into the pipeline through specialization constants,
+	// so changing it only means creating a new pipeline, not recompiling the shader.
+	// Whatever set_compute_specialization() was given follows, from constant_id 2.
+	std::vector<uint32_t> specialization = { _workgroupSize.width, _workgroupSize.height };
+	specialization.insert(specialization.end(), _computeSpecialization.begin(), _computeSpecialization.end());
+
+	std::vector<VkSpecializationMapEntry> mapEntries = specialization_entries(specialization.size(), 0);
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = (uint32_t)mapEntries.size();
+	specializationInfo.pMapEntries = mapEntries.data();
+	specializationInfo.dataSize = specialization.size() * sizeof(uint32_t);
+	specializationInfo.pData = specialization.data();
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = _computeShader;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineInfo.layout = _computePipelineLayout;
+
+	VkPipeline pipeline;
+
+	if (vkCreateComputePipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+
+	add_variant(_computeVariants, _computeSpecialization, pipeline);
+	_computePipeline = pipeline;
 }
 
-void vulkan_renderer::create_framebuffers()
+std::vector<VkSpecializationMapEntry> vulkan_renderer::specialization_entries(size_t count, uint32_t firstId)
 {
-	_swapChainFramebuffers.resize(_swapChainImageViews.size());
+	std::vector<VkSpecializationMapEntry> entries(count);
 
-	for (size_t i = 0; i < _swapChainImageViews.size(); i++)
+	for (size_t i = 0; i < count; i++)
 	{
-		// Why can a single frame buffer have many image views attached to it?
-		// This doesn't seem to be the same thing as the number of layers.
+		entries[i].constantID = firstId + (uint32_t)i;
+		entries[i].offset = (uint32_t)(i * sizeof(uint32_t));
+		entries[i].size = sizeof(uint32_t);
+	}
+
+	return entries;
+}
+
+void vulkan_renderer::set_fragment_specialization(const std::vector<uint32_t>& values)
+{
+	if (values == _fragmentSpecialization)
+		return;
+
+	_fragmentSpecialization = values;
 
-		// You can only use a framebuffer with the render passes that 
-		// it is compatible with, which roughly means that they
-		// use the same number and type of attachments.
+	if (_pipelineLayout == nullptr)
+		return;
+
+	_graphicsPipeline = find_variant(_graphicsVariants, values);
+
+	if (_graphicsPipeline == nullptr)
+		create_graphics_pipeline();
+}
 
-		// Oh, our render pass only has a single attachment, for color.
-		// The attachmentCount and pAttachments parameters specify the 
-		// VkImageView objects that should be bound to the 
-		// respective attachment descriptions in the render pass 
-		// pAttachment array.
+void vulkan_renderer::set_compute_specialization(const std::vector<uint32_t>& values)
+{
+	if (values == _computeSpecialization)
+		return;
 
-		VkImageView attachments[] = {
-			_swapChainImageViews[i]
-		};
+	_computeSpecialization = values;
+
+	if (_computePipelineLayout == nullptr)
+		return;
 
-		VkFramebufferCreateInfo framebufferInfo{};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = _renderPass;
-		framebufferInfo.attachmentCount = 1;
-		framebufferInfo.pAttachments = attachments;
-		framebufferInfo.width = _selectedSwapExtent.width;
-		framebufferInfo.height = _selectedSwapExtent.height;
+	_computePipeline = find_variant(_computeVariants, values);
 
-		// Our swap chain images are single images, so the number of layers is 1.
-		framebufferInfo.layers = 1;
+	if (_computePipeline == nullptr)
+		create_compute_pipeline();
+}
 
-		if (vkCreateFramebuffer(_logicalDevice, &framebufferInfo, nullptr, &_swapChainFramebuffers[i]) != VK_SUCCESS)
+VkPipeline vulkan_renderer::find_variant(std::vector<pipeline_variant>& variants, const std::vector<uint32_t>& values)
+{
+	for (pipeline_variant& variant : variants)
+	{
+		if (variant.values == values)
 		{
-			throw std::runtime_error("failed to create framebuffer!");
+			variant.last_used = ++_variantClock;
+			return variant.pipeline;
 		}
 	}
+
+	return nullptr;
+}
+
+void vulkan_renderer::add_variant(std::vector<pipeline_variant>& variants, const std::vector<uint32_t>& values, VkPipeline pipeline)
+{
+	// The pipeline in use is always the one most recently switched to,
+	// so it's never the least recently used, and never the one to go.
+	if (variants.size() >= PIPELINE_VARIANTS)
+	{
+		auto oldest = std::min_element(variants.begin(), variants.end(),
+			[](const pipeline_variant& a, const pipeline_variant& b) { return a.last_used < b.last_used; });
+
+		// The last frame may still be drawing with it, so it's only put aside until that's done.
+		_retiredPipelines.push_back({ oldest->pipeline, _submittedFrames });
+		variants.erase(oldest);
+	}
+
+	variants.push_back({ values, pipeline, ++_variantClock });
+}
+
+void vulkan_renderer::destroy_variants(std::vector<pipeline_variant>& variants)
+{
+	for (const pipeline_variant& variant : variants)
+		vkDestroyPipeline(_logicalDevice, variant.pipeline, nullptr);
+
+	variants.clear();
+}
+
+void vulkan_renderer::destroy_retired_pipelines(bool all)
+{
+	auto finished = std::remove_if(_retiredPipelines.begin(), _retiredPipelines.end(),
+		[&](const retired_pipeline& retired)
+		{
+			if (!all && !frame_done(retired.frame))
+				return false;
+
+			vkDestroyPipeline(_logicalDevice, retired.pipeline, nullptr);
+			return true;
+		});
+
+	_retiredPipelines.erase(finished, _retiredPipelines.end());
+}
+
+void vulkan_renderer::create_resample_pipeline()
+{
+	// Copies each pixel of the new view from the nearest pixel of the old one,
+	// treating a pixel as however many 32-bit words the compute shader writes.
+	// Where the new view reaches past the old one's edge, the edge is stretched out.
+	std::string resampleShaderSource =
+		"#version 450                                                                    \n"
+		"layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;          \n"
+		"layout(constant_id = 2) const uint WORDS_PER_PIXEL = 1;                         \n"
+		"                                                                                \n"
+		"layout(push_constant) uniform constants                                         \n"
+		"{                                                                               \n"
+		"    uvec2 size;                                                                 \n"
+		"    vec2 center;                                                                \n"
+		"    float scale;                                                                \n"
+		"} PushConstants;                                                                \n"
+		"                                                                                \n"
+		"layout(std430, set = 0, binding = 0) writeonly buffer Destination               \n"
+		"{                                                                               \n"
+		"    uint words[];                                                               \n"
+		"} Dst;                                                                          \n"
+		"                                                                                \n"
+		"layout(std430, set = 0, binding = 1) readonly buffer Source                     \n"
+		"{                                                                               \n"
+		"    uint words[];                                                               \n"
+		"} Src;                                                                          \n"
+		"                                                                                \n"
+		"void main()                                                                     \n"
+		"{                                                                               \n"
+		"    uvec2 size = PushConstants.size;                                            \n"
+		"    uvec2 pixel = gl_GlobalInvocationID.xy;                                     \n"
+		"                                                                                \n"
+		"    if (pixel.x >= size.x || pixel.y >= size.y)                                 \n"
+		"        return;                                                                 \n"
+		"                                                                                \n"
+		"    vec2 center = PushConstants.center;                                         \n"
+		"    vec2 source = center + (vec2(pixel) + 0.5f - center) * PushConstants.scale; \n"
+		"    uvec2 nearest = uvec2(clamp(floor(source), vec2(0.0f), vec2(size) - 1.0f)); \n"
+		"                                                                                \n"
+		"    uint dst = (pixel.y * size.x + pixel.x) * WORDS_PER_PIXEL;                  \n"
+		"    uint src = (nearest.y * size.x + nearest.x) * WORDS_PER_PIXEL;              \n"
+		"                                                                                \n"
+		"    for (uint i = 0 ; i < WORDS_PER_PIXEL ; i++)                                \n"
+		"        Dst.words[dst + i] = Src.words[src + i];                                \n"
+		"}                                                                               \n";
+
+	if (_bytesPerPixel % sizeof(uint32_t) != 0)
+	{
+		throw std::runtime_error("Zoom previews need the compute shader to write whole 32-bit words per pixel.");
+	}
+
+	if (_resampleShader == nullptr)
+		_resampleShader = compile_shader("resample_compute_shader", resampleShaderSource, shaderc_shader_kind::shaderc_compute_shader);
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(resample_push_data);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+	if (vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &_resamplePipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create resample pipeline layout!");
+	}
+
+	uint32_t constants[] = { _workgroupSize.width, _workgroupSize.height, _bytesPerPixel / (uint32_t)sizeof(uint32_t) };
+
+	VkSpecializationMapEntry mapEntries[3]{};
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		mapEntries[i].constantID = i;
+		mapEntries[i].offset = i * sizeof(uint32_t);
+		mapEntries[i].size = sizeof(uint32_t);
+	}
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = 3;
+	specializationInfo.pMapEntries = mapEntries;
+	specializationInfo.dataSize = sizeof(constants);
+	specializationInfo.pData = constants;
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = _resampleShader;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineInfo.layout = _resamplePipelineLayout;
+
+	if (vkCreateComputePipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &_resamplePipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create resample pipeline!");
+	}
+}
+
+void vulkan_renderer::create_iteration_buffer()
+{
+	VkExtent2D extent = _target->extent();
+	VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * _bytesPerPixel;
+
+	if (size == _iterationBufferSize && _iterationBuffer != nullptr &&
+		extent.width == _iterationExtent.width && extent.height == _iterationExtent.height)
+	{
+		return;
+	}
+
+	// The surface changed size. Frames still in flight may be using the old buffer.
+	// Tiles they read back for the cache are still good, and are collected once they're done.
+	wait_for_frame(_submittedFrames);
+	cleanup_iteration_buffer();
+
+	if (size == 0)
+		return;
+
+	// Only ever touched by the GPU, so it lives in device local memory.
+	// Panning shifts its contents with transfer commands, by way of the spare buffer.
+	// Zoom previews copy its contents over to the spare buffer, and resample them back.
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	createBuffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _iterationBuffer, _iterationBufferMemory);
+	createBuffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _spareIterationBuffer, _spareIterationBufferMemory);
+
+	_iterationBufferSize = size;
+	_iterationExtent = extent;
+
+	write_iteration_descriptor();
+}
+
+void vulkan_renderer::write_iteration_descriptor()
+{
+	// Nothing may be using the set while it's updated, including frames still in flight.
+	wait_for_frame(_submittedFrames);
+
+	VkDescriptorBufferInfo bufferInfos[2]{};
+	bufferInfos[0].buffer = _iterationBuffer;
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].range = VK_WHOLE_SIZE;
+	bufferInfos[1].buffer = _spareIterationBuffer;
+	bufferInfos[1].offset = 0;
+	bufferInfos[1].range = VK_WHOLE_SIZE;
+
+	VkWriteDescriptorSet descriptorWrites[2]{};
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = _descriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(_logicalDevice, 2, descriptorWrites, 0, nullptr);
 }
 
 uint32_t vulkan_renderer::find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags properties)
@@ -1164,15 +1715,19 @@ void vulkan_renderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDevic
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	// Wait for the copy operation to finish. Only setting up copies buffers this way,
+	// so a fence of its own, waited for straight away, is all it needs. Waiting for the
+	// whole queue to go idle would also wait for any frames that happened to be in flight.
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-	// Wait for the copy operation to finish.
-	// We could have used a fence to do the same thing. 
-	// That would allow us to schedule multiple transfers simultaneously
-	// and wait for them all to complete, instead of executing one at a time. 
+	VkFence copied;
+	vkCreateFence(_logicalDevice, &fenceInfo, nullptr, &copied);
 
-	vkQueueWaitIdle(_graphicsQueue);
+	vkQueueSubmit(_graphicsQueue, 1, &submitInfo, copied);
+	vkWaitForFences(_logicalDevice, 1, &copied, VK_TRUE, UINT64_MAX);
 
+	vkDestroyFence(_logicalDevice, copied, nullptr);
 	vkFreeCommandBuffers(_logicalDevice, _commandPool, 1, &commandBuffer);
 }
 
@@ -1284,7 +1839,7 @@ void vulkan_renderer::create_command_pool()
 	}
 }
 
-void vulkan_renderer::create_command_buffer()
+void vulkan_renderer::create_command_buffers()
 {
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1301,12 +1856,19 @@ void vulkan_renderer::create_command_buffer()
 	// from primary command buffers.
 
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = 1;
 
-	if (vkAllocateCommandBuffers(_logicalDevice, &allocInfo, &_commandBuffer) != VK_SUCCESS)
+	// One for each frame in flight. A command buffer can't be recorded again
+	// while the GPU's still executing it, so the frames can't share one.
+	std::vector<VkCommandBuffer> commandBuffers(_frames.size());
+	allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+
+	if (vkAllocateCommandBuffers(_logicalDevice, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
 	{
-		throw std::runtime_error("failed to allocate command buffer!");
+		throw std::runtime_error("failed to allocate command buffers!");
 	}
+
+	for (size_t i = 0; i < _frames.size(); i++)
+		_frames[i].command_buffer = commandBuffers[i];
 }
 
 void vulkan_renderer::create_sync_objects()
@@ -1314,262 +1876,1464 @@ void vulkan_renderer::create_sync_objects()
 	VkSemaphoreCreateInfo semaphoreInfo{};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	if (vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr, &_imageAvailableSemaphore) != VK_SUCCESS ||
-		vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr, &_renderFinishedSemaphore) != VK_SUCCESS)
+	// Each frame's fence starts out signaled, as though it had a frame before it that's
+	// already finished. Otherwise, the first wait on it would never return.
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (frame_resources& frame : _frames)
 	{
-		throw std::runtime_error("failed to create semaphores!");
+		if (vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr, &frame.image_available) != VK_SUCCESS ||
+			vkCreateSemaphore(_logicalDevice, &semaphoreInfo, nullptr, &frame.render_finished) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create semaphores!");
+		}
+
+		if (vkCreateFence(_logicalDevice, &fenceInfo, nullptr, &frame.in_flight) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create fence!");
+		}
 	}
 }
 
-void vulkan_renderer::draw_frame(void* pushData)
+void vulkan_renderer::cleanup_frame_resources()
 {
-	/*
-	Rendering a frame in Vulkan consists of a common set of steps:
+	for (frame_resources& frame : _frames)
+	{
+		if (frame.render_finished != nullptr)
+			vkDestroySemaphore(_logicalDevice, frame.render_finished, nullptr);
 
-		* Wait for the previous frame to finish.
-	      (if rendering multiple frames in flight, this entails waiting
-		   on the fence for the current frame to be ready, allowing the GPU
-		   to catch up to the CPU).
+		if (frame.image_available != nullptr)
+			vkDestroySemaphore(_logicalDevice, frame.image_available, nullptr);
 
-		* Acquire an image from the swap chain.
+		if (frame.in_flight != nullptr)
+			vkDestroyFence(_logicalDevice, frame.in_flight, nullptr);
 
-		* Record a command buffer which draws the scene onto that image.
+		if (frame.command_buffer != nullptr)
+			vkFreeCommandBuffers(_logicalDevice, _commandPool, 1, &frame.command_buffer);
 
-		* Submit the recorded command buffer.
+		cleanup_cache_staging_buffer(frame);
+		frame = frame_resources();
+	}
+}
 
-		* Present the swap chain image.
+void vulkan_renderer::set_frames_in_flight(uint32_t count)
+{
+	if (count < 1 || count > MAX_FRAMES_IN_FLIGHT)
+	{
+		throw std::runtime_error("Frames in flight must be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT) + ".");
+	}
 
-	=== Semaphores ===
+	if (count == _frames.size())
+		return;
 
-	A semaphore is used to add order between queue operations.
-	Queue operations refer to the work we submit to a queue, either in
-	a command buffer or from within a function.
+	// Once the last frame's finished, so has everything submitted before it,
+	// so the frames' numbers needn't be kept. Their tiles for the cache are, though.
+	wait_for_frame(_submittedFrames);
+	cleanup_frame_resources();
 
-	Two kinds of semaphores in Vulkan: Binary and Timeline.
-	Tutorial only covers Binary.
+	_frames.resize(count);
+	_currentFrame = 0;
 
-	The way we use a semaphore to order queue operations is by providing
-	the same semaphore as a "signal" semaphore in one queue operation,
-	and as a "wait" semaphore in another queue operation.
+	create_command_buffers();
+	create_sync_objects();
+}
 
-		A signals S when it completes.
-		B waits on S to begin.
+bool vulkan_renderer::frame_finished(uint64_t frame)
+{
+	// Whatever finished frames read back for the cache can be taken into it now,
+	// and finished batches' timings into their schedules.
+	collect_finished_frames();
+	return frame_done(frame);
+}
 
-		After operation B begins executing, semaphore S is automatically
-		reset back to being unsignaled, allowing it to be used again.
+bool vulkan_renderer::frame_done(uint64_t frame)
+{
+	// A frame that's no longer the last to have used its resources was waited
+	// for before they were used again. Frame 0 is the one before the first.
+	for (const frame_resources& resources : _frames)
+	{
+		if (resources.frame == frame)
+			return vkGetFenceStatus(_logicalDevice, resources.in_flight) == VK_SUCCESS;
+	}
 
-	=== Fences ===
+	return frame <= _submittedFrames;
+}
 
-	A fence has a similar purpose, in that it is used to synchronize execution,
-	but it is for ordering the execution on the CPU, otherwise known as the host.
-	If the host needs to know when the GPU has finished something, we use a fence.
+void vulkan_renderer::wait_for_frame(uint64_t frame)
+{
+	// Frames finish in order, so waiting for one waits for all those before it.
+	for (const frame_resources& resources : _frames)
+	{
+		if (resources.frame == frame && frame != 0)
+			vkWaitForFences(_logicalDevice, 1, &resources.in_flight, VK_TRUE, UINT64_MAX);
+	}
 
-	Unlike semaphores, fences must be reset manually to put them back
-	into the unsignaled state. This is because fences are used to control
-	the execution of the host, and so the host gets to decide when to reset the fence.
+	collect_finished_frames();
+}
 
-	Semaphores: Control execution order of operations on the GPU
-	Fences: Used to keep CPU and GPU in sync with each other.
+void vulkan_renderer::create_batch_resources()
+{
+	_batches.resize(BATCHES_IN_FLIGHT);
+	_currentBatch = 0;
 
-	====
-	
-	The Mandelbrot Explorer isn't animated, so the "Frames in Flight" stuff isn't needed.
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = _commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
 
-	For simplicity's sake, drawing a frame will be a blocking operation.
-	Leave it to .NET to run this operation in a Task, if it needs to be async.
+	// Signaled to start with, like the frames' fences.
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	*/
+	for (batch_resources& batch : _batches)
+	{
+		if (vkAllocateCommandBuffers(_logicalDevice, &allocInfo, &batch.command_buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
 
-	// Acquire an image from the swap chain.
-	uint32_t imageIndex;
+		if (vkCreateFence(_logicalDevice, &fenceInfo, nullptr, &batch.in_flight) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create fence!");
+		}
+	}
+}
 
-	// The swap chain is an extension feature, hence the *KHR suffix.
+void vulkan_renderer::cleanup_batch_resources()
+{
+	for (batch_resources& batch : _batches)
+	{
+		if (batch.in_flight != nullptr)
+			vkDestroyFence(_logicalDevice, batch.in_flight, nullptr);
 
-	// According to Vulkan documentation, it seems _imageAvailableSemaphores 
-	// is signaled when the next image is acquired?
+		if (batch.command_buffer != nullptr)
+			vkFreeCommandBuffers(_logicalDevice, _commandPool, 1, &batch.command_buffer);
+	}
 
-	// Tutorial says it's signaled when the presentation engine is finished
-	// using the image - that's the point in time where we can start drawing to it.
+	_batches.clear();
+}
 
-	// Ahh, vkAcquireNextImageKHR immediately returns the index of an image that 
-	// might not yet be ready to be written to. The semaphore will let us know
-	// when we can draw to this image.
+vulkan_renderer::batch_resources& vulkan_renderer::next_batch_resources()
+{
+	// The batch before last had these resources. By the time the next batch is recorded,
+	// it's usually long finished, and its timings are there for the schedule to plan with.
+	batch_resources& batch = _batches[_currentBatch];
+	vkWaitForFences(_logicalDevice, 1, &batch.in_flight, VK_TRUE, UINT64_MAX);
 
-	//  _imageAvailableSemaphore must be unsignaled. Will be signaled when the image is acquired.
-	VkResult result = vkAcquireNextImageKHR(
-		_logicalDevice,
-		_swapChain,
-		UINT64_MAX,
-		_imageAvailableSemaphore,	
-		VK_NULL_HANDLE,
-		&imageIndex);
+	if (batch.schedule != nullptr)
+		collect_batch(batch);
 
-	// If the swap extent is invalid, try to recreate it and acquire a swapchain image again.
-	if (result == VK_ERROR_OUT_OF_DATE_KHR)
-	{
-		recreate_swap_chain();
+	vkResetCommandBuffer(batch.command_buffer, 0);
 
-		result = vkAcquireNextImageKHR(
-			_logicalDevice,
-			_swapChain,
-			UINT64_MAX,
-			_imageAvailableSemaphore,
-			VK_NULL_HANDLE,
-			&imageIndex);
+	batch.first_query = _currentBatch * (_timestampCapacity + 1);
+	_firstQuery = batch.first_query;
+	_currentBatch = (_currentBatch + 1) % (uint32_t)_batches.size();
 
-		// If the swap extent is still invalid (e.g., application is minimized),
-		// then don't bother rendering this frame.
-		if (result == VK_ERROR_OUT_OF_DATE_KHR)
-		{
-			return;
-		}
-	}
+	return batch;
+}
 
-	// Throw an exception if acquiring the swap chain image failed for any other reason.
-	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+void vulkan_renderer::submit_batch(batch_resources& batch, VkSubmitInfo& submitInfo, progressive_schedule& schedule, size_t tiles, bool timed)
+{
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.command_buffer;
+
+	// The fence is only reset once there's definitely a submission coming to signal it again.
+	vkResetFences(_logicalDevice, 1, &batch.in_flight);
+
+	if (vkQueueSubmit(_graphicsQueue, 1, &submitInfo, batch.in_flight) != VK_SUCCESS)
 	{
-		throw std::runtime_error("failed to acquire swap chain image!");
+		throw std::runtime_error("failed to submit draw command buffer!");
 	}
 
-	// Reset the command buffer to make sure it's able to be recorded.
-	vkResetCommandBuffer(_commandBuffer, 0);
+	batch.schedule = &schedule;
+	batch.tiles = tiles;
+	batch.timed = timed;
+}
 
-	// Now record the command buffer.
-	record_command_buffer(_commandBuffer, imageIndex, pushData);
+void vulkan_renderer::submit_frame_fence(frame_resources& frame)
+{
+	// A submission with no command buffers still signals its fence, once everything
+	// submitted before it has finished. That makes it the frame's last batch's.
+	vkResetFences(_logicalDevice, 1, &frame.in_flight);
 
-	// Now submit the command buffer to the graphics queue.
+	if (vkQueueSubmit(_graphicsQueue, 0, nullptr, frame.in_flight) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to submit frame fence!");
+	}
+}
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+void vulkan_renderer::collect_batch(batch_resources& batch)
+{
+	// Only called once the batch has finished.
+	double milliseconds = batch.timed ? read_batch_milliseconds(batch.first_query, batch.tiles, _tileMilliseconds) : -1.0;
+	batch.schedule->complete_batch(milliseconds, milliseconds >= 0.0 ? &_tileMilliseconds : nullptr);
+	batch.schedule = nullptr;
+}
 
-	// The pipeline should stop & wait on writing colors to the image until
-	// the image acquired from the swap chain becomes available to write to.
-	// (no problem running the prior steps in the pipeline before then - 
-	//  I guess that includes the vertex shader? How about the fragment shader?)
-
-	// Slight problem: 
-	// The render pass will attempt to do a layout transition on the selected image
-	// at the start of the pipeline, before it's time to write colors 
-	// and before the image acquired from the swap chain is available.
-
-	// Two options:
-	// 1) Wait at the beginning of the pipeline for the image to be available,
-	//    rather than at the color output stage
-	//    (i.e, use VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT in our waitStages). 
-	//    
-	// 2) Make the render pass wait for the color output stage
-	//    to begin the layout transition.
-	//
-	// Tutorial uses the second approach.
+void vulkan_renderer::collect_finished_batches()
+{
+	// Oldest first, so that each schedule hears about its batches in the order it handed them out.
+	// Batches finish in that order too, so once one's still running, so are the rest.
+	for (size_t i = 0; i < _batches.size(); i++)
+	{
+		batch_resources& batch = _batches[(_currentBatch + i) % _batches.size()];
 
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &_imageAvailableSemaphore;
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &_commandBuffer;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &_renderFinishedSemaphore;
+		if (batch.schedule == nullptr)
+			continue;
 
-	// The last parameter references an optional fence that will be signaled 
-	// when the command buffer finished execution. This allows us to know 
-	// when it is safe for the command buffer to be reused.
+		if (vkGetFenceStatus(_logicalDevice, batch.in_flight) != VK_SUCCESS)
+			break;
 
-	// Waiting on a fence is the preferred approach when doing animation.
-	// I won't worry about that here and will use the (relatively inefficient) 
-	// vkDeviceWaitIdle
+		collect_batch(batch);
+	}
+}
 
-	if (vkQueueSubmit(_graphicsQueue, 1, &submitInfo, nullptr) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit draw command buffer!");
+void vulkan_renderer::create_timestamp_queries(uint32_t tileCapacity)
+{
+	if (_timestampQueryPool != nullptr)
+	{
+		vkDestroyQueryPool(_logicalDevice, _timestampQueryPool, nullptr);
+		_timestampQueryPool = nullptr;
+		_timestampCapacity = 0;
 	}
 
-	// When the command buffer finishes executing, then present the image.
-	VkPresentInfoKHR presentInfo{};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &_renderFinishedSemaphore;
+	// Timestamps are optional. Queues which don't support them
+	// report zero valid bits, in which case we'll time submissions on the host.
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
 
-	// Specify the swap chain(s) to present the images to and the index of the image
-	// for each swap chain. This will almost always be a single one.
-	// Curious - is it possible to present multiple images at the same time?
-	// Perhaps, if different swapchains are connected to different surfaces. Interesting.
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = &_swapChain;
-	presentInfo.pImageIndices = &imageIndex;
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilies.data());
 
-	// If presenting many swap chains, this can tell us which one went wrong.
-	// Since we're using only one, the return value of the present function is enough.
-	presentInfo.pResults = nullptr;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
 
-	result = vkQueuePresentKHR(_presentQueue, &presentInfo);
+	uint32_t validBits = queueFamilies[_graphicsQueueFamilyIndex].timestampValidBits;
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
-	{
-		// Did the image get presented?
-		// Should the image be re-rendered, given that the fragment shader
-		// may be a lengthy operation (e.g., if the iteration count is high)?
-		// Should draw_frame() return something indicating success or failure?
-		recreate_swap_chain();
-	}
-	else if (result != VK_SUCCESS)
+	if (validBits == 0 || properties.limits.timestampPeriod <= 0.0f)
+		return;
+
+	_timestampPeriod = properties.limits.timestampPeriod;
+	_timestampMask = validBits >= 64 ? UINT64_MAX : ((uint64_t)1 << validBits) - 1;
+
+	// A range of queries for each batch that can be in flight.
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = BATCHES_IN_FLIGHT * (tileCapacity + 1);
+
+	if (vkCreateQueryPool(_logicalDevice, &queryPoolInfo, nullptr, &_timestampQueryPool) != VK_SUCCESS)
 	{
-		throw std::runtime_error("failed to present swap chain image!");
+		throw std::runtime_error("failed to create timestamp query pool!");
 	}
 
-	// Crude form of synchronization. 
-	// Wait for the image to be presented before returning.
-	vkDeviceWaitIdle(_logicalDevice);
+	_timestampCapacity = tileCapacity;
 }
 
-void vulkan_renderer::record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, void* pushData)
+void vulkan_renderer::draw_frame(void* pushData, const void* computePushData)
 {
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	// With a compute shader loaded, the escape-time math runs in compute dispatches
+	// and the render pass only colors the results. Keep a copy of the compute
+	// push constants, since each tile gets its own rectangle written into them.
+	bool compute = _computePipeline != nullptr;
 
-	// The flags parameter specifies how we're going to use the command buffer.
+	if (compute)
+	{
+		if (computePushData == nullptr)
+		{
+			throw std::runtime_error("A compute shader is loaded, but no compute push data was given.");
+		}
 
-	// Available flags:
-	//	VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-	//	  The command buffer will be rerecorded right after executing it once.
-	//	VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT
-	//	  This is a secondary command buffer that will be entirely 
-	//    within a single render pass. 
-	//  VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT
-	//	  The command buffer can be resubmitted while it is also 
-	//    already pending execution.
+		create_iteration_buffer();
 
-	// None of these flags are applicable to us right now.
+		_computePushData.resize(_computePushDataSize);
+		memcpy(_computePushData.data(), computePushData, _computePushDataSize);
+	}
 
-	beginInfo.flags = 0;
+	// Until the frame's done, the iteration buffer holds a mix of old and new results.
+	_iterationBufferValid = false;
+	_refining = false;
 
-	// pInheritanceInfo is only relevant for secondary command buffers.
-	// It specifies which state to inherit from the calling primary command buffers.
+	if (caching())
+	{
+		// Only compute the parts of the frame that aren't already cached.
+		VkExtent2D extent = _target->extent();
+		tile whole = { 0, 0, extent.width, extent.height };
 
-	beginInfo.pInheritanceInfo = nullptr;
+		// The frame copies the tiles it computes back out for the cache as it finishes.
+		fill_from_cache(std::vector<tile>(1, whole), _uncachedTiles);
+		read_back_to_cache(_uncachedTiles);
 
-	// If the command buffer was already recorded once, then a call to 
-	// vkBeginCommandBuffer will implicitly reset it. 
-	// It's not possible to append commands to a buffer at a later time.
+		if (render_frame(pushData, &_uncachedTiles))
+			_iterationBufferValid = true;
 
-	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-		throw std::runtime_error("failed to begin recording command buffer!");
+		return;
 	}
 
-	// Drawing starts by beginning the render pass with vkCmdBeginRenderPass.
-
-	VkRenderPassBeginInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	if (render_frame(pushData, nullptr) && compute)
+		_iterationBufferValid = true;
+}
 
-	// The first parameters are the render pass itself and the attachments to bind.
-	renderPassInfo.renderPass = _renderPass;
-	renderPassInfo.framebuffer = _swapChainFramebuffers[imageIndex];
+void vulkan_renderer::pan_frame(int32_t deltaX, int32_t deltaY, void* pushData, const void* computePushData)
+{
+	// Panning reuses the last frame's results, so it needs a complete one of the same size.
+	// A pan of a whole surface or more leaves nothing to reuse.
+	VkExtent2D extent = _target->extent();
+	uint32_t distanceX = (uint32_t)std::abs(deltaX);
+	uint32_t distanceY = (uint32_t)std::abs(deltaY);
+
+	if (_computePipeline == nullptr || !_iterationBufferValid || computePushData == nullptr ||
+		extent.width != _iterationExtent.width || extent.height != _iterationExtent.height ||
+		distanceX >= extent.width || distanceY >= extent.height)
+	{
+		draw_frame(pushData, computePushData);
+		return;
+	}
+
+	_computePushData.resize(_computePushDataSize);
+	memcpy(_computePushData.data(), computePushData, _computePushDataSize);
+	_refining = false;
+
+	if (deltaX != 0 || deltaY != 0)
+		shift_iteration_buffer(deltaX, deltaY);
+
+	// Only the strips along the edges that the shift uncovered need computing:
+	// a full-height strip of columns, plus a strip of rows across the rest.
+	_exposedTiles.clear();
+
+	if (distanceX > 0)
+	{
+		tile columns = { deltaX > 0 ? 0 : extent.width - distanceX, 0, distanceX, extent.height };
+		_exposedTiles.push_back(columns);
+	}
+
+	if (distanceY > 0)
+	{
+		tile rows = { deltaX > 0 ? distanceX : 0, deltaY > 0 ? 0 : extent.height - distanceY,
+			extent.width - distanceX, distanceY };
+		_exposedTiles.push_back(rows);
+	}
+
+	_iterationBufferValid = false;
+
+	// Places already visited may be cached.
+	const std::vector<tile>* regions = &_exposedTiles;
+
+	if (caching())
+	{
+		fill_from_cache(_exposedTiles, _uncachedTiles);
+		regions = &_uncachedTiles;
+		read_back_to_cache(*regions);
+	}
+
+	if (render_frame(pushData, regions))
+		_iterationBufferValid = true;
+}
+
+bool vulkan_renderer::recolor_frame(void* pushData)
+{
+	// Recoloring needs the iteration buffer to hold a complete frame computed
+	// at the surface's current size, or one that's on its way to being refined.
+	VkExtent2D extent = _target->extent();
+
+	if (_computePipeline == nullptr || !(_iterationBufferValid || _refining) ||
+		extent.width != _iterationExtent.width || extent.height != _iterationExtent.height)
+	{
+		return false;
+	}
+
+	// Refinement carries on with the new colors.
+	if (_refining)
+		memcpy(_refinePushData.data(), pushData, _refinePushData.size());
+
+	return render_frame(pushData, &_noTiles);
+}
+
+bool vulkan_renderer::present_results(const void* results, uint32_t width, uint32_t height, void* pushData)
+{
+	VkExtent2D extent = _target->extent();
+
+	if (_computePipeline == nullptr || extent.width != width || extent.height != height)
+		return false;
+
+	create_iteration_buffer();
+
+	if (_iterationBuffer == nullptr)
+		return false;
+
+	// The next frame's staging buffer is laid out just like the iteration buffer, so it
+	// takes the whole frame in one go, and the frame copies it over before coloring it.
+	frame_resources& frame = next_frame();
+	create_cache_staging_buffer(frame);
+	memcpy(frame.cache_staged, results, (size_t)_iterationBufferSize);
+
+	VkBufferCopy copy{};
+	copy.size = _iterationBufferSize;
+	_cacheFills.assign(1, copy);
+
+	return present_iteration_buffer(pushData);
+}
+
+bool vulkan_renderer::present_iteration_buffer(void* pushData)
+{
+	VkExtent2D extent = _target->extent();
+
+	if (_computePipeline == nullptr || _iterationBuffer == nullptr ||
+		extent.width != _iterationExtent.width || extent.height != _iterationExtent.height)
+	{
+		return false;
+	}
+
+	// Only the color pass needs to run.
+	_refining = false;
+	_iterationBufferValid = render_frame(pushData, &_noTiles);
+	return _iterationBufferValid;
+}
+
+void vulkan_renderer::upload_perturbation_reference(uint32_t slot, const void* orbit, size_t orbitBytes, const void* bla, size_t blaBytes)
+{
+	if (slot >= PERTURBATION_REFERENCE_SLOTS)
+	{
+		throw std::runtime_error("There's no such perturbation reference slot.");
+	}
+
+	if (orbitBytes == 0 || blaBytes < sizeof(mandelbrot_bla_header))
+	{
+		throw std::runtime_error("A perturbation reference needs an orbit, and a BLA table with at least its header.");
+	}
+
+	perturbation_reference& reference = _perturbationReferences[slot];
+	upload_to_device(orbit, orbitBytes, reference.orbit, reference.orbitMemory, reference.orbitCapacity);
+	upload_to_device(bla, blaBytes, reference.bla, reference.blaMemory, reference.blaCapacity);
+}
+
+void vulkan_renderer::upload_to_device(const void* data, VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize& capacity)
+{
+	// Uploads pile up in the staging buffer until the next pass copies them over. Once it has,
+	// the staging buffer starts over, after that pass is done copying out of it. It's usually
+	// long done by the time the engine has a new reference to upload.
+	if (_perturbationUploads.empty() && _uploadStagingUsed != 0)
+	{
+		wait_for_frame(_perturbationPass);
+		_uploadStagingUsed = 0;
+	}
+
+	// Growing the buffer waits for the last pass to stop reading it. Growing it only
+	// when needed keeps that rare.
+	if (size > capacity)
+	{
+		if (buffer != nullptr)
+		{
+			wait_for_frame(_perturbationPass);
+
+			// Copies still waiting to go into the old buffer are superseded by this one.
+			VkBuffer old = buffer;
+			_perturbationUploads.erase(std::remove_if(_perturbationUploads.begin(), _perturbationUploads.end(),
+				[old](const perturbation_upload& upload) { return upload.buffer == old; }), _perturbationUploads.end());
+
+			vkDestroyBuffer(_logicalDevice, buffer, nullptr);
+			vkFreeMemory(_logicalDevice, memory, nullptr);
+		}
+
+		buffer = nullptr;
+		memory = nullptr;
+		capacity = 0;
+
+		createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+
+		capacity = size;
+	}
+
+	// Copies want their offsets aligned for the wider transfers.
+	VkDeviceSize offset = (_uploadStagingUsed + 15) & ~(VkDeviceSize)15;
+
+	if (offset + size > _uploadStagingCapacity)
+	{
+		// Nothing's reading it: the pending uploads haven't been recorded yet, and the pass
+		// that copied the ones before them was waited for above. Those still pending are
+		// carried over to the new buffer, at the same offsets.
+		VkDeviceSize stagingCapacity = std::max(offset + size, _uploadStagingCapacity * 2);
+
+		VkBuffer staging = nullptr;
+		VkDeviceMemory stagingMemory = nullptr;
+
+		createBuffer(stagingCapacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			staging, stagingMemory);
+
+		void* mapped;
+		vkMapMemory(_logicalDevice, stagingMemory, 0, stagingCapacity, 0, &mapped);
+
+		if (_uploadStagingBuffer != nullptr)
+		{
+			memcpy(mapped, _uploadStaging, (size_t)_uploadStagingUsed);
+
+			vkUnmapMemory(_logicalDevice, _uploadStagingBufferMemory);
+			vkDestroyBuffer(_logicalDevice, _uploadStagingBuffer, nullptr);
+			vkFreeMemory(_logicalDevice, _uploadStagingBufferMemory, nullptr);
+		}
+
+		_uploadStagingBuffer = staging;
+		_uploadStagingBufferMemory = stagingMemory;
+		_uploadStaging = (uint8_t*)mapped;
+		_uploadStagingCapacity = stagingCapacity;
+	}
+
+	memcpy(_uploadStaging + offset, data, (size_t)size);
+	_uploadStagingUsed = offset + size;
+
+	perturbation_upload upload{};
+	upload.buffer = buffer;
+	upload.copy.srcOffset = offset;
+	upload.copy.dstOffset = 0;
+	upload.copy.size = size;
+	_perturbationUploads.push_back(upload);
+}
+
+void vulkan_renderer::record_perturbation_uploads(VkCommandBuffer commandBuffer)
+{
+	if (_perturbationUploads.empty())
+		return;
+
+	for (const perturbation_upload& upload : _perturbationUploads)
+		vkCmdCopyBuffer(commandBuffer, _uploadStagingBuffer, upload.buffer, 1, &upload.copy);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	_perturbationUploads.clear();
+}
+
+void vulkan_renderer::create_glitch_buffer()
+{
+	VkDeviceSize size = (VkDeviceSize)_iterationExtent.width * _iterationExtent.height * sizeof(float);
+
+	if (_glitchBuffer != nullptr && _glitchBufferSize == size)
+		return;
+
+	if (_glitchBuffer != nullptr)
+	{
+		vkUnmapMemory(_logicalDevice, _glitchBufferMemory);
+		vkDestroyBuffer(_logicalDevice, _glitchBuffer, nullptr);
+		vkFreeMemory(_logicalDevice, _glitchBufferMemory, nullptr);
+	}
+
+	// The shader writes it straight into host-visible memory. That's slower than device
+	// local memory, but it's only one float per pixel, against many iterations' work,
+	// and it saves copying it back.
+	createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		_glitchBuffer, _glitchBufferMemory);
+
+	void* mapped;
+	vkMapMemory(_logicalDevice, _glitchBufferMemory, 0, size, 0, &mapped);
+	_glitches = (float*)mapped;
+	_glitchBufferSize = size;
+}
+
+void vulkan_renderer::create_perturbation_descriptor_set()
+{
+	// Binding 0 is the iteration buffer, 1 and 2 the reference orbit and its BLA table,
+	// and 3 the glitch buffer. All of them are only ever seen by the compute stage.
+	const uint32_t bindingCount = 4;
+	VkDescriptorSetLayoutBinding bindings[bindingCount]{};
+
+	for (uint32_t i = 0; i < bindingCount; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bindingCount;
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(_logicalDevice, &layoutInfo, nullptr, &_perturbationSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create perturbation descriptor set layout!");
+	}
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = bindingCount;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(_logicalDevice, &poolInfo, nullptr, &_perturbationDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create perturbation descriptor pool!");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = _perturbationDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &_perturbationSetLayout;
+
+	if (vkAllocateDescriptorSets(_logicalDevice, &allocInfo, &_perturbationDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate perturbation descriptor set!");
+	}
+}
+
+void vulkan_renderer::create_perturbation_pipeline(uint32_t variant)
+{
+	// Variant 0 holds deltas in floats, variant 1 in floatexps.
+	if (_perturbationShaders[variant] == nullptr)
+	{
+		_perturbationShaders[variant] = variant == 0
+			? compile_shader("perturbation_compute_shader", mandelbrot_perturbation_info::MANDELBROT_PERTURBATION_SHADER, shaderc_shader_kind::shaderc_compute_shader)
+			: compile_shader("perturbation_floatexp_compute_shader", mandelbrot_perturbation_info::MANDELBROT_PERTURBATION_FLOATEXP_SHADER, shaderc_shader_kind::shaderc_compute_shader);
+	}
+
+	if (_perturbationPipelineLayout == nullptr)
+	{
+		VkPushConstantRange pushConstant{};
+		pushConstant.offset = 0;
+		pushConstant.size = sizeof(mandelbrot_perturbation_info);
+		pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &_perturbationSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+		if (vkCreatePipelineLayout(_logicalDevice, &pipelineLayoutInfo, nullptr, &_perturbationPipelineLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create perturbation pipeline layout!");
+		}
+	}
+
+	// The same workgroup size as the compute shader's.
+	uint32_t workgroupSize[] = { _workgroupSize.width, _workgroupSize.height };
+
+	VkSpecializationMapEntry mapEntries[2]{};
+	mapEntries[0].constantID = 0;
+	mapEntries[0].offset = 0;
+	mapEntries[0].size = sizeof(uint32_t);
+	mapEntries[1].constantID = 1;
+	mapEntries[1].offset = sizeof(uint32_t);
+	mapEntries[1].size = sizeof(uint32_t);
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = 2;
+	specializationInfo.pMapEntries = mapEntries;
+	specializationInfo.dataSize = sizeof(workgroupSize);
+	specializationInfo.pData = workgroupSize;
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = _perturbationShaders[variant];
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineInfo.layout = _perturbationPipelineLayout;
+
+	if (vkCreateComputePipelines(_logicalDevice, _pipelineCache, 1, &pipelineInfo, nullptr, &_perturbationPipelines[variant]) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create perturbation pipeline!");
+	}
+}
+
+uint64_t vulkan_renderer::run_perturbation_pass(uint32_t slot, const mandelbrot_perturbation_info& info, bool floatexpDeltas, const float* glitches)
+{
+	VkExtent2D extent = _target->extent();
+
+	if (_computePipeline == nullptr || extent.width != info.surface_width || extent.height != info.surface_height)
+		return 0;
+
+	if (_bytesPerPixel != sizeof(mandelbrot_pixel_result))
+	{
+		throw std::runtime_error("The perturbation shaders write mandelbrot_pixel_results, and the loaded compute shader doesn't.");
+	}
+
+	if (slot >= PERTURBATION_REFERENCE_SLOTS || _perturbationReferences[slot].orbit == nullptr)
+	{
+		throw std::runtime_error("No reference orbit has been uploaded to that slot.");
+	}
+
+	create_iteration_buffer();
+
+	if (_iterationBuffer == nullptr)
+		return 0;
+
+	create_glitch_buffer();
+
+	if (_perturbationSetLayout == nullptr)
+		create_perturbation_descriptor_set();
+
+	uint32_t variant = floatexpDeltas ? 1 : 0;
+
+	if (_perturbationPipelines[variant] == nullptr)
+		create_perturbation_pipeline(variant);
+
+	// The last pass may still be using the set, and reading the glitch buffer.
+	wait_for_frame(_perturbationPass);
+
+	const perturbation_reference& reference = _perturbationReferences[slot];
+	VkBuffer buffers[] = { _iterationBuffer, reference.orbit, reference.bla, _glitchBuffer };
+	VkDescriptorBufferInfo bufferInfos[4]{};
+	VkWriteDescriptorSet descriptorWrites[4]{};
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		bufferInfos[i].buffer = buffers[i];
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = VK_WHOLE_SIZE;
+
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = _perturbationDescriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(_logicalDevice, 4, descriptorWrites, 0, nullptr);
+
+	size_t pixels = (size_t)extent.width * extent.height;
+
+	if (info.glitched_only)
+		memcpy(_glitches, glitches, pixels * sizeof(float));
+
+	// The iteration buffer no longer holds any one frame until the pass is presented.
+	_iterationBufferValid = false;
+	_refining = false;
+
+	// A deep view can take far longer than a driver lets a single submission run
+	// before giving up on the device, so the surface goes a few tiles at a time,
+	// as many as the schedule reckons fit in the budget.
+	progressive_schedule& schedule = _perturbationSchedules[info.glitched_only ? 1 : 0];
+	schedule.set_options(_schedule.options());
+	schedule.set_work_density(1.0);
+	schedule.begin_frame(extent.width, extent.height);
+
+	// The pass takes a frame's place, so that it's numbered like one and its fence
+	// follows its batches. It has nothing of its own to record.
+	frame_resources& frame = next_frame();
+	bool firstBatch = true;
+
+	while (!schedule.finished())
+	{
+		// As with a progressive frame, taking the next batch's resources reads the timings
+		// of the batch before last, in time for the schedule to plan this one with them.
+		batch_resources& batch = next_batch_resources();
+		VkCommandBuffer commandBuffer = batch.command_buffer;
+
+		const std::vector<tile>& tiles = schedule.next_batch();
+		bool timed = _timestampQueryPool != nullptr && tiles.size() <= _timestampCapacity;
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+
+		// Like a frame's batches, the pass's can queue up behind the frames before it, but
+		// not overlap with them: they all write the same iteration buffer.
+		VkMemoryBarrier previousBatch{};
+		previousBatch.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		previousBatch.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		previousBatch.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 1, &previousBatch, 0, nullptr, 0, nullptr);
+
+		// The reference orbits and BLA tables uploaded since the last pass.
+		if (firstBatch)
+			record_perturbation_uploads(commandBuffer);
+
+		if (timed)
+		{
+			vkCmdResetQueryPool(commandBuffer, _timestampQueryPool, _firstQuery, (uint32_t)tiles.size() + 1);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampQueryPool, _firstQuery);
+		}
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _perturbationPipelines[variant]);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _perturbationPipelineLayout, 0, 1, &_perturbationDescriptorSet, 0, nullptr);
+
+		mandelbrot_perturbation_info rect = info;
+
+		for (uint32_t i = 0; i < tiles.size(); i++)
+		{
+			const tile& t = tiles[i];
+			rect.rect_left = t.left;
+			rect.rect_top = t.top;
+			rect.rect_width = t.width;
+			rect.rect_height = t.height;
+
+			vkCmdPushConstants(commandBuffer, _perturbationPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(rect), &rect);
+
+			uint32_t groupsX = (t.width + _workgroupSize.width - 1) / _workgroupSize.width;
+			uint32_t groupsY = (t.height + _workgroupSize.height - 1) / _workgroupSize.height;
+			vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+			if (timed)
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampQueryPool, _firstQuery + i + 1);
+		}
+
+		// For the color pass, and for reading the glitches back.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to record command buffer!");
+		}
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_batch(batch, submitInfo, schedule, tiles.size(), timed);
+
+		firstBatch = false;
+	}
+
+	submit_frame_fence(frame);
+	frame.frame = ++_submittedFrames;
+	_currentFrame = (_currentFrame + 1) % (uint32_t)_frames.size();
+	_perturbationPass = frame.frame;
+
+	return _perturbationPass;
+}
+
+void vulkan_renderer::read_glitches(uint64_t pass, float* glitches)
+{
+	// Later passes write the same buffer, so only the last pass's glitches are there to read.
+	if (pass == 0 || pass != _perturbationPass)
+	{
+		throw std::runtime_error("Only the last perturbation pass's glitches can be read.");
+	}
+
+	wait_for_frame(pass);
+	memcpy(glitches, _glitches, (size_t)_glitchBufferSize);
+}
+
+void vulkan_renderer::cleanup_perturbation()
+{
+	for (perturbation_reference& reference : _perturbationReferences)
+	{
+		if (reference.orbit != nullptr)
+			vkDestroyBuffer(_logicalDevice, reference.orbit, nullptr);
+
+		if (reference.orbitMemory != nullptr)
+			vkFreeMemory(_logicalDevice, reference.orbitMemory, nullptr);
+
+		if (reference.bla != nullptr)
+			vkDestroyBuffer(_logicalDevice, reference.bla, nullptr);
+
+		if (reference.blaMemory != nullptr)
+			vkFreeMemory(_logicalDevice, reference.blaMemory, nullptr);
+
+		reference = perturbation_reference();
+	}
+
+	if (_uploadStagingBuffer != nullptr)
+	{
+		vkUnmapMemory(_logicalDevice, _uploadStagingBufferMemory);
+		vkDestroyBuffer(_logicalDevice, _uploadStagingBuffer, nullptr);
+		vkFreeMemory(_logicalDevice, _uploadStagingBufferMemory, nullptr);
+	}
+
+	_uploadStagingBuffer = nullptr;
+	_uploadStagingBufferMemory = nullptr;
+	_uploadStagingCapacity = 0;
+	_uploadStagingUsed = 0;
+	_uploadStaging = nullptr;
+	_perturbationUploads.clear();
+
+	for (VkShaderModule& shader : _perturbationShaders)
+	{
+		if (shader != nullptr)
+			vkDestroyShaderModule(_logicalDevice, shader, nullptr);
+
+		shader = nullptr;
+	}
+
+	if (_perturbationDescriptorPool != nullptr)
+		vkDestroyDescriptorPool(_logicalDevice, _perturbationDescriptorPool, nullptr);
+
+	if (_perturbationSetLayout != nullptr)
+		vkDestroyDescriptorSetLayout(_logicalDevice, _perturbationSetLayout, nullptr);
+
+	_perturbationDescriptorPool = nullptr;
+	_perturbationDescriptorSet = nullptr;
+	_perturbationSetLayout = nullptr;
+}
+
+bool vulkan_renderer::preview_zoom(float scale, float centerX, float centerY, void* pushData, const void* computePushData)
+{
+	// Like panning, the preview needs a complete last frame, or at least a preview of one,
+	// of the same size.
+	VkExtent2D extent = _target->extent();
+
+	if (_computePipeline == nullptr || !(_iterationBufferValid || _refining) || computePushData == nullptr ||
+		extent.width != _iterationExtent.width || extent.height != _iterationExtent.height || !(scale > 0.0f))
+	{
+		return false;
+	}
+
+	if (_resamplePipeline == nullptr)
+		create_resample_pipeline();
+
+	_computePushData.resize(_computePushDataSize);
+	memcpy(_computePushData.data(), computePushData, _computePushDataSize);
+
+	_refinePushData.resize(_pushDataSize);
+	memcpy(_refinePushData.data(), pushData, _pushDataSize);
+
+	resample_iteration_buffer(scale, centerX, centerY);
+
+	// Anything cached goes straight over the preview, and needs no refining.
+	tile whole = { 0, 0, extent.width, extent.height };
+	_refineRegions.assign(1, whole);
+
+	if (caching())
+		fill_from_cache(std::vector<tile>(1, whole), _refineRegions);
+
+	// Show the preview straight away, then start refining it, coarsest pass first.
+	_iterationBufferValid = _refineRegions.empty();
+	_refining = !_refineRegions.empty();
+
+	if (_refining)
+		begin_refine_pass(COARSEST_REFINE_STEP);
+
+	if (!render_frame(pushData, &_noTiles))
+	{
+		// The resampling went with the frame, so there's no preview to refine.
+		_iterationBufferValid = false;
+		_refining = false;
+		return false;
+	}
+
+	return true;
+}
+
+bool vulkan_renderer::refine_frame()
+{
+	if (!_refining)
+		return false;
+
+	if (_schedule.finished())
+		begin_refine_pass(_refineStep / 2);
+
+	_pixelStep = _refineStep;
+	_previousStep = _refineStep == COARSEST_REFINE_STEP ? 0 : _refineStep * 2;
+
+	bool drawn = render_frame(_refinePushData.data(), nullptr, true);
+
+	_pixelStep = 1;
+	_previousStep = 0;
+
+	if (!drawn)
+	{
+		// The surface changed size, or can't be drawn on at all right now.
+		// Either way, whatever draws next has to start over.
+		_refining = false;
+		return false;
+	}
+
+	// The last pass's last batch carried the readback for the cache.
+	if (_refineStep == 1 && _schedule.finished())
+	{
+		_refining = false;
+		_iterationBufferValid = true;
+	}
+
+	return _refining;
+}
+
+void vulkan_renderer::begin_refine_pass(uint32_t pixelStep)
+{
+	// The coarsest pass computes one pixel in every pixelStep x pixelStep block.
+	// Each pass after that computes the three quarters of its grid the pass before didn't.
+	_refineStep = pixelStep;
+
+	double blocks = 1.0 / ((double)pixelStep * pixelStep);
+	_schedule.set_work_density(pixelStep == COARSEST_REFINE_STEP ? blocks : 0.75 * blocks);
+
+	VkExtent2D extent = _target->extent();
+	_schedule.begin_frame(extent.width, extent.height, _refineRegions);
+}
+
+void vulkan_renderer::resample_iteration_buffer(float scale, float centerX, float centerY)
+{
+	// Recorded at the start of the next frame, like a pan's shift: the last frame's results
+	// are copied over to the spare buffer (binding 1), and resampled back from there into
+	// the iteration buffer (binding 0). The frames still in flight needn't be waited for.
+	_resample.width = _iterationExtent.width;
+	_resample.height = _iterationExtent.height;
+	_resample.center_x = centerX;
+	_resample.center_y = centerY;
+	_resample.scale = scale;
+	_resampling = true;
+}
+
+void vulkan_renderer::shift_iteration_buffer(int32_t deltaX, int32_t deltaY)
+{
+	// Moves every stored result deltaX pixels right and deltaY pixels down.
+	// A buffer can't be copied onto an overlapping part of itself, so the results
+	// are copied over to the spare buffer and back again. Both copies are recorded at
+	// the start of the next frame, so the pan needn't wait for the frames still in
+	// flight, and the descriptor set they're using needn't change.
+	VkExtent2D extent = _iterationExtent;
+	VkDeviceSize rowSize = (VkDeviceSize)extent.width * _bytesPerPixel;
+
+	uint32_t keptColumns = extent.width - (uint32_t)std::abs(deltaX);
+	uint32_t keptRows = extent.height - (uint32_t)std::abs(deltaY);
+	uint32_t srcX = deltaX < 0 ? (uint32_t)-deltaX : 0;
+	uint32_t dstX = deltaX > 0 ? (uint32_t)deltaX : 0;
+	uint32_t srcY = deltaY < 0 ? (uint32_t)-deltaY : 0;
+	uint32_t dstY = deltaY > 0 ? (uint32_t)deltaY : 0;
+
+	// Rows that stay whole can go in one block. Otherwise each row is its own region.
+	std::vector<VkBufferCopy> regions;
+
+	if (deltaX == 0)
+	{
+		VkBufferCopy region{};
+		region.srcOffset = srcY * rowSize;
+		region.dstOffset = dstY * rowSize;
+		region.size = keptRows * rowSize;
+		regions.push_back(region);
+	}
+	else
+	{
+		regions.resize(keptRows);
+
+		for (uint32_t row = 0; row < keptRows; row++)
+		{
+			regions[row].srcOffset = (srcY + row) * rowSize + (VkDeviceSize)srcX * _bytesPerPixel;
+			regions[row].dstOffset = (dstY + row) * rowSize + (VkDeviceSize)dstX * _bytesPerPixel;
+			regions[row].size = (VkDeviceSize)keptColumns * _bytesPerPixel;
+		}
+	}
+
+	// The copy back puts each region straight back where the first copy put it.
+	// The uncovered strips still hold the old results, but they're about to be computed anyway.
+	_shiftCopies = regions;
+	_shiftBackCopies = regions;
+
+	for (VkBufferCopy& region : _shiftBackCopies)
+		region.srcOffset = region.dstOffset;
+}
+
+bool vulkan_renderer::render_frame(void* pushData, const std::vector<tile>* regions, bool continueSchedule)
+{
+	/*
+	Rendering a frame in Vulkan consists of a common set of steps:
+
+		* Wait for the previous frame to finish.
+	      (if rendering multiple frames in flight, this entails waiting
+		   on the fence for the current frame to be ready, allowing the GPU
+		   to catch up to the CPU).
+
+		* Acquire an image from the swap chain.
+
+		* Record a command buffer which draws the scene onto that image.
+
+		* Submit the recorded command buffer.
+
+		* Present the swap chain image.
+
+	=== Semaphores ===
+
+	A semaphore is used to add order between queue operations.
+	Queue operations refer to the work we submit to a queue, either in
+	a command buffer or from within a function.
+
+	Two kinds of semaphores in Vulkan: Binary and Timeline.
+	Tutorial only covers Binary.
+
+	The way we use a semaphore to order queue operations is by providing
+	the same semaphore as a "signal" semaphore in one queue operation,
+	and as a "wait" semaphore in another queue operation.
+
+		A signals S when it completes.
+		B waits on S to begin.
+
+		After operation B begins executing, semaphore S is automatically
+		reset back to being unsignaled, allowing it to be used again.
+
+	=== Fences ===
+
+	A fence has a similar purpose, in that it is used to synchronize execution,
+	but it is for ordering the execution on the CPU, otherwise known as the host.
+	If the host needs to know when the GPU has finished something, we use a fence.
+
+	Unlike semaphores, fences must be reset manually to put them back
+	into the unsignaled state. This is because fences are used to control
+	the execution of the host, and so the host gets to decide when to reset the fence.
+
+	Semaphores: Control execution order of operations on the GPU
+	Fences: Used to keep CPU and GPU in sync with each other.
+
+	====
+	
+	=== Frames in Flight ===
+
+	The Mandelbrot Explorer isn't animated, but waiting for each frame to finish
+	before returning would still hold up whoever's drawing for as long as the GPU
+	takes over it, e.g. the UI thread on every mouse move. So each frame gets its
+	own command buffer, semaphores and fence, and is only waited for when its turn
+	comes round again, frames_in_flight() frames later.
+
+	*/
+
+	bool compute = _computePipeline != nullptr;
+
+	// Wait for the last frame that used this frame's resources to finish with them.
+	// Its semaphores have been waited on by then, and its command buffer is free.
+	frame_resources& frame = next_frame();
+
+	// Acquire an image from the target to draw onto.
+	// For a swap chain target, this is where we find out which swap chain image we got.
+	uint32_t imageIndex;
+
+	if (!_target->acquire_image(frame.image_available, imageIndex))
+	{
+		// Copies meant for this frame would only confuse the next one.
+		// A new palette's still good for whichever frame comes next.
+		_shiftCopies.clear();
+		_shiftBackCopies.clear();
+		_cacheFills.clear();
+		_cacheReadbacks.clear();
+		_resampling = false;
+		return false;
+	}
+
+	// Work out which tiles go into which submission.
+	// Without progressive rendering, every region goes out in a single submission.
+	// No regions means just the one color pass over the stored results.
+	VkExtent2D extent = _target->extent();
+	bool complete = true;
+
+	tile whole = { 0, 0, extent.width, extent.height };
+	_fullFrame.assign(1, whole);
+
+	if (regions == nullptr)
+		regions = &_fullFrame;
+
+	if (compute && (extent.width != _iterationExtent.width || extent.height != _iterationExtent.height))
+	{
+		// Acquiring the image resized the swap chain out from under us,
+		// and the iteration buffer no longer matches it. The image has to be
+		// presented regardless, so just clear it, and let the caller draw it properly.
+		_fullFrame.clear();
+		regions = &_noTiles;
+		complete = false;
+
+		// Nor do the copies queued up for it, or the tiles it was to read back.
+		_shiftCopies.clear();
+		_shiftBackCopies.clear();
+		_cacheFills.clear();
+		_cacheReadbacks.clear();
+		_resampling = false;
+	}
+
+	// Continuing a schedule draws just its next batch, and presents that as the whole frame.
+	bool progressive = (_progressive || continueSchedule) && !regions->empty();
+
+	if (progressive && !continueSchedule)
+	{
+		_schedule.set_work_density(1.0);
+		_schedule.begin_frame(extent.width, extent.height, *regions);
+	}
+
+	bool firstBatch = true;
+	bool lastBatch = false;
+
+	while (!lastBatch)
+	{
+		// A progressive frame's batches each take the next of the batch resources, so that one
+		// can be recorded while the one before it runs. Taking them reads the timings of the
+		// batch before last, in time for the schedule to plan this one with them. A whole frame
+		// goes in the frame's own command buffer, which next_frame() has made sure is free.
+		batch_resources* batch = progressive ? &next_batch_resources() : nullptr;
+		VkCommandBuffer commandBuffer = progressive ? batch->command_buffer : frame.command_buffer;
+
+		const std::vector<tile>& tiles = progressive ? _schedule.next_batch() : *regions;
+		lastBatch = continueSchedule || (progressive ? _schedule.finished() : true);
+
+		// Only progressive frames need their tiles timed.
+		bool timed = progressive && _timestampQueryPool != nullptr && tiles.size() <= _timestampCapacity;
+
+		// Refining's last batch leaves the whole view computed, so it's the one to read the
+		// computed regions back for the cache, like any other frame's last batch.
+		if (continueSchedule && _pixelStep == 1 && _schedule.finished() && caching())
+			read_back_to_cache(_refineRegions);
+
+		// Reset the command buffer to make sure it's able to be recorded.
+		if (!progressive)
+			vkResetCommandBuffer(frame.command_buffer, 0);
+
+		// Now record the command buffer.
+		record_command_buffer(commandBuffer, imageIndex, pushData, tiles, firstBatch, lastBatch, timed);
+
+		// Now submit the command buffer to the graphics queue.
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+		// The pipeline should stop & wait on writing colors to the image until
+		// the image acquired from the swap chain becomes available to write to.
+		// (no problem running the prior steps in the pipeline before then - 
+		//  I guess that includes the vertex shader? How about the fragment shader?)
+
+		// Slight problem: 
+		// The render pass will attempt to do a layout transition on the selected image
+		// at the start of the pipeline, before it's time to write colors 
+		// and before the image acquired from the swap chain is available.
+
+		// Two options:
+		// 1) Wait at the beginning of the pipeline for the image to be available,
+		//    rather than at the color output stage
+		//    (i.e, use VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT in our waitStages). 
+		//    
+		// 2) Make the render pass wait for the color output stage
+		//    to begin the layout transition.
+		//
+		// Tutorial uses the second approach.
+		//
+		// An offscreen target has nothing to wait on and nothing to present,
+		// so it doesn't use either semaphore. When a frame is split over several
+		// submissions, only the first to draw onto the image waits for it,
+		// and only the last signals that it's ready to present. With a compute
+		// shader, the image isn't drawn onto until the last submission.
+
+		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+		bool waitSemaphore = _target->uses_semaphores() && (compute ? lastBatch : firstBatch);
+		bool signalSemaphore = _target->uses_semaphores() && lastBatch;
+
+		submitInfo.waitSemaphoreCount = waitSemaphore ? 1 : 0;
+		submitInfo.pWaitSemaphores = waitSemaphore ? &frame.image_available : nullptr;
+		submitInfo.pWaitDstStageMask = waitSemaphore ? waitStages : nullptr;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.signalSemaphoreCount = signalSemaphore ? 1 : 0;
+		submitInfo.pSignalSemaphores = signalSemaphore ? &frame.render_finished : nullptr;
+
+		// The last parameter references an optional fence that will be signaled 
+		// when the command buffer finished execution. This allows us to know 
+		// when it is safe for the command buffer to be reused.
+		//
+		// Nothing waits for a batch here. Its timings are read once it's finished.
+
+		if (progressive)
+		{
+			submit_batch(*batch, submitInfo, _schedule, tiles.size(), timed);
+		}
+		else
+		{
+			// The fence is only reset once there's definitely a submission coming to signal it again.
+			vkResetFences(_logicalDevice, 1, &frame.in_flight);
+
+			if (vkQueueSubmit(_graphicsQueue, 1, &submitInfo, frame.in_flight) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit draw command buffer!");
+			}
+		}
+
+		firstBatch = false;
+	}
+
+	// A progressive frame's own fence follows its batches.
+	if (progressive)
+		submit_frame_fence(frame);
+
+	// When the command buffer finishes executing, then present the image.
+	_target->present(frame.render_finished, imageIndex);
+
+	// No waiting for the frame to finish. The next frame uses the next set of resources.
+	frame.frame = ++_submittedFrames;
+	_currentFrame = (_currentFrame + 1) % (uint32_t)_frames.size();
+
+	return complete;
+}
+
+double vulkan_renderer::read_batch_milliseconds(uint32_t firstQuery, size_t tileCount, std::vector<double>& tileMilliseconds)
+{
+	if (_timestampQueryPool == nullptr || tileCount > _timestampCapacity)
+		return -1.0;
+
+	std::vector<uint64_t> timestamps(tileCount + 1);
+
+	VkResult result = vkGetQueryPoolResults(_logicalDevice, _timestampQueryPool, firstQuery, (uint32_t)timestamps.size(),
+		timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (result != VK_SUCCESS)
+		return -1.0;
+
+	// Draws can overlap a little on the GPU, so the time between
+	// two timestamps isn't exactly one tile's cost, but it's close enough.
+	tileMilliseconds.resize(tileCount);
+
+	for (size_t i = 0; i < tileCount; i++)
+	{
+		uint64_t ticks = (timestamps[i + 1] - timestamps[i]) & _timestampMask;
+		tileMilliseconds[i] = ticks * _timestampPeriod / 1000000.0;
+	}
+
+	uint64_t ticks = (timestamps[tileCount] - timestamps[0]) & _timestampMask;
+	return ticks * _timestampPeriod / 1000000.0;
+}
+
+void vulkan_renderer::record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, void* pushData,
+	const std::vector<tile>& tiles, bool firstBatch, bool lastBatch, bool timed)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	// The flags parameter specifies how we're going to use the command buffer.
+
+	// Available flags:
+	//	VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+	//	  The command buffer will be rerecorded right after executing it once.
+	//	VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT
+	//	  This is a secondary command buffer that will be entirely 
+	//    within a single render pass. 
+	//  VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT
+	//	  The command buffer can be resubmitted while it is also 
+	//    already pending execution.
+
+	// None of these flags are applicable to us right now.
+
+	beginInfo.flags = 0;
+
+	// pInheritanceInfo is only relevant for secondary command buffers.
+	// It specifies which state to inherit from the calling primary command buffers.
+
+	beginInfo.pInheritanceInfo = nullptr;
+
+	// If the command buffer was already recorded once, then a call to 
+	// vkBeginCommandBuffer will implicitly reset it. 
+	// It's not possible to append commands to a buffer at a later time.
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+
+	// The frame before this one may still be running. It reads and writes the same iteration
+	// buffer, and the same readback buffer for an offscreen target, so it has to be done with
+	// them before this one starts. Frames can queue up on the GPU, but not overlap on it.
+	VkMemoryBarrier previousFrame{};
+	previousFrame.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	previousFrame.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	previousFrame.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0, 1, &previousFrame, 0, nullptr, 0, nullptr);
+
+	// A pan's shift and the cached tiles go into the iteration buffer before anything reads it.
+	frame_resources& frame = _frames[_currentFrame];
+
+	if (firstBatch)
+		record_frame_start_copies(commandBuffer, frame);
+
+	// Queries have to be reset outside of a render pass before they can be written again.
+	if (timed)
+	{
+		vkCmdResetQueryPool(commandBuffer, _timestampQueryPool, _firstQuery, (uint32_t)tiles.size() + 1);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _timestampQueryPool, _firstQuery);
+	}
+
+	if (_computePipeline != nullptr)
+	{
+		record_compute_tiles(commandBuffer, tiles, timed);
+
+		// Once every tile of the iteration buffer is written, color the whole surface in one pass.
+		if (lastBatch)
+		{
+			// The fragment shader mustn't read the buffer until the compute shader's
+			// writes have finished and are visible to it.
+			VkBufferMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = _iterationBuffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+
+			vkCmdPipelineBarrier(commandBuffer,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+			record_render_pass(commandBuffer, imageIndex, pushData, _fullFrame, _renderPass, false);
+		}
+	}
+	else
+	{
+		// Only the first batch of tiles in a frame clears the image.
+		record_render_pass(commandBuffer, imageIndex, pushData, tiles,
+			firstBatch ? _renderPass : _continueRenderPass, timed);
+	}
+
+	// Once every tile is drawn, let the target do whatever it needs with the finished image,
+	// and copy the freshly computed tiles out for the cache.
+	if (lastBatch)
+	{
+		_target->record_after_render_pass(commandBuffer, imageIndex);
+		record_cache_readback(commandBuffer, frame);
+	}
+
+	// We now finish recording the command buffer.
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record command buffer!");
+	}
+}
+
+void vulkan_renderer::record_render_pass(VkCommandBuffer commandBuffer, uint32_t imageIndex, void* pushData,
+	const std::vector<tile>& tiles, VkRenderPass renderPass, bool timed)
+{
+	// Drawing starts by beginning the render pass with vkCmdBeginRenderPass.
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+
+	// The first parameters are the render pass itself and the attachments to bind.
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = _target->framebuffer(imageIndex);
 
 	// These define the size of the render area. 
 	// The render area defines where the shader loads and stores take place.
 	// The pixels outside this region will have undefined values.
 	// It should match the size of the attachments for best performance.
 	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = _selectedSwapExtent;
+	renderPassInfo.renderArea.extent = _target->extent();
 
 	// These last two parameters define the clear values to use for VK_ATTACHMENT_LOAD_OP_CLEAR,
 	// which we used as the load operation for the color attachment. 
@@ -1609,6 +3373,12 @@ void vulkan_renderer::record_command_buffer(VkCommandBuffer commandBuffer, uint3
 	// The second parameter specifies if the pipeline object is a graphics or compute pipeline.
 	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipeline);
 
+	if (_computePipeline != nullptr)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout,
+			0, 1, &_descriptorSet, 0, nullptr);
+	}
+
 	VkBuffer vertexBuffers[]{ _vertexBuffer };
 	VkDeviceSize offsets[] = { 0 };
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
@@ -1617,11 +3387,13 @@ void vulkan_renderer::record_command_buffer(VkCommandBuffer commandBuffer, uint3
 	// The viewport and scissor state for this pipeline were set to be dynamic.
 	// So we need to set them in the command buffer before issuing our draw command:
 
+	VkExtent2D extent = _target->extent();
+
 	VkViewport viewport{};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(_selectedSwapExtent.width);
-	viewport.height = static_cast<float>(_selectedSwapExtent.height);
+	viewport.width = static_cast<float>(extent.width);
+	viewport.height = static_cast<float>(extent.height);
 	viewport.minDepth = 0.0f;
 	viewport.maxDepth = 1.0f;
 
@@ -1630,34 +3402,527 @@ void vulkan_renderer::record_command_buffer(VkCommandBuffer commandBuffer, uint3
 
 	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = _selectedSwapExtent;
-
-	// We can set multiple scissors?
-	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
 	if (_pushDataSize > 0)
 	{
 		vkCmdPushConstants(commandBuffer, _pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, _pushDataSize, pushData);
 	}
 
-	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(_indices.size()), 1, 0, 0, 0);
+	// The quad always covers the whole surface, and the scissor
+	// restricts each draw to a single tile. The fragment shader only
+	// ever runs for pixels inside the scissor.
+	for (uint32_t i = 0; i < tiles.size(); i++)
+	{
+		const tile& t = tiles[i];
+
+		VkRect2D scissor{};
+		scissor.offset = { (int32_t)t.left, (int32_t)t.top };
+		scissor.extent = { t.width, t.height };
+
+		// We can set multiple scissors?
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(_indices.size()), 1, 0, 0, 0);
+
+		if (timed)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampQueryPool, _firstQuery + i + 1);
+	}
 
 	vkCmdEndRenderPass(commandBuffer);
+}
 
-	// We now finish recording the command buffer.
-	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+void vulkan_renderer::record_compute_tiles(VkCommandBuffer commandBuffer, const std::vector<tile>& tiles, bool timed)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computePipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _computePipelineLayout,
+		0, 1, &_descriptorSet, 0, nullptr);
+
+	for (uint32_t i = 0; i < tiles.size(); i++)
 	{
-		throw std::runtime_error("failed to record command buffer!");
+		const tile& t = tiles[i];
+
+		// Each tile gets its own rectangle at the front of the push constants,
+		// followed by the pass's pixel step. Push constants are captured when
+		// they're recorded, so reusing the same block for every tile is fine.
+		uint32_t header[] = { t.left, t.top, t.width, t.height, _pixelStep, _previousStep };
+		memcpy(_computePushData.data(), header, sizeof(header));
+
+		vkCmdPushConstants(commandBuffer, _computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+			0, _computePushDataSize, _computePushData.data());
+
+		// Enough workgroups to cover the tile, one invocation per block of pixels,
+		// with blocks aligned to the surface rather than the tile.
+		// The shader ignores invocations past its edge.
+		uint32_t firstX = t.left - t.left % _pixelStep;
+		uint32_t firstY = t.top - t.top % _pixelStep;
+		uint32_t blocksX = (t.left + t.width - firstX + _pixelStep - 1) / _pixelStep;
+		uint32_t blocksY = (t.top + t.height - firstY + _pixelStep - 1) / _pixelStep;
+		uint32_t groupsX = (blocksX + _workgroupSize.width - 1) / _workgroupSize.width;
+		uint32_t groupsY = (blocksY + _workgroupSize.height - 1) / _workgroupSize.height;
+
+		vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+		if (timed)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _timestampQueryPool, _firstQuery + i + 1);
+	}
+}
+
+namespace
+{
+	int64_t floor_divide(int64_t a, int64_t b)
+	{
+		int64_t quotient = a / b;
+		return (a % b != 0 && (a < 0) != (b < 0)) ? quotient - 1 : quotient;
+	}
+
+	bool intersect(const tile& a, const tile& b, tile& result)
+	{
+		uint32_t left = std::max(a.left, b.left);
+		uint32_t top = std::max(a.top, b.top);
+		uint32_t right = std::min(a.left + a.width, b.left + b.width);
+		uint32_t bottom = std::min(a.top + a.height, b.top + b.height);
+
+		if (left >= right || top >= bottom)
+			return false;
+
+		result = { left, top, right - left, bottom - top };
+		return true;
+	}
+
+	// One tile of the world grid, and the part of it that's on the surface.
+	struct placed_tile
+	{
+		int64_t tile_x;
+		int64_t tile_y;
+		tile visible;		// in surface pixels.
+		uint32_t offset_x;	// of visible's top-left corner within the tile.
+		uint32_t offset_y;
+		bool whole;
+	};
+
+	std::vector<placed_tile> place_tiles(const tile_cache_view& view, VkExtent2D extent)
+	{
+		const int64_t size = tile_cache::TILE_SIZE;
+
+		int64_t firstX = floor_divide(view.origin_x, size);
+		int64_t firstY = floor_divide(view.origin_y, size);
+		int64_t lastX = floor_divide(view.origin_x + extent.width - 1, size);
+		int64_t lastY = floor_divide(view.origin_y + extent.height - 1, size);
+
+		std::vector<placed_tile> tiles;
+
+		for (int64_t tileY = firstY; tileY <= lastY; tileY++)
+		{
+			for (int64_t tileX = firstX; tileX <= lastX; tileX++)
+			{
+				// The tile's corners relative to the surface. They can hang off either edge.
+				int64_t left = tileX * size - view.origin_x;
+				int64_t top = tileY * size - view.origin_y;
+				int64_t clippedLeft = std::max<int64_t>(left, 0);
+				int64_t clippedTop = std::max<int64_t>(top, 0);
+				int64_t clippedRight = std::min<int64_t>(left + size, extent.width);
+				int64_t clippedBottom = std::min<int64_t>(top + size, extent.height);
+
+				placed_tile placed;
+				placed.tile_x = tileX;
+				placed.tile_y = tileY;
+				placed.visible = { (uint32_t)clippedLeft, (uint32_t)clippedTop,
+					(uint32_t)(clippedRight - clippedLeft), (uint32_t)(clippedBottom - clippedTop) };
+				placed.offset_x = (uint32_t)(clippedLeft - left);
+				placed.offset_y = (uint32_t)(clippedTop - top);
+				placed.whole = placed.visible.width == size && placed.visible.height == size;
+
+				tiles.push_back(placed);
+			}
+		}
+
+		return tiles;
+	}
+}
+
+void vulkan_renderer::set_cache_view(const tile_cache_view& view)
+{
+	_cacheView = view;
+	_cacheViewSet = true;
+}
+
+bool vulkan_renderer::caching()
+{
+	if (!_cacheViewSet || _computePipeline == nullptr || _iterationBuffer == nullptr || !(_cacheView.pixel_size > 0.0))
+		return false;
+
+	VkExtent2D extent = _target->extent();
+	return extent.width == _iterationExtent.width && extent.height == _iterationExtent.height;
+}
+
+vulkan_renderer::frame_resources& vulkan_renderer::next_frame()
+{
+	// The next frame's resources are free once the last frame to use them has finished,
+	// and whatever it read back for the cache has arrived in its staging buffer.
+	frame_resources& frame = _frames[_currentFrame];
+	vkWaitForFences(_logicalDevice, 1, &frame.in_flight, VK_TRUE, UINT64_MAX);
+	collect_cache_readbacks(frame);
+
+	return frame;
+}
+
+void vulkan_renderer::create_cache_staging_buffer(frame_resources& frame)
+{
+	if (frame.cache_staging != nullptr)
+		return;
+
+	// Laid out exactly like the iteration buffer, so that copies between
+	// the two use the same offsets on both sides. Kept mapped for good.
+	createBuffer(
+		_iterationBufferSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		frame.cache_staging,
+		frame.cache_staging_memory);
+
+	void* mapped;
+	vkMapMemory(_logicalDevice, frame.cache_staging_memory, 0, _iterationBufferSize, 0, &mapped);
+	frame.cache_staged = (uint8_t*)mapped;
+}
+
+void vulkan_renderer::cleanup_cache_staging_buffer(frame_resources& frame)
+{
+	if (frame.cache_staging != nullptr)
+	{
+		vkUnmapMemory(_logicalDevice, frame.cache_staging_memory);
+		vkDestroyBuffer(_logicalDevice, frame.cache_staging, nullptr);
+		vkFreeMemory(_logicalDevice, frame.cache_staging_memory, nullptr);
+	}
+
+	frame.cache_staging = nullptr;
+	frame.cache_staging_memory = nullptr;
+	frame.cache_staged = nullptr;
+	frame.cache_readbacks.clear();
+}
+
+void vulkan_renderer::fill_from_cache(const std::vector<tile>& regions, std::vector<tile>& uncached)
+{
+	uncached.clear();
+
+	// Tiles read back by frames that have finished since the last look are worth having first.
+	// The cached ones are staged in the next frame's own buffer, which it copies them out of.
+	collect_finished_frames();
+
+	frame_resources& frame = next_frame();
+	create_cache_staging_buffer(frame);
+
+	const uint32_t size = tile_cache::TILE_SIZE;
+	VkExtent2D extent = _iterationExtent;
+
+	for (const placed_tile& placed : place_tiles(_cacheView, extent))
+	{
+		const uint8_t* data = nullptr;
+		bool lookedUp = false;
+
+		for (const tile& region : regions)
+		{
+			tile piece;
+
+			if (!intersect(placed.visible, region, piece))
+				continue;
+
+			if (!lookedUp)
+			{
+				tile_key key = _cacheView.key(placed.tile_x, placed.tile_y);
+				const std::vector<uint8_t>* cached = _tileCache.find(key);
+
+				if (cached != nullptr)
+				{
+					data = cached->data();
+				}
+				else if (_tileStore.is_open())
+				{
+					// Read straight out of the mapped file, and keep a copy in memory for next time.
+					data = _tileStore.find(key);
+
+					if (data != nullptr)
+						_tileCache.insert(key, std::vector<uint8_t>(data, data + _tileStore.tile_bytes()));
+				}
+
+				lookedUp = true;
+			}
+
+			if (data == nullptr)
+			{
+				uncached.push_back(piece);
+				continue;
+			}
+
+			// Stage the cached rows where they belong in the iteration buffer.
+			for (uint32_t row = 0; row < piece.height; row++)
+			{
+				uint32_t tileX = piece.left - placed.visible.left + placed.offset_x;
+				uint32_t tileY = piece.top + row - placed.visible.top + placed.offset_y;
+
+				VkBufferCopy copy{};
+				copy.srcOffset = ((VkDeviceSize)(piece.top + row) * extent.width + piece.left) * _bytesPerPixel;
+				copy.dstOffset = copy.srcOffset;
+				copy.size = (VkDeviceSize)piece.width * _bytesPerPixel;
+
+				memcpy(frame.cache_staged + copy.srcOffset,
+					data + ((size_t)tileY * size + tileX) * _bytesPerPixel,
+					(size_t)copy.size);
+
+				_cacheFills.push_back(copy);
+			}
+		}
+	}
+}
+
+void vulkan_renderer::read_back_to_cache(const std::vector<tile>& computed)
+{
+	// Only tiles wholly on the surface are complete enough to keep,
+	// and only the ones just computed are worth copying back.
+	VkExtent2D extent = _iterationExtent;
+	_cacheReadbacks.clear();
+
+	for (const placed_tile& placed : place_tiles(_cacheView, extent))
+	{
+		if (!placed.whole)
+			continue;
+
+		for (const tile& region : computed)
+		{
+			tile piece;
+
+			if (intersect(placed.visible, region, piece))
+			{
+				cache_readback readback;
+				readback.key = _cacheView.key(placed.tile_x, placed.tile_y);
+				readback.row_pitch = (VkDeviceSize)extent.width * _bytesPerPixel;
+				readback.offset = (VkDeviceSize)placed.visible.top * readback.row_pitch + (VkDeviceSize)placed.visible.left * _bytesPerPixel;
+
+				_cacheReadbacks.push_back(readback);
+				break;
+			}
+		}
+	}
+}
+
+void vulkan_renderer::record_frame_start_copies(VkCommandBuffer commandBuffer, frame_resources& frame)
+{
+	if (_shiftCopies.empty() && _cacheFills.empty() && !_resampling && !_paletteChanged)
+		return;
+
+	// The frames before this one have finished reading the old palette by now. Updates are
+	// copied into the command buffer as it's recorded, so there's no staging buffer to keep.
+	if (_paletteChanged)
+	{
+		const VkDeviceSize chunk = 65536;
+
+		for (VkDeviceSize offset = 0; offset < _palette.size(); offset += chunk)
+		{
+			VkDeviceSize size = std::min<VkDeviceSize>(chunk, _palette.size() - offset);
+			vkCmdUpdateBuffer(commandBuffer, _paletteBuffer, offset, size, _palette.data() + offset);
+		}
+
+		_paletteChanged = false;
+	}
+
+	if (!_shiftCopies.empty())
+	{
+		vkCmdCopyBuffer(commandBuffer, _iterationBuffer, _spareIterationBuffer, (uint32_t)_shiftCopies.size(), _shiftCopies.data());
+
+		// The copy back can't start reading the spare buffer until the first copy's done writing it.
+		VkMemoryBarrier shifted{};
+		shifted.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		shifted.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		shifted.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &shifted, 0, nullptr, 0, nullptr);
+
+		vkCmdCopyBuffer(commandBuffer, _spareIterationBuffer, _iterationBuffer, (uint32_t)_shiftBackCopies.size(), _shiftBackCopies.data());
+	}
+
+	if (_resampling)
+	{
+		VkBufferCopy whole{};
+		whole.size = _iterationBufferSize;
+		vkCmdCopyBuffer(commandBuffer, _iterationBuffer, _spareIterationBuffer, 1, &whole);
+
+		VkMemoryBarrier copied{};
+		copied.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		copied.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		copied.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &copied, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _resamplePipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _resamplePipelineLayout,
+			0, 1, &_descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, _resamplePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(_resample), &_resample);
+
+		uint32_t groupsX = (_resample.width + _workgroupSize.width - 1) / _workgroupSize.width;
+		uint32_t groupsY = (_resample.height + _workgroupSize.height - 1) / _workgroupSize.height;
+		vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+		// Cached tiles go over the preview, so they have to wait for it.
+		VkMemoryBarrier resampled{};
+		resampled.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		resampled.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		resampled.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 1, &resampled, 0, nullptr, 0, nullptr);
+
+		_resampling = false;
+	}
+
+	// Cached tiles only ever land in the strips a shift uncovers, so the two don't overlap.
+	if (!_cacheFills.empty())
+		vkCmdCopyBuffer(commandBuffer, frame.cache_staging, _iterationBuffer, (uint32_t)_cacheFills.size(), _cacheFills.data());
+
+	// The copies' writes have to be visible to the shaders that follow.
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	_shiftCopies.clear();
+	_shiftBackCopies.clear();
+	_cacheFills.clear();
+}
+
+void vulkan_renderer::record_cache_readback(VkCommandBuffer commandBuffer, frame_resources& frame)
+{
+	if (_cacheReadbacks.empty())
+		return;
+
+	const uint32_t size = tile_cache::TILE_SIZE;
+	create_cache_staging_buffer(frame);
+
+	std::vector<VkBufferCopy> copies;
+	copies.reserve(_cacheReadbacks.size() * size);
+
+	for (const cache_readback& readback : _cacheReadbacks)
+	{
+		for (uint32_t row = 0; row < size; row++)
+		{
+			VkBufferCopy copy{};
+			copy.srcOffset = readback.offset + row * readback.row_pitch;
+			copy.dstOffset = copy.srcOffset;
+			copy.size = (VkDeviceSize)size * _bytesPerPixel;
+			copies.push_back(copy);
+		}
+	}
+
+	// The compute shader's writes (and those of any copies at the start of the frame)
+	// have to land before they can be copied, and the copy's writes before the host can read them.
+	VkMemoryBarrier before{};
+	before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	before.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &before, 0, nullptr, 0, nullptr);
+
+	vkCmdCopyBuffer(commandBuffer, _iterationBuffer, frame.cache_staging, (uint32_t)copies.size(), copies.data());
+
+	VkMemoryBarrier after{};
+	after.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	after.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+		0, 1, &after, 0, nullptr, 0, nullptr);
+
+	// The tiles belong to this frame now, and are collected once its fence has been signaled.
+	frame.cache_readbacks.swap(_cacheReadbacks);
+	_cacheReadbacks.clear();
+}
+
+void vulkan_renderer::collect_cache_readbacks(frame_resources& frame)
+{
+	// Only called once the frame that read the tiles back has finished.
+	const uint32_t size = tile_cache::TILE_SIZE;
+	size_t rowBytes = (size_t)size * _bytesPerPixel;
+
+	for (const cache_readback& readback : frame.cache_readbacks)
+	{
+		std::vector<uint8_t> data(rowBytes * size);
+
+		for (uint32_t row = 0; row < size; row++)
+		{
+			size_t offset = (size_t)(readback.offset + row * readback.row_pitch);
+			memcpy(data.data() + row * rowBytes, frame.cache_staged + offset, rowBytes);
+		}
+
+		if (_tileStore.is_open())
+		{
+			// A store that can't be written to any more (a full disk, say)
+			// is given up on, rather than stopping frames being drawn.
+			try
+			{
+				_tileStore.insert(readback.key, data.data());
+			}
+			catch (const std::runtime_error&)
+			{
+				_tileStore.close();
+			}
+		}
+
+		_tileCache.insert(readback.key, std::move(data));
+	}
+
+	frame.cache_readbacks.clear();
+}
+
+void vulkan_renderer::collect_finished_frames()
+{
+	for (frame_resources& frame : _frames)
+	{
+		if (!frame.cache_readbacks.empty() && vkGetFenceStatus(_logicalDevice, frame.in_flight) == VK_SUCCESS)
+			collect_cache_readbacks(frame);
 	}
+
+	collect_finished_batches();
+	destroy_retired_pipelines(false);
+}
+
+void vulkan_renderer::open_tile_store(const std::string& directory)
+{
+	_tileStoreDirectory = directory;
+	reopen_tile_store();
+}
+
+void vulkan_renderer::close_tile_store()
+{
+	_tileStoreDirectory.clear();
+	_tileStore.close();
+}
+
+void vulkan_renderer::reopen_tile_store()
+{
+	_tileStore.close();
+
+	if (_tileStoreDirectory.empty() || _computeShader == nullptr)
+		return;
+
+	uint32_t tileBytes = tile_cache::TILE_SIZE * tile_cache::TILE_SIZE * _bytesPerPixel;
+	_tileStore.open(_tileStoreDirectory, _computeShaderHash, _computeShaderPrecision, tileBytes);
 }
 
 void vulkan_renderer::load_fragment_shader(std::string code, uint32_t pushDataSize)
 {
 	VkShaderModule shaderModule = compile_shader("custom_fragment_shader", code, shaderc_shader_kind::shaderc_fragment_shader);
 
-	vkDeviceWaitIdle(_logicalDevice);
+	wait_for_frame(_submittedFrames);
 
 	// Cleanup the old fragment shader module.
 	vkDestroyShaderModule(_logicalDevice, _fragmentShader, nullptr);
@@ -1669,3 +3934,101 @@ void vulkan_renderer::load_fragment_shader(std::string code, uint32_t pushDataSi
 	// Finally, recreate the graphics pipeline with the new shader.
 	recreate_graphics_pipeline();
 }
+
+void vulkan_renderer::load_compute_shader(std::string code, uint32_t pushDataSize, uint32_t bytesPerPixel, const std::string& precision)
+{
+	if (!_supportsCompute)
+	{
+		throw std::runtime_error("The graphics queue on this device doesn't support compute shaders.");
+	}
+
+	// The tile rectangle (uvec4) and the pixel steps (two uints) come first.
+	if (pushDataSize < 6 * sizeof(uint32_t))
+	{
+		throw std::runtime_error("Compute shader push constants are too small to hold the tile rectangle.");
+	}
+
+	if (bytesPerPixel == 0)
+	{
+		throw std::runtime_error("Compute shader must write at least one byte per pixel.");
+	}
+
+	VkShaderModule shaderModule = compile_shader("custom_compute_shader", code, shaderc_shader_kind::shaderc_compute_shader);
+
+	// Tiles the old shader's frames read back belong in its cache, not the new one's.
+	wait_for_frame(_submittedFrames);
+
+	if (_computeShader != nullptr)
+		vkDestroyShaderModule(_logicalDevice, _computeShader, nullptr);
+
+	_computeShader = shaderModule;
+	_computePushDataSize = pushDataSize;
+	_bytesPerPixel = bytesPerPixel;
+	_iterationBufferValid = false;
+	_refining = false;
+
+	// Cached tiles are in the old shader's format. The new one gets a tile store of its own.
+	_tileCache.clear();
+	_computeShaderHash = kernel_hash(code);
+	_computeShaderPrecision = precision;
+	reopen_tile_store();
+
+	cleanup_compute_pipeline();
+	create_compute_pipeline();
+}
+
+void vulkan_renderer::set_workgroup_size(uint32_t width, uint32_t height)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+
+	if (width == 0 || height == 0 ||
+		width > properties.limits.maxComputeWorkGroupSize[0] ||
+		height > properties.limits.maxComputeWorkGroupSize[1] ||
+		width * height > properties.limits.maxComputeWorkGroupInvocations)
+	{
+		throw std::runtime_error("Workgroup size is outside the device's limits.");
+	}
+
+	_workgroupSize = { width, height };
+
+	if (_computeShader != nullptr)
+	{
+		wait_for_frame(_submittedFrames);
+		cleanup_compute_pipeline();
+		create_compute_pipeline();
+	}
+}
+
+void vulkan_renderer::set_progressive(bool enabled, const progressive_options& options)
+{
+	_schedule.set_options(options);
+	_progressive = enabled;
+
+	// Make room for a timestamp after every tile of the largest batch.
+	// Batches still in flight write theirs into the old pool, so they're read first.
+	if (_timestampQueryPool != nullptr && options.max_batch_tiles > _timestampCapacity)
+	{
+		for (batch_resources& batch : _batches)
+			vkWaitForFences(_logicalDevice, 1, &batch.in_flight, VK_TRUE, UINT64_MAX);
+
+		collect_finished_batches();
+		create_timestamp_queries(options.max_batch_tiles);
+	}
+}
+
+void vulkan_renderer::read_pixels(std::vector<uint8_t>& pixels)
+{
+	offscreen_target* target = dynamic_cast<offscreen_target*>(_target.get());
+
+	if (target == nullptr)
+	{
+		throw std::runtime_error("Pixels can only be read back from a headless renderer.");
+	}
+
+	// The readback buffer only holds the last frame once it's finished.
+	wait_for_frame(_submittedFrames);
+
+	pixels.resize((size_t)target->pixels_size());
+	memcpy(pixels.data(), target->pixels(), pixels.size());
+}
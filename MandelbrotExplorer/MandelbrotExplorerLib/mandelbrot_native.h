@@ -2,41 +2,237 @@
 #include "pch.h"
 #include <vector>
 #include <string>
+#include <memory>
 #include <shaderc/shaderc.hpp>
 #include "vertex.h"
+#include "render_target.h"
+#include "progressive_schedule.h"
+#include "tile_store.h"
+#include "shader_cache.h"
+#include "background_task.h"
+#include "debug_message_log.h"
 #include <glm/glm.hpp>
 
-struct debug_message
+struct mandelbrot_perturbation_info;
+
+// Where the time went while a renderer was being set up, in milliseconds. Shader compilation
+// and pipeline creation run in the background, alongside the phases on the constructor's
+// thread; the waits are how long that thread then sat idle for them.
+struct startup_statistics
 {
-	std::string text;
-	VkDebugUtilsMessageSeverityFlagBitsEXT severity;
-	VkDebugUtilsMessageTypeFlagsEXT type;
+	// The instance (and the window's surface).
+	double instance_milliseconds = 0.0;
+
+	// Choosing the physical device, the logical device, the pipeline cache, and the target's format.
+	double device_milliseconds = 0.0;
+
+	// The render pass, descriptors, the target's images, command buffers, vertex buffers and sync objects.
+	double resources_milliseconds = 0.0;
+
+	// In the background: compiling every startup shader, then building the graphics pipeline.
+	double shader_compile_milliseconds = 0.0;
+	double pipeline_milliseconds = 0.0;
+
+	double shader_wait_milliseconds = 0.0;
+	double pipeline_wait_milliseconds = 0.0;
+
+	// From the constructor's start to its end.
+	double total_milliseconds = 0.0;
 };
 
 class vulkan_renderer
 {
 public:
 
-	vulkan_renderer(HINSTANCE hinstance, HWND hwnd, bool debug);
+	// precompile lists shaders the caller means to load straight afterwards. They're compiled
+	// in the background while the device is set up, so that loading them needn't wait for it.
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+	vulkan_renderer(HINSTANCE hinstance, HWND hwnd, bool debug, const std::vector<shader_source>& precompile = {});
+#endif
+
+	// Headless renderer. Draws into an offscreen image of the given size
+	// which can be read back with read_pixels() after each frame.
+	vulkan_renderer(uint32_t width, uint32_t height, bool debug, const std::vector<shader_source>& precompile = {});
 	~vulkan_renderer();
 	
 	void dispose();
 	bool disposed() { return _disposed; }
 
-	const std::vector<debug_message>& debug_messages() const { return _messages; };
+	// Safe to call while the validation layer's still adding to them from other threads.
+	std::vector<debug_message> debug_messages() const { return _messages.messages(); }
+	const startup_statistics& setup_statistics() const { return _startup; }
 
 	void load_fragment_shader(std::string code, uint32_t pushDataSize);
 
-	void refresh_surface() { recreate_swap_chain(); }
-	VkExtent2D surface_extent() { return _selectedSwapExtent; }
-
-	void draw_frame(void* pushData = nullptr);
+	// Splits each frame between a compute shader, which writes raw per-pixel results
+	// (bytesPerPixel each) into the iteration buffer, and the fragment shader,
+	// which only has to color them. Both see the iteration buffer as a storage buffer
+	// at set = 0, binding = 0, indexed by y * surface width + x.
+	//
+	// The compute shader's push constants must start with a uvec4 rectangle
+	// (left, top, width, height). The renderer fills it in for each tile it dispatches,
+	// and sizes the dispatch to cover the rectangle with workgroups.
+	//
+	// precision names the number format the shader computes in, for telling apart
+	// the tile stores of shaders that compute the same view differently.
+	void load_compute_shader(std::string code, uint32_t pushDataSize, uint32_t bytesPerPixel, const std::string& precision = "float32");
+	bool supports_compute() { return _supportsCompute; }
+
+	// Workgroup dimensions, given to the compute shader as
+	// specialization constants 0 and 1 (local_size_x_id, local_size_y_id).
+	void set_workgroup_size(uint32_t width, uint32_t height);
+	VkExtent2D workgroup_size() { return _workgroupSize; }
+
+	// Values for the loaded shaders' other specialization constants, one 32-bit word each:
+	// the fragment shader's from constant_id 0, and the compute shader's from constant_id 2.
+	// Each set of values gets a pipeline of its own, built the first time it's asked for and
+	// kept for whenever it's asked for again, up to PIPELINE_VARIANTS of each kind. Loading a
+	// shader or changing the workgroup size starts afresh, with the same values as before.
+	// The values apply to every frame drawn from then on, including any refine_frame()
+	// passes, so the compute shader's shouldn't change in the middle of a refinement.
+	static const size_t PIPELINE_VARIANTS = 8;
+	void set_fragment_specialization(const std::vector<uint32_t>& values);
+	void set_compute_specialization(const std::vector<uint32_t>& values);
+
+	void refresh_surface() { _target->recreate(); }
+	VkExtent2D surface_extent() { return _target->extent(); }
+	VkFormat surface_format() { return _target->format(); }
+	bool headless() { return _headless; }
+
+	// pushData goes to the fragment shader. computePushData goes to the compute shader,
+	// and is only needed once one has been loaded.
+	void draw_frame(void* pushData = nullptr, const void* computePushData = nullptr);
+
+	// Frames aren't waited for. Drawing returns as soon as the frame's recorded and submitted,
+	// leaving the caller free to get on with the next one while the GPU works on it. Up to
+	// frames_in_flight() frames can be queued up like that; drawing another first waits for
+	// the oldest of them to finish. Frames are numbered from 1 in the order they're submitted,
+	// and finish in that order. submitted_frame() is the latest, 0 before there's been one.
+	// Progressive frames (and refine_frame() passes) aren't waited for either. Their batches
+	// go out back to back, and each batch's timings are read when the batch after next is
+	// recorded, by which time it's usually long finished. Only read_pixels() and reading a
+	// perturbation pass's glitches wait for frames themselves, since they need their results
+	// on the CPU. Pans, zoom previews, the tile cache and new palettes don't: their copies go
+	// in the frames' own command buffers.
+	static const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+	static const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+	void set_frames_in_flight(uint32_t count);
+	uint32_t frames_in_flight() const { return (uint32_t)_frames.size(); }
+	uint64_t submitted_frame() const { return _submittedFrames; }
+	bool frame_finished(uint64_t frame);
+	void wait_for_frame(uint64_t frame);
+
+	// The palette the fragment shader colors with: vec4 colors (std430, so 16 bytes each), as many
+	// as fit in bytes, in a storage buffer at set = 0, binding = 2. The shader can find out how many
+	// there are from the buffer's length. Until it's set, there's a single black entry. The colors
+	// are copied in at the start of the next frame, after the frames still in flight have finished
+	// with the old ones. Only a palette of a different length waits for those frames.
+	void set_palette(const void* colors, size_t bytes);
+
+	// Draws the last frame again with new fragment shader push constants (e.g. a new fill color)
+	// and the palette set_palette() was last given, coloring the compute shader's stored results
+	// without recomputing them.
+	// Returns false if there's nothing stored to recolor, in which case draw_frame() is needed.
+	bool recolor_frame(void* pushData);
+
+	// Draws a frame from per-pixel results computed somewhere other than the compute shader,
+	// e.g. by the perturbation engine on the CPU. results must be laid out exactly as the
+	// compute shader would have written them, for a width x height surface. They're copied
+	// into the iteration buffer and colored, and can be recolored afterwards like any other frame.
+	// Returns false, having drawn nothing, if no compute shader is loaded (so there's no iteration
+	// buffer to put them in) or the surface is no longer width x height.
+	bool present_results(const void* results, uint32_t width, uint32_t height, void* pushData);
+
+	// Colors and presents whatever the iteration buffer holds now, e.g. after run_perturbation_pass().
+	// Returns false, having drawn nothing, if it doesn't hold a frame of the surface's current size.
+	bool present_iteration_buffer(void* pushData);
+
+	// The perturbation engine's pixels, on the GPU: see vulkan_perturbation_device.
+	// A reference orbit (vec2s of float) and its BLA table (a mandelbrot_bla_header, then
+	// mandelbrot_bla_steps) are uploaded into one of a few slots, and stay there, in device
+	// local memory, for any number of passes until something else is uploaded into that slot.
+	// The upload's staged, and copied over at the start of the next pass.
+	enum { PERTURBATION_REFERENCE_SLOTS = 2 };
+	void upload_perturbation_reference(uint32_t slot, const void* orbit, size_t orbitBytes, const void* bla, size_t blaBytes);
+
+	// Runs every pixel of the surface against the reference in slot, with
+	// MANDELBROT_PERTURBATION_SHADER (or its floatexp version), into the iteration buffer.
+	// glitches has a float per pixel, saying which pixels to run when info.glitched_only is set.
+	// The compute shader loaded must write mandelbrot_pixel_results. Returns 0, having run
+	// nothing, if no compute shader is loaded, or the surface isn't the size info says.
+	//
+	// The pass is cut into tiles and submitted a batch at a time, each batch sized to the
+	// budget set_progressive() was last given, and pipelined just as progressive frames are.
+	// Nothing waits for it: the pass is numbered like a frame, and the number returned can be
+	// given to frame_finished() and wait_for_frame(), or to read_glitches(), which waits for
+	// the pass and then copies out which of its pixels glitched.
+	uint64_t run_perturbation_pass(uint32_t slot, const mandelbrot_perturbation_info& info, bool floatexpDeltas, const float* glitches);
+	void read_glitches(uint64_t pass, float* glitches);
+
+	// Draws a frame that's the last one moved deltaX pixels right and deltaY pixels down,
+	// with every other parameter unchanged. The last frame's results are shifted along
+	// and only the newly uncovered strips are computed. Falls back on draw_frame()
+	// when there's no last frame to reuse.
+	void pan_frame(int32_t deltaX, int32_t deltaY, void* pushData, const void* computePushData);
+
+	// Zooming in or out by scale (new view size / old view size) about the point
+	// (centerX, centerY) of the surface, in pixels. The last frame's results are
+	// resampled and shown straight away as a preview, then replaced bit by bit
+	// by refine_frame(). Returns false, having drawn nothing, if there's no last
+	// frame to preview from, in which case draw_frame() is needed.
+	bool preview_zoom(float scale, float centerX, float centerY, void* pushData, const void* computePushData);
+
+	// Computes and presents one submission's worth of the view preview_zoom() started,
+	// in passes from one pixel per 8x8 block down to every pixel.
+	// Returns whether there's more refining to do. Any other drawing cancels it.
+	bool refine_frame();
+	bool refining() const { return _refining; }
+
+	// Tiles computed by a compute shader are kept in a tile cache, and reused by
+	// later frames instead of computed again. For that, the renderer needs to know
+	// where each frame sits on the cache's world grid: set_cache_view() before each
+	// draw_frame(), pan_frame() or preview_zoom() call. Until then, nothing's cached.
+	void set_cache_view(const tile_cache_view& view);
+	void clear_cache_view() { _cacheViewSet = false; }
+	tile_cache& cache() { return _tileCache; }
+
+	// Also keeps the cached tiles on disk, in the directory given, so that they're still
+	// there the next time the program runs. Tiles not in the cache are looked for there
+	// before being computed. Each compute shader gets a store of its own.
+	void open_tile_store(const std::string& directory);
+	void close_tile_store();
+	tile_store& store() { return _tileStore; }
+
+	// Keeps compiled shaders and the driver's pipeline cache on disk, in the directory given, so that
+	// renderers set up later (in this run or the next) skip compiling GLSL and building pipelines
+	// they've built before. Applies to renderers constructed after it's set; empty turns it off.
+	static void set_shader_cache_directory(const std::string& directory) { shader_cache::set_default_directory(directory); }
+	static std::string shader_cache_directory() { return shader_cache::default_directory(); }
+	const shader_cache_statistics& shader_statistics() const { return _shaderCache.statistics(); }
+
+	// Progressive rendering cuts each frame into tiles and submits them a few
+	// at a time, so that no single submission runs long enough for the driver
+	// to time out. Anything heavier than the basic 32-bit shader should use it.
+	void set_progressive(bool enabled, const progressive_options& options = progressive_options());
+	bool progressive() const { return _progressive; }
+	const progressive_statistics& progressive_frame_statistics() const { return _schedule.statistics(); }
+
+	// Copies the most recently drawn frame out of a headless renderer,
+	// as tightly packed rows of 4-byte pixels in surface_format() order.
+	void read_pixels(std::vector<uint8_t>& pixels);
 
 private:
 
-	void setup(HINSTANCE hinstance, HWND hwnd, bool debug);
+	friend class offscreen_target;
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+	friend class swapchain_target;
+
+	void setup(HINSTANCE hinstance, HWND hwnd, bool debug, const std::vector<shader_source>& precompile);
+#endif
+	void setup_headless(VkExtent2D extent, bool debug, const std::vector<shader_source>& precompile);
+	void start_shader_compilation(background_task& task, const std::vector<shader_source>& precompile);
+	void setup_rendering(background_task& shaders);
 	void cleanup_pipeline();
-	void cleanup_swap_chain();
 	void cleanup();
 	void create_vkinstance();
 	void create_vkinstance_with_debugging();
@@ -47,25 +243,48 @@ private:
 		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
 		void* pUserData);
 
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 	void create_surface(HWND hwnd, HINSTANCE hinstance);
+#endif
 	void select_physical_device();
 	void create_logical_device();
-	void choose_swap_surface_format();
-	void choose_swap_present_mode();
-	void choose_swap_extent();
-	
-	void recreate_swap_chain();
-	void create_swap_chain();
-	void create_image_views();
-	
+
+	void create_pipeline_cache();
+	void save_pipeline_cache();
+
 	VkShaderModule compile_shader(std::string name, std::string source, shaderc_shader_kind kind);
 	void create_vertex_shader();
 	void create_fragment_shader();
 
 	void create_render_pass();
-	void create_framebuffers();
+	void create_descriptor_set();
 	void recreate_graphics_pipeline();
 	void create_graphics_pipeline();
+	void cleanup_compute_pipeline();
+	void create_compute_pipeline();
+
+	struct pipeline_variant
+	{
+		std::vector<uint32_t> values;
+		VkPipeline pipeline;
+		uint64_t last_used;
+	};
+
+	static std::vector<VkSpecializationMapEntry> specialization_entries(size_t count, uint32_t firstId);
+	VkPipeline find_variant(std::vector<pipeline_variant>& variants, const std::vector<uint32_t>& values);
+	void add_variant(std::vector<pipeline_variant>& variants, const std::vector<uint32_t>& values, VkPipeline pipeline);
+	void destroy_variants(std::vector<pipeline_variant>& variants);
+	void create_iteration_buffer();
+	void create_resample_pipeline();
+	void write_iteration_descriptor();
+	void cleanup_iteration_buffer();
+	void create_perturbation_descriptor_set();
+	void create_perturbation_pipeline(uint32_t variant);
+	void create_glitch_buffer();
+	void cleanup_palette_buffer();
+	void cleanup_perturbation();
+	void upload_to_device(const void* data, VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize& capacity);
+	void record_perturbation_uploads(VkCommandBuffer commandBuffer);
 
 	uint32_t find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
@@ -73,11 +292,101 @@ private:
 	void create_vertex_buffer();
 	void create_index_buffer();
 
+	// A freshly computed tile on its way out of the iteration buffer and into the cache.
+	// The key's worked out when the copy's recorded, since the view may have moved on
+	// by the time the frame's finished.
+	struct cache_readback
+	{
+		tile_key key;
+		VkDeviceSize offset;	// of its first row, in the iteration buffer and staging buffer alike.
+		VkDeviceSize row_pitch;
+	};
+
+	// What each frame in flight needs of its own, so that one can be recorded
+	// while the others are still waiting on the GPU. The frames take turns.
+	struct frame_resources
+	{
+		VkCommandBuffer command_buffer = nullptr;
+		VkSemaphore image_available = nullptr;
+		VkSemaphore render_finished = nullptr;
+		VkFence in_flight = nullptr;	// signaled once its last submission's done.
+		uint64_t frame = 0;	// the number of the frame that last used them.
+
+		// Host-visible, and laid out like the iteration buffer, for moving tiles in and out
+		// of the cache. Only created once there's something to move. Tiles the frame copies
+		// out wait in it until its fence says they've arrived.
+		VkBuffer cache_staging = nullptr;
+		VkDeviceMemory cache_staging_memory = nullptr;
+		uint8_t* cache_staged = nullptr;
+		std::vector<cache_readback> cache_readbacks;
+	};
+
+	// A submission that's only part of a frame: one batch of a progressive frame, a
+	// refine_frame() pass or a perturbation pass. A few can be on the GPU at once, each
+	// with its own command buffer, fence and range of timestamp queries, so that the next
+	// batch can be recorded while the last one runs. A batch's timings go to its schedule
+	// when its resources are next needed, or sooner, if it's found finished before then.
+	// The frame's own fence follows its last batch in a submission of its own.
+	struct batch_resources
+	{
+		VkCommandBuffer command_buffer = nullptr;
+		VkFence in_flight = nullptr;
+		uint32_t first_query = 0;
+
+		// The schedule the batch came from, until its timings have been read.
+		progressive_schedule* schedule = nullptr;
+		size_t tiles = 0;
+		bool timed = false;
+	};
+
+	static const uint32_t BATCHES_IN_FLIGHT = 2;
+
 	void create_command_pool();
-	void create_command_buffer();
+	void create_command_buffers();
 	void create_sync_objects();
-
-	void record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, void* pushData);
+	void cleanup_frame_resources();
+	void create_batch_resources();
+	void cleanup_batch_resources();
+	void create_timestamp_queries(uint32_t tileCapacity);
+
+	batch_resources& next_batch_resources();
+	void submit_batch(batch_resources& batch, VkSubmitInfo& submitInfo, progressive_schedule& schedule, size_t tiles, bool timed);
+	void submit_frame_fence(frame_resources& frame);
+	void collect_batch(batch_resources& batch);
+	void collect_finished_batches();
+	bool frame_done(uint64_t frame);
+
+	// Draws and presents one frame, computing only the given regions (the whole frame if null).
+	// With no regions at all, only the color pass runs.
+	// Returns false if the frame couldn't be drawn properly.
+	bool render_frame(void* pushData, const std::vector<tile>* regions, bool continueSchedule = false);
+	void shift_iteration_buffer(int32_t deltaX, int32_t deltaY);
+	void resample_iteration_buffer(float scale, float centerX, float centerY);
+	void begin_refine_pass(uint32_t pixelStep);
+
+	// The cache's copies are recorded into the frames' own command buffers, so drawing never
+	// waits on them: cached tiles go into the iteration buffer at the start of the next frame,
+	// and the tiles it computes come back out at its end. They're only taken into the cache
+	// once that frame's finished, which the next frame to use its resources finds out for sure.
+	// The same goes for pans, zoom previews and new palettes.
+	bool caching();
+	frame_resources& next_frame();
+	void create_cache_staging_buffer(frame_resources& frame);
+	void cleanup_cache_staging_buffer(frame_resources& frame);
+	void fill_from_cache(const std::vector<tile>& regions, std::vector<tile>& uncached);
+	void read_back_to_cache(const std::vector<tile>& computed);
+	void record_frame_start_copies(VkCommandBuffer commandBuffer, frame_resources& frame);
+	void record_cache_readback(VkCommandBuffer commandBuffer, frame_resources& frame);
+	void collect_cache_readbacks(frame_resources& frame);
+	void collect_finished_frames();
+	void reopen_tile_store();
+
+	void record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, void* pushData,
+		const std::vector<tile>& tiles, bool firstBatch, bool lastBatch, bool timed);
+	void record_render_pass(VkCommandBuffer commandBuffer, uint32_t imageIndex, void* pushData,
+		const std::vector<tile>& tiles, VkRenderPass renderPass, bool timed);
+	void record_compute_tiles(VkCommandBuffer commandBuffer, const std::vector<tile>& tiles, bool timed);
+	double read_batch_milliseconds(uint32_t firstQuery, size_t tileCount, std::vector<double>& tileMilliseconds);
 
 	// ================================================================
 
@@ -100,11 +409,13 @@ private:
 	// ================================================================
 
 	bool _disposed = false;
+	bool _headless = false;
+	startup_statistics _startup;
 
 	VkInstance _vkinstance = nullptr;
 
 	VkDebugUtilsMessengerEXT _debugMessenger = nullptr;
-	std::vector<debug_message> _messages;
+	debug_message_log _messages;
 
 	VkSurfaceKHR _surface = nullptr;
 
@@ -116,30 +427,190 @@ private:
 	VkQueue _graphicsQueue = nullptr;
 	VkQueue _presentQueue = nullptr;
 
-	VkSurfaceFormatKHR _selectedSurfaceFormat;
-	VkPresentModeKHR _selectedPresentMode;
-	VkExtent2D _selectedSwapExtent;
+	std::unique_ptr<render_target> _target;
 
-	VkSwapchainKHR _swapChain = nullptr;
-	std::vector<VkImage> _swapChainImages;
-	std::vector<VkImageView> _swapChainImageViews;
+	shader_cache _shaderCache;
+	VkPipelineCache _pipelineCache = nullptr;
 
 	VkShaderModule _vertexShader = nullptr;
 	VkShaderModule _fragmentShader = nullptr;
 
 	VkRenderPass _renderPass = nullptr;
+	VkRenderPass _continueRenderPass = nullptr;	// same as _renderPass, but loads rather than clears.
 	VkPipelineLayout _pipelineLayout = nullptr;
-	VkPipeline _graphicsPipeline = nullptr;
-	std::vector<VkFramebuffer> _swapChainFramebuffers;
+	VkPipeline _graphicsPipeline = nullptr;		// whichever of _graphicsVariants is in use.
+	std::vector<pipeline_variant> _graphicsVariants;
+	std::vector<uint32_t> _fragmentSpecialization;
+	uint64_t _variantClock = 0;
+
+	// Variants pushed out while a frame still in flight might be using them.
+	// Each goes once the last frame submitted before it was pushed out has finished.
+	struct retired_pipeline
+	{
+		VkPipeline pipeline;
+		uint64_t frame;
+	};
+
+	std::vector<retired_pipeline> _retiredPipelines;
+	void destroy_retired_pipelines(bool all);
+
+	// The iteration buffer, shared by the compute and graphics pipelines.
+	VkDescriptorSetLayout _descriptorSetLayout = nullptr;
+	VkDescriptorPool _descriptorPool = nullptr;
+	VkDescriptorSet _descriptorSet = nullptr;
+
+	VkBuffer _iterationBuffer = nullptr;
+	VkDeviceMemory _iterationBufferMemory = nullptr;
+	VkDeviceSize _iterationBufferSize = 0;
+
+	// Panning and zooming copy the last frame's results over to here, then back again moved.
+	VkBuffer _spareIterationBuffer = nullptr;
+	VkDeviceMemory _spareIterationBufferMemory = nullptr;
+
+	// Whether the buffer holds a complete frame, and the surface size it's laid out for.
+	bool _iterationBufferValid = false;
+	VkExtent2D _iterationExtent = { 0, 0 };
+
+	bool _supportsCompute = false;
+	VkShaderModule _computeShader = nullptr;
+	VkPipelineLayout _computePipelineLayout = nullptr;
+	VkPipeline _computePipeline = nullptr;		// whichever of _computeVariants is in use.
+	std::vector<pipeline_variant> _computeVariants;
+	std::vector<uint32_t> _computeSpecialization;
+	VkExtent2D _workgroupSize = { 8, 8 };
+	uint32_t _bytesPerPixel = 0;
+
+	// Only refine_frame() dispatches coarse passes. Everything else computes every pixel.
+	uint32_t _pixelStep = 1;
+	uint32_t _previousStep = 0;
+
+	// Resamples the spare buffer into the iteration buffer for zoom previews.
+	struct resample_push_data
+	{
+		uint32_t width;
+		uint32_t height;
+		float center_x;
+		float center_y;
+		float scale;
+	};
+
+	VkShaderModule _resampleShader = nullptr;
+	VkPipelineLayout _resamplePipelineLayout = nullptr;
+	VkPipeline _resamplePipeline = nullptr;
+	resample_push_data _resample = {};
+	bool _resampling = false;	// at the start of the next frame.
+
+	// Perturbation passes have a descriptor set of their own: the iteration buffer,
+	// a reference orbit, its BLA table and the glitch buffer. There's a pipeline
+	// for float deltas and one for floatexp deltas, each made when first needed.
+	VkDescriptorSetLayout _perturbationSetLayout = nullptr;
+	VkDescriptorPool _perturbationDescriptorPool = nullptr;
+	VkDescriptorSet _perturbationDescriptorSet = nullptr;
+	VkPipelineLayout _perturbationPipelineLayout = nullptr;
+	VkShaderModule _perturbationShaders[2] = { nullptr, nullptr };
+	VkPipeline _perturbationPipelines[2] = { nullptr, nullptr };
+
+	struct perturbation_reference
+	{
+		VkBuffer orbit = nullptr;
+		VkDeviceMemory orbitMemory = nullptr;
+		VkDeviceSize orbitCapacity = 0;
+		VkBuffer bla = nullptr;
+		VkDeviceMemory blaMemory = nullptr;
+		VkDeviceSize blaCapacity = 0;
+	};
+
+	perturbation_reference _perturbationReferences[PERTURBATION_REFERENCE_SLOTS];
+
+	// One float per pixel. Host-visible and kept mapped, since the host reads
+	// it back after every pass to find the glitched pixels.
+	// _perturbationPass is the last pass to use it, numbered like a frame.
+	VkBuffer _glitchBuffer = nullptr;
+	VkDeviceMemory _glitchBufferMemory = nullptr;
+	VkDeviceSize _glitchBufferSize = 0;
+	float* _glitches = nullptr;
+	uint64_t _perturbationPass = 0;
+
+	// In device local memory. A new palette waits in _palette for the next frame to copy it in.
+	VkBuffer _paletteBuffer = nullptr;
+	VkDeviceMemory _paletteBufferMemory = nullptr;
+	VkDeviceSize _paletteBufferSize = 0;
+	std::vector<uint8_t> _palette;
+	bool _paletteChanged = false;
+
+	// Uploads pass through here on their way to device local memory, one after another,
+	// until the next perturbation pass copies them out. Grows to fit.
+	struct perturbation_upload
+	{
+		VkBuffer buffer;
+		VkBufferCopy copy;
+	};
+
+	VkBuffer _uploadStagingBuffer = nullptr;
+	VkDeviceMemory _uploadStagingBufferMemory = nullptr;
+	VkDeviceSize _uploadStagingCapacity = 0;
+	VkDeviceSize _uploadStagingUsed = 0;
+	uint8_t* _uploadStaging = nullptr;
+	std::vector<perturbation_upload> _perturbationUploads;
+
+	// Schedules for perturbation passes over the whole surface, and over only its glitched
+	// pixels. The two cost so differently that each keeps its own history.
+	progressive_schedule _perturbationSchedules[2];
+
+	static const uint32_t COARSEST_REFINE_STEP = 8;
+	bool _refining = false;
+	uint32_t _refineStep = 1;
+	std::vector<uint8_t> _refinePushData;
+	std::vector<tile> _refineRegions;
+
+	tile_cache _tileCache;
+	tile_cache_view _cacheView;
+	bool _cacheViewSet = false;
+	std::vector<tile> _uncachedTiles;
+
+	tile_store _tileStore;
+	std::string _tileStoreDirectory;
+	uint64_t _computeShaderHash = 0;
+	std::string _computeShaderPrecision;
+
+	// Copies for the start of the next frame, before any of its tiles are computed: a pan's shift
+	// of the last frame's results (over to the spare buffer and back), then cached tiles out of
+	// the frame's staging buffer. And the tiles to read back into the cache at its end.
+	std::vector<VkBufferCopy> _shiftCopies;
+	std::vector<VkBufferCopy> _shiftBackCopies;
+	std::vector<VkBufferCopy> _cacheFills;
+	std::vector<cache_readback> _cacheReadbacks;
 
 	VkCommandPool _commandPool = nullptr;
-	VkCommandBuffer _commandBuffer;
 
-	VkSemaphore _imageAvailableSemaphore;
-	VkSemaphore _renderFinishedSemaphore;
+	std::vector<frame_resources> _frames;
+	uint32_t _currentFrame = 0;
+	uint64_t _submittedFrames = 0;
+
+	std::vector<batch_resources> _batches;
+	uint32_t _currentBatch = 0;		// the oldest, and the next to be used.
+
+	// Times each tile on the GPU, if the graphics queue supports timestamps.
+	// One query at the start of each batch, then one after each tile. Only batches are timed,
+	// and each of them has a range of its own, so no two submissions in flight share queries.
+	// _firstQuery is where the batch being recorded starts.
+	VkQueryPool _timestampQueryPool = nullptr;
+	uint32_t _timestampCapacity = 0;	// tiles per batch.
+	uint32_t _firstQuery = 0;
+	double _timestampPeriod = 0.0;	// nanoseconds per tick.
+	uint64_t _timestampMask = 0;
+
+	bool _progressive = false;
+	progressive_schedule _schedule;
+	std::vector<tile> _fullFrame;
+	std::vector<tile> _noTiles;
+	std::vector<tile> _exposedTiles;
+	std::vector<double> _tileMilliseconds;
 
 	// ================================================================
 
 	uint32_t _pushDataSize = 0;
+	uint32_t _computePushDataSize = 0;
+	std::vector<uint8_t> _computePushData;
 };
 
@@ -3,6 +3,15 @@
 
 const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "#version 450                                                                            \n"
+"// Specialization constants. Non-zero values fix max_iterations, gradient_length        \n"
+"// and bailout_radius for the pipeline, so that the compiler can treat them as          \n"
+"// constants; zero leaves them to the push constants. Without smoothing, each           \n"
+"// iteration gets one color, and the bands between them show.                           \n"
+"layout(constant_id = 0) const uint SPECIALIZED_MAX_ITERATIONS = 0;                      \n"
+"layout(constant_id = 1) const uint SPECIALIZED_GRADIENT_LENGTH = 0;                     \n"
+"layout(constant_id = 2) const float SPECIALIZED_BAILOUT_RADIUS = 0.0f;                  \n"
+"layout(constant_id = 3) const bool SMOOTHING = true;                                    \n"
+"                                                                                        \n"
 "layout(location = 0) in vec3 inputColor;                                                \n"
 "layout(location = 0) out vec4 outputColor;                                              \n"
 "                                                                                        \n"
@@ -19,9 +28,14 @@ const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "    uint fill_color;                                                                    \n"
 "    float gradient_period_factor;                                                       \n"
 "    uint gradient_length;                                                               \n"
-"    uint gradient[21];                                                                  \n"
 "} PushConstants;                                                                        \n"
 "                                                                                        \n"
+"// The gradient, sampled finely enough that coloring only takes the nearest entry.      \n"
+"layout(std430, set = 0, binding = 2) readonly buffer PaletteBuffer                      \n"
+"{                                                                                       \n"
+"    vec4 colors[];                                                                      \n"
+"} Palette;                                                                              \n"
+"                                                                                        \n"
 "void main()                                                                             \n"
 "{                                                                                       \n"
 "    float top = PushConstants.top;                                                      \n"
@@ -38,29 +52,69 @@ const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "    float zr = 0.0f;                                                                    \n"
 "    float zi = 0.0f;                                                                    \n"
 "                                                                                        \n"
-"    uint max_iteration = PushConstants.max_iterations;                                  \n"
-"    float bailout_radius = PushConstants.bailout_radius;                                \n"
+"    uint max_iteration = SPECIALIZED_MAX_ITERATIONS != 0                                \n"
+"        ? SPECIALIZED_MAX_ITERATIONS : PushConstants.max_iterations;                    \n"
+"    float bailout_radius = SPECIALIZED_BAILOUT_RADIUS != 0.0f                           \n"
+"        ? SPECIALIZED_BAILOUT_RADIUS : PushConstants.bailout_radius;                    \n"
 "    float m1 = 0.0f;                                                                    \n"
 "    float m2 = 0.0f;                                                                    \n"
 "    uint iteration = 0;                                                                 \n"
 "                                                                                        \n"
+"    // Points inside the main cardioid or the period-2 bulb never escape,               \n"
+"    // so there's no need to iterate them at all.                                       \n"
+"    float ci2 = ci*ci;                                                                  \n"
+"    float xr = cr - 0.25f;                                                              \n"
+"    float q = xr*xr + ci2;                                                              \n"
+"    float br = cr + 1.0f;                                                               \n"
+"    bool known_interior = q*(q + xr) <= 0.25f*ci2 || br*br + ci2 <= 0.0625f;            \n"
+"                                                                                        \n"
+"    // Brent's cycle detection. z is remembered after 1, 2, 4, 8, ... iterations.       \n"
+"    // If z ever lands exactly on the remembered value, the orbit is periodic,          \n"
+"    // every z in the cycle has already been checked against the bailout radius,        \n"
+"    // and the pixel can never escape. The comparison is exact, so the result           \n"
+"    // is the same as running all max_iterations.                                       \n"
+"    float check_zr = 0.0f;                                                              \n"
+"    float check_zi = 0.0f;                                                              \n"
+"    uint check_window = 1;                                                              \n"
+"    uint check_steps = 0;                                                               \n"
+"                                                                                        \n"
+"    if (known_interior)                                                                 \n"
+"        iteration = max_iteration;                                                      \n"
+"                                                                                        \n"
 "    // Count the number of iterations until z exceeds the bailout radius.               \n"
 "    // m1 is the square magnitude of z on the iteration just before bailout.            \n"
 "    // m2 is the square magnitude of z on the iteration of bailout.                     \n"
-"    for (uint i = 0 ; i < max_iteration ; i++)                                          \n"
+"    // Stop as soon as that happens, rather than idling through the rest of the loop.   \n"
+"    for (uint i = 0 ; i < max_iteration && !known_interior ; i++)                       \n"
 "    {                                                                                   \n"
-"        if (m2 < bailout_radius)                                                        \n"
+"        if (m2 >= bailout_radius)                                                       \n"
+"            break;                                                                      \n"
+"                                                                                        \n"
+"        float zr2 = zr*zr;                                                              \n"
+"        float zi2 = zi*zi;                                                              \n"
+"                                                                                        \n"
+"        float zr_next = zr2 - zi2 + cr;                                                 \n"
+"        float zi_next = 2*zr*zi + ci;                                                   \n"
+"        zr = zr_next;                                                                   \n"
+"        zi = zi_next;                                                                   \n"
+"        m1 = m2;                                                                        \n"
+"        m2 = zr2 + zi2;                                                                 \n"
+"        iteration = iteration + 1;                                                      \n"
+"                                                                                        \n"
+"        if (zr == check_zr && zi == check_zi)                                           \n"
+"        {                                                                               \n"
+"            iteration = max_iteration;                                                  \n"
+"            break;                                                                      \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        check_steps = check_steps + 1;                                                  \n"
+"                                                                                        \n"
+"        if (check_steps == check_window)                                                \n"
 "        {                                                                               \n"
-"            float zr2 = zr*zr;                                                          \n"
-"            float zi2 = zi*zi;                                                          \n"
-"                                                                                        \n"
-"            float zr_next = zr2 - zi2 + cr;                                             \n"
-"            float zi_next = 2*zr*zi + ci;                                               \n"
-"            zr = zr_next;                                                               \n"
-"            zi = zi_next;                                                               \n"
-"            m1 = m2;                                                                    \n"
-"            m2 = zr2 + zi2;                                                             \n"
-"            iteration = iteration + 1;                                                  \n"
+"            check_steps = 0;                                                            \n"
+"            check_window = check_window * 2;                                            \n"
+"            check_zr = zr;                                                              \n"
+"            check_zi = zi;                                                              \n"
 "        }                                                                               \n"
 "    }                                                                                   \n"
 "                                                                                        \n"
@@ -79,7 +133,8 @@ const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "        float invm1 = 1.0f / m1;                                                        \n"
 "        float delta = 1.0f - log(bailout_radius * invm1) / log(m2 * invm1);             \n"
 "                                                                                        \n"
-"        uint length = PushConstants.gradient_length;                                    \n"
+"        uint length = SPECIALIZED_GRADIENT_LENGTH != 0                                  \n"
+"            ? SPECIALIZED_GRADIENT_LENGTH : PushConstants.gradient_length;              \n"
 "                                                                                        \n"
 "        // The gradient repeats every P iterations.                                     \n"
 "        // This is known as the gradient period.                                        \n"
@@ -88,7 +143,7 @@ const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "        // the closer we get to the mandelbrot edge.                                    \n"
 "                                                                                        \n"
 "        float F = PushConstants.gradient_period_factor;                                 \n"
-"        float T = float(iteration) - delta;                                             \n"
+"        float T = SMOOTHING ? float(iteration) - delta : float(iteration);              \n"
 "        float M = float(max_iteration);                                                 \n"
 "        float L = float(length);                                                        \n"
 "        float P = mix(L, M*F, (T-1.0f)/(M-1.0f));                                       \n"
@@ -97,34 +152,12 @@ const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "        // Now calculate where the real-valued iteration T                              \n"
 "        // lies within the gradient.                                                    \n"
 "        float t_mod_p = T - K*P;                                                        \n"
-"        float hue = (t_mod_p / P) * L;                                                  \n"
-"        float epsilon = hue - floor(hue);                                               \n"
-"                                                                                        \n"
-"        int c1_index = int(floor(hue));                                                 \n"
-"        int c2_index = int(floor(hue + 1)) % int(length);                               \n"
-"        uint c1 = PushConstants.gradient[c1_index];                                     \n"
-"        uint c2 = PushConstants.gradient[c2_index];                                     \n"
-"                                                                                        \n"
-"        uint c1r_hex = (c1 >> 16) & 0xFF;                                               \n"
-"        uint c1g_hex = (c1 >> 8) & 0xFF;                                                \n"
-"        uint c1b_hex = (c1) & 0xFF;                                                     \n"
-"                                                                                        \n"
-"        uint c2r_hex = (c2 >> 16) & 0xFF;                                               \n"
-"        uint c2g_hex = (c2 >> 8) & 0xFF;                                                \n"
-"        uint c2b_hex = (c2) & 0xFF;                                                     \n"
-"                                                                                        \n"
-"        float r1 = float(c1r_hex) / 255.0f;                                             \n"
-"        float g1 = float(c1g_hex) / 255.0f;                                             \n"
-"        float b1 = float(c1b_hex) / 255.0f;                                             \n"
-"        float r2 = float(c2r_hex) / 255.0f;                                             \n"
-"        float g2 = float(c2g_hex) / 255.0f;                                             \n"
-"        float b2 = float(c2b_hex) / 255.0f;                                             \n"
-"                                                                                        \n"
-"        float r = r1 + (r2 - r1) * epsilon;                                             \n"
-"        float g = g1 + (g2 - g1) * epsilon;                                             \n"
-"        float b = b1 + (b2 - b1) * epsilon;                                             \n"
-"                                                                                        \n"
-"        outputColor = vec4(r, g, b, 1.0f);                                              \n"
+"                                                                                        \n"
+"        // Where T lies within the period, from 0 up to 1, picks the palette entry.     \n"
+"        // The blending between the gradient's colors was done when it was built.       \n"
+"        float u = max(t_mod_p / P, 0.0f);                                               \n"
+"        uint entries = uint(Palette.colors.length());                                   \n"
+"        outputColor = Palette.colors[min(uint(u * float(entries)), entries - 1)];       \n"
 "    }                                                                                   \n"
 "    else                                                                                \n"
 "    {                                                                                   \n"
@@ -260,3 +293,1032 @@ const std::string mandelbrot_parameter_info::MANDELBROT_FRAGMENT_SHADER =
 "\n"
 ;
 
+
+const std::string mandelbrot_parameter_info::MANDELBROT_COLOR_SHADER =
+"#version 450                                                                            \n"
+"// Specialization constants. Non-zero values fix max_iterations, gradient_length        \n"
+"// and bailout_radius for the pipeline, so that the compiler can treat them as          \n"
+"// constants; zero leaves them to the push constants. Without smoothing, each           \n"
+"// iteration gets one color, and the bands between them show.                           \n"
+"layout(constant_id = 0) const uint SPECIALIZED_MAX_ITERATIONS = 0;                      \n"
+"layout(constant_id = 1) const uint SPECIALIZED_GRADIENT_LENGTH = 0;                     \n"
+"layout(constant_id = 2) const float SPECIALIZED_BAILOUT_RADIUS = 0.0f;                  \n"
+"layout(constant_id = 3) const bool SMOOTHING = true;                                    \n"
+"                                                                                        \n"
+"layout(location = 0) in vec3 inputColor;                                                \n"
+"layout(location = 0) out vec4 outputColor;                                              \n"
+"                                                                                        \n"
+"layout(push_constant) uniform constants                                                 \n"
+"{                                                                                       \n"
+"    float top;                                                                          \n"
+"    float left;                                                                         \n"
+"    float right;                                                                        \n"
+"    float bottom;                                                                       \n"
+"    float surface_width;                                                                \n"
+"    float surface_height;                                                               \n"
+"    float bailout_radius;                                                               \n"
+"    uint max_iterations;                                                                \n"
+"    uint fill_color;                                                                    \n"
+"    float gradient_period_factor;                                                       \n"
+"    uint gradient_length;                                                               \n"
+"} PushConstants;                                                                        \n"
+"                                                                                        \n"
+"// The gradient, sampled finely enough that coloring only takes the nearest entry.      \n"
+"layout(std430, set = 0, binding = 2) readonly buffer PaletteBuffer                      \n"
+"{                                                                                       \n"
+"    vec4 colors[];                                                                      \n"
+"} Palette;                                                                              \n"
+"                                                                                        \n"
+"struct pixel_result                                                                     \n"
+"{                                                                                       \n"
+"    float smooth_iteration;                                                             \n"
+"    float magnitude;                                                                    \n"
+"};                                                                                      \n"
+"                                                                                        \n"
+"layout(std430, set = 0, binding = 0) readonly buffer IterationBuffer                    \n"
+"{                                                                                       \n"
+"    pixel_result pixels[];                                                              \n"
+"} Iterations;                                                                           \n"
+"                                                                                        \n"
+"void main()                                                                             \n"
+"{                                                                                       \n"
+"    // The expensive part already happened in the compute shader.                       \n"
+"    // All that's left is to look up this pixel's result and color it.                  \n"
+"    uint x = uint(gl_FragCoord.x);                                                      \n"
+"    uint y = uint(gl_FragCoord.y);                                                      \n"
+"    uint index = y * uint(PushConstants.surface_width) + x;                             \n"
+"                                                                                        \n"
+"    float T = Iterations.pixels[index].smooth_iteration;                                \n"
+"                                                                                        \n"
+"    if (T != -1.0f)                                                                     \n"
+"    {                                                                                   \n"
+"        // T = iteration - delta, with delta from 0 up to (not including) 1.            \n"
+"        if (!SMOOTHING)                                                                 \n"
+"            T = ceil(T);                                                                \n"
+"                                                                                        \n"
+"        uint max_iteration = SPECIALIZED_MAX_ITERATIONS != 0                            \n"
+"            ? SPECIALIZED_MAX_ITERATIONS : PushConstants.max_iterations;                \n"
+"        uint length = SPECIALIZED_GRADIENT_LENGTH != 0                                  \n"
+"            ? SPECIALIZED_GRADIENT_LENGTH : PushConstants.gradient_length;              \n"
+"                                                                                        \n"
+"        // The gradient repeats every P iterations.                                     \n"
+"        // This is known as the gradient period.                                        \n"
+"        // Below is a silly attempt to scale P according to                             \n"
+"        // the iteration number, so that colors don't cycle too fast                    \n"
+"        // the closer we get to the mandelbrot edge.                                    \n"
+"                                                                                        \n"
+"        float F = PushConstants.gradient_period_factor;                                 \n"
+"        float M = float(max_iteration);                                                 \n"
+"        float L = float(length);                                                        \n"
+"        float P = mix(L, M*F, (T-1.0f)/(M-1.0f));                                       \n"
+"        float K = floor(T/P);                                                           \n"
+"                                                                                        \n"
+"        // Now calculate where the real-valued iteration T                              \n"
+"        // lies within the gradient.                                                    \n"
+"        float t_mod_p = T - K*P;                                                        \n"
+"                                                                                        \n"
+"        // Where T lies within the period, from 0 up to 1, picks the palette entry.     \n"
+"        // The blending between the gradient's colors was done when it was built.       \n"
+"        float u = max(t_mod_p / P, 0.0f);                                               \n"
+"        uint entries = uint(Palette.colors.length());                                   \n"
+"        outputColor = Palette.colors[min(uint(u * float(entries)), entries - 1)];       \n"
+"    }                                                                                   \n"
+"    else                                                                                \n"
+"    {                                                                                   \n"
+"        uint fill_color = PushConstants.fill_color;                                     \n"
+"        uint ired = (fill_color >> 16) & 0xFF;                                          \n"
+"        uint igreen = (fill_color >> 8) & 0xFF;                                         \n"
+"        uint iblue = (fill_color) & 0xFF;                                               \n"
+"                                                                                        \n"
+"        float r_out = float(ired) / 255.0f;                                             \n"
+"        float g_out = float(igreen) / 255.0f;                                           \n"
+"        float b_out = float(iblue) / 255.0f;                                            \n"
+"                                                                                        \n"
+"        outputColor = vec4(r_out, g_out, b_out, 1.0f);                                  \n"
+"    }                                                                                   \n"
+"}                                                                                       \n"
+;
+
+const std::string mandelbrot_compute_info::MANDELBROT_COMPUTE_SHADER =
+"#version 450                                                                            \n"
+"layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;                  \n"
+"                                                                                        \n"
+"// Specialization constants, after the workgroup size. Non-zero values fix              \n"
+"// max_iterations and bailout_radius for the pipeline, so that the compiler can         \n"
+"// treat the loop's bounds as constants; zero leaves them to the push constants.        \n"
+"layout(constant_id = 2) const uint SPECIALIZED_MAX_ITERATIONS = 0;                      \n"
+"layout(constant_id = 3) const float SPECIALIZED_BAILOUT_RADIUS = 0.0f;                  \n"
+"                                                                                        \n"
+"layout(push_constant) uniform constants                                                 \n"
+"{                                                                                       \n"
+"    uvec4 rect;                                                                         \n"
+"    uint pixel_step;                                                                    \n"
+"    uint previous_step;                                                                 \n"
+"    float top;                                                                          \n"
+"    float left;                                                                         \n"
+"    float right;                                                                        \n"
+"    float bottom;                                                                       \n"
+"    float surface_width;                                                                \n"
+"    float surface_height;                                                               \n"
+"    float bailout_radius;                                                               \n"
+"    uint max_iterations;                                                                \n"
+"} PushConstants;                                                                        \n"
+"                                                                                        \n"
+"struct pixel_result                                                                     \n"
+"{                                                                                       \n"
+"    float smooth_iteration;                                                             \n"
+"    float magnitude;                                                                    \n"
+"};                                                                                      \n"
+"                                                                                        \n"
+"layout(std430, set = 0, binding = 0) writeonly buffer IterationBuffer                   \n"
+"{                                                                                       \n"
+"    pixel_result pixels[];                                                              \n"
+"} Iterations;                                                                           \n"
+"                                                                                        \n"
+"void main()                                                                             \n"
+"{                                                                                       \n"
+"    // One invocation per pixel of the rectangle being dispatched, or on a coarse pass, \n"
+"    // per pixel_step x pixel_step block. Blocks sit on a grid across the whole surface,\n"
+"    // not just this rectangle, so that each pass lines up with the one before.         \n"
+"    // The last workgroups hang off the edge of the rectangle.                          \n"
+"    uvec4 rect = PushConstants.rect;                                                    \n"
+"    uint pixel_step = PushConstants.pixel_step;                                         \n"
+"    uint x = rect.x - rect.x % pixel_step + gl_GlobalInvocationID.x * pixel_step;       \n"
+"    uint y = rect.y - rect.y % pixel_step + gl_GlobalInvocationID.y * pixel_step;       \n"
+"                                                                                        \n"
+"    if (x >= rect.x + rect.z || y >= rect.y + rect.w)                                   \n"
+"        return;                                                                         \n"
+"                                                                                        \n"
+"    // Pixels on the previous pass's grid were computed exactly there,                  \n"
+"    // and their blocks already cover this one.                                         \n"
+"    uint previous_step = PushConstants.previous_step;                                   \n"
+"                                                                                        \n"
+"    if (previous_step != 0 && x % previous_step == 0 && y % previous_step == 0)         \n"
+"        return;                                                                         \n"
+"                                                                                        \n"
+"    float top = PushConstants.top;                                                      \n"
+"    float left = PushConstants.left;                                                    \n"
+"    float right = PushConstants.right;                                                  \n"
+"    float bottom = PushConstants.bottom;                                                \n"
+"    float surface_width = PushConstants.surface_width;                                  \n"
+"    float surface_height = PushConstants.surface_height;                                \n"
+"                                                                                        \n"
+"    // Pixel centers, the same as gl_FragCoord in the fragment shader.                  \n"
+"    float surface_x = float(x) + 0.5f;                                                  \n"
+"    float surface_y = float(y) + 0.5f;                                                  \n"
+"                                                                                        \n"
+"    float cr = mix(left, right, surface_x/surface_width);                               \n"
+"    float ci = mix(top, bottom, surface_y/surface_height);                              \n"
+"    float zr = 0.0f;                                                                    \n"
+"    float zi = 0.0f;                                                                    \n"
+"                                                                                        \n"
+"    uint max_iteration = SPECIALIZED_MAX_ITERATIONS != 0                                \n"
+"        ? SPECIALIZED_MAX_ITERATIONS : PushConstants.max_iterations;                    \n"
+"    float bailout_radius = SPECIALIZED_BAILOUT_RADIUS != 0.0f                           \n"
+"        ? SPECIALIZED_BAILOUT_RADIUS : PushConstants.bailout_radius;                    \n"
+"    float m1 = 0.0f;                                                                    \n"
+"    float m2 = 0.0f;                                                                    \n"
+"    uint iteration = 0;                                                                 \n"
+"                                                                                        \n"
+"    // Points inside the main cardioid or the period-2 bulb never escape,               \n"
+"    // so there's no need to iterate them at all.                                       \n"
+"    float ci2 = ci*ci;                                                                  \n"
+"    float xr = cr - 0.25f;                                                              \n"
+"    float q = xr*xr + ci2;                                                              \n"
+"    float br = cr + 1.0f;                                                               \n"
+"    bool known_interior = q*(q + xr) <= 0.25f*ci2 || br*br + ci2 <= 0.0625f;            \n"
+"                                                                                        \n"
+"    // Brent's cycle detection. z is remembered after 1, 2, 4, 8, ... iterations.       \n"
+"    // If z ever lands exactly on the remembered value, the orbit is periodic,          \n"
+"    // every z in the cycle has already been checked against the bailout radius,        \n"
+"    // and the pixel can never escape. The comparison is exact, so the result           \n"
+"    // is the same as running all max_iterations.                                       \n"
+"    float check_zr = 0.0f;                                                              \n"
+"    float check_zi = 0.0f;                                                              \n"
+"    uint check_window = 1;                                                              \n"
+"    uint check_steps = 0;                                                               \n"
+"                                                                                        \n"
+"    if (known_interior)                                                                 \n"
+"        iteration = max_iteration;                                                      \n"
+"                                                                                        \n"
+"    // Count the number of iterations until z exceeds the bailout radius.               \n"
+"    // m1 is the square magnitude of z on the iteration just before bailout.            \n"
+"    // m2 is the square magnitude of z on the iteration of bailout.                     \n"
+"    // Stop as soon as that happens, rather than idling through the rest of the loop.   \n"
+"    for (uint i = 0 ; i < max_iteration && !known_interior ; i++)                       \n"
+"    {                                                                                   \n"
+"        if (m2 >= bailout_radius)                                                       \n"
+"            break;                                                                      \n"
+"                                                                                        \n"
+"        float zr2 = zr*zr;                                                              \n"
+"        float zi2 = zi*zi;                                                              \n"
+"                                                                                        \n"
+"        float zr_next = zr2 - zi2 + cr;                                                 \n"
+"        float zi_next = 2*zr*zi + ci;                                                   \n"
+"        zr = zr_next;                                                                   \n"
+"        zi = zi_next;                                                                   \n"
+"        m1 = m2;                                                                        \n"
+"        m2 = zr2 + zi2;                                                                 \n"
+"        iteration = iteration + 1;                                                      \n"
+"                                                                                        \n"
+"        if (zr == check_zr && zi == check_zi)                                           \n"
+"        {                                                                               \n"
+"            iteration = max_iteration;                                                  \n"
+"            break;                                                                      \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        check_steps = check_steps + 1;                                                  \n"
+"                                                                                        \n"
+"        if (check_steps == check_window)                                                \n"
+"        {                                                                               \n"
+"            check_steps = 0;                                                            \n"
+"            check_window = check_window * 2;                                            \n"
+"            check_zr = zr;                                                              \n"
+"            check_zi = zi;                                                              \n"
+"        }                                                                               \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    float smooth_iteration = -1.0f;                                                     \n"
+"                                                                                        \n"
+"    if (iteration < max_iteration)                                                      \n"
+"    {                                                                                   \n"
+"        // Same smoothing as the fragment shader.                                       \n"
+"        float invm1 = 1.0f / m1;                                                        \n"
+"        float delta = 1.0f - log(bailout_radius * invm1) / log(m2 * invm1);             \n"
+"        smooth_iteration = float(iteration) - delta;                                    \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    // On a coarse pass, the result stands in for its whole block until a finer one.    \n"
+"    uint block_left = max(x, rect.x);                                                   \n"
+"    uint block_top = max(y, rect.y);                                                    \n"
+"    uint block_right = min(x + pixel_step, rect.x + rect.z);                            \n"
+"    uint block_bottom = min(y + pixel_step, rect.y + rect.w);                           \n"
+"                                                                                        \n"
+"    for (uint py = block_top ; py < block_bottom ; py++)                                \n"
+"    {                                                                                   \n"
+"        for (uint px = block_left ; px < block_right ; px++)                            \n"
+"        {                                                                               \n"
+"            uint index = py * uint(surface_width) + px;                                 \n"
+"            Iterations.pixels[index] = pixel_result(smooth_iteration, m2);              \n"
+"        }                                                                               \n"
+"    }                                                                                   \n"
+"}                                                                                       \n"
+;
+
+const std::string mandelbrot_ff_parameter_info::MANDELBROT_FF_FRAGMENT_SHADER =
+"#version 450                                                                            \n"
+"// Specialization constants. Non-zero values fix max_iterations, gradient_length        \n"
+"// and bailout_radius for the pipeline, so that the compiler can treat them as          \n"
+"// constants; zero leaves them to the push constants. Without smoothing, each           \n"
+"// iteration gets one color, and the bands between them show.                           \n"
+"layout(constant_id = 0) const uint SPECIALIZED_MAX_ITERATIONS = 0;                      \n"
+"layout(constant_id = 1) const uint SPECIALIZED_GRADIENT_LENGTH = 0;                     \n"
+"layout(constant_id = 2) const float SPECIALIZED_BAILOUT_RADIUS = 0.0f;                  \n"
+"layout(constant_id = 3) const bool SMOOTHING = true;                                    \n"
+"                                                                                        \n"
+"layout(location = 0) in vec3 inputColor;                                                \n"
+"layout(location = 0) out vec4 outputColor;                                              \n"
+"                                                                                        \n"
+"// The view is given by its top-left corner, in float-float, and the size of a pixel.   \n"
+"// Those offsets from the corner are tiny next to the corner itself, so float will do.  \n"
+"layout(push_constant) uniform constants                                                 \n"
+"{                                                                                       \n"
+"    vec2 left;                                                                          \n"
+"    vec2 top;                                                                           \n"
+"    float pixel_width;                                                                  \n"
+"    float pixel_height;                                                                 \n"
+"    float bailout_radius;                                                               \n"
+"    uint max_iterations;                                                                \n"
+"    uint fill_color;                                                                    \n"
+"    float gradient_period_factor;                                                       \n"
+"    uint gradient_length;                                                               \n"
+"} PushConstants;                                                                        \n"
+"                                                                                        \n"
+"// The gradient, sampled finely enough that coloring only takes the nearest entry.      \n"
+"layout(std430, set = 0, binding = 2) readonly buffer PaletteBuffer                      \n"
+"{                                                                                       \n"
+"    vec4 colors[];                                                                      \n"
+"} Palette;                                                                              \n"
+"                                                                                        \n"
+"// Float-float arithmetic: each number is vec2(hi, lo), an unevaluated sum with lo      \n"
+"// no more than half an ulp of hi, for about 48 bits of precision out of plain floats.  \n"
+"// Nothing here needs native doubles, or even FMA.                                      \n"
+"//                                                                                      \n"
+"// Every intermediate is declared precise, so the compiler can neither fuse a*b + c     \n"
+"// into an FMA nor reorder the additions. Either would throw away the very rounding     \n"
+"// errors these functions exist to capture.                                             \n"
+"vec2 ff_quick_two_sum(float a, float b)                                                 \n"
+"{                                                                                       \n"
+"    precise float s = a + b;                                                            \n"
+"    precise float e = b - (s - a);                                                      \n"
+"    return vec2(s, e);                                                                  \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_two_sum(float a, float b)                                                       \n"
+"{                                                                                       \n"
+"    precise float s = a + b;                                                            \n"
+"    precise float bb = s - a;                                                           \n"
+"    precise float e = (a - (s - bb)) + (b - bb);                                        \n"
+"    return vec2(s, e);                                                                  \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"// Dekker's split: hi holds the top 12 bits of a, lo the rest,                          \n"
+"// so that products of the halves are exact in float.                                   \n"
+"vec2 ff_split(float a)                                                                  \n"
+"{                                                                                       \n"
+"    precise float t = 4097.0f * a;                                                      \n"
+"    precise float hi = t - (t - a);                                                     \n"
+"    precise float lo = a - hi;                                                          \n"
+"    return vec2(hi, lo);                                                                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_two_prod(float a, float b)                                                      \n"
+"{                                                                                       \n"
+"    precise float p = a * b;                                                            \n"
+"    vec2 sa = ff_split(a);                                                              \n"
+"    vec2 sb = ff_split(b);                                                              \n"
+"    precise float e = ((sa.x * sb.x - p) + sa.x * sb.y + sa.y * sb.x) + sa.y * sb.y;    \n"
+"    return vec2(p, e);                                                                  \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_add(vec2 a, vec2 b)                                                             \n"
+"{                                                                                       \n"
+"    vec2 s = ff_two_sum(a.x, b.x);                                                      \n"
+"    precise float e = s.y + (a.y + b.y);                                                \n"
+"    return ff_quick_two_sum(s.x, e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_mul(vec2 a, vec2 b)                                                             \n"
+"{                                                                                       \n"
+"    vec2 p = ff_two_prod(a.x, b.x);                                                     \n"
+"    precise float e = p.y + (a.x * b.y + a.y * b.x);                                    \n"
+"    return ff_quick_two_sum(p.x, e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_sqr(vec2 a)                                                                     \n"
+"{                                                                                       \n"
+"    vec2 p = ff_two_prod(a.x, a.x);                                                     \n"
+"    precise float e = p.y + 2.0f * a.x * a.y;                                           \n"
+"    return ff_quick_two_sum(p.x, e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"void main()                                                                             \n"
+"{                                                                                       \n"
+"    // gl_FragCoord is at the pixel's center, and x * pixel_width is computed exactly.  \n"
+"    vec2 x_offset = ff_two_prod(gl_FragCoord.x, PushConstants.pixel_width);             \n"
+"    vec2 y_offset = ff_two_prod(gl_FragCoord.y, PushConstants.pixel_height);            \n"
+"    vec2 cr = ff_add(PushConstants.left, x_offset);                                     \n"
+"    vec2 ci = ff_add(PushConstants.top, y_offset);                                      \n"
+"                                                                                        \n"
+"    vec2 zr = vec2(0.0f);                                                               \n"
+"    vec2 zi = vec2(0.0f);                                                               \n"
+"                                                                                        \n"
+"    uint max_iteration = SPECIALIZED_MAX_ITERATIONS != 0                                \n"
+"        ? SPECIALIZED_MAX_ITERATIONS : PushConstants.max_iterations;                    \n"
+"    float bailout_radius = SPECIALIZED_BAILOUT_RADIUS != 0.0f                           \n"
+"        ? SPECIALIZED_BAILOUT_RADIUS : PushConstants.bailout_radius;                    \n"
+"    float m1 = 0.0f;                                                                    \n"
+"    float m2 = 0.0f;                                                                    \n"
+"    uint iteration = 0;                                                                 \n"
+"                                                                                        \n"
+"    // Points inside the main cardioid or the period-2 bulb never escape,               \n"
+"    // so there's no need to iterate them at all. Float is plenty for telling.          \n"
+"    float ci2 = ci.x*ci.x;                                                              \n"
+"    float xr = cr.x - 0.25f;                                                            \n"
+"    float q = xr*xr + ci2;                                                              \n"
+"    float br = cr.x + 1.0f;                                                             \n"
+"    bool known_interior = q*(q + xr) <= 0.25f*ci2 || br*br + ci2 <= 0.0625f;            \n"
+"                                                                                        \n"
+"    // Brent's cycle detection, comparing both halves of z exactly.                     \n"
+"    vec2 check_zr = vec2(0.0f);                                                         \n"
+"    vec2 check_zi = vec2(0.0f);                                                         \n"
+"    uint check_window = 1;                                                              \n"
+"    uint check_steps = 0;                                                               \n"
+"                                                                                        \n"
+"    if (known_interior)                                                                 \n"
+"        iteration = max_iteration;                                                      \n"
+"                                                                                        \n"
+"    for (uint i = 0 ; i < max_iteration && !known_interior ; i++)                       \n"
+"    {                                                                                   \n"
+"        if (m2 >= bailout_radius)                                                       \n"
+"            break;                                                                      \n"
+"                                                                                        \n"
+"        vec2 zr2 = ff_sqr(zr);                                                          \n"
+"        vec2 zi2 = ff_sqr(zi);                                                          \n"
+"                                                                                        \n"
+"        // Doubling both halves is exact.                                               \n"
+"        vec2 zr_next = ff_add(ff_add(zr2, -zi2), cr);                                   \n"
+"        vec2 zi_next = ff_add(2.0f * ff_mul(zr, zi), ci);                               \n"
+"        zr = zr_next;                                                                   \n"
+"        zi = zi_next;                                                                   \n"
+"                                                                                        \n"
+"        // Only compared against the bailout radius, so the low halves don't matter.    \n"
+"        m1 = m2;                                                                        \n"
+"        m2 = zr2.x + zi2.x;                                                             \n"
+"        iteration = iteration + 1;                                                      \n"
+"                                                                                        \n"
+"        if (zr == check_zr && zi == check_zi)                                           \n"
+"        {                                                                               \n"
+"            iteration = max_iteration;                                                  \n"
+"            break;                                                                      \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        check_steps = check_steps + 1;                                                  \n"
+"                                                                                        \n"
+"        if (check_steps == check_window)                                                \n"
+"        {                                                                               \n"
+"            check_steps = 0;                                                            \n"
+"            check_window = check_window * 2;                                            \n"
+"            check_zr = zr;                                                              \n"
+"            check_zi = zi;                                                              \n"
+"        }                                                                               \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    if (iteration < max_iteration)                                                      \n"
+"    {                                                                                   \n"
+"        // Same smoothing and coloring as MANDELBROT_FRAGMENT_SHADER.                   \n"
+"        float invm1 = 1.0f / m1;                                                        \n"
+"        float delta = 1.0f - log(bailout_radius * invm1) / log(m2 * invm1);             \n"
+"                                                                                        \n"
+"        uint length = SPECIALIZED_GRADIENT_LENGTH != 0                                  \n"
+"            ? SPECIALIZED_GRADIENT_LENGTH : PushConstants.gradient_length;              \n"
+"                                                                                        \n"
+"        float F = PushConstants.gradient_period_factor;                                 \n"
+"        float T = SMOOTHING ? float(iteration) - delta : float(iteration);              \n"
+"        float M = float(max_iteration);                                                 \n"
+"        float L = float(length);                                                        \n"
+"        float P = mix(L, M*F, (T-1.0f)/(M-1.0f));                                       \n"
+"        float K = floor(T/P);                                                           \n"
+"                                                                                        \n"
+"        float t_mod_p = T - K*P;                                                        \n"
+"                                                                                        \n"
+"        // Where T lies within the period, from 0 up to 1, picks the palette entry.     \n"
+"        // The blending between the gradient's colors was done when it was built.       \n"
+"        float u = max(t_mod_p / P, 0.0f);                                               \n"
+"        uint entries = uint(Palette.colors.length());                                   \n"
+"        outputColor = Palette.colors[min(uint(u * float(entries)), entries - 1)];       \n"
+"    }                                                                                   \n"
+"    else                                                                                \n"
+"    {                                                                                   \n"
+"        uint fill_color = PushConstants.fill_color;                                     \n"
+"        uint ired = (fill_color >> 16) & 0xFF;                                          \n"
+"        uint igreen = (fill_color >> 8) & 0xFF;                                         \n"
+"        uint iblue = (fill_color) & 0xFF;                                               \n"
+"                                                                                        \n"
+"        float r_out = float(ired) / 255.0f;                                             \n"
+"        float g_out = float(igreen) / 255.0f;                                           \n"
+"        float b_out = float(iblue) / 255.0f;                                            \n"
+"                                                                                        \n"
+"        outputColor = vec4(r_out, g_out, b_out, 1.0f);                                  \n"
+"    }                                                                                   \n"
+"}                                                                                       \n"
+;
+
+const std::string mandelbrot_ff_compute_info::MANDELBROT_FF_COMPUTE_SHADER =
+"#version 450                                                                            \n"
+"layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;                  \n"
+"                                                                                        \n"
+"// Specialization constants, after the workgroup size. Non-zero values fix              \n"
+"// max_iterations and bailout_radius for the pipeline, so that the compiler can         \n"
+"// treat the loop's bounds as constants; zero leaves them to the push constants.        \n"
+"layout(constant_id = 2) const uint SPECIALIZED_MAX_ITERATIONS = 0;                      \n"
+"layout(constant_id = 3) const float SPECIALIZED_BAILOUT_RADIUS = 0.0f;                  \n"
+"                                                                                        \n"
+"// Same as MANDELBROT_COMPUTE_SHADER's, except for the view: its top-left corner        \n"
+"// in float-float, and the size of a pixel.                                             \n"
+"layout(push_constant) uniform constants                                                 \n"
+"{                                                                                       \n"
+"    uvec4 rect;                                                                         \n"
+"    uint pixel_step;                                                                    \n"
+"    uint previous_step;                                                                 \n"
+"    vec2 left;                                                                          \n"
+"    vec2 top;                                                                           \n"
+"    float pixel_width;                                                                  \n"
+"    float pixel_height;                                                                 \n"
+"    float surface_width;                                                                \n"
+"    float surface_height;                                                               \n"
+"    float bailout_radius;                                                               \n"
+"    uint max_iterations;                                                                \n"
+"} PushConstants;                                                                        \n"
+"                                                                                        \n"
+"struct pixel_result                                                                     \n"
+"{                                                                                       \n"
+"    float smooth_iteration;                                                             \n"
+"    float magnitude;                                                                    \n"
+"};                                                                                      \n"
+"                                                                                        \n"
+"layout(std430, set = 0, binding = 0) writeonly buffer IterationBuffer                   \n"
+"{                                                                                       \n"
+"    pixel_result pixels[];                                                              \n"
+"} Iterations;                                                                           \n"
+"                                                                                        \n"
+"// Float-float arithmetic: each number is vec2(hi, lo), an unevaluated sum with lo      \n"
+"// no more than half an ulp of hi, for about 48 bits of precision out of plain floats.  \n"
+"// Nothing here needs native doubles, or even FMA.                                      \n"
+"//                                                                                      \n"
+"// Every intermediate is declared precise, so the compiler can neither fuse a*b + c     \n"
+"// into an FMA nor reorder the additions. Either would throw away the very rounding     \n"
+"// errors these functions exist to capture.                                             \n"
+"vec2 ff_quick_two_sum(float a, float b)                                                 \n"
+"{                                                                                       \n"
+"    precise float s = a + b;                                                            \n"
+"    precise float e = b - (s - a);                                                      \n"
+"    return vec2(s, e);                                                                  \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_two_sum(float a, float b)                                                       \n"
+"{                                                                                       \n"
+"    precise float s = a + b;                                                            \n"
+"    precise float bb = s - a;                                                           \n"
+"    precise float e = (a - (s - bb)) + (b - bb);                                        \n"
+"    return vec2(s, e);                                                                  \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"// Dekker's split: hi holds the top 12 bits of a, lo the rest,                          \n"
+"// so that products of the halves are exact in float.                                   \n"
+"vec2 ff_split(float a)                                                                  \n"
+"{                                                                                       \n"
+"    precise float t = 4097.0f * a;                                                      \n"
+"    precise float hi = t - (t - a);                                                     \n"
+"    precise float lo = a - hi;                                                          \n"
+"    return vec2(hi, lo);                                                                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_two_prod(float a, float b)                                                      \n"
+"{                                                                                       \n"
+"    precise float p = a * b;                                                            \n"
+"    vec2 sa = ff_split(a);                                                              \n"
+"    vec2 sb = ff_split(b);                                                              \n"
+"    precise float e = ((sa.x * sb.x - p) + sa.x * sb.y + sa.y * sb.x) + sa.y * sb.y;    \n"
+"    return vec2(p, e);                                                                  \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_add(vec2 a, vec2 b)                                                             \n"
+"{                                                                                       \n"
+"    vec2 s = ff_two_sum(a.x, b.x);                                                      \n"
+"    precise float e = s.y + (a.y + b.y);                                                \n"
+"    return ff_quick_two_sum(s.x, e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_mul(vec2 a, vec2 b)                                                             \n"
+"{                                                                                       \n"
+"    vec2 p = ff_two_prod(a.x, b.x);                                                     \n"
+"    precise float e = p.y + (a.x * b.y + a.y * b.x);                                    \n"
+"    return ff_quick_two_sum(p.x, e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"vec2 ff_sqr(vec2 a)                                                                     \n"
+"{                                                                                       \n"
+"    vec2 p = ff_two_prod(a.x, a.x);                                                     \n"
+"    precise float e = p.y + 2.0f * a.x * a.y;                                           \n"
+"    return ff_quick_two_sum(p.x, e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"void main()                                                                             \n"
+"{                                                                                       \n"
+"    // Tiles and coarse passes work exactly as in MANDELBROT_COMPUTE_SHADER.            \n"
+"    uvec4 rect = PushConstants.rect;                                                    \n"
+"    uint pixel_step = PushConstants.pixel_step;                                         \n"
+"    uint x = rect.x - rect.x % pixel_step + gl_GlobalInvocationID.x * pixel_step;       \n"
+"    uint y = rect.y - rect.y % pixel_step + gl_GlobalInvocationID.y * pixel_step;       \n"
+"                                                                                        \n"
+"    if (x >= rect.x + rect.z || y >= rect.y + rect.w)                                   \n"
+"        return;                                                                         \n"
+"                                                                                        \n"
+"    uint previous_step = PushConstants.previous_step;                                   \n"
+"                                                                                        \n"
+"    if (previous_step != 0 && x % previous_step == 0 && y % previous_step == 0)         \n"
+"        return;                                                                         \n"
+"                                                                                        \n"
+"    float surface_width = PushConstants.surface_width;                                  \n"
+"                                                                                        \n"
+"    // Pixel centers, the same as gl_FragCoord in the fragment shader.                  \n"
+"    float surface_x = float(x) + 0.5f;                                                  \n"
+"    float surface_y = float(y) + 0.5f;                                                  \n"
+"                                                                                        \n"
+"    vec2 x_offset = ff_two_prod(surface_x, PushConstants.pixel_width);                  \n"
+"    vec2 y_offset = ff_two_prod(surface_y, PushConstants.pixel_height);                 \n"
+"    vec2 cr = ff_add(PushConstants.left, x_offset);                                     \n"
+"    vec2 ci = ff_add(PushConstants.top, y_offset);                                      \n"
+"                                                                                        \n"
+"    vec2 zr = vec2(0.0f);                                                               \n"
+"    vec2 zi = vec2(0.0f);                                                               \n"
+"                                                                                        \n"
+"    uint max_iteration = SPECIALIZED_MAX_ITERATIONS != 0                                \n"
+"        ? SPECIALIZED_MAX_ITERATIONS : PushConstants.max_iterations;                    \n"
+"    float bailout_radius = SPECIALIZED_BAILOUT_RADIUS != 0.0f                           \n"
+"        ? SPECIALIZED_BAILOUT_RADIUS : PushConstants.bailout_radius;                    \n"
+"    float m1 = 0.0f;                                                                    \n"
+"    float m2 = 0.0f;                                                                    \n"
+"    uint iteration = 0;                                                                 \n"
+"                                                                                        \n"
+"    // Points inside the main cardioid or the period-2 bulb never escape,               \n"
+"    // so there's no need to iterate them at all. Float is plenty for telling.          \n"
+"    float ci2 = ci.x*ci.x;                                                              \n"
+"    float xr = cr.x - 0.25f;                                                            \n"
+"    float q = xr*xr + ci2;                                                              \n"
+"    float br = cr.x + 1.0f;                                                             \n"
+"    bool known_interior = q*(q + xr) <= 0.25f*ci2 || br*br + ci2 <= 0.0625f;            \n"
+"                                                                                        \n"
+"    // Brent's cycle detection, comparing both halves of z exactly.                     \n"
+"    vec2 check_zr = vec2(0.0f);                                                         \n"
+"    vec2 check_zi = vec2(0.0f);                                                         \n"
+"    uint check_window = 1;                                                              \n"
+"    uint check_steps = 0;                                                               \n"
+"                                                                                        \n"
+"    if (known_interior)                                                                 \n"
+"        iteration = max_iteration;                                                      \n"
+"                                                                                        \n"
+"    for (uint i = 0 ; i < max_iteration && !known_interior ; i++)                       \n"
+"    {                                                                                   \n"
+"        if (m2 >= bailout_radius)                                                       \n"
+"            break;                                                                      \n"
+"                                                                                        \n"
+"        vec2 zr2 = ff_sqr(zr);                                                          \n"
+"        vec2 zi2 = ff_sqr(zi);                                                          \n"
+"                                                                                        \n"
+"        // Doubling both halves is exact.                                               \n"
+"        vec2 zr_next = ff_add(ff_add(zr2, -zi2), cr);                                   \n"
+"        vec2 zi_next = ff_add(2.0f * ff_mul(zr, zi), ci);                               \n"
+"        zr = zr_next;                                                                   \n"
+"        zi = zi_next;                                                                   \n"
+"                                                                                        \n"
+"        // Only compared against the bailout radius, so the low halves don't matter.    \n"
+"        m1 = m2;                                                                        \n"
+"        m2 = zr2.x + zi2.x;                                                             \n"
+"        iteration = iteration + 1;                                                      \n"
+"                                                                                        \n"
+"        if (zr == check_zr && zi == check_zi)                                           \n"
+"        {                                                                               \n"
+"            iteration = max_iteration;                                                  \n"
+"            break;                                                                      \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        check_steps = check_steps + 1;                                                  \n"
+"                                                                                        \n"
+"        if (check_steps == check_window)                                                \n"
+"        {                                                                               \n"
+"            check_steps = 0;                                                            \n"
+"            check_window = check_window * 2;                                            \n"
+"            check_zr = zr;                                                              \n"
+"            check_zi = zi;                                                              \n"
+"        }                                                                               \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    float smooth_iteration = -1.0f;                                                     \n"
+"                                                                                        \n"
+"    if (iteration < max_iteration)                                                      \n"
+"    {                                                                                   \n"
+"        float invm1 = 1.0f / m1;                                                        \n"
+"        float delta = 1.0f - log(bailout_radius * invm1) / log(m2 * invm1);             \n"
+"        smooth_iteration = float(iteration) - delta;                                    \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    uint block_left = max(x, rect.x);                                                   \n"
+"    uint block_top = max(y, rect.y);                                                    \n"
+"    uint block_right = min(x + pixel_step, rect.x + rect.z);                            \n"
+"    uint block_bottom = min(y + pixel_step, rect.y + rect.w);                           \n"
+"                                                                                        \n"
+"    for (uint py = block_top ; py < block_bottom ; py++)                                \n"
+"    {                                                                                   \n"
+"        for (uint px = block_left ; px < block_right ; px++)                            \n"
+"        {                                                                               \n"
+"            uint index = py * uint(surface_width) + px;                                 \n"
+"            Iterations.pixels[index] = pixel_result(smooth_iteration, m2);              \n"
+"        }                                                                               \n"
+"    }                                                                                   \n"
+"}                                                                                       \n"
+;
+
+namespace
+{
+	// Shared by both perturbation shaders, which only differ in what they hold deltas in.
+	const std::string PERTURBATION_SHADER_BODY =
+"layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;                  \n"
+"                                                                                        \n"
+"// One invocation per pixel, iterating the pixel's delta d from the reference orbit Z,  \n"
+"//                                                                                      \n"
+"//   d' = (2Z + d) d + dc                                                               \n"
+"//                                                                                      \n"
+"// the same as perturbation_engine does on the CPU. With FLOATEXP_DELTAS defined,       \n"
+"// d and dc are floats with exponents of their own, for views far too deep for floats.  \n"
+"layout(push_constant) uniform constants                                                 \n"
+"{                                                                                       \n"
+"    uvec4 rect;                                                                         \n"
+"    uvec2 surface_size;                                                                 \n"
+"    float spacing;                                                                      \n"
+"    int spacing_exponent;                                                               \n"
+"    float offset_real;                                                                  \n"
+"    int offset_real_exponent;                                                           \n"
+"    float offset_imag;                                                                  \n"
+"    int offset_imag_exponent;                                                           \n"
+"    float bailout_radius;                                                               \n"
+"    uint max_iterations;                                                                \n"
+"    uint orbit_last;                                                                    \n"
+"    float glitch_tolerance;                                                             \n"
+"    uint rebase;                                                                        \n"
+"    uint glitched_only;                                                                 \n"
+"} PushConstants;                                                                        \n"
+"                                                                                        \n"
+"struct pixel_result                                                                     \n"
+"{                                                                                       \n"
+"    float smooth_iteration;                                                             \n"
+"    float magnitude;                                                                    \n"
+"};                                                                                      \n"
+"                                                                                        \n"
+"layout(std430, set = 0, binding = 0) writeonly buffer IterationBuffer                   \n"
+"{                                                                                       \n"
+"    pixel_result pixels[];                                                              \n"
+"} Iterations;                                                                           \n"
+"                                                                                        \n"
+"// Z_n, rounded to float.                                                               \n"
+"layout(std430, set = 0, binding = 1) readonly buffer ReferenceOrbit                     \n"
+"{                                                                                       \n"
+"    vec2 z[];                                                                           \n"
+"} Orbit;                                                                                \n"
+"                                                                                        \n"
+"// See mandelbrot_bla_step. The table's levels one after another, level_size[L]         \n"
+"// steps of level L from steps[level_offset[L]]. No levels at all without BLA.          \n"
+"struct bla_step                                                                         \n"
+"{                                                                                       \n"
+"    float ar;                                                                           \n"
+"    float ai;                                                                           \n"
+"    float br;                                                                           \n"
+"    float bi;                                                                           \n"
+"    int a_exponent;                                                                     \n"
+"    int b_exponent;                                                                     \n"
+"    float radius_squared;                                                               \n"
+"    int radius_exponent;                                                                \n"
+"    uint length;                                                                        \n"
+"};                                                                                      \n"
+"                                                                                        \n"
+"layout(std430, set = 0, binding = 2) readonly buffer BlaTable                           \n"
+"{                                                                                       \n"
+"    uint level_count;                                                                   \n"
+"    uint level_offset[32];                                                              \n"
+"    uint level_size[32];                                                                \n"
+"    bla_step steps[];                                                                   \n"
+"} Bla;                                                                                  \n"
+"                                                                                        \n"
+"// For each pixel, -1 if it isn't glitched, or else |z|^2 / |Z|^2 where it glitched.    \n"
+"layout(std430, set = 0, binding = 3) buffer GlitchBuffer                                \n"
+"{                                                                                       \n"
+"    float values[];                                                                     \n"
+"} Glitches;                                                                             \n"
+"                                                                                        \n"
+"const float NOT_GLITCHED = -1.0f;                                                       \n"
+"                                                                                        \n"
+"// x * 2^e. ldexp() is only defined for exponents a float can hold,                     \n"
+"// so large ones are applied in two halves.                                             \n"
+"float scale(float x, int e)                                                             \n"
+"{                                                                                       \n"
+"    e = clamp(e, -252, 252);                                                            \n"
+"    int half_e = e / 2;                                                                 \n"
+"    return ldexp(ldexp(x, half_e), e - half_e);                                         \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"#ifdef FLOATEXP_DELTAS                                                                  \n"
+"                                                                                        \n"
+"// m * 2^e, with m between 0.5 and 1 in magnitude, or 0.                                \n"
+"struct delta_t                                                                          \n"
+"{                                                                                       \n"
+"    float m;                                                                            \n"
+"    int e;                                                                              \n"
+"};                                                                                      \n"
+"                                                                                        \n"
+"// Low enough that 0 loses every comparison of exponents,                               \n"
+"// and high enough that adding two of them can't overflow.                              \n"
+"const int ZERO_EXPONENT = -536870912;                                                   \n"
+"                                                                                        \n"
+"delta_t d_make(float m, int e)                                                          \n"
+"{                                                                                       \n"
+"    int k;                                                                              \n"
+"    float f = frexp(m, k);                                                              \n"
+"    return m == 0.0f ? delta_t(0.0f, ZERO_EXPONENT) : delta_t(f, e + k);                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"delta_t d_from(float x)                                                                 \n"
+"{                                                                                       \n"
+"    return d_make(x, 0);                                                                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"// Lines both up with the larger exponent. Anything shifted further                     \n"
+"// than 32 places is lost to rounding anyway.                                           \n"
+"delta_t d_add(delta_t a, delta_t b)                                                     \n"
+"{                                                                                       \n"
+"    int e = max(a.e, b.e);                                                              \n"
+"    float m = ldexp(a.m, max(a.e - e, -32)) + ldexp(b.m, max(b.e - e, -32));            \n"
+"    return d_make(m, e);                                                                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"delta_t d_sub(delta_t a, delta_t b)                                                     \n"
+"{                                                                                       \n"
+"    return d_add(a, delta_t(-b.m, b.e));                                                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"delta_t d_mul(delta_t a, delta_t b)                                                     \n"
+"{                                                                                       \n"
+"    return d_make(a.m * b.m, a.e + b.e);                                                \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"// a * f * 2^e                                                                          \n"
+"delta_t d_scale(delta_t a, float f, int e)                                              \n"
+"{                                                                                       \n"
+"    return d_make(a.m * f, a.e + e);                                                    \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"bool d_less(delta_t a, delta_t b)                                                       \n"
+"{                                                                                       \n"
+"    return d_sub(a, b).m < 0.0f;                                                        \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"float d_float(delta_t a)                                                                \n"
+"{                                                                                       \n"
+"    return a.e < -125 ? 0.0f : ldexp(a.m, min(a.e, 128));                               \n"
+"}                                                                                       \n"
+"                                                                                        \n"
+"#else                                                                                   \n"
+"                                                                                        \n"
+"#define delta_t float                                                                   \n"
+"                                                                                        \n"
+"float d_make(float m, int e) { return scale(m, e); }                                    \n"
+"float d_from(float x) { return x; }                                                     \n"
+"float d_add(float a, float b) { return a + b; }                                         \n"
+"float d_sub(float a, float b) { return a - b; }                                         \n"
+"float d_mul(float a, float b) { return a * b; }                                         \n"
+"float d_scale(float a, float f, int e) { return scale(a * f, e); }                      \n"
+"bool d_less(float a, float b) { return a < b; }                                         \n"
+"float d_float(float a) { return a; }                                                    \n"
+"                                                                                        \n"
+"#endif                                                                                  \n"
+"                                                                                        \n"
+"void main()                                                                             \n"
+"{                                                                                       \n"
+"    uvec4 rect = PushConstants.rect;                                                    \n"
+"    uint x = rect.x + gl_GlobalInvocationID.x;                                          \n"
+"    uint y = rect.y + gl_GlobalInvocationID.y;                                          \n"
+"                                                                                        \n"
+"    if (x >= rect.x + rect.z || y >= rect.y + rect.w)                                   \n"
+"        return;                                                                         \n"
+"                                                                                        \n"
+"    uvec2 surface_size = PushConstants.surface_size;                                    \n"
+"    uint index = y * surface_size.x + x;                                                \n"
+"                                                                                        \n"
+"    // Passes against secondary references only run the pixels still glitched.          \n"
+"    if (PushConstants.glitched_only != 0 && Glitches.values[index] == NOT_GLITCHED)     \n"
+"        return;                                                                         \n"
+"                                                                                        \n"
+"    // Pixel centers sit half a pixel in from the edges, the same as on the CPU.        \n"
+"    // Imaginary parts grow upwards. Both are taken relative to the orbit's center.     \n"
+"    delta_t spacing = d_make(PushConstants.spacing, PushConstants.spacing_exponent);    \n"
+"    float pixel_x = float(x) + 0.5f - 0.5f * float(surface_size.x);                     \n"
+"    float pixel_y = 0.5f * float(surface_size.y) - (float(y) + 0.5f);                   \n"
+"                                                                                        \n"
+"    delta_t dcr = d_sub(d_mul(d_from(pixel_x), spacing),                                \n"
+"        d_make(PushConstants.offset_real, PushConstants.offset_real_exponent));         \n"
+"    delta_t dci = d_sub(d_mul(d_from(pixel_y), spacing),                                \n"
+"        d_make(PushConstants.offset_imag, PushConstants.offset_imag_exponent));         \n"
+"                                                                                        \n"
+"    uint max_iteration = PushConstants.max_iterations;                                  \n"
+"    float bailout_radius = PushConstants.bailout_radius;                                \n"
+"    uint last = PushConstants.orbit_last;                                               \n"
+"    uint levels = min(Bla.level_count, 32u);                                            \n"
+"    bool rebase = PushConstants.rebase != 0;                                            \n"
+"    float tolerance = PushConstants.glitch_tolerance;                                   \n"
+"                                                                                        \n"
+"    // z_0 = Z_0 = 0, so d_0 = 0. m indexes the reference orbit,                        \n"
+"    // which only keeps in step with iteration until the first rebase.                  \n"
+"    delta_t dr = d_from(0.0f);                                                          \n"
+"    delta_t di = d_from(0.0f);                                                          \n"
+"    uint m = 0;                                                                         \n"
+"    uint iteration = 0;                                                                 \n"
+"    float m1 = 0.0f;                                                                    \n"
+"    float m2 = 0.0f;                                                                    \n"
+"    float glitch = NOT_GLITCHED;                                                        \n"
+"                                                                                        \n"
+"    while (iteration < max_iteration && m2 < bailout_radius)                            \n"
+"    {                                                                                   \n"
+"        vec2 z = Orbit.z[m];                                                            \n"
+"        delta_t r = d_add(d_from(z.x), dr);                                             \n"
+"        delta_t i = d_add(d_from(z.y), di);                                             \n"
+"        delta_t magnitude = d_add(d_mul(r, r), d_mul(i, i));                            \n"
+"                                                                                        \n"
+"        m1 = m2;                                                                        \n"
+"        m2 = d_float(magnitude);                                                        \n"
+"        iteration = iteration + 1;                                                      \n"
+"                                                                                        \n"
+"        if (m2 >= bailout_radius || iteration >= max_iteration)                         \n"
+"            break;                                                                      \n"
+"                                                                                        \n"
+"        delta_t delta_magnitude = d_add(d_mul(dr, dr), d_mul(di, di));                  \n"
+"                                                                                        \n"
+"        if (rebase && (d_less(magnitude, delta_magnitude) || m == last))                \n"
+"        {                                                                               \n"
+"            // z is closer to 0 than to Z_m, or the reference orbit's run out.          \n"
+"            dr = r;                                                                     \n"
+"            di = i;                                                                     \n"
+"            z = vec2(0.0f);                                                             \n"
+"            m = 0;                                                                      \n"
+"        }                                                                               \n"
+"        else if (m == last)                                                             \n"
+"        {                                                                               \n"
+"            glitch = 0.0f;                                                              \n"
+"            break;                                                                      \n"
+"        }                                                                               \n"
+"        else                                                                            \n"
+"        {                                                                               \n"
+"            // Pauldelbrot's criterion.                                                 \n"
+"            float reference_magnitude = dot(z, z);                                      \n"
+"            delta_t limit = d_from(tolerance * reference_magnitude);                    \n"
+"                                                                                        \n"
+"            if (d_less(magnitude, limit))                                               \n"
+"            {                                                                           \n"
+"                glitch = m2 / reference_magnitude;                                      \n"
+"                break;                                                                  \n"
+"            }                                                                           \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        // The longest BLA step from here, climbing the levels the same way             \n"
+"        // as bla_table::lookup() does.                                                 \n"
+"        int step = -1;                                                                  \n"
+"                                                                                        \n"
+"        if (m != 0)                                                                     \n"
+"        {                                                                               \n"
+"            uint n = m - 1;                                                             \n"
+"            uint remaining = max_iteration - iteration;                                 \n"
+"                                                                                        \n"
+"            for (uint level = 1; level < levels; level++)                               \n"
+"            {                                                                           \n"
+"                // Level L only has steps starting where n is a multiple of 2^L.        \n"
+"                if (((n >> (level - 1)) & 1u) != 0u)                                    \n"
+"                    break;                                                              \n"
+"                                                                                        \n"
+"                uint k = n >> level;                                                    \n"
+"                                                                                        \n"
+"                if (k >= Bla.level_size[level])                                         \n"
+"                    break;                                                              \n"
+"                                                                                        \n"
+"                uint candidate = Bla.level_offset[level] + k;                           \n"
+"                bla_step s = Bla.steps[candidate];                                      \n"
+"                delta_t radius = d_make(s.radius_squared, s.radius_exponent);           \n"
+"                                                                                        \n"
+"                if (!d_less(delta_magnitude, radius) || s.length > remaining)           \n"
+"                    break;                                                              \n"
+"                                                                                        \n"
+"                step = int(candidate);                                                  \n"
+"            }                                                                           \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        if (step >= 0)                                                                  \n"
+"        {                                                                               \n"
+"            // d' = a d + b dc, for s.length iterations at once.                        \n"
+"            bla_step s = Bla.steps[step];                                               \n"
+"            int ae = s.a_exponent;                                                      \n"
+"            int be = s.b_exponent;                                                      \n"
+"                                                                                        \n"
+"            delta_t next_r = d_add(                                                     \n"
+"                d_sub(d_scale(dr, s.ar, ae), d_scale(di, s.ai, ae)),                    \n"
+"                d_sub(d_scale(dcr, s.br, be), d_scale(dci, s.bi, be)));                 \n"
+"            di = d_add(                                                                 \n"
+"                d_add(d_scale(di, s.ar, ae), d_scale(dr, s.ai, ae)),                    \n"
+"                d_add(d_scale(dci, s.br, be), d_scale(dcr, s.bi, be)));                 \n"
+"            dr = next_r;                                                                \n"
+"                                                                                        \n"
+"            m = m + s.length;                                                           \n"
+"            iteration = iteration + s.length - 1;                                       \n"
+"                                                                                        \n"
+"            vec2 previous = Orbit.z[m - 1];                                             \n"
+"            m2 = dot(previous, previous);                                               \n"
+"            continue;                                                                   \n"
+"        }                                                                               \n"
+"                                                                                        \n"
+"        // d' = (2Z + d) d + dc                                                         \n"
+"        delta_t tr = d_add(d_from(2.0f * z.x), dr);                                     \n"
+"        delta_t ti = d_add(d_from(2.0f * z.y), di);                                     \n"
+"        delta_t next_r = d_add(d_sub(d_mul(tr, dr), d_mul(ti, di)), dcr);               \n"
+"        di = d_add(d_add(d_mul(tr, di), d_mul(ti, dr)), dci);                           \n"
+"        dr = next_r;                                                                    \n"
+"        m = m + 1;                                                                      \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    float smooth_iteration = -1.0f;                                                     \n"
+"                                                                                        \n"
+"    if (glitch == NOT_GLITCHED && iteration < max_iteration)                            \n"
+"    {                                                                                   \n"
+"        float invm1 = 1.0f / m1;                                                        \n"
+"        float delta = 1.0f - log(bailout_radius * invm1) / log(m2 * invm1);             \n"
+"        smooth_iteration = float(iteration) - delta;                                    \n"
+"    }                                                                                   \n"
+"                                                                                        \n"
+"    Iterations.pixels[index] = pixel_result(smooth_iteration, m2);                      \n"
+"    Glitches.values[index] = glitch;                                                    \n"
+"}                                                                                       \n"
+;
+}
+
+const std::string mandelbrot_perturbation_info::MANDELBROT_PERTURBATION_SHADER =
+"#version 450                                                                            \n" + PERTURBATION_SHADER_BODY;
+
+const std::string mandelbrot_perturbation_info::MANDELBROT_PERTURBATION_FLOATEXP_SHADER =
+"#version 450                                                                            \n"
+"#define FLOATEXP_DELTAS                                                                 \n" + PERTURBATION_SHADER_BODY;
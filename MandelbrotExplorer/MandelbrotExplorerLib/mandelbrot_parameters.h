@@ -1,11 +1,16 @@
 #pragma once
 #include "pch.h"
 #include <glm/glm.hpp>
+#include "double_double.h"
 
 struct mandelbrot_parameter_info
 {
+	// Runs the whole escape-time loop and colors the result, one fragment per pixel.
 	static const std::string MANDELBROT_FRAGMENT_SHADER;
 
+	// Only colors the results MANDELBROT_COMPUTE_SHADER left in the iteration buffer.
+	static const std::string MANDELBROT_COLOR_SHADER;
+
 	glm::float32 top;			
 	glm::float32 left;			
 	glm::float32 right;			
@@ -16,10 +21,10 @@ struct mandelbrot_parameter_info
 	glm::uint max_iterations;		
 	glm::uint fill_color;		
 	glm::float32 gradient_period_factor;	
-	glm::uint gradient_length;
 
-	static const int GRADIENT_CAPACITY = 21;
-	glm::uint gradient[GRADIENT_CAPACITY];
+	// How many colors the gradient has. The colors themselves are in the palette,
+	// which the renderer keeps in a storage buffer: see vulkan_renderer::set_palette().
+	glm::uint gradient_length;
 
 	mandelbrot_parameter_info()
 	{
@@ -29,3 +34,219 @@ struct mandelbrot_parameter_info
 		}
 	}
 };
+
+// The view's bounds at full precision. mandelbrot_parameter_info only has room for
+// floats within the 128 byte push constant limit, and floats run out of bits after
+// a zoom of about 1e-5. The double and double-double kernels take their bounds
+// from here instead, and everything else from mandelbrot_parameter_info as usual.
+struct mandelbrot_precise_bounds
+{
+	double_double top;
+	double_double left;
+	double_double right;
+	double_double bottom;
+
+	mandelbrot_precise_bounds()
+	{
+	}
+
+	mandelbrot_precise_bounds(const double_double& top, const double_double& left, const double_double& right, const double_double& bottom)
+		: top(top), left(left), right(right), bottom(bottom)
+	{
+	}
+
+	// Just the float bounds, for callers that haven't got anything better.
+	explicit mandelbrot_precise_bounds(const mandelbrot_parameter_info& info)
+		: top(info.top), left(info.left), right(info.right), bottom(info.bottom)
+	{
+	}
+};
+
+// What MANDELBROT_COMPUTE_SHADER writes into the iteration buffer for each pixel.
+struct mandelbrot_pixel_result
+{
+	// Same value (and same INTERIOR marker) as iteration_buffer holds for the CPU renderer.
+	static constexpr float INTERIOR = -1.0f;
+
+	glm::float32 smooth_iteration;	// T = iteration - delta, or INTERIOR.
+	glm::float32 magnitude;			// |z|^2 on the iteration of bailout.
+};
+
+// Push constants for MANDELBROT_COMPUTE_SHADER.
+// Only what the escape-time loop needs; the gradient is left to the color shader.
+struct mandelbrot_compute_info
+{
+	static const std::string MANDELBROT_COMPUTE_SHADER;
+
+	// The renderer fills these in for each tile it dispatches.
+	// Coarse passes compute one pixel per pixel_step x pixel_step block and fill the
+	// block with it, skipping the blocks previous_step's pass already computed.
+	glm::uint rect_left = 0;
+	glm::uint rect_top = 0;
+	glm::uint rect_width = 0;
+	glm::uint rect_height = 0;
+	glm::uint pixel_step = 1;
+	glm::uint previous_step = 0;
+
+	glm::float32 top;
+	glm::float32 left;
+	glm::float32 right;
+	glm::float32 bottom;
+	glm::float32 surface_width;
+	glm::float32 surface_height;
+	glm::float32 bailout_radius;
+	glm::uint max_iterations;
+
+	mandelbrot_compute_info(const mandelbrot_parameter_info& info)
+		: top(info.top), left(info.left), right(info.right), bottom(info.bottom),
+		  surface_width(info.surface_width), surface_height(info.surface_height),
+		  bailout_radius(info.bailout_radius), max_iterations(info.max_iterations)
+	{
+	}
+};
+
+// A number for the emulated-double shaders: hi + lo, with lo no more than half an ulp
+// of hi. About 48 bits of precision from plain floats, which every device has,
+// where native doubles are slow on most and missing on some.
+struct float_float
+{
+	glm::float32 hi;
+	glm::float32 lo;
+
+	float_float()
+		: hi(0.0f), lo(0.0f)
+	{
+	}
+
+	float_float(const double_double& value)
+	{
+		hi = (float)value.hi;
+		lo = (float)(double)(value - double_double(hi));
+	}
+};
+
+// Push constants for MANDELBROT_FF_FRAGMENT_SHADER, which runs the escape-time loop in
+// float-float for zooms down to about 1e-13. Only the view's top-left corner needs
+// float-float. The pixel size is tiny next to it, so float does for that, and doing
+// without the other two bounds and the surface size keeps it all well within 128 bytes.
+struct mandelbrot_ff_parameter_info
+{
+	static const std::string MANDELBROT_FF_FRAGMENT_SHADER;
+
+	float_float left;
+	float_float top;
+	glm::float32 pixel_width;
+	glm::float32 pixel_height;
+	glm::float32 bailout_radius;
+	glm::uint max_iterations;
+	glm::uint fill_color;
+	glm::float32 gradient_period_factor;
+	glm::uint gradient_length;
+
+	mandelbrot_ff_parameter_info(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds)
+		: left(bounds.left), top(bounds.top),
+		  pixel_width((float)((double)(bounds.right - bounds.left) / info.surface_width)),
+		  pixel_height((float)((double)(bounds.bottom - bounds.top) / info.surface_height)),
+		  bailout_radius(info.bailout_radius), max_iterations(info.max_iterations),
+		  fill_color(info.fill_color), gradient_period_factor(info.gradient_period_factor),
+		  gradient_length(info.gradient_length)
+	{
+		static_assert(sizeof(mandelbrot_ff_parameter_info) <= 128, "Float-float parameters size exceeds Vulkan push constant limit.");
+	}
+};
+
+// Push constants for MANDELBROT_FF_COMPUTE_SHADER, the float-float counterpart to
+// MANDELBROT_COMPUTE_SHADER. Writes the same mandelbrot_pixel_result, so
+// MANDELBROT_COLOR_SHADER colors its results as usual.
+struct mandelbrot_ff_compute_info
+{
+	static const std::string MANDELBROT_FF_COMPUTE_SHADER;
+
+	glm::uint rect_left = 0;
+	glm::uint rect_top = 0;
+	glm::uint rect_width = 0;
+	glm::uint rect_height = 0;
+	glm::uint pixel_step = 1;
+	glm::uint previous_step = 0;
+
+	float_float left;
+	float_float top;
+	glm::float32 pixel_width;
+	glm::float32 pixel_height;
+	glm::float32 surface_width;
+	glm::float32 surface_height;
+	glm::float32 bailout_radius;
+	glm::uint max_iterations;
+
+	mandelbrot_ff_compute_info(const mandelbrot_parameter_info& info, const mandelbrot_precise_bounds& bounds)
+		: left(bounds.left), top(bounds.top),
+		  pixel_width((float)((double)(bounds.right - bounds.left) / info.surface_width)),
+		  pixel_height((float)((double)(bounds.bottom - bounds.top) / info.surface_height)),
+		  surface_width(info.surface_width), surface_height(info.surface_height),
+		  bailout_radius(info.bailout_radius), max_iterations(info.max_iterations)
+	{
+	}
+};
+
+// Push constants for MANDELBROT_PERTURBATION_SHADER, which runs the perturbation engine's
+// pixels on the GPU against a reference orbit and BLA table in storage buffers, with float
+// deltas, and MANDELBROT_PERTURBATION_FLOATEXP_SHADER, the same with floats that have
+// exponents of their own. Writes the same mandelbrot_pixel_result as MANDELBROT_COMPUTE_SHADER.
+// See vulkan_perturbation_device. The pixel spacing and offsets are far too small for a float,
+// so each is a float mantissa times 2^exponent.
+struct mandelbrot_perturbation_info
+{
+	static const std::string MANDELBROT_PERTURBATION_SHADER;
+	static const std::string MANDELBROT_PERTURBATION_FLOATEXP_SHADER;
+
+	// Levels the shaders' BLA table has room for.
+	enum { BLA_LEVEL_CAPACITY = 32 };
+
+	// The renderer fills these in for each band of rows it dispatches.
+	glm::uint rect_left = 0;
+	glm::uint rect_top = 0;
+	glm::uint rect_width = 0;
+	glm::uint rect_height = 0;
+
+	glm::uint surface_width = 0;
+	glm::uint surface_height = 0;
+
+	// Where the reference orbit's center is relative to the view's.
+	glm::float32 spacing = 0.0f;
+	glm::int32 spacing_exponent = 0;
+	glm::float32 offset_real = 0.0f;
+	glm::int32 offset_real_exponent = 0;
+	glm::float32 offset_imag = 0.0f;
+	glm::int32 offset_imag_exponent = 0;
+
+	glm::float32 bailout_radius = 4.0f;
+	glm::uint max_iterations = 0;
+	glm::uint orbit_last = 0;		// Index of the reference orbit's last element.
+	glm::float32 glitch_tolerance = 0.0f;
+	glm::uint rebase = 1;
+	glm::uint glitched_only = 0;	// Only run the pixels the glitch buffer marks as glitched.
+};
+
+// One step of the BLA table as the perturbation shaders read it: see bla_step. a and b
+// are each a pair of float mantissas sharing an exponent, since at deep zooms b is
+// far beyond a float's range, and a can be too.
+struct mandelbrot_bla_step
+{
+	glm::float32 ar;
+	glm::float32 ai;
+	glm::float32 br;
+	glm::float32 bi;
+	glm::int32 a_exponent;
+	glm::int32 b_exponent;
+	glm::float32 radius_squared;
+	glm::int32 radius_exponent;
+	glm::uint length;
+};
+
+// The start of the BLA table's storage buffer, followed by the steps of every level in turn.
+struct mandelbrot_bla_header
+{
+	glm::uint level_count;
+	glm::uint level_offset[mandelbrot_perturbation_info::BLA_LEVEL_CAPACITY];
+	glm::uint level_size[mandelbrot_perturbation_info::BLA_LEVEL_CAPACITY];
+};
@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "palette.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	float channel(uint32_t color, int shift, bool srgb)
+	{
+		float value = float((color >> shift) & 0xFF) / 255.0f;
+
+		if (!srgb)
+			return value;
+
+		return value <= 0.04045f
+			? value / 12.92f
+			: std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+}
+
+void palette::build(const uint32_t* gradient, uint32_t length, uint32_t size, bool srgbInterpolation)
+{
+	if (length == 0 || size == 0)
+	{
+		_colors.assign(1, palette_color{ 0.0f, 0.0f, 0.0f, 1.0f });
+		return;
+	}
+
+	std::vector<palette_color> stops(length);
+
+	for (uint32_t i = 0; i < length; i++)
+	{
+		stops[i].r = channel(gradient[i], 16, srgbInterpolation);
+		stops[i].g = channel(gradient[i], 8, srgbInterpolation);
+		stops[i].b = channel(gradient[i], 0, srgbInterpolation);
+		stops[i].a = 1.0f;
+	}
+
+	_colors.resize(size);
+
+	// Exactly as the shaders blended the gradient: hue = u * length, between colors
+	// floor(hue) and floor(hue) + 1, wrapping around to the first.
+	for (uint32_t i = 0; i < size; i++)
+	{
+		double hue = (double)i / size * length;
+		uint32_t c1 = std::min((uint32_t)hue, length - 1);
+		uint32_t c2 = (c1 + 1) % length;
+		float epsilon = (float)(hue - c1);
+
+		palette_color& color = _colors[i];
+		color.r = stops[c1].r + (stops[c2].r - stops[c1].r) * epsilon;
+		color.g = stops[c1].g + (stops[c2].g - stops[c1].g) * epsilon;
+		color.b = stops[c1].b + (stops[c2].b - stops[c1].b) * epsilon;
+		color.a = 1.0f;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <cstdint>
+
+// One palette entry, laid out as a std430 vec4, ready for the fragment shader to output as is.
+struct palette_color
+{
+	float r;
+	float g;
+	float b;
+	float a;
+};
+
+// A gradient sampled so finely that coloring a pixel only takes looking up the nearest sample,
+// where the shaders used to unpack and blend two of the gradient's colors for every pixel.
+//
+// The gradient's colors are 0xRRGGBB, evenly spaced around a loop: the last blends back into
+// the first. Entry i holds the color a fraction i / size() of the way around, so a pixel at
+// position u (0 <= u < 1) within the gradient's period takes entry floor(u * size()).
+class palette
+{
+public:
+
+	static const uint32_t DEFAULT_SIZE = 4096;
+
+	// By default, the channels are taken as they are, as linear values, and blended as such,
+	// the way the shaders always have. With srgbInterpolation, they're taken as sRGB, the way
+	// color pickers mean them, and blended in linear light. The gradient's own colors then
+	// come out exactly as given in an sRGB image, and the blends between them don't darken.
+	// An empty gradient gives a palette of a single black entry.
+	void build(const uint32_t* gradient, uint32_t length, uint32_t size = DEFAULT_SIZE, bool srgbInterpolation = false);
+
+	uint32_t size() const { return (uint32_t)_colors.size(); }
+	const std::vector<palette_color>& colors() const { return _colors; }
+
+	// The entry for position u within the period, as the shaders look it up.
+	const palette_color& at(float u) const
+	{
+		// Degenerate positions (NaN, infinities) are anyone's guess in the shaders. Here, they're the first entry.
+		if (!(u >= 0.0f && u < 1.0f))
+			return _colors[0];
+
+		uint32_t index = (uint32_t)(u * (float)_colors.size());
+		return _colors[index < _colors.size() ? index : _colors.size() - 1];
+	}
+
+private:
+
+	std::vector<palette_color> _colors = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+};
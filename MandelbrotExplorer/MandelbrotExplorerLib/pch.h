@@ -7,12 +7,18 @@
 #ifndef PCH_H
 #define PCH_H
 
+// The native renderer also builds headless on non-Windows hosts,
+// where there's no Win32 surface and no C++/CLI.
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#define NOMINMAX
+#endif
 
 // add headers that you want to pre-compile here
-#define NOMINMAX
+#ifdef _MANAGED
 #include <msclr/marshal.h>
 #include <msclr/marshal_cppstd.h>
+#endif
 #include <vulkan/vulkan.h>
 #include <stdexcept>
 
@@ -0,0 +1,891 @@
+#include "pch.h"
+#include "perturbation.h"
+#include "double_double.h"
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+
+// A reference orbit, and its BLA steps, as far as they've been computed. The orbit's one
+// producer appends a chunk of elements, extends the BLA table over them, and only then
+// publishes the new size, with a release that makes all of it visible to whichever pixel
+// acquires the size. Nothing below the published size ever changes again, and the orbit
+// has room for every element it could ever have, so pixels read it without locks,
+// like the consumers of a queue that never wraps around. Only a pixel that catches up
+// with the producer takes the lock, to sleep until the next chunk.
+struct orbit_stream
+{
+	std::atomic<size_t> available{ 0 };
+	std::atomic<bool> complete{ false };
+
+	// Set if the pixels give up early, so that the producer stops too.
+	std::atomic<bool> cancelled{ false };
+
+	// Whether the producer builds BLA steps along with the orbit.
+	bool bla = false;
+
+	// Index of the orbit's last element, once it's complete.
+	size_t last = 0;
+
+	std::mutex mutex;
+	std::condition_variable published;
+
+	void publish(size_t size, bool done)
+	{
+		{
+			// Under the lock, so that no pixel can check for more and then miss being woken.
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (done)
+				last = size > 0 ? size - 1 : 0;
+
+			available.store(size, std::memory_order_release);
+
+			if (done)
+				complete.store(true, std::memory_order_release);
+		}
+
+		published.notify_all();
+	}
+
+	// Waits until the orbit has at least count elements, or is complete with fewer.
+	// Returns how many it has.
+	size_t wait_for(size_t count) const
+	{
+		size_t size = available.load(std::memory_order_acquire);
+
+		if (size >= count)
+			return size;
+
+		// The final size is published before complete, so read it again after.
+		if (complete.load(std::memory_order_acquire))
+			return available.load(std::memory_order_acquire);
+
+		std::unique_lock<std::mutex> lock(const_cast<std::mutex&>(mutex));
+		const_cast<std::condition_variable&>(published).wait(lock, [&]
+		{
+			return available.load(std::memory_order_acquire) >= count || complete.load(std::memory_order_acquire);
+		});
+
+		return available.load(std::memory_order_acquire);
+	}
+};
+
+namespace
+{
+	const float NOT_GLITCHED = -1.0f;
+
+	// Marks an orbit's skip tables out of date, since no maxDc is ever negative.
+	const double STALE_MAX_DC = -1.0;
+
+	// Pixel spacing down to which double deltas are used, as a power of two (about 1e-289).
+	// Well short of where dc would underflow, since some pixels' d shrink below their dc for a while.
+	const int32_t SMALLEST_DOUBLE_SPACING = -960;
+
+	// Source of reference_orbit::generation, shared by every engine.
+	std::atomic<uint64_t> lastGeneration{ 0 };
+
+	// Orbit elements a streamed reference publishes at a time. Pixels mostly lag far behind
+	// the producer, so this only needs to be small next to any orbit worth streaming,
+	// and large enough that publishing, and waking any pixels waiting, is rare.
+	const size_t STREAM_CHUNK = 1024;
+
+	double milliseconds_since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	struct pixel_pass
+	{
+		const double* reference_real;
+		const double* reference_imag;
+		const float* reference_real_float;
+		const float* reference_imag_float;
+
+		// SIZE_MAX while the orbit's being streamed, and stream says how much of it there is.
+		size_t last;
+		const orbit_stream* stream;
+		double bailout_radius;
+		uint32_t max_iterations;
+		bool rebase;
+		double glitch_tolerance;
+
+		// Whichever of these the orbit has, if any.
+		const bla_table* bla;
+		const series_approximation* series;
+
+		// Where the pixels are relative to the orbit's center.
+		uint32_t surface_width;
+		uint32_t surface_height;
+		floatexp<double> spacing;
+		floatexp<double> offset_real;
+		floatexp<double> offset_imag;
+
+		// Every pixel, or just the ones glitches marks as glitched.
+		bool glitched_only;
+		float* glitches;
+	};
+
+	struct pixel_outcome
+	{
+		uint32_t iteration;
+		double m1;
+		double m2;
+
+		// |z|^2 / |Z|^2 where the pixel glitched, or NOT_GLITCHED.
+		float glitch;
+		uint32_t rebases;
+		uint32_t skipped;
+	};
+
+	struct pass_totals
+	{
+		std::atomic<uint64_t> glitched{ 0 };
+		std::atomic<uint64_t> rebases{ 0 };
+		std::atomic<uint64_t> iterations{ 0 };
+		std::atomic<uint64_t> skipped{ 0 };
+	};
+
+	// Z_m, as pixels with each kind of delta read it.
+	void reference_at(const pixel_pass& pass, size_t m, float& zr, float& zi)
+	{
+		zr = pass.reference_real_float[m];
+		zi = pass.reference_imag_float[m];
+	}
+
+	void reference_at(const pixel_pass& pass, size_t m, double& zr, double& zi)
+	{
+		zr = pass.reference_real[m];
+		zi = pass.reference_imag[m];
+	}
+
+	void reference_at(const pixel_pass& pass, size_t m, floatexp<double>& zr, floatexp<double>& zi)
+	{
+		zr = pass.reference_real[m];
+		zi = pass.reference_imag[m];
+	}
+
+	// d' = a d + b dc.
+	template <typename T>
+	void take_step(const bla_step& step, T& dr, T& di, const T& dcr, const T& dci)
+	{
+		T ar(step.ar), ai(step.ai), br(step.br), bi(step.bi);
+		T nextR = ar * dr - ai * di + br * dcr - bi * dci;
+		di = ar * di + ai * dr + br * dci + bi * dcr;
+		dr = nextR;
+	}
+
+	// a and b can be far beyond a float's range even where a d and b dc aren't.
+	void take_step(const bla_step& step, float& dr, float& di, const float& dcr, const float& dci)
+	{
+		double nextR = step.ar * dr - step.ai * di + step.br * dcr - step.bi * dci;
+		di = (float)(step.ar * di + step.ai * dr + step.br * dci + step.bi * dcr);
+		dr = (float)nextR;
+	}
+
+	// Waits for the streamed orbit to reach count elements, updating a pixel's idea of
+	// how many there are, and of which is the last once that's known.
+	void catch_up(const pixel_pass& pass, size_t count, size_t& available, size_t& last)
+	{
+		available = pass.stream->wait_for(count);
+
+		if (available < count && pass.stream->complete.load(std::memory_order_acquire))
+			last = pass.stream->last;
+	}
+
+	// Rounds a view offset to a pixel's delta type.
+	template <typename T> T narrow(const floatexp<double>& value) { return (T)value.to_double(); }
+	template <> floatexp<double> narrow<floatexp<double>>(const floatexp<double>& value) { return value; }
+
+	// T is float, double or floatexp<double>: see delta_format.
+	template <typename T>
+	pixel_outcome perturb_pixel(const pixel_pass& pass, const T& dcr, const T& dci)
+	{
+		pixel_outcome outcome{ 0, 0.0, 0.0, NOT_GLITCHED, 0, 0 };
+
+		// z_0 = Z_0 = 0, so d_0 = 0. m indexes the reference orbit,
+		// which only keeps in step with iteration until the first rebase.
+		T dr(0.0);
+		T di(0.0);
+		size_t m = 0;
+
+		// How much of the orbit there's known to be. Everything, unless it's being streamed.
+		size_t available = pass.stream != nullptr ? pass.stream->available.load(std::memory_order_acquire) : SIZE_MAX;
+		size_t last = pass.last;
+
+		if (pass.series != nullptr && pass.series->skip() > 0)
+		{
+			double sr = 0.0;
+			double si = 0.0;
+			pass.series->evaluate(to_double(dcr), to_double(dci), sr, si);
+			dr = T(sr);
+			di = T(si);
+
+			m = pass.series->skip();
+			outcome.iteration = pass.series->skip();
+			outcome.skipped = pass.series->skip();
+
+			// |z|^2 on the iteration before, near enough, for smoothing should the next one bail out.
+			outcome.m2 = pass.reference_real[m - 1] * pass.reference_real[m - 1] + pass.reference_imag[m - 1] * pass.reference_imag[m - 1];
+		}
+
+		// Same loop as the shaders': m2 ends up as |z|^2 on the iteration of bailout,
+		// and m1 as |z|^2 on the iteration before.
+		while (outcome.iteration < pass.max_iterations && outcome.m2 < pass.bailout_radius)
+		{
+			// Only ever true at the start of a streamed orbit, or where a BLA step lands.
+			if (m >= available)
+			{
+				catch_up(pass, m + 1, available, last);
+
+				// The orbit was cut short, which only happens when the frame's being abandoned.
+				if (m >= available)
+				{
+					outcome.glitch = 0.0f;
+					break;
+				}
+			}
+
+			T zr, zi;
+			reference_at(pass, m, zr, zi);
+
+			T r = zr + dr;
+			T i = zi + di;
+			T magnitude = r * r + i * i;
+
+			outcome.m1 = outcome.m2;
+			outcome.m2 = to_double(magnitude);
+			outcome.iteration++;
+
+			// Done, so there's no need for another delta, nor for a reference orbit to take it from.
+			if (outcome.m2 >= pass.bailout_radius || outcome.iteration >= pass.max_iterations)
+				break;
+
+			T deltaMagnitude = dr * dr + di * di;
+
+			// Whether m is the last element depends on whether the next one's coming.
+			if (m + 1 >= available && last == SIZE_MAX)
+				catch_up(pass, m + 2, available, last);
+
+			if (pass.rebase && (magnitude < deltaMagnitude || m == last))
+			{
+				// z is closer to 0 than to Z_m, or the reference orbit's run out.
+				// Either way, Z_0 = 0 is a better fit, and costs nothing to switch to.
+				dr = r;
+				di = i;
+				zr = T(0.0);
+				zi = T(0.0);
+				m = 0;
+				outcome.rebases++;
+			}
+			else if (m == last)
+			{
+				outcome.glitch = 0.0f;
+				break;
+			}
+			else
+			{
+				double referenceMagnitude = pass.reference_real[m] * pass.reference_real[m] + pass.reference_imag[m] * pass.reference_imag[m];
+
+				if (magnitude < T(pass.glitch_tolerance * referenceMagnitude))
+				{
+					outcome.glitch = (float)(outcome.m2 / referenceMagnitude);
+					break;
+				}
+			}
+
+			if (pass.bla != nullptr && m != 0)
+			{
+				// With extended deltas |d|^2 may underflow to 0 here, but then it's
+				// far inside any radius anyway.
+				const bla_step* step = pass.bla->lookup(m, to_double(deltaMagnitude), pass.max_iterations - outcome.iteration, available);
+
+				if (step != nullptr)
+				{
+					// step->length iterations at once.
+					take_step(*step, dr, di, dcr, dci);
+
+					m += step->length;
+					outcome.iteration += step->length - 1;
+					outcome.skipped += step->length - 1;
+					outcome.m2 = pass.reference_real[m - 1] * pass.reference_real[m - 1] + pass.reference_imag[m - 1] * pass.reference_imag[m - 1];
+					continue;
+				}
+			}
+
+			// d' = (2Z + d) d + dc
+			T tr = zr + zr + dr;
+			T ti = zi + zi + di;
+			T nextR = tr * dr - ti * di + dcr;
+			di = tr * di + ti * dr + dci;
+			dr = nextR;
+
+			m++;
+		}
+
+		return outcome;
+	}
+
+	// Runs a pass's pixels with deltas of type T.
+	template <typename T>
+	void run_pixels(const pixel_pass& pass, tile_scheduler& scheduler, iteration_buffer& output, pass_totals& totals)
+	{
+		double center = 0.5 * pass.surface_width;
+
+		// Tiles never overlap, so workers can all write into output and glitches at once.
+		scheduler.run(pass.surface_width, pass.surface_height, [&](const tile& t)
+		{
+			uint64_t tileGlitched = 0;
+			uint64_t tileRebases = 0;
+			uint64_t tileIterations = 0;
+			uint64_t tileSkipped = 0;
+
+			// A row's real offsets, all at the spacing's exponent to start with,
+			// then normalized together and taken relative to the orbit's own center.
+			std::vector<double> mantissas(t.width);
+			std::vector<int32_t> exponents(t.width);
+			std::vector<T> dcr(t.width);
+
+			for (uint32_t k = 0; k < t.width; k++)
+			{
+				// Pixel centers sit half a pixel in from the edges, the same as
+				// in the shaders and cpu_renderer.
+				mantissas[k] = ((t.left + k + 0.5) - center) * pass.spacing.mantissa;
+				exponents[k] = pass.spacing.exponent;
+			}
+
+			normalize(mantissas.data(), exponents.data(), t.width);
+
+			for (uint32_t k = 0; k < t.width; k++)
+				dcr[k] = narrow<T>(floatexp<double>::raw(mantissas[k], exponents[k]) - pass.offset_real);
+
+			for (uint32_t y = t.top; y < t.top + t.height; y++)
+			{
+				// Imaginary parts grow upwards.
+				floatexp<double> imag = (0.5 * pass.surface_height - (y + 0.5)) * pass.spacing;
+				T dci = narrow<T>(imag - pass.offset_imag);
+
+				float* values = output.row(y);
+				float* glitches = pass.glitches + (size_t)y * pass.surface_width;
+
+				for (uint32_t x = t.left; x < t.left + t.width; x++)
+				{
+					if (pass.glitched_only && glitches[x] == NOT_GLITCHED)
+						continue;
+
+					pixel_outcome outcome = perturb_pixel(pass, dcr[x - t.left], dci);
+					glitches[x] = outcome.glitch;
+					tileRebases += outcome.rebases;
+					tileIterations += outcome.iteration;
+					tileSkipped += outcome.skipped;
+
+					if (outcome.glitch != NOT_GLITCHED)
+					{
+						values[x] = iteration_buffer::INTERIOR;
+						tileGlitched++;
+					}
+					else if (outcome.iteration < pass.max_iterations)
+					{
+						float invm1 = 1.0f / (float)outcome.m1;
+						float delta = 1.0f - std::log((float)pass.bailout_radius * invm1) / std::log((float)outcome.m2 * invm1);
+						values[x] = float(outcome.iteration) - delta;
+					}
+					else
+					{
+						values[x] = iteration_buffer::INTERIOR;
+					}
+				}
+			}
+
+			totals.glitched += tileGlitched;
+			totals.rebases += tileRebases;
+			totals.iterations += tileIterations;
+			totals.skipped += tileSkipped;
+		});
+	}
+}
+
+perturbation_engine::perturbation_engine(const tile_scheduler_options& options)
+	: _scheduler(new tile_scheduler(options))
+{
+}
+
+perturbation_engine::~perturbation_engine()
+{
+}
+
+uint32_t perturbation_engine::center_words(const floatexp<double>& height)
+{
+	// height / 65536 is between 2^(exponent - 16) and twice that.
+	return bignum::words_for_exponent(height.exponent - 16);
+}
+
+void perturbation_engine::set_view(const std::string& centerReal, const std::string& centerImag, const std::string& height)
+{
+	floatexp<double> h = parse_floatexp(height);
+
+	if (!(h.mantissa > 0.0))
+		throw std::runtime_error("The view's height must be greater than zero.");
+
+	uint32_t words = center_words(h);
+	bignum real = bignum::parse(centerReal, words);
+	bignum imag = bignum::parse(centerImag, words);
+
+	// Zooming about the center, or just recoloring, doesn't need a new orbit.
+	if (real != _centerReal || imag != _centerImag)
+		_referenceValid = false;
+
+	_centerReal = real;
+	_centerImag = imag;
+	_height = h;
+}
+
+void perturbation_engine::set_view(const mandelbrot_precise_bounds& bounds)
+{
+	double h = (double)(bounds.top - bounds.bottom);
+
+	if (!(h > 0.0) || !std::isfinite(h))
+		throw std::runtime_error("The view's height must be a number between 0 and infinity.");
+
+	// Halving is exact, so the center is exactly representable as a double_double,
+	// and each half of that is exactly representable as a bignum.
+	double_double centerReal = (bounds.left + bounds.right) * double_double(0.5);
+	double_double centerImag = (bounds.top + bounds.bottom) * double_double(0.5);
+
+	uint32_t words = center_words(h);
+	bignum real = bignum::from_double(centerReal.hi, words) + bignum::from_double(centerReal.lo, words);
+	bignum imag = bignum::from_double(centerImag.hi, words) + bignum::from_double(centerImag.lo, words);
+
+	if (real != _centerReal || imag != _centerImag)
+		_referenceValid = false;
+
+	_centerReal = real;
+	_centerImag = imag;
+	_height = h;
+}
+
+void perturbation_engine::reset_orbit(reference_orbit& orbit, uint32_t words)
+{
+	orbit.real.clear();
+	orbit.imag.clear();
+	orbit.real_float.clear();
+	orbit.imag_float.clear();
+	orbit.bla.clear();
+	orbit.series.clear();
+	orbit.skipping = iteration_skipping_method::none;
+	orbit.skipping_max_dc = STALE_MAX_DC;
+	orbit.precision_bits = words * 32;
+	orbit.escaped = false;
+	orbit.generation = ++lastGeneration;
+}
+
+void perturbation_engine::compute_orbit(const bignum& centerReal, const bignum& centerImag,
+	uint32_t maxIterations, float bailoutRadius, reference_orbit& orbit, orbit_stream* stream)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	uint32_t words = centerReal.fraction_words();
+	bignum zr(words);
+	bignum zi(words);
+
+	double r = 0.0;
+	double i = 0.0;
+	double cr = centerReal.to_double();
+	double ci = centerImag.to_double();
+
+	if (stream == nullptr)
+		reset_orbit(orbit, words);
+
+	bool precise = true;
+
+	while (true)
+	{
+		orbit.real.push_back(r);
+		orbit.imag.push_back(i);
+		orbit.real_float.push_back((float)r);
+		orbit.imag_float.push_back((float)i);
+
+		double magnitude = r * r + i * i;
+
+		if (magnitude >= bailoutRadius)
+		{
+			orbit.escaped = true;
+			break;
+		}
+
+		// Pixels never need z_max_iterations itself, only the ones before it.
+		if (orbit.size() >= maxIterations)
+			break;
+
+		if (stream != nullptr && orbit.size() % STREAM_CHUNK == 0)
+		{
+			if (stream->cancelled.load(std::memory_order_relaxed))
+				break;
+
+			if (stream->bla)
+				orbit.bla.extend(orbit.real, orbit.imag, orbit.size());
+
+			stream->publish(orbit.size(), false);
+		}
+
+		// Once |Z| > 2 the reference is certain to escape, and it does so quickly
+		// enough that the rest of its orbit no longer depends on the low bits of C.
+		// Double precision finishes it off, and keeps the bignum well clear of overflowing.
+		if (magnitude > 4.0)
+			precise = false;
+
+		if (precise)
+		{
+			bignum zr2 = zr * zr;
+			bignum zi2 = zi * zi;
+			zi = (zr * zi).twice() + centerImag;
+			zr = zr2 - zi2 + centerReal;
+
+			r = zr.to_double();
+			i = zi.to_double();
+		}
+		else
+		{
+			double nextR = r * r - i * i + cr;
+			i = 2.0 * r * i + ci;
+			r = nextR;
+		}
+	}
+
+	if (stream != nullptr)
+	{
+		if (stream->bla)
+			orbit.bla.finish(orbit.real, orbit.imag);
+
+		stream->publish(orbit.size(), true);
+	}
+
+	_statistics.reference_milliseconds += milliseconds_since(start);
+}
+
+void perturbation_engine::set_options(const perturbation_options& options)
+{
+	// The primary reference's skip tables only need rebuilding if they'd come out differently.
+	if (options.skipping != _options.skipping || options.bla_epsilon != _options.bla_epsilon ||
+		options.series_terms != _options.series_terms || options.series_tolerance != _options.series_tolerance)
+	{
+		_reference.skipping_max_dc = STALE_MAX_DC;
+	}
+
+	_options = options;
+}
+
+void perturbation_engine::prepare_skipping(reference_orbit& orbit, double maxDc)
+{
+	iteration_skipping_method method = _frameSkipping;
+
+	if (orbit.skipping == method && orbit.skipping_max_dc == maxDc)
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+
+	orbit.bla.clear();
+	orbit.series.clear();
+
+	if (method == iteration_skipping_method::bla)
+		orbit.bla.build(orbit.real, orbit.imag, maxDc, _options.bla_epsilon, *_scheduler);
+	else if (method == iteration_skipping_method::series)
+		orbit.series.build(orbit.real, orbit.imag, maxDc, _options.series_terms, _options.series_tolerance);
+
+	orbit.skipping = method;
+	orbit.skipping_max_dc = maxDc;
+	orbit.generation = ++lastGeneration;
+
+	double milliseconds = milliseconds_since(start);
+	_statistics.skipping_milliseconds += milliseconds;
+	_statistics.reference_milliseconds += milliseconds;
+}
+
+delta_format perturbation_engine::choose_delta_format(const floatexp<double>& spacing)
+{
+	// Never float32: see delta_format.
+	if (spacing.exponent >= SMALLEST_DOUBLE_SPACING)
+		return delta_format::float64;
+
+	return delta_format::extended;
+}
+
+floatexp<double> perturbation_engine::pixel_real(uint32_t x) const
+{
+	// Pixel centers sit half a pixel in from the edges, the same as
+	// in the shaders and cpu_renderer. Imaginary parts grow upwards.
+	return ((x + 0.5) - 0.5 * _surfaceWidth) * _pixelSpacing;
+}
+
+floatexp<double> perturbation_engine::pixel_imag(uint32_t y) const
+{
+	return (0.5 * _surfaceHeight - (y + 0.5)) * _pixelSpacing;
+}
+
+perturbation_pass perturbation_engine::make_pass(const mandelbrot_parameter_info& info,
+	const floatexp<double>& offsetReal, const floatexp<double>& offsetImag, bool glitchedOnly) const
+{
+	perturbation_pass pass;
+	pass.surface_width = _surfaceWidth;
+	pass.surface_height = _surfaceHeight;
+	pass.spacing = _pixelSpacing;
+	pass.offset_real = offsetReal;
+	pass.offset_imag = offsetImag;
+	pass.bailout_radius = info.bailout_radius;
+	pass.max_iterations = info.max_iterations;
+	pass.rebase = _options.rebase;
+	pass.glitch_tolerance = _options.glitch_tolerance;
+	pass.deltas = _statistics.deltas;
+	pass.glitched_only = glitchedOnly;
+	return pass;
+}
+
+uint64_t perturbation_engine::run_pass(const reference_orbit& orbit, const perturbation_pass& description,
+	const orbit_stream* stream, iteration_buffer& output)
+{
+	pixel_pass pass;
+	pass.reference_real = orbit.real.data();
+	pass.reference_imag = orbit.imag.data();
+	pass.reference_real_float = orbit.real_float.data();
+	pass.reference_imag_float = orbit.imag_float.data();
+	pass.last = stream != nullptr ? SIZE_MAX : orbit.size() - 1;
+	pass.stream = stream;
+	pass.bailout_radius = description.bailout_radius;
+	pass.max_iterations = description.max_iterations;
+	pass.rebase = description.rebase;
+	pass.glitch_tolerance = description.glitch_tolerance;
+	pass.bla = orbit.bla.empty() ? nullptr : &orbit.bla;
+	pass.series = orbit.series.skip() > 0 ? &orbit.series : nullptr;
+	pass.surface_width = description.surface_width;
+	pass.surface_height = description.surface_height;
+	pass.spacing = description.spacing;
+	pass.offset_real = description.offset_real;
+	pass.offset_imag = description.offset_imag;
+	pass.glitched_only = description.glitched_only;
+	pass.glitches = _glitches.data();
+
+	pass_totals totals;
+
+	switch (description.deltas)
+	{
+	case delta_format::float32: run_pixels<float>(pass, *_scheduler, output, totals); break;
+	case delta_format::extended: run_pixels<floatexp<double>>(pass, *_scheduler, output, totals); break;
+	default: run_pixels<double>(pass, *_scheduler, output, totals); break;
+	}
+
+	_statistics.rebases += totals.rebases;
+	_statistics.iterations += totals.iterations;
+	_statistics.skipped_iterations += totals.skipped;
+	return totals.glitched;
+}
+
+void perturbation_engine::start_frame(const mandelbrot_parameter_info& info)
+{
+	_surfaceWidth = (uint32_t)info.surface_width;
+	_surfaceHeight = (uint32_t)info.surface_height;
+	_pixelSpacing = _height / (double)std::max(_surfaceHeight, 1u);
+	_statistics = perturbation_statistics();
+}
+
+void perturbation_engine::iterate(const mandelbrot_parameter_info& info, iteration_buffer& output)
+{
+	start_frame(info);
+	output.resize(_surfaceWidth, _surfaceHeight);
+
+	_statistics.deltas = _options.deltas != delta_format::automatic ? _options.deltas : choose_delta_format(_pixelSpacing);
+	_frameSkipping = _options.skipping;
+
+	// The series approximation is evaluated in doubles, so with extended deltas BLA is used instead.
+	if (_frameSkipping == iteration_skipping_method::series && _statistics.deltas == delta_format::extended)
+		_frameSkipping = iteration_skipping_method::bla;
+
+	run_frame(info, [&](const reference_orbit& orbit, const perturbation_pass& pass, const orbit_stream* stream)
+	{
+		return run_pass(orbit, pass, stream, output);
+	}, true);
+}
+
+void perturbation_engine::iterate(const mandelbrot_parameter_info& info, perturbation_device& device)
+{
+	start_frame(info);
+
+	_statistics.deltas = device.choose_delta_format(_options.deltas, _pixelSpacing);
+	_frameSkipping = _options.skipping;
+
+	if (_frameSkipping == iteration_skipping_method::series)
+		_frameSkipping = iteration_skipping_method::bla;
+
+	// A device gets each orbit uploaded whole.
+	run_frame(info, [&](const reference_orbit& orbit, const perturbation_pass& pass, const orbit_stream*)
+	{
+		return device.run_pass(orbit, pass, _glitches);
+	}, false);
+}
+
+uint64_t perturbation_engine::run_new_orbit(const bignum& centerReal, const bignum& centerImag, const mandelbrot_parameter_info& info,
+	reference_orbit& orbit, double maxDc, const perturbation_pass& pass, const pass_runner& runPass, bool streaming)
+{
+	if (!streaming || _frameSkipping == iteration_skipping_method::series)
+	{
+		compute_orbit(centerReal, centerImag, info.max_iterations, info.bailout_radius, orbit);
+		prepare_skipping(orbit, maxDc);
+		return runPass(orbit, pass, nullptr);
+	}
+
+	// Room for the longest orbit there could be, so that it never moves while pixels are reading it.
+	reset_orbit(orbit, centerReal.fraction_words());
+	orbit.real.reserve(info.max_iterations);
+	orbit.imag.reserve(info.max_iterations);
+	orbit.real_float.reserve(info.max_iterations);
+	orbit.imag_float.reserve(info.max_iterations);
+
+	orbit_stream stream;
+	stream.bla = _frameSkipping == iteration_skipping_method::bla;
+
+	if (stream.bla)
+		orbit.bla.start(info.max_iterations, maxDc, _options.bla_epsilon);
+
+	double referenceBefore = _statistics.reference_milliseconds;
+	std::exception_ptr failure;
+
+	std::thread producer([&]
+	{
+		try
+		{
+			compute_orbit(centerReal, centerImag, info.max_iterations, info.bailout_radius, orbit, &stream);
+		}
+		catch (...)
+		{
+			// Pixels waiting for the rest would otherwise wait forever.
+			failure = std::current_exception();
+			stream.publish(orbit.size(), true);
+		}
+	});
+
+	uint64_t glitched = 0;
+
+	try
+	{
+		glitched = runPass(orbit, pass, &stream);
+	}
+	catch (...)
+	{
+		stream.cancelled = true;
+		producer.join();
+		throw;
+	}
+
+	producer.join();
+
+	if (failure)
+		std::rethrow_exception(failure);
+
+	orbit.bla.trim();
+	orbit.skipping = _frameSkipping;
+	orbit.skipping_max_dc = maxDc;
+	_statistics.streamed_reference_milliseconds += _statistics.reference_milliseconds - referenceBefore;
+
+	return glitched;
+}
+
+void perturbation_engine::run_frame(const mandelbrot_parameter_info& info, const pass_runner& runPass, bool streamable)
+{
+	bool streaming = streamable && _options.stream_references;
+	_statistics.reference_reused = _referenceValid &&
+		_referenceMaxIterations == info.max_iterations && _referenceBailoutRadius == info.bailout_radius;
+
+	if (_surfaceWidth == 0 || _surfaceHeight == 0)
+	{
+		// Nothing to stream into, but the orbit's still wanted.
+		if (!_statistics.reference_reused)
+		{
+			_referenceValid = false;
+			compute_orbit(_centerReal, _centerImag, info.max_iterations, info.bailout_radius, _reference);
+			_referenceValid = true;
+			_referenceMaxIterations = info.max_iterations;
+			_referenceBailoutRadius = info.bailout_radius;
+		}
+
+		return;
+	}
+
+	// Secondary references are counted as reference time, not pixel time,
+	// except for the time they spend streaming alongside the pixels.
+	auto start = std::chrono::steady_clock::now();
+	double referenceBefore = _statistics.reference_milliseconds;
+
+	// Every pixel is within half the view's diagonal of its center, and within the whole
+	// diagonal of any secondary reference's.
+	double diagonal = to_double(std::hypot((double)_surfaceWidth, (double)_surfaceHeight) * _pixelSpacing);
+	perturbation_pass primary = make_pass(info, 0.0, 0.0, false);
+	uint64_t glitched = 0;
+
+	_glitches.assign((size_t)_surfaceWidth * _surfaceHeight, NOT_GLITCHED);
+
+	if (_statistics.reference_reused)
+	{
+		prepare_skipping(_reference, 0.5 * diagonal);
+		glitched = runPass(_reference, primary, nullptr);
+	}
+	else
+	{
+		// Not valid again until it's complete.
+		_referenceValid = false;
+		glitched = run_new_orbit(_centerReal, _centerImag, info, _reference, 0.5 * diagonal, primary, runPass, streaming);
+		_referenceValid = true;
+		_referenceMaxIterations = info.max_iterations;
+		_referenceBailoutRadius = info.bailout_radius;
+	}
+
+	_statistics.glitched_pixels = glitched;
+
+	while (glitched > 0 && _statistics.secondary_references < _options.max_secondary_references)
+	{
+		// The pixel deepest in a glitch is the likeliest to sit near whatever the
+		// glitch is centered on (usually a minibrot's nucleus or one of its preimages).
+		// Against its own orbit, it's never glitched itself, so every pass makes progress.
+		size_t deepest = 0;
+
+		for (size_t i = 0; i < _glitches.size(); i++)
+		{
+			if (_glitches[i] != NOT_GLITCHED &&
+				(_glitches[deepest] == NOT_GLITCHED || _glitches[i] < _glitches[deepest]))
+			{
+				deepest = i;
+			}
+		}
+
+		uint32_t x = (uint32_t)(deepest % _surfaceWidth);
+		uint32_t y = (uint32_t)(deepest / _surfaceWidth);
+		uint32_t words = _centerReal.fraction_words();
+
+		floatexp<double> pixelReal = pixel_real(x);
+		floatexp<double> pixelImag = pixel_imag(y);
+		bignum offsetReal = bignum::from_double(pixelReal.mantissa, pixelReal.exponent, words);
+		bignum offsetImag = bignum::from_double(pixelImag.mantissa, pixelImag.exponent, words);
+
+		// The offsets as the bignums hold them, which may have lost a bit or two off the end.
+		int32_t exponentReal = 0;
+		int32_t exponentImag = 0;
+		double mantissaReal = offsetReal.to_double(exponentReal);
+		double mantissaImag = offsetImag.to_double(exponentImag);
+
+		perturbation_pass secondary = make_pass(info,
+			floatexp<double>::normalized(mantissaReal, exponentReal),
+			floatexp<double>::normalized(mantissaImag, exponentImag), true);
+
+		_statistics.secondary_references++;
+		glitched = run_new_orbit(_centerReal + offsetReal, _centerImag + offsetImag, info,
+			_secondary, diagonal, secondary, runPass, streaming);
+	}
+
+	_statistics.unresolved_pixels = glitched;
+	_statistics.pixel_milliseconds = milliseconds_since(start) -
+		(_statistics.reference_milliseconds - referenceBefore - _statistics.streamed_reference_milliseconds);
+}
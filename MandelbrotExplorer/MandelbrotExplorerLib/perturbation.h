@@ -0,0 +1,321 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "bignum.h"
+#include "floatexp.h"
+#include "mandelbrot_parameters.h"
+#include "mandelbrot_cpu.h"
+#include "tile_scheduler.h"
+#include "iteration_skipping.h"
+
+enum class iteration_skipping_method
+{
+	none,
+	bla,	// Bivariate linear approximation, anywhere along the orbit.
+	series	// Series approximation, at the start of the orbit only.
+};
+
+// What each pixel's d and dc are held in. Doubles are good down to a pixel spacing
+// of about 1e-290, and floatexp<double> indefinitely, at several times the cost.
+//
+// Floats are good down to about 1e-30, but one pixel at a time they're no faster than
+// doubles, and their 24 bits go noticeably astray over a few thousand iterations near
+// the boundary, so automatic never picks them. They're there for comparison, and for
+// hardware that runs floats a good deal faster than doubles.
+enum class delta_format
+{
+	automatic,	// Double, or floatexp<double> where the view's pixel spacing needs it.
+	float32,
+	float64,
+	extended	// floatexp<double> (floatexp<float> on the GPU)
+};
+
+// The orbit z -> z^2 + c of a single point, the view's center, computed in
+// as much precision as the view needs and then rounded to double.
+// Element n holds z_n, starting from z_0 = 0.
+struct reference_orbit
+{
+	std::vector<double> real;
+	std::vector<double> imag;
+
+	// The same, rounded to float, for pixels whose deltas are floats.
+	std::vector<float> real_float;
+	std::vector<float> imag_float;
+
+	// Bits after the point the orbit was computed with.
+	uint32_t precision_bits = 0;
+
+	// Whether the orbit stopped because the reference escaped,
+	// rather than because it reached max_iterations.
+	bool escaped = false;
+
+	size_t size() const { return real.size(); }
+
+	// Skip tables built from this orbit, for the method and largest |dc| they were built with.
+	// A new orbit clears them, and a negative skipping_max_dc marks them out of date.
+	bla_table bla;
+	series_approximation series;
+	iteration_skipping_method skipping = iteration_skipping_method::none;
+	double skipping_max_dc = 0.0;
+
+	// A new number, never used by any other orbit, whenever the orbit or its skip tables
+	// change, so that copies of them kept elsewhere (on the GPU, say) can tell they're out of date.
+	uint64_t generation = 0;
+};
+
+struct perturbation_options
+{
+	// Zhuoran's rebasing: whenever a pixel's orbit comes closer to 0 than to the
+	// reference's, carry on from the start of the reference orbit with d = z.
+	// That does away with nearly every glitch, and with pixels outliving the reference.
+	bool rebase = true;
+
+	// Pauldelbrot's criterion: a pixel is glitched once |z|^2 < glitch_tolerance |Z|^2,
+	// i.e. its orbit has come so close to 0, compared with the reference's, that the
+	// delta's lost most of its precision to cancellation.
+	double glitch_tolerance = 1e-6;
+
+	// Glitched pixels are rendered again against a new reference orbit, centered on the
+	// pixel deepest in a glitch, until none are left or this many references have been tried.
+	uint32_t max_secondary_references = 16;
+
+	// How pixels skip the iterations where they follow the reference orbit linearly.
+	iteration_skipping_method skipping = iteration_skipping_method::bla;
+
+	// A BLA step is only taken while the d^2 it drops is below bla_epsilon times what it keeps.
+	// A double's own precision, so skipping makes no visible difference.
+	double bla_epsilon = 1.0 / 9007199254740992.0;
+
+	// Terms of the series approximation, and how small the last has to stay next to the first.
+	uint32_t series_terms = 16;
+	double series_tolerance = 1.0 / 9007199254740992.0;
+
+	delta_format deltas = delta_format::automatic;
+
+	// Computes each new reference orbit on a thread of its own while the pixels iterate it,
+	// rather than before them, with pixels only waiting where they catch up with it. BLA steps
+	// are built along with it. CPU only, and not with the series approximation, which needs
+	// the orbit as far as its skip before any pixel can start.
+	bool stream_references = true;
+};
+
+struct perturbation_statistics
+{
+	double reference_milliseconds = 0.0;
+	double pixel_milliseconds = 0.0;
+
+	// Whether the last frame had to compute a new reference orbit, or could reuse the one before.
+	bool reference_reused = false;
+
+	// Pixels glitched against the view's center, and so rendered again.
+	uint64_t glitched_pixels = 0;
+
+	// Secondary references, i.e. times the glitched pixels were rendered again.
+	uint32_t secondary_references = 0;
+
+	// Pixels still glitched after the last secondary reference. They're shown as interior.
+	uint64_t unresolved_pixels = 0;
+
+	// Times any pixel was rebased to the start of a reference orbit.
+	uint64_t rebases = 0;
+
+	// Iterations over every pixel, and how many of those were skipped over
+	// rather than computed one by one. Only counted on the CPU.
+	uint64_t iterations = 0;
+	uint64_t skipped_iterations = 0;
+
+	// Time spent building skip tables, included in reference_milliseconds.
+	// Not counted for streamed references, whose tables are built as part of the orbit.
+	double skipping_milliseconds = 0.0;
+
+	// Of reference_milliseconds, the time spent on streamed references,
+	// alongside the pixels' own, which pixel_milliseconds also counts.
+	double streamed_reference_milliseconds = 0.0;
+
+	// What the pixels' deltas were held in. Never automatic.
+	delta_format deltas = delta_format::float64;
+};
+
+// One run of the pixels against a reference orbit.
+struct perturbation_pass
+{
+	uint32_t surface_width = 0;
+	uint32_t surface_height = 0;
+
+	// Pixel spacing, and where the orbit's center is relative to the view's.
+	floatexp<double> spacing;
+	floatexp<double> offset_real;
+	floatexp<double> offset_imag;
+
+	float bailout_radius = 4.0f;
+	uint32_t max_iterations = 0;
+	bool rebase = true;
+	double glitch_tolerance = 0.0;
+	delta_format deltas = delta_format::float64;
+
+	// Every pixel, or just the ones still marked glitched.
+	bool glitched_only = false;
+};
+
+// Somewhere other than the CPU to run the perturbation engine's pixels, which keeps
+// their results itself. The engine still computes the reference orbits and skip tables,
+// and decides which pixels need secondary references.
+class perturbation_device
+{
+public:
+
+	virtual ~perturbation_device() {}
+
+	// Never automatic. requested may be, and spacing is the view's pixel spacing.
+	virtual delta_format choose_delta_format(delta_format requested, const floatexp<double>& spacing) const = 0;
+
+	// Runs pass's pixels against orbit, using its BLA table if it has one. glitches holds one
+	// value per pixel, row by row: -1 if the pixel's not glitched, or else |z|^2 / |Z|^2 where
+	// it glitched. It says which pixels to run when pass.glitched_only is set, and is updated
+	// for every pixel run. Returns how many of those are glitched now.
+	virtual uint64_t run_pass(const reference_orbit& orbit, const perturbation_pass& pass, std::vector<float>& glitches) = 0;
+};
+
+// How much of a reference orbit's been computed so far, while it's streamed. See perturbation.cpp.
+struct orbit_stream;
+
+// Deep zooms by perturbation theory.
+//
+// Past a zoom of about 1e-30 even double_double can't tell neighbouring pixels
+// apart, and every point would need its own arbitrary-precision orbit, which is
+// far too slow. But neighbouring orbits stay close to each other for a long time.
+// Write a pixel's point as c = C + dc and its orbit as z_n = Z_n + d_n, where Z_n
+// is the orbit of the view's center C. Then
+//
+//   d_n+1 = 2 Z_n d_n + d_n^2 + dc
+//
+// Only the reference orbit Z needs the precision. Z itself is never smaller
+// than the view (it's order 1), so it's fine rounded to double once computed,
+// and d and dc are tiny but only ever need a double's precision relative to themselves.
+// So each pixel costs a handful of float or double operations per iteration, down to
+// about 1e-290, below which dc underflows a double and is held in a floatexp instead.
+//
+// That only works while d stays small compared with Z. Where the two orbits part ways,
+// pixels are either rebased onto the start of the reference orbit, or found to be
+// glitched and rendered again against a reference orbit of their own.
+// See perturbation_options.
+class perturbation_engine
+{
+public:
+
+	perturbation_engine(const tile_scheduler_options& options = tile_scheduler_options());
+	~perturbation_engine();
+
+	perturbation_engine(const perturbation_engine&) = delete;
+	perturbation_engine& operator=(const perturbation_engine&) = delete;
+
+	// The view's center and height (top minus bottom) in the complex plane, as decimal
+	// strings, e.g. "-1.74995768370609350360221450607069970727110579726252", "1.5e-400".
+	// The width follows from the surface's aspect ratio. Throws if any of them can't be read.
+	void set_view(const std::string& centerReal, const std::string& centerImag, const std::string& height);
+
+	// The same, for a view that doubles (or double_doubles) can express.
+	void set_view(const mandelbrot_precise_bounds& bounds);
+
+	void set_options(const perturbation_options& options);
+	const perturbation_options& options() const { return _options; }
+
+	const bignum& center_real() const { return _centerReal; }
+	const bignum& center_imag() const { return _centerImag; }
+	const floatexp<double>& height() const { return _height; }
+
+	// Runs every pixel of the surface described by info.surface_width and info.surface_height,
+	// producing the same smooth iteration values as cpu_renderer. info's bounds are ignored
+	// in favour of the view set above. The reference orbit is reused if it's still good.
+	void iterate(const mandelbrot_parameter_info& info, iteration_buffer& output);
+
+	// The same, with the pixels run on device, which keeps the results. The series
+	// approximation is evaluated per pixel on the CPU, so on a device BLA is used instead.
+	void iterate(const mandelbrot_parameter_info& info, perturbation_device& device);
+
+	const reference_orbit& reference() const { return _reference; }
+	const perturbation_statistics& statistics() const { return _statistics; }
+	const tile_scheduler& scheduler() const { return *_scheduler; }
+
+	// What delta_format::automatic picks for pixels spacing apart.
+	static delta_format choose_delta_format(const floatexp<double>& spacing);
+
+private:
+
+	// The stream is null unless the orbit's still being computed.
+	typedef std::function<uint64_t(const reference_orbit&, const perturbation_pass&, const orbit_stream*)> pass_runner;
+
+	// Sets up the surface size, pixel spacing and statistics for a frame.
+	void start_frame(const mandelbrot_parameter_info& info);
+
+	// Gets the reference orbit ready and runs every pixel against it with runPass,
+	// then the glitched ones against secondary references until they're resolved.
+	// New orbits are streamed into runPass if streamable is set, and the options allow it.
+	void run_frame(const mandelbrot_parameter_info& info, const pass_runner& runPass, bool streamable);
+
+	perturbation_pass make_pass(const mandelbrot_parameter_info& info,
+		const floatexp<double>& offsetReal, const floatexp<double>& offsetImag, bool glitchedOnly) const;
+
+	// Clears orbit, ready for compute_orbit() to fill in again.
+	void reset_orbit(reference_orbit& orbit, uint32_t words);
+
+	// Given a stream, orbit has to have been reset already, and have room for maxIterations
+	// elements. Chunks of them are published to the stream as they're computed, along with
+	// the BLA steps they complete if stream says to build them.
+	void compute_orbit(const bignum& centerReal, const bignum& centerImag,
+		uint32_t maxIterations, float bailoutRadius, reference_orbit& orbit, orbit_stream* stream = nullptr);
+
+	// Computes orbit for the given center and runs pass against it, with runPass. Both at once,
+	// if streaming is set and the frame's skipping allows it, or else one after the other.
+	uint64_t run_new_orbit(const bignum& centerReal, const bignum& centerImag, const mandelbrot_parameter_info& info,
+		reference_orbit& orbit, double maxDc, const perturbation_pass& pass, const pass_runner& runPass, bool streaming);
+
+	// (Re)builds orbit's skip tables for the current options, unless they're already built
+	// for the same maxDc: the largest |dc| of any pixel relative to the orbit's center.
+	// 0 if that underflows, which makes no difference to the tables.
+	void prepare_skipping(reference_orbit& orbit, double maxDc);
+
+	// Runs pass's pixels against orbit on the CPU: every pixel, or just the ones still marked
+	// in _glitches. Returns how many of them are glitched now. With a stream, the pixels only
+	// read as much of orbit as it says is there.
+	uint64_t run_pass(const reference_orbit& orbit, const perturbation_pass& pass,
+		const orbit_stream* stream, iteration_buffer& output);
+
+	// Offset of pixel (x, y)'s center from the view's center, on the surface being iterated.
+	floatexp<double> pixel_real(uint32_t x) const;
+	floatexp<double> pixel_imag(uint32_t y) const;
+
+	// Fraction words the center needs for the given view height. Surfaces are never
+	// anywhere near 65536 pixels high, so that's small enough for a pixel.
+	static uint32_t center_words(const floatexp<double>& height);
+
+	std::unique_ptr<tile_scheduler> _scheduler;
+
+	bignum _centerReal;
+	bignum _centerImag;
+	floatexp<double> _height = 4.0;
+
+	reference_orbit _reference;
+	bool _referenceValid = false;
+	uint32_t _referenceMaxIterations = 0;
+	float _referenceBailoutRadius = 0.0f;
+
+	uint32_t _surfaceWidth = 0;
+	uint32_t _surfaceHeight = 0;
+	floatexp<double> _pixelSpacing;
+
+	// The skipping method this frame's skip tables are built for.
+	iteration_skipping_method _frameSkipping = iteration_skipping_method::none;
+
+	// For every pixel, how far into a glitch it is (|z|^2 / |Z|^2 when it was found),
+	// or -1 if it isn't glitched.
+	std::vector<float> _glitches;
+	reference_orbit _secondary;
+
+	perturbation_options _options;
+	perturbation_statistics _statistics;
+};
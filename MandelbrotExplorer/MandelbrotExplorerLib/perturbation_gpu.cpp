@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "perturbation_gpu.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	const float NOT_GLITCHED = -1.0f;
+
+	// Pixel spacing down to which float deltas are used, as a power of two (about 5e-20).
+	// Below that, |d|^2 underflows a float while pixels are still close to the reference,
+	// and BLA, whose radius checks depend on it, stops skipping anything.
+	const int32_t SMALLEST_FLOAT_SPACING = -64;
+
+	void split(double value, float& mantissa, int32_t& exponent)
+	{
+		int e = 0;
+		mantissa = (float)std::frexp(value, &e);
+		exponent = e;
+	}
+
+	void split(const floatexp<double>& value, float& mantissa, int32_t& exponent)
+	{
+		mantissa = (float)value.mantissa;
+		exponent = value.exponent;
+	}
+
+	// A complex number as two float mantissas sharing the larger part's exponent.
+	// The smaller part loses whatever it has below the larger one's precision,
+	// which is nothing the sum would have kept anyway.
+	void split(double real, double imag, float& mantissaReal, float& mantissaImag, int32_t& exponent)
+	{
+		int exponentReal = 0;
+		int exponentImag = 0;
+		std::frexp(real, &exponentReal);
+		std::frexp(imag, &exponentImag);
+
+		int e = std::max(exponentReal, exponentImag);
+		mantissaReal = (float)std::ldexp(real, -e);
+		mantissaImag = (float)std::ldexp(imag, -e);
+		exponent = e;
+	}
+
+	mandelbrot_bla_step pack(const bla_step& step)
+	{
+		mandelbrot_bla_step packed;
+		split(step.ar, step.ai, packed.ar, packed.ai, packed.a_exponent);
+		split(step.br, step.bi, packed.br, packed.bi, packed.b_exponent);
+		split(step.radius_squared, packed.radius_squared, packed.radius_exponent);
+		packed.length = step.length;
+		return packed;
+	}
+}
+
+vulkan_perturbation_device::vulkan_perturbation_device(vulkan_renderer& renderer)
+	: _renderer(renderer)
+{
+}
+
+delta_format vulkan_perturbation_device::choose_delta_format(delta_format requested, const floatexp<double>& spacing) const
+{
+	if (requested == delta_format::float32 || requested == delta_format::extended)
+		return requested;
+
+	return spacing.exponent >= SMALLEST_FLOAT_SPACING ? delta_format::float32 : delta_format::extended;
+}
+
+uint32_t vulkan_perturbation_device::upload(const reference_orbit& orbit)
+{
+	_passes++;
+
+	for (uint32_t i = 0; i < vulkan_renderer::PERTURBATION_REFERENCE_SLOTS; i++)
+	{
+		if (_slots[i].generation == orbit.generation && orbit.generation != 0)
+		{
+			_slots[i].last_used = _passes;
+			return i;
+		}
+	}
+
+	uint32_t oldest = 0;
+
+	for (uint32_t i = 1; i < vulkan_renderer::PERTURBATION_REFERENCE_SLOTS; i++)
+	{
+		if (_slots[i].last_used < _slots[oldest].last_used)
+			oldest = i;
+	}
+
+	// The orbit as vec2s.
+	_orbitData.resize(2 * orbit.size());
+
+	for (size_t n = 0; n < orbit.size(); n++)
+	{
+		_orbitData[2 * n] = orbit.real_float[n];
+		_orbitData[2 * n + 1] = orbit.imag_float[n];
+	}
+
+	// The BLA table's levels one after another. Lookups never use level 0's single steps,
+	// so that's left out. Without BLA, there are no levels at all.
+	mandelbrot_bla_header header{};
+	header.level_count = (uint32_t)std::min(orbit.bla.level_count(), (size_t)mandelbrot_perturbation_info::BLA_LEVEL_CAPACITY);
+
+	size_t stepCount = 0;
+
+	for (uint32_t level = 1; level < header.level_count; level++)
+	{
+		header.level_offset[level] = (uint32_t)stepCount;
+		header.level_size[level] = (uint32_t)orbit.bla.level(level).size();
+		stepCount += orbit.bla.level(level).size();
+	}
+
+	_blaData.resize(sizeof(header) + stepCount * sizeof(mandelbrot_bla_step));
+	memcpy(_blaData.data(), &header, sizeof(header));
+
+	uint8_t* packed = _blaData.data() + sizeof(header);
+
+	for (uint32_t level = 1; level < header.level_count; level++)
+	{
+		for (const bla_step& step : orbit.bla.level(level))
+		{
+			mandelbrot_bla_step value = pack(step);
+			memcpy(packed, &value, sizeof(value));
+			packed += sizeof(value);
+		}
+	}
+
+	_renderer.upload_perturbation_reference(oldest,
+		_orbitData.data(), _orbitData.size() * sizeof(float),
+		_blaData.data(), _blaData.size());
+
+	_slots[oldest].generation = orbit.generation;
+	_slots[oldest].last_used = _passes;
+	_uploads++;
+	return oldest;
+}
+
+uint64_t vulkan_perturbation_device::run_pass(const reference_orbit& orbit, const perturbation_pass& pass, std::vector<float>& glitches)
+{
+	uint32_t slot = upload(orbit);
+
+	mandelbrot_perturbation_info info;
+	info.surface_width = pass.surface_width;
+	info.surface_height = pass.surface_height;
+	split(pass.spacing, info.spacing, info.spacing_exponent);
+	split(pass.offset_real, info.offset_real, info.offset_real_exponent);
+	split(pass.offset_imag, info.offset_imag, info.offset_imag_exponent);
+	info.bailout_radius = pass.bailout_radius;
+	info.max_iterations = pass.max_iterations;
+	info.orbit_last = (uint32_t)(orbit.size() - 1);
+	info.glitch_tolerance = (float)pass.glitch_tolerance;
+	info.rebase = pass.rebase ? 1 : 0;
+	info.glitched_only = pass.glitched_only ? 1 : 0;
+
+	uint64_t submitted = _renderer.run_perturbation_pass(slot, info, pass.deltas == delta_format::extended, glitches.data());
+
+	if (submitted == 0)
+	{
+		throw std::runtime_error("Perturbation on the GPU needs a compute shader loaded, and a surface the size of the view.");
+	}
+
+	_lastPass = submitted;
+
+	// The engine picks its next reference by the glitches, so this is where the pass is waited for.
+	_renderer.read_glitches(submitted, glitches.data());
+
+	uint64_t glitched = 0;
+
+	for (float glitch : glitches)
+	{
+		if (glitch != NOT_GLITCHED)
+			glitched++;
+	}
+
+	return glitched;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <cstdint>
+#include "perturbation.h"
+#include "mandelbrot_native.h"
+
+// Runs the perturbation engine's pixels on the GPU, with vulkan_renderer's perturbation
+// passes. The results are left in the renderer's iteration buffer, for
+// present_iteration_buffer() to color.
+//
+// Most GPUs are slow at doubles, if they have them at all, so deltas are floats, or once the
+// view's too deep for those, floats with exponents of their own (floatexp<float>, in effect).
+// Each reference orbit is rounded to float, its BLA table split into float mantissas and
+// exponents, and the two uploaded together. They stay on the GPU for as long as the orbit's
+// unchanged, so frames that reuse a reference orbit upload nothing at all.
+class vulkan_perturbation_device : public perturbation_device
+{
+public:
+
+	explicit vulkan_perturbation_device(vulkan_renderer& renderer);
+
+	// Float where the pixel spacing allows it, floatexp otherwise. A request for
+	// float32 or extended is kept to, and float64 is taken for automatic.
+	delta_format choose_delta_format(delta_format requested, const floatexp<double>& spacing) const override;
+
+	uint64_t run_pass(const reference_orbit& orbit, const perturbation_pass& pass, std::vector<float>& glitches) override;
+
+	// Reference orbits uploaded so far, for seeing how often they're reused.
+	uint64_t uploads() const { return _uploads; }
+
+	// The renderer's number for the last pass run, as for vulkan_renderer::frame_finished().
+	// 0 before there's been one.
+	uint64_t last_pass() const { return _lastPass; }
+
+private:
+
+	// The renderer's slot holding orbit, uploading it into the least recently used one first
+	// if it isn't already there.
+	uint32_t upload(const reference_orbit& orbit);
+
+	struct slot
+	{
+		uint64_t generation = 0;	// reference_orbit::generation of what's there. 0 for nothing.
+		uint64_t last_used = 0;
+	};
+
+	vulkan_renderer& _renderer;
+	slot _slots[vulkan_renderer::PERTURBATION_REFERENCE_SLOTS];
+	uint64_t _passes = 0;
+	uint64_t _uploads = 0;
+	uint64_t _lastPass = 0;
+
+	// Kept between uploads, to save reallocating them.
+	std::vector<float> _orbitData;
+	std::vector<uint8_t> _blaData;
+};
@@ -0,0 +1,270 @@
+#include "pch.h"
+#include "progressive_schedule.h"
+#include <chrono>
+#include <algorithm>
+
+namespace
+{
+	double now_milliseconds()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration<double, std::milli>(now).count();
+	}
+}
+
+progressive_schedule::progressive_schedule(const progressive_options& options)
+{
+	set_options(options);
+}
+
+void progressive_schedule::set_options(const progressive_options& options)
+{
+	if (options.tile_width == 0 || options.tile_height == 0 || options.min_tile_size == 0 || options.max_batch_tiles == 0)
+	{
+		throw std::runtime_error("Progressive tile sizes and counts must be non-zero.");
+	}
+
+	if (!(options.budget_milliseconds > 0.0))
+	{
+		throw std::runtime_error("Progressive submission budget must be positive.");
+	}
+
+	_options = options;
+}
+
+void progressive_schedule::set_work_density(double density)
+{
+	if (!(density > 0.0 && density <= 1.0))
+	{
+		throw std::runtime_error("Progressive work density must be in (0, 1].");
+	}
+
+	_density = density;
+}
+
+void progressive_schedule::begin_frame(uint32_t width, uint32_t height)
+{
+	tile whole = { 0, 0, width, height };
+	begin_frame(width, height, std::vector<tile>(1, whole));
+}
+
+void progressive_schedule::begin_frame(uint32_t width, uint32_t height, const std::vector<tile>& regions)
+{
+	std::vector<tile> cells = tile_scheduler::split(width, height, _options.tile_width, _options.tile_height);
+
+	// Cut the regions along the cell grid, so that no tile crosses from one cell into another.
+	_pending.clear();
+
+	for (const tile& cell : cells)
+	{
+		for (const tile& region : regions)
+		{
+			uint32_t left = std::max(cell.left, region.left);
+			uint32_t top = std::max(cell.top, region.top);
+			uint32_t right = std::min(cell.left + cell.width, region.left + region.width);
+			uint32_t bottom = std::min(cell.top + cell.height, region.top + region.height);
+
+			if (left < right && top < bottom)
+			{
+				tile piece = { left, top, right - left, bottom - top };
+				_pending.push_back(piece);
+			}
+		}
+	}
+
+	std::reverse(_pending.begin(), _pending.end());
+
+	uint32_t columns = (width + _options.tile_width - 1) / _options.tile_width;
+
+	if (width != _frameWidth || height != _frameHeight || columns != _columns || _cellCosts.size() != cells.size())
+	{
+		_cellCosts.assign(cells.size(), 0.0);
+		_columns = columns;
+		_frameWidth = width;
+		_frameHeight = height;
+		_layout++;
+	}
+
+	_cellMeasuredThisFrame.assign(_cellCosts.size(), 0);
+
+	// Batches of the last frame may still be on their way back. They're kept, and still
+	// complete in turn, but only this frame's batches count towards its statistics.
+	_frame++;
+	_statistics = progressive_statistics();
+}
+
+size_t progressive_schedule::cell_index(const tile& t) const
+{
+	// Split tiles never cross the edge of the tile they came from,
+	// so the top-left corner is enough to find the cell.
+	uint32_t column = t.left / _options.tile_width;
+	uint32_t row = t.top / _options.tile_height;
+	return (size_t)row * _columns + column;
+}
+
+void progressive_schedule::record_cost(const tile& t, double perPixel)
+{
+	// A split cell is measured a quarter at a time.
+	// Remember its most expensive quarter, so that next frame it's
+	// split up again rather than sent whole on the strength of a cheap corner.
+	size_t index = cell_index(t);
+
+	if (_cellMeasuredThisFrame[index])
+		_cellCosts[index] = std::max(_cellCosts[index], perPixel);
+	else
+		_cellCosts[index] = perPixel;
+
+	_cellMeasuredThisFrame[index] = 1;
+}
+
+double progressive_schedule::estimate(const tile& t, double density) const
+{
+	double perPixel = _cellCosts[cell_index(t)];
+
+	if (perPixel <= 0.0)
+		perPixel = _millisecondsPerPixel;
+
+	return perPixel * t.width * t.height * density;
+}
+
+const std::vector<tile>& progressive_schedule::next_batch()
+{
+	_batches.emplace_back();
+	batch& taken = _batches.back();
+	taken.density = _density;
+	taken.frame = _frame;
+	taken.layout = _layout;
+
+	double planned = 0.0;
+	bool guessed = false;
+
+	while (!_pending.empty() && taken.tiles.size() < _options.max_batch_tiles)
+	{
+		tile next = _pending.back();
+		double cost = estimate(next, _density);
+
+		// A tile with no history of its own is only a guess, and a cheap-looking
+		// guess can turn out to be solid interior. Take at most one per batch,
+		// so a bad guess only ever costs a single tile's worth of overshoot.
+		bool guess = _cellCosts[cell_index(next)] <= 0.0;
+
+		if (guess && guessed)
+			break;
+
+		if (cost > _options.budget_milliseconds)
+		{
+			uint32_t halfWidth = next.width / 2;
+			uint32_t halfHeight = next.height / 2;
+
+			if (std::min(halfWidth, halfHeight) >= _options.min_tile_size)
+			{
+				// Replace the tile with its quarters, keeping the top-left one next in line.
+				_pending.pop_back();
+
+				tile quarters[4] =
+				{
+					{ next.left, next.top, halfWidth, halfHeight },
+					{ next.left + halfWidth, next.top, next.width - halfWidth, halfHeight },
+					{ next.left, next.top + halfHeight, halfWidth, next.height - halfHeight },
+					{ next.left + halfWidth, next.top + halfHeight, next.width - halfWidth, next.height - halfHeight }
+				};
+
+				for (int i = 3; i >= 0; i--)
+					_pending.push_back(quarters[i]);
+
+				continue;
+			}
+		}
+
+		// A tile that's still over budget at the minimum size goes out on its own.
+		if (!taken.tiles.empty() && planned + cost > _options.budget_milliseconds)
+			break;
+
+		_pending.pop_back();
+		taken.tiles.push_back(next);
+		guessed = guessed || guess;
+		taken.pixels += (uint64_t)next.width * next.height;
+		planned += cost;
+	}
+
+	taken.start_milliseconds = now_milliseconds();
+	return taken.tiles;
+}
+
+void progressive_schedule::complete_batch(double milliseconds, const std::vector<double>* tileMilliseconds)
+{
+	if (_batches.empty())
+	{
+		throw std::runtime_error("There's no outstanding batch to complete.");
+	}
+
+	// Kept at the front until its tiles have been costed.
+	const batch& done = _batches.front();
+	const std::vector<tile>& tiles = done.tiles;
+	double density = done.density;
+
+	if (milliseconds < 0.0)
+		milliseconds = now_milliseconds() - done.start_milliseconds;
+
+	if (done.frame == _frame)
+	{
+		_statistics.submissions++;
+		_statistics.tiles += (uint32_t)tiles.size();
+		_statistics.gpu_milliseconds += milliseconds;
+		_statistics.longest_submission_milliseconds = std::max(_statistics.longest_submission_milliseconds, milliseconds);
+	}
+
+	// Tiles from before the frame size changed don't belong to any of the cells now.
+	if (done.pixels == 0 || done.layout != _layout)
+	{
+		_batches.pop_front();
+		return;
+	}
+
+	double measured = milliseconds / (done.pixels * density);
+
+	if (tileMilliseconds != nullptr && tileMilliseconds->size() == tiles.size())
+	{
+		for (size_t i = 0; i < tiles.size(); i++)
+		{
+			const tile& t = tiles[i];
+			record_cost(t, (*tileMilliseconds)[i] / ((double)t.width * t.height * density));
+		}
+	}
+	else
+	{
+		// Only the batch as a whole was timed, so scale every tile's estimate
+		// by however far off the batch's estimate was. Tiles with no estimate
+		// get the batch's average.
+		//
+		// There's no telling which tile made a batch come in under its estimate,
+		// so estimates only come down by half at a time. An expensive tile batched
+		// with overestimated cheap ones can't be mistaken for a cheap one in one go.
+		double planned = 0.0;
+
+		for (const tile& t : tiles)
+			planned += estimate(t, density);
+
+		double scale = planned > 0.0 ? std::max(milliseconds / planned, 0.5) : 0.0;
+		std::vector<double> perPixel(tiles.size());
+
+		for (size_t i = 0; i < tiles.size(); i++)
+		{
+			const tile& t = tiles[i];
+			perPixel[i] = planned > 0.0 ? estimate(t, density) / ((double)t.width * t.height * density) * scale : measured;
+		}
+
+		for (size_t i = 0; i < tiles.size(); i++)
+			record_cost(tiles[i], perPixel[i]);
+	}
+
+	_batches.pop_front();
+
+	// Cost per pixel swings wildly across a frame (interior vs. exterior).
+	// Overshooting the budget is what matters, so jump straight up
+	// to any higher cost, and only drift back down gradually.
+	if (measured > _millisecondsPerPixel)
+		_millisecondsPerPixel = measured;
+	else
+		_millisecondsPerPixel = 0.75 * _millisecondsPerPixel + 0.25 * measured;
+}
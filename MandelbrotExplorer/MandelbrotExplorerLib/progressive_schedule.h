@@ -0,0 +1,129 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "tile_scheduler.h"
+
+struct progressive_options
+{
+	// Longest any single submission should keep the GPU busy.
+	// Windows resets the driver (TDR) after 2 seconds by default,
+	// but long submissions make the rest of the desktop stutter well before that.
+	double budget_milliseconds = 4.0;
+
+	// Frames are cut into tiles of this size. A tile that would blow
+	// the budget on its own is split into quarters, down to min_tile_size.
+	uint32_t tile_width = 128;
+	uint32_t tile_height = 128;
+	uint32_t min_tile_size = 16;
+
+	// Cap on tiles per submission, however cheap they are.
+	// The renderer needs a timestamp query per tile.
+	uint32_t max_batch_tiles = 64;
+};
+
+// What it took to draw the most recent frame.
+struct progressive_statistics
+{
+	uint32_t submissions = 0;
+	uint32_t tiles = 0;
+	double gpu_milliseconds = 0.0;
+	double longest_submission_milliseconds = 0.0;
+};
+
+// Decides which tiles of a frame go into each submission.
+//
+// The GPU can't be interrupted partway through a submission, so a frame which
+// takes too long in one go gets the driver reset. Instead, each submission only
+// carries as many tiles as should fit in the time budget, judging by how long
+// earlier tiles took per pixel.
+//
+// Costs are remembered per tile, since the same part of the screen tends to cost
+// about the same from one frame to the next. Tiles with no history yet fall back
+// on a running estimate for the whole frame, which rises as soon as a submission
+// runs long and eases back down afterwards.
+//
+// The renderer doesn't wait for each batch before taking the next, so batches can be
+// outstanding: taken, but not yet timed. They're completed in the order they were taken,
+// and a batch completed after the next frame has begun still counts towards the costs.
+class progressive_schedule
+{
+public:
+
+	progressive_schedule(const progressive_options& options = progressive_options());
+
+	const progressive_options& options() const { return _options; }
+
+	// Keeps the cost estimate, since it's measured per pixel
+	// and doesn't depend on any of the options.
+	void set_options(const progressive_options& options);
+
+	// Queues up every tile of a width x height frame, top-left first.
+	// Tile history is forgotten if the frame size or tile size changed.
+	void begin_frame(uint32_t width, uint32_t height);
+
+	// Same, but only queues the parts of the frame covered by the given regions,
+	// e.g. the strips uncovered by panning. Regions shouldn't overlap.
+	void begin_frame(uint32_t width, uint32_t height, const std::vector<tile>& regions);
+
+	bool finished() const { return _pending.empty(); }
+
+	// Fraction of each tile's pixels that actually get computed, e.g. 1/64 on a pass
+	// that computes one pixel per 8x8 block. Costs are remembered per computed pixel,
+	// so what's learned on a coarse pass carries over to the finer ones.
+	void set_work_density(double density);
+
+	// Takes the tiles for the next submission. Always at least one.
+	// They stay where they are until the batch is completed.
+	const std::vector<tile>& next_batch();
+
+	// Reports how long the oldest outstanding batch ran on the GPU in total and, where available,
+	// tile by tile (one entry per tile of the batch, in order). If the GPU can't time
+	// itself, pass a negative total to use the host's time since next_batch() instead.
+	void complete_batch(double milliseconds, const std::vector<double>* tileMilliseconds = nullptr);
+	size_t outstanding() const { return _batches.size(); }
+
+	double milliseconds_per_pixel() const { return _millisecondsPerPixel; }
+	const progressive_statistics& statistics() const { return _statistics; }
+
+private:
+
+	struct batch
+	{
+		std::vector<tile> tiles;
+		uint64_t pixels = 0;
+		double start_milliseconds = 0.0;
+		double density = 1.0;
+		uint64_t frame = 0;		// the begin_frame() it was taken in.
+		uint64_t layout = 0;	// the cell grid its tiles sit on.
+	};
+
+	double estimate(const tile& t, double density) const;
+	size_t cell_index(const tile& t) const;
+	void record_cost(const tile& t, double perPixel);
+
+	progressive_options _options;
+
+	// Used as a stack, so the next tile to draw is at the back.
+	std::vector<tile> _pending;
+	double _density = 1.0;
+
+	// Oldest first. Taking a batch never moves the others, so their tiles stay put.
+	std::deque<batch> _batches;
+	uint64_t _frame = 0;
+	uint64_t _layout = 0;
+
+	// 0 until the first batch has been measured.
+	double _millisecondsPerPixel = 0.0;
+
+	// Milliseconds per pixel last measured for each tile_width x tile_height cell
+	// of the frame, row by row. 0 where nothing's been measured.
+	std::vector<double> _cellCosts;
+	std::vector<uint8_t> _cellMeasuredThisFrame;
+	uint32_t _columns = 0;
+	uint32_t _frameWidth = 0;
+	uint32_t _frameHeight = 0;
+
+	progressive_statistics _statistics;
+};
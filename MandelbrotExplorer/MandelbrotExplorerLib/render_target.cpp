@@ -0,0 +1,597 @@
+#include "pch.h"
+#include "render_target.h"
+#include "mandelbrot_native.h"
+#include <limits>
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+
+swapchain_target::swapchain_target(vulkan_renderer& renderer)
+	: _renderer(renderer)
+{
+	choose_swap_surface_format();
+	choose_swap_present_mode();
+	choose_swap_extent();
+}
+
+swapchain_target::~swapchain_target()
+{
+	destroy();
+}
+
+void swapchain_target::create(VkRenderPass renderPass)
+{
+	_renderPass = renderPass;
+
+	create_swap_chain();
+	create_image_views();
+	create_framebuffers();			// swapchain framebuffers depend on the render pass.
+}
+
+void swapchain_target::destroy()
+{
+	for (auto framebuffer : _swapChainFramebuffers) {
+		vkDestroyFramebuffer(_renderer._logicalDevice, framebuffer, nullptr);
+	}
+
+	for (auto imageView : _swapChainImageViews) {
+		vkDestroyImageView(_renderer._logicalDevice, imageView, nullptr);
+	}
+
+	_swapChainFramebuffers.clear();
+	_swapChainImageViews.clear();
+
+	if (_swapChain != nullptr)
+		vkDestroySwapchainKHR(_renderer._logicalDevice, _swapChain, nullptr);
+
+	_swapChain = nullptr;
+}
+
+void swapchain_target::choose_swap_surface_format()
+{
+	uint32_t formatCount;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(_renderer._physicalDevice, _renderer._surface, &formatCount, nullptr);
+
+	if (formatCount != 0) 
+	{
+		std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(_renderer._physicalDevice, _renderer._surface, &formatCount, surfaceFormats.data());
+
+		for (VkSurfaceFormatKHR f : surfaceFormats)
+		{
+			if (f.format == VK_FORMAT_B8G8R8A8_SRGB && f.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+			{
+				_selectedSurfaceFormat = f;
+				return;
+			}
+		}
+
+		_selectedSurfaceFormat = surfaceFormats[0];
+		return;
+	}
+
+	throw std::runtime_error("No surface formats available.");
+}
+
+void swapchain_target::choose_swap_present_mode()
+{
+	uint32_t presentModeCount;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(_renderer._physicalDevice, _renderer._surface, &presentModeCount, nullptr);
+
+	if (presentModeCount != 0) 
+	{
+		std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(_renderer._physicalDevice, _renderer._surface, &presentModeCount, presentModes.data());		
+
+		for (VkPresentModeKHR mode : presentModes)
+		{
+			if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
+			{
+				_selectedPresentMode = mode;
+				return;
+			}
+		}
+
+		_selectedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+		return;
+	}
+
+	throw std::runtime_error("No present modes available.");
+}
+
+void swapchain_target::choose_swap_extent()
+{
+	VkSurfaceCapabilitiesKHR capabilities;
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_renderer._physicalDevice, _renderer._surface, &capabilities);
+
+	if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+	{
+		_selectedSwapExtent = capabilities.currentExtent;
+	}
+	else
+	{
+		throw std::runtime_error("Invalid extent.");
+	}
+}
+
+void swapchain_target::recreate()
+{
+	do
+	{
+		choose_swap_extent();
+
+	} while (_selectedSwapExtent.width == 0 || _selectedSwapExtent.height == 0);
+
+	vkDeviceWaitIdle(_renderer._logicalDevice);
+
+	destroy();
+	create(_renderPass);
+}
+
+void swapchain_target::create_swap_chain()
+{
+	VkSurfaceCapabilitiesKHR capabilities;
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_renderer._physicalDevice, _renderer._surface, &capabilities);
+
+	// We need to decide how many images we would like to have in the swap chain.
+	// The implementation specifies the minimum number that it requires to function.
+
+	// Sticking to the minimum means that we may sometimes have to wait 
+	// on the driver to complete internal operations before we can acquire 
+	// another image to render to. Therefore, it is recommended to request
+	// at least one more image than the minimum.
+
+	// Make sure that this +1 doesn't exceed the allowed maximum.
+	// (0 is a special value that means no maximum).
+
+	uint32_t imageCount = capabilities.minImageCount + 1;
+
+	if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount)
+	{
+		imageCount = capabilities.maxImageCount;
+	}
+
+	VkSwapchainCreateInfoKHR createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	createInfo.surface = _renderer._surface;
+	createInfo.minImageCount = imageCount;
+	createInfo.imageFormat = _selectedSurfaceFormat.format;
+	createInfo.imageColorSpace = _selectedSurfaceFormat.colorSpace;
+	createInfo.imageExtent = _selectedSwapExtent;
+
+	// Each swap chain image can have many layers to it?
+	createInfo.imageArrayLayers = 1;
+	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+	uint32_t queueFamilyIndices[]{ _renderer._graphicsQueueFamilyIndex, _renderer._presentQueueFamilyIndex };
+
+	if (_renderer._graphicsQueueFamilyIndex != _renderer._presentQueueFamilyIndex)
+	{
+		// If the graphics family and the present family aren't the same,
+		// make it so the swap chain images can be shared across queue families.
+		// Apparently, this option is less performant.
+		// Later sections of the tutorial show how to explicitly do
+		// transfers from the graphics family to the present family.
+
+		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = 2;
+		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		//             ^
+		// How does Vulkan know which index is for the graphics family
+		// and which index is for the present family?
+		// Oh, it doesn't matter - it just needs a list of which
+		// queue families need to be able to access this image.
+	}
+	else
+	{
+		// Vulkan tutorial says that the present family and the
+		// graphics family are the same on most hardware.
+
+		createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createInfo.queueFamilyIndexCount = 0;
+		createInfo.pQueueFamilyIndices = nullptr;
+	}
+
+	createInfo.preTransform = capabilities.currentTransform;
+	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	createInfo.presentMode = _selectedPresentMode;
+	createInfo.clipped = VK_TRUE;
+	createInfo.oldSwapchain = VK_NULL_HANDLE;
+
+	// When resizing the window, we'll need to create a new swap chain
+	// but then link back to the old one?
+
+	if (vkCreateSwapchainKHR(_renderer._logicalDevice, &createInfo, nullptr, &_swapChain) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create swap chain!");
+	}
+
+	vkGetSwapchainImagesKHR(_renderer._logicalDevice, _swapChain, &imageCount, nullptr);
+	_swapChainImages.resize(imageCount);
+	vkGetSwapchainImagesKHR(_renderer._logicalDevice, _swapChain, &imageCount, _swapChainImages.data());
+}
+
+void swapchain_target::create_image_views()
+{
+	_swapChainImageViews.resize(_swapChainImages.size());
+
+	for (size_t i = 0; i < _swapChainImages.size(); i++)
+	{
+		VkImageViewCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		createInfo.image = _swapChainImages[i];
+		createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		createInfo.format = _selectedSurfaceFormat.format;
+		createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+		// Our images will be used as color targets without any
+		// mipmapping levels or multiple layers.
+		createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		createInfo.subresourceRange.baseMipLevel = 0;
+		createInfo.subresourceRange.levelCount = 1;
+		createInfo.subresourceRange.baseArrayLayer = 0;
+		createInfo.subresourceRange.layerCount = 1;
+
+		// If we were working on a stereographic 3D application,
+		// then you would create a swap chain with multiple layers.
+		// You could then create multiple image views for each image
+		// representing the views for the left and right eyes
+		// by accessing different layers.
+
+		if (vkCreateImageView(_renderer._logicalDevice, &createInfo, nullptr, &_swapChainImageViews[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create image views!");
+		}
+	}
+}
+
+void swapchain_target::create_framebuffers()
+{
+	_swapChainFramebuffers.resize(_swapChainImageViews.size());
+
+	for (size_t i = 0; i < _swapChainImageViews.size(); i++)
+	{
+		// Why can a single frame buffer have many image views attached to it?
+		// This doesn't seem to be the same thing as the number of layers.
+
+		// You can only use a framebuffer with the render passes that 
+		// it is compatible with, which roughly means that they
+		// use the same number and type of attachments.
+
+		// Oh, our render pass only has a single attachment, for color.
+		// The attachmentCount and pAttachments parameters specify the 
+		// VkImageView objects that should be bound to the 
+		// respective attachment descriptions in the render pass 
+		// pAttachment array.
+
+		VkImageView attachments[] = {
+			_swapChainImageViews[i]
+		};
+
+		VkFramebufferCreateInfo framebufferInfo{};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = _renderPass;
+		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.pAttachments = attachments;
+		framebufferInfo.width = _selectedSwapExtent.width;
+		framebufferInfo.height = _selectedSwapExtent.height;
+
+		// Our swap chain images are single images, so the number of layers is 1.
+		framebufferInfo.layers = 1;
+
+		if (vkCreateFramebuffer(_renderer._logicalDevice, &framebufferInfo, nullptr, &_swapChainFramebuffers[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create framebuffer!");
+		}
+	}
+}
+
+bool swapchain_target::acquire_image(VkSemaphore imageAvailable, uint32_t& imageIndex)
+{
+	// The swap chain is an extension feature, hence the *KHR suffix.
+
+	// According to Vulkan documentation, it seems _imageAvailableSemaphores 
+	// is signaled when the next image is acquired?
+
+	// Tutorial says it's signaled when the presentation engine is finished
+	// using the image - that's the point in time where we can start drawing to it.
+
+	// Ahh, vkAcquireNextImageKHR immediately returns the index of an image that 
+	// might not yet be ready to be written to. The semaphore will let us know
+	// when we can draw to this image.
+
+	//  imageAvailable must be unsignaled. Will be signaled when the image is acquired.
+	VkResult result = vkAcquireNextImageKHR(
+		_renderer._logicalDevice,
+		_swapChain,
+		UINT64_MAX,
+		imageAvailable,	
+		VK_NULL_HANDLE,
+		&imageIndex);
+
+	// If the swap extent is invalid, try to recreate it and acquire a swapchain image again.
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		recreate();
+
+		result = vkAcquireNextImageKHR(
+			_renderer._logicalDevice,
+			_swapChain,
+			UINT64_MAX,
+			imageAvailable,
+			VK_NULL_HANDLE,
+			&imageIndex);
+
+		// If the swap extent is still invalid (e.g., application is minimized),
+		// then don't bother rendering this frame.
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			return false;
+		}
+	}
+
+	// Throw an exception if acquiring the swap chain image failed for any other reason.
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	{
+		throw std::runtime_error("failed to acquire swap chain image!");
+	}
+
+	return true;
+}
+
+void swapchain_target::present(VkSemaphore renderFinished, uint32_t imageIndex)
+{
+	// When the command buffer finishes executing, then present the image.
+	VkPresentInfoKHR presentInfo{};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = &renderFinished;
+
+	// Specify the swap chain(s) to present the images to and the index of the image
+	// for each swap chain. This will almost always be a single one.
+	// Curious - is it possible to present multiple images at the same time?
+	// Perhaps, if different swapchains are connected to different surfaces. Interesting.
+	presentInfo.swapchainCount = 1;
+	presentInfo.pSwapchains = &_swapChain;
+	presentInfo.pImageIndices = &imageIndex;
+
+	// If presenting many swap chains, this can tell us which one went wrong.
+	// Since we're using only one, the return value of the present function is enough.
+	presentInfo.pResults = nullptr;
+
+	VkResult result = vkQueuePresentKHR(_renderer._presentQueue, &presentInfo);
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		// Did the image get presented?
+		// Should the image be re-rendered, given that the fragment shader
+		// may be a lengthy operation (e.g., if the iteration count is high)?
+		// Should draw_frame() return something indicating success or failure?
+		recreate();
+	}
+	else if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to present swap chain image!");
+	}
+}
+
+#endif
+
+offscreen_target::offscreen_target(vulkan_renderer& renderer, VkExtent2D extent)
+	: _renderer(renderer), _extent(extent)
+{
+	if (_extent.width == 0 || _extent.height == 0)
+	{
+		throw std::runtime_error("Offscreen target extent must be non-zero.");
+	}
+}
+
+offscreen_target::~offscreen_target()
+{
+	destroy();
+}
+
+void offscreen_target::create(VkRenderPass renderPass)
+{
+	_renderPass = renderPass;
+	VkDevice device = _renderer._logicalDevice;
+
+	// Unlike swap chain images, nobody hands us this image.
+	// We have to create it and back it with memory ourselves.
+	// It's drawn to as a color attachment, then used as the source
+	// of a copy into the readback buffer.
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = _format;
+	imageInfo.extent.width = _extent.width;
+	imageInfo.extent.height = _extent.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &_image) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create offscreen image!");
+	}
+
+	VkMemoryRequirements memRequirements{};
+	vkGetImageMemoryRequirements(device, _image, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = _renderer.find_memory_type(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &_imageMemory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate offscreen image memory!");
+	}
+
+	if (vkBindImageMemory(device, _image, _imageMemory, 0) != VK_SUCCESS) {
+		throw std::runtime_error("failed to bind offscreen image memory!");
+	}
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = _image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = _format;
+	viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(device, &viewInfo, nullptr, &_imageView) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create offscreen image view!");
+	}
+
+	VkFramebufferCreateInfo framebufferInfo{};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = _renderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &_imageView;
+	framebufferInfo.width = _extent.width;
+	framebufferInfo.height = _extent.height;
+	framebufferInfo.layers = 1;
+
+	if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &_framebuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create offscreen framebuffer!");
+	}
+
+	// The readback buffer stays mapped for the lifetime of the target.
+	// Host coherent memory means we don't need to invalidate before reading.
+	_renderer.createBuffer(
+		pixels_size(),
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		_readbackBuffer,
+		_readbackBufferMemory);
+
+	if (vkMapMemory(device, _readbackBufferMemory, 0, pixels_size(), 0, &_readbackData) != VK_SUCCESS) {
+		throw std::runtime_error("failed to map readback buffer memory!");
+	}
+}
+
+void offscreen_target::recreate()
+{
+	// Nothing about an offscreen image goes out of date,
+	// but rebuild it anyway so refresh_surface() behaves the same for both targets.
+	vkDeviceWaitIdle(_renderer._logicalDevice);
+
+	destroy();
+	create(_renderPass);
+}
+
+void offscreen_target::destroy()
+{
+	VkDevice device = _renderer._logicalDevice;
+
+	if (_readbackBufferMemory != nullptr && _readbackData != nullptr)
+		vkUnmapMemory(device, _readbackBufferMemory);
+
+	if (_readbackBuffer != nullptr)
+		vkDestroyBuffer(device, _readbackBuffer, nullptr);
+
+	if (_readbackBufferMemory != nullptr)
+		vkFreeMemory(device, _readbackBufferMemory, nullptr);
+
+	if (_framebuffer != nullptr)
+		vkDestroyFramebuffer(device, _framebuffer, nullptr);
+
+	if (_imageView != nullptr)
+		vkDestroyImageView(device, _imageView, nullptr);
+
+	if (_image != nullptr)
+		vkDestroyImage(device, _image, nullptr);
+
+	if (_imageMemory != nullptr)
+		vkFreeMemory(device, _imageMemory, nullptr);
+
+	_readbackData = nullptr;
+	_readbackBuffer = nullptr;
+	_readbackBufferMemory = nullptr;
+	_framebuffer = nullptr;
+	_imageView = nullptr;
+	_image = nullptr;
+	_imageMemory = nullptr;
+}
+
+bool offscreen_target::acquire_image(VkSemaphore imageAvailable, uint32_t& imageIndex)
+{
+	// There's only the one image, and it's ours whenever we want it.
+	imageIndex = 0;
+	return true;
+}
+
+void offscreen_target::record_after_render_pass(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	// The render pass already transitioned the image to TRANSFER_SRC_OPTIMAL,
+	// but the copy still has to wait for the color writes to land.
+	VkImageMemoryBarrier imageBarrier{};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = _image;
+	imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageBarrier.subresourceRange.baseMipLevel = 0;
+	imageBarrier.subresourceRange.levelCount = 1;
+	imageBarrier.subresourceRange.baseArrayLayer = 0;
+	imageBarrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &imageBarrier);
+
+	// A bufferRowLength and bufferImageHeight of 0 means tightly packed.
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { _extent.width, _extent.height, 1 };
+
+	vkCmdCopyImageToBuffer(commandBuffer, _image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _readbackBuffer, 1, &region);
+
+	// Make the copied pixels visible to the host once the frame completes.
+	VkBufferMemoryBarrier bufferBarrier{};
+	bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.buffer = _readbackBuffer;
+	bufferBarrier.offset = 0;
+	bufferBarrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		0, nullptr,
+		1, &bufferBarrier,
+		0, nullptr);
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+
+class vulkan_renderer;
+
+// A render target is whatever the renderer draws its frames onto.
+//
+// The renderer itself only needs a framebuffer to draw into and a way to hand
+// the finished image off afterwards. Whether that image ends up on a window
+// (swapchain_target) or in host memory for a batch job (offscreen_target)
+// is up to the target.
+class render_target
+{
+public:
+
+	virtual ~render_target() {}
+
+	virtual VkFormat format() const = 0;
+	virtual VkExtent2D extent() const = 0;
+
+	// The layout the render pass should leave the image in once drawing completes.
+	virtual VkImageLayout final_layout() const = 0;
+
+	// Whether acquiring an image signals a semaphore which the draw must wait on,
+	// and whether presenting needs to wait on the draw's semaphore.
+	virtual bool uses_semaphores() const = 0;
+
+	// Creates the images, image views and framebuffers for the given render pass.
+	virtual void create(VkRenderPass renderPass) = 0;
+	virtual void recreate() = 0;
+	virtual void destroy() = 0;
+
+	virtual VkFramebuffer framebuffer(uint32_t imageIndex) const = 0;
+
+	// Returns false if there's currently nothing to draw onto
+	// (e.g., the window is minimized), in which case the frame should be skipped.
+	virtual bool acquire_image(VkSemaphore imageAvailable, uint32_t& imageIndex) = 0;
+
+	// Records any commands that need to follow the render pass
+	// in the same command buffer (e.g., copying the image somewhere).
+	virtual void record_after_render_pass(VkCommandBuffer commandBuffer, uint32_t imageIndex) {}
+
+	virtual void present(VkSemaphore renderFinished, uint32_t imageIndex) = 0;
+};
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+
+// Draws onto a window's surface through a swap chain.
+class swapchain_target : public render_target
+{
+public:
+
+	swapchain_target(vulkan_renderer& renderer);
+	~swapchain_target();
+
+	VkFormat format() const override { return _selectedSurfaceFormat.format; }
+	VkExtent2D extent() const override { return _selectedSwapExtent; }
+	VkImageLayout final_layout() const override { return VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; }
+	bool uses_semaphores() const override { return true; }
+
+	void create(VkRenderPass renderPass) override;
+	void recreate() override;
+	void destroy() override;
+
+	VkFramebuffer framebuffer(uint32_t imageIndex) const override { return _swapChainFramebuffers[imageIndex]; }
+
+	bool acquire_image(VkSemaphore imageAvailable, uint32_t& imageIndex) override;
+	void present(VkSemaphore renderFinished, uint32_t imageIndex) override;
+
+private:
+
+	void choose_swap_surface_format();
+	void choose_swap_present_mode();
+	void choose_swap_extent();
+
+	void create_swap_chain();
+	void create_image_views();
+	void create_framebuffers();
+
+	vulkan_renderer& _renderer;
+	VkRenderPass _renderPass = nullptr;
+
+	VkSurfaceFormatKHR _selectedSurfaceFormat;
+	VkPresentModeKHR _selectedPresentMode;
+	VkExtent2D _selectedSwapExtent;
+
+	VkSwapchainKHR _swapChain = nullptr;
+	std::vector<VkImage> _swapChainImages;
+	std::vector<VkImageView> _swapChainImageViews;
+	std::vector<VkFramebuffer> _swapChainFramebuffers;
+};
+
+#endif
+
+// Draws into a single image that never gets displayed.
+//
+// After each frame the image is copied into a host-visible buffer,
+// which stays mapped so the caller can read the pixels straight out of it.
+// This lets the renderer run on machines with no display at all,
+// including on software implementations such as lavapipe.
+class offscreen_target : public render_target
+{
+public:
+
+	offscreen_target(vulkan_renderer& renderer, VkExtent2D extent);
+	~offscreen_target();
+
+	VkFormat format() const override { return _format; }
+	VkExtent2D extent() const override { return _extent; }
+	VkImageLayout final_layout() const override { return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; }
+	bool uses_semaphores() const override { return false; }
+
+	void create(VkRenderPass renderPass) override;
+	void recreate() override;
+	void destroy() override;
+
+	VkFramebuffer framebuffer(uint32_t imageIndex) const override { return _framebuffer; }
+
+	bool acquire_image(VkSemaphore imageAvailable, uint32_t& imageIndex) override;
+	void record_after_render_pass(VkCommandBuffer commandBuffer, uint32_t imageIndex) override;
+	void present(VkSemaphore renderFinished, uint32_t imageIndex) override {}
+
+	// Tightly packed rows of 4-byte pixels in format() order.
+	// Only valid once the frame that wrote them has finished on the device.
+	const void* pixels() const { return _readbackData; }
+	VkDeviceSize pixels_size() const { return (VkDeviceSize)_extent.width * _extent.height * 4; }
+
+private:
+
+	vulkan_renderer& _renderer;
+	VkRenderPass _renderPass = nullptr;
+
+	// Same format the swapchain_target prefers,
+	// so both targets produce the same bytes for the same frame.
+	VkFormat _format = VK_FORMAT_B8G8R8A8_SRGB;
+	VkExtent2D _extent;
+
+	VkImage _image = nullptr;
+	VkDeviceMemory _imageMemory = nullptr;
+	VkImageView _imageView = nullptr;
+	VkFramebuffer _framebuffer = nullptr;
+
+	VkBuffer _readbackBuffer = nullptr;
+	VkDeviceMemory _readbackBufferMemory = nullptr;
+	void* _readbackData = nullptr;
+};
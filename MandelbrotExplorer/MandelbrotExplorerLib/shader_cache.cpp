@@ -0,0 +1,336 @@
+#include "pch.h"
+#include "shader_cache.h"
+#include "tile_store.h"
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char SPIRV_MAGIC[8] = { 'M', 'B', 'S', 'P', 'I', 'R', 'V', '\0' };
+	const char PIPELINES_MAGIC[8] = { 'M', 'B', 'P', 'I', 'P', 'E', 'S', '\0' };
+
+	// The first word of every SPIR-V module.
+	const uint32_t SPIRV_MODULE_MAGIC = 0x07230203;
+
+	// What vkGetPipelineCacheData() puts in front of its own data, for every driver.
+	const size_t VULKAN_CACHE_HEADER_BYTES = 16 + VK_UUID_SIZE;
+
+	// Laid out by hand, like tile_store's headers, so that there's no padding.
+	struct spirv_header
+	{
+		char magic[8];
+		uint32_t format_version;
+		uint32_t kind;
+		uint64_t source_bytes;
+		uint64_t spirv_words;
+	};
+
+	struct pipelines_header
+	{
+		char magic[8];
+		uint32_t format_version;
+		uint32_t vendor_id;
+		uint32_t device_id;
+		uint32_t driver_version;
+		uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+		uint64_t data_bytes;
+		uint64_t data_hash;
+	};
+
+	static_assert(sizeof(spirv_header) == 32, "spirv_header must have no padding.");
+	static_assert(sizeof(pipelines_header) == 56, "pipelines_header must have no padding.");
+
+	std::mutex defaultDirectoryMutex;
+	std::string defaultDirectory;
+
+	// Tells apart the temporary files of writers in the same process.
+	std::atomic<uint32_t> temporaryCount{ 0 };
+
+	std::FILE* open_file(const std::string& path, bool write)
+	{
+#ifdef _WIN32
+		int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+		std::vector<wchar_t> widePath(std::max(length, 1));
+		MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, widePath.data(), length);
+		return _wfopen(widePath.data(), write ? L"wb" : L"rb");
+#else
+		return std::fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+	}
+
+	bool read_file(const std::string& path, std::vector<uint8_t>& contents)
+	{
+		std::FILE* file = open_file(path, false);
+
+		if (file == nullptr)
+			return false;
+
+		contents.clear();
+		uint8_t buffer[65536];
+		size_t count;
+
+		while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+			contents.insert(contents.end(), buffer, buffer + count);
+
+		bool ok = std::ferror(file) == 0;
+		std::fclose(file);
+		return ok;
+	}
+
+	bool replace_file(const std::string& from, const std::string& to)
+	{
+#ifdef _WIN32
+		int fromLength = MultiByteToWideChar(CP_UTF8, 0, from.c_str(), -1, nullptr, 0);
+		int toLength = MultiByteToWideChar(CP_UTF8, 0, to.c_str(), -1, nullptr, 0);
+		std::vector<wchar_t> wideFrom(std::max(fromLength, 1));
+		std::vector<wchar_t> wideTo(std::max(toLength, 1));
+		MultiByteToWideChar(CP_UTF8, 0, from.c_str(), -1, wideFrom.data(), fromLength);
+		MultiByteToWideChar(CP_UTF8, 0, to.c_str(), -1, wideTo.data(), toLength);
+
+		if (MoveFileExW(wideFrom.data(), wideTo.data(), MOVEFILE_REPLACE_EXISTING) != 0)
+			return true;
+
+		DeleteFileW(wideFrom.data());
+		return false;
+#else
+		if (std::rename(from.c_str(), to.c_str()) == 0)
+			return true;
+
+		std::remove(from.c_str());
+		return false;
+#endif
+	}
+
+	// Writes the pieces one after another under a temporary name, then renames the whole into place.
+	void write_file(const std::string& path, const std::vector<std::pair<const void*, size_t>>& pieces)
+	{
+#ifdef _WIN32
+		unsigned long process = GetCurrentProcessId();
+#else
+		unsigned long process = (unsigned long)getpid();
+#endif
+		std::string temporary = path + ".tmp" + std::to_string(process) + "-" + std::to_string(++temporaryCount);
+		std::FILE* file = open_file(temporary, true);
+
+		if (file == nullptr)
+			return;
+
+		bool ok = true;
+
+		for (const auto& piece : pieces)
+			ok = ok && std::fwrite(piece.first, 1, piece.second, file) == piece.second;
+
+		ok = std::fclose(file) == 0 && ok;
+
+		if (ok)
+			replace_file(temporary, path);
+		else
+			std::remove(temporary.c_str());
+	}
+
+	std::string hex(uint64_t value, int digits)
+	{
+		static const char DIGITS[] = "0123456789abcdef";
+		std::string text(digits, '0');
+
+		for (int i = digits - 1; i >= 0; i--, value >>= 4)
+			text[i] = DIGITS[value & 15];
+
+		return text;
+	}
+
+	uint64_t data_hash(const std::vector<uint8_t>& data)
+	{
+		return kernel_hash(std::string(data.begin(), data.end()));
+	}
+}
+
+void shader_cache::set_default_directory(const std::string& directory)
+{
+	std::lock_guard<std::mutex> lock(defaultDirectoryMutex);
+	defaultDirectory = directory;
+}
+
+std::string shader_cache::default_directory()
+{
+	std::lock_guard<std::mutex> lock(defaultDirectoryMutex);
+	return defaultDirectory;
+}
+
+std::vector<uint32_t> shader_cache::compile(const std::string& name, const std::string& source, shaderc_shader_kind kind)
+{
+	auto precompiled = _precompiled.find(std::make_pair((int)kind, source));
+
+	if (precompiled != _precompiled.end())
+	{
+		std::vector<uint32_t> spirv = std::move(precompiled->second);
+		_precompiled.erase(precompiled);
+		return spirv;
+	}
+
+	return read_or_compile(name, source, kind);
+}
+
+void shader_cache::precompile(const shader_source& source)
+{
+	try
+	{
+		_precompiled[std::make_pair((int)source.kind, source.code)] = read_or_compile(source.name, source.code, source.kind);
+	}
+	catch (const std::runtime_error&)
+	{
+	}
+}
+
+std::vector<uint32_t> shader_cache::read_or_compile(const std::string& name, const std::string& source, shaderc_shader_kind kind)
+{
+	std::string path;
+
+	if (is_open())
+	{
+		path = _directory + "/" + hex(kernel_hash(source), 16) + "-" + std::to_string((int)kind) + ".spv";
+		std::vector<uint8_t> contents;
+
+		if (read_file(path, contents) && contents.size() >= sizeof(spirv_header))
+		{
+			spirv_header header;
+			memcpy(&header, contents.data(), sizeof(header));
+
+			uint64_t spirvOffset = sizeof(header) + header.source_bytes;
+
+			bool matches = memcmp(header.magic, SPIRV_MAGIC, sizeof(header.magic)) == 0 &&
+				header.format_version == FORMAT_VERSION &&
+				header.kind == (uint32_t)kind &&
+				header.source_bytes == source.size() &&
+				header.spirv_words > 0 &&
+				contents.size() == spirvOffset + header.spirv_words * sizeof(uint32_t) &&
+				memcmp(contents.data() + sizeof(header), source.data(), source.size()) == 0;
+
+			if (matches)
+			{
+				std::vector<uint32_t> spirv((size_t)header.spirv_words);
+				memcpy(spirv.data(), contents.data() + spirvOffset, spirv.size() * sizeof(uint32_t));
+
+				if (spirv[0] == SPIRV_MODULE_MAGIC)
+				{
+					_statistics.spirv_hits++;
+					return spirv;
+				}
+			}
+		}
+	}
+
+	shaderc::Compiler compiler;
+	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, name.c_str());
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status::shaderc_compilation_status_success)
+	{
+		std::string message;
+		message = "Failed to compile shader: " + name + "\n";
+		message += result.GetErrorMessage() + "\n";
+
+		throw std::runtime_error(message);
+	}
+
+	std::vector<uint32_t> spirv;
+	std::copy(result.begin(), result.end(), std::back_inserter(spirv));
+	_statistics.spirv_misses++;
+
+	if (is_open() && !spirv.empty())
+	{
+		spirv_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SPIRV_MAGIC, sizeof(header.magic));
+		header.format_version = FORMAT_VERSION;
+		header.kind = (uint32_t)kind;
+		header.source_bytes = source.size();
+		header.spirv_words = spirv.size();
+
+		write_file(path, {
+			{ &header, sizeof(header) },
+			{ source.data(), source.size() },
+			{ spirv.data(), spirv.size() * sizeof(uint32_t) } });
+	}
+
+	return spirv;
+}
+
+std::string shader_cache::pipeline_cache_path(const VkPhysicalDeviceProperties& properties) const
+{
+	return _directory + "/pipelines-" + hex(properties.vendorID, 4) + "-" + hex(properties.deviceID, 4) + ".cache";
+}
+
+std::vector<uint8_t> shader_cache::load_pipeline_cache(const VkPhysicalDeviceProperties& properties)
+{
+	std::vector<uint8_t> data;
+	std::vector<uint8_t> contents;
+
+	if (!is_open() || !read_file(pipeline_cache_path(properties), contents) || contents.size() < sizeof(pipelines_header))
+		return data;
+
+	pipelines_header header;
+	memcpy(&header, contents.data(), sizeof(header));
+
+	bool matches = memcmp(header.magic, PIPELINES_MAGIC, sizeof(header.magic)) == 0 &&
+		header.format_version == FORMAT_VERSION &&
+		header.vendor_id == properties.vendorID &&
+		header.device_id == properties.deviceID &&
+		header.driver_version == properties.driverVersion &&
+		memcmp(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+		header.data_bytes >= VULKAN_CACHE_HEADER_BYTES &&
+		contents.size() == sizeof(header) + header.data_bytes;
+
+	if (!matches)
+		return data;
+
+	data.assign(contents.begin() + sizeof(header), contents.end());
+
+	// The driver checks its own header as well, but a file cut short or
+	// written over by something else shouldn't get as far as the driver.
+	uint32_t vulkanHeader[4];
+	memcpy(vulkanHeader, data.data(), sizeof(vulkanHeader));
+
+	if (data_hash(data) != header.data_hash ||
+		vulkanHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+		vulkanHeader[2] != properties.vendorID ||
+		vulkanHeader[3] != properties.deviceID ||
+		memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		data.clear();
+		return data;
+	}
+
+	_statistics.pipeline_cache_loaded = true;
+	return data;
+}
+
+void shader_cache::save_pipeline_cache(const VkPhysicalDeviceProperties& properties, const std::vector<uint8_t>& data)
+{
+	if (!is_open() || data.size() < VULKAN_CACHE_HEADER_BYTES)
+		return;
+
+	pipelines_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PIPELINES_MAGIC, sizeof(header.magic));
+	header.format_version = FORMAT_VERSION;
+	header.vendor_id = properties.vendorID;
+	header.device_id = properties.deviceID;
+	header.driver_version = properties.driverVersion;
+	memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.data_bytes = data.size();
+	header.data_hash = data_hash(data);
+
+	write_file(pipeline_cache_path(properties), {
+		{ &header, sizeof(header) },
+		{ data.data(), data.size() } });
+}
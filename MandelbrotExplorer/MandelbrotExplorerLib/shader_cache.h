@@ -0,0 +1,86 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <shaderc/shaderc.hpp>
+
+// GLSL for a renderer to compile, and what to call it in error messages.
+struct shader_source
+{
+	std::string name;
+	std::string code;
+	shaderc_shader_kind kind;
+};
+
+struct shader_cache_statistics
+{
+	// Shaders read from disk, and shaders that had to be compiled.
+	uint32_t spirv_hits = 0;
+	uint32_t spirv_misses = 0;
+
+	// Whether an earlier run's pipeline cache was found for this device and driver.
+	bool pipeline_cache_loaded = false;
+};
+
+// Keeps what a renderer builds at startup on disk, so that the next one to start
+// doesn't have to build it again. A directory holds:
+//
+//   <hash>-<kind>.spv, one shader's SPIR-V, named after a hash of its GLSL source.
+//   The source is in the file too, and compared in full before the SPIR-V is used,
+//   so a hash collision only ever costs a compilation.
+//
+//   pipelines-<vendor>-<device>.cache, the contents of the renderer's VkPipelineCache,
+//   behind a header recording the device's pipeline cache UUID and driver version.
+//   Drivers are only ever handed data they wrote themselves; after a driver update,
+//   the old data's ignored and replaced.
+//
+// Files are written under a temporary name and then renamed into place, so any number
+// of processes can share a directory. Readers only ever see whole files, and the last
+// writer wins. A file that can't be read, or doesn't check out, is just a cache miss,
+// and one that can't be written is left for the next run to try again.
+class shader_cache
+{
+public:
+
+	static const uint32_t FORMAT_VERSION = 1;
+
+	// The directory renderers open their caches in as they're set up, shared by every
+	// thread in the process. Empty (the default) means no caching.
+	static void set_default_directory(const std::string& directory);
+	static std::string default_directory();
+
+	// The directory must exist. Until one's opened, compile() just compiles,
+	// and there's no pipeline cache to load or save.
+	void open(const std::string& directory) { _directory = directory; }
+	void close() { _directory.clear(); }
+	bool is_open() const { return !_directory.empty(); }
+
+	// source's SPIR-V, from disk if it's been compiled before. Throws if it doesn't compile.
+	std::vector<uint32_t> compile(const std::string& name, const std::string& source, shaderc_shader_kind kind);
+
+	// Compiles source ahead of time, so that a later compile() of exactly the same source
+	// and kind doesn't have to. Made for compiling on another thread while the device is
+	// set up: it may run alongside load_pipeline_cache(), but not alongside compile().
+	// Source that fails to compile is left for compile() to report.
+	void precompile(const shader_source& source);
+
+	// What to create the device's VkPipelineCache from: the data saved for exactly this device
+	// and driver, or nothing.
+	std::vector<uint8_t> load_pipeline_cache(const VkPhysicalDeviceProperties& properties);
+	void save_pipeline_cache(const VkPhysicalDeviceProperties& properties, const std::vector<uint8_t>& data);
+
+	const shader_cache_statistics& statistics() const { return _statistics; }
+
+private:
+
+	std::string pipeline_cache_path(const VkPhysicalDeviceProperties& properties) const;
+
+	std::vector<uint32_t> read_or_compile(const std::string& name, const std::string& source, shaderc_shader_kind kind);
+
+	std::string _directory;
+	std::map<std::pair<int, std::string>, std::vector<uint32_t>> _precompiled;
+	shader_cache_statistics _statistics;
+};
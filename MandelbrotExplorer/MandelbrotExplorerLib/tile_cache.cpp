@@ -0,0 +1,92 @@
+#include "pch.h"
+#include "tile_cache.h"
+#include <functional>
+
+size_t tile_key_hash::operator()(const tile_key& key) const
+{
+	// Boost-style hash_combine over every field.
+	size_t seed = 0;
+
+	auto combine = [&seed](size_t value)
+	{
+		seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	};
+
+	combine(std::hash<int32_t>()(key.zoom_level));
+	combine(std::hash<double>()(key.pixel_size));
+	combine(std::hash<int64_t>()(key.tile_x));
+	combine(std::hash<int64_t>()(key.tile_y));
+	combine(std::hash<uint32_t>()(key.max_iterations));
+	combine(std::hash<float>()(key.bailout_radius));
+
+	return seed;
+}
+
+tile_cache::tile_cache(size_t budgetBytes)
+	: _budgetBytes(budgetBytes)
+{
+}
+
+void tile_cache::set_budget(size_t budgetBytes)
+{
+	_budgetBytes = budgetBytes;
+	evict_to(_budgetBytes);
+}
+
+const std::vector<uint8_t>* tile_cache::find(const tile_key& key)
+{
+	auto found = _index.find(key);
+
+	if (found == _index.end())
+	{
+		_statistics.misses++;
+		return nullptr;
+	}
+
+	// Move it to the front. Splicing keeps the iterator in the index valid.
+	_entries.splice(_entries.begin(), _entries, found->second);
+	_statistics.hits++;
+
+	return &found->second->data;
+}
+
+void tile_cache::insert(const tile_key& key, std::vector<uint8_t>&& data)
+{
+	auto found = _index.find(key);
+
+	if (found != _index.end())
+	{
+		_sizeBytes -= found->second->data.size();
+		_entries.erase(found->second);
+		_index.erase(found);
+	}
+
+	// A tile bigger than the whole budget would only evict everything else, then itself.
+	if (data.size() > _budgetBytes)
+		return;
+
+	evict_to(_budgetBytes - data.size());
+
+	_sizeBytes += data.size();
+	_entries.push_front(entry{ key, std::move(data) });
+	_index[key] = _entries.begin();
+}
+
+void tile_cache::clear()
+{
+	_entries.clear();
+	_index.clear();
+	_sizeBytes = 0;
+}
+
+void tile_cache::evict_to(size_t budgetBytes)
+{
+	while (_sizeBytes > budgetBytes && !_entries.empty())
+	{
+		entry& oldest = _entries.back();
+		_sizeBytes -= oldest.data.size();
+		_index.erase(oldest.key);
+		_entries.pop_back();
+		_statistics.evictions++;
+	}
+}
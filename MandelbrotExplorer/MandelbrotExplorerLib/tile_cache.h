@@ -0,0 +1,114 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+
+// Identifies one tile of a fixed grid laid over the complex plane.
+//
+// At a given zoom level, world pixel (x, y) is the square whose top-left corner
+// is x * pixel_size on the real axis and -y * pixel_size on the imaginary axis,
+// so y counts downwards like the surface does. Tile (tile_x, tile_y) covers world
+// pixels tile_x * TILE_SIZE up to (tile_x + 1) * TILE_SIZE, and likewise for y.
+struct tile_key
+{
+	int32_t zoom_level;
+	double pixel_size;
+	int64_t tile_x;
+	int64_t tile_y;
+	uint32_t max_iterations;
+	float bailout_radius;
+
+	bool operator==(const tile_key& other) const
+	{
+		return zoom_level == other.zoom_level && pixel_size == other.pixel_size &&
+			tile_x == other.tile_x && tile_y == other.tile_y &&
+			max_iterations == other.max_iterations && bailout_radius == other.bailout_radius;
+	}
+};
+
+struct tile_key_hash
+{
+	size_t operator()(const tile_key& key) const;
+};
+
+// Where the surface currently sits on the world grid, and the parameters
+// its results depend on. Everything a tile_key needs, bar the tile.
+struct tile_cache_view
+{
+	int32_t zoom_level = 0;
+	double pixel_size = 0.0;
+
+	// World pixel at the top-left corner of the surface.
+	int64_t origin_x = 0;
+	int64_t origin_y = 0;
+
+	uint32_t max_iterations = 0;
+	float bailout_radius = 0.0f;
+
+	tile_key key(int64_t tileX, int64_t tileY) const
+	{
+		tile_key k = { zoom_level, pixel_size, tileX, tileY, max_iterations, bailout_radius };
+		return k;
+	}
+};
+
+struct tile_cache_statistics
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+};
+
+// Keeps the raw per-pixel results of previously computed tiles, so that
+// zooming back out, returning to a spot, or panning back over somewhere
+// already visited doesn't have to compute it all over again.
+//
+// Tiles are TILE_SIZE x TILE_SIZE pixels, stored row by row in whatever
+// per-pixel format the compute shader writes. Once the tiles held add up to
+// more than the memory budget, the least recently used ones are thrown out.
+class tile_cache
+{
+public:
+
+	static const uint32_t TILE_SIZE = 128;
+
+	tile_cache(size_t budgetBytes = 256 * 1024 * 1024);
+
+	size_t budget_bytes() const { return _budgetBytes; }
+	size_t size_bytes() const { return _sizeBytes; }
+	size_t tile_count() const { return _index.size(); }
+	const tile_cache_statistics& statistics() const { return _statistics; }
+
+	// Evicts straight away if the cache is already over the new budget.
+	void set_budget(size_t budgetBytes);
+
+	// The tile's data, or null if it isn't cached. Counts as a use of the tile.
+	// The pointer is good until the next insert() or clear().
+	const std::vector<uint8_t>* find(const tile_key& key);
+
+	// Takes over the tile's data, replacing anything already cached under the same key.
+	void insert(const tile_key& key, std::vector<uint8_t>&& data);
+
+	void clear();
+
+private:
+
+	struct entry
+	{
+		tile_key key;
+		std::vector<uint8_t> data;
+	};
+
+	void evict_to(size_t budgetBytes);
+
+	size_t _budgetBytes;
+	size_t _sizeBytes = 0;
+
+	// Most recently used at the front.
+	std::list<entry> _entries;
+	std::unordered_map<tile_key, std::list<entry>::iterator, tile_key_hash> _index;
+
+	tile_cache_statistics _statistics;
+};
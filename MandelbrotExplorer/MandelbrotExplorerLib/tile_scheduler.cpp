@@ -0,0 +1,362 @@
+#include "pch.h"
+#include "tile_scheduler.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct tile_scheduler::state
+{
+	struct worker
+	{
+		// Guards tiles. Only ever contended when someone is stealing.
+		std::mutex mutex;
+		std::deque<tile> tiles;
+
+		std::thread thread;
+		worker_statistics statistics;
+		uint32_t victimSeed = 0;
+	};
+
+	std::vector<std::unique_ptr<worker>> workers;
+
+	// One run() at a time.
+	std::mutex runMutex;
+
+	// Guards everything below.
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable finished;
+	uint64_t generation = 0;
+	uint32_t running = 0;
+	bool shutdown = false;
+	std::exception_ptr error;
+
+	const std::function<void(const tile&)>* work = nullptr;
+	std::atomic<bool> abandoned{ false };
+
+	void worker_loop(uint32_t index, bool pin);
+	void run_tiles(uint32_t index);
+	bool take_own(worker& self, tile& next);
+	bool steal(uint32_t index, tile& next);
+};
+
+namespace
+{
+	uint32_t logical_core_count()
+	{
+#ifdef _WIN32
+		// Windows splits machines with more than 64 logical cores into processor groups,
+		// and hardware_concurrency() may only count the group the process started in.
+		DWORD count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+
+		if (count > 0)
+			return (uint32_t)count;
+#endif
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	void pin_current_thread(uint32_t core)
+	{
+#ifdef _WIN32
+		// An affinity mask only covers one processor group (64 logical cores), and a thread
+		// starts out in its process's group. Core numbers run through each group in turn,
+		// so that the workers are spread over all of them instead of piling onto the first.
+		WORD groups = GetActiveProcessorGroupCount();
+		DWORD total = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+
+		if (groups == 0 || total == 0)
+			return;
+
+		DWORD index = core % total;
+
+		for (WORD group = 0; group < groups; group++)
+		{
+			DWORD count = GetActiveProcessorCount(group);
+
+			if (index < count)
+			{
+				GROUP_AFFINITY affinity{};
+				affinity.Group = group;
+				affinity.Mask = (KAFFINITY)1 << index;
+				SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+				return;
+			}
+
+			index -= count;
+		}
+#elif defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(core % CPU_SETSIZE, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+	}
+}
+
+void tile_scheduler::state::worker_loop(uint32_t index, bool pin)
+{
+	if (pin)
+		pin_current_thread(index);
+
+	uint64_t seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start.wait(lock, [&] { return shutdown || generation != seen; });
+
+			if (shutdown)
+				return;
+
+			seen = generation;
+		}
+
+		run_tiles(index);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (--running == 0)
+				finished.notify_all();
+		}
+	}
+}
+
+void tile_scheduler::state::run_tiles(uint32_t index)
+{
+	worker& self = *workers[index];
+
+	for (;;)
+	{
+		tile next;
+		bool stolen = false;
+
+		if (!take_own(self, next))
+		{
+			// Tiles never spawn more tiles, so once there's nothing
+			// left to steal anywhere, this worker is finished.
+			if (!steal(index, next))
+				return;
+
+			stolen = true;
+		}
+
+		if (abandoned.load(std::memory_order_relaxed))
+			continue;
+
+		auto tileStart = std::chrono::steady_clock::now();
+		bool completed = true;
+
+		try
+		{
+			(*work)(next);
+		}
+		catch (...)
+		{
+			// Keep the first error for run() to rethrow, and skip whatever's left.
+			// A tile that threw isn't counted as completed.
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!error)
+				error = std::current_exception();
+
+			abandoned = true;
+			completed = false;
+		}
+
+		auto tileEnd = std::chrono::steady_clock::now();
+
+		self.statistics.busy_milliseconds += std::chrono::duration<double, std::milli>(tileEnd - tileStart).count();
+
+		if (!completed)
+			continue;
+
+		self.statistics.tiles_completed++;
+
+		if (stolen)
+			self.statistics.tiles_stolen++;
+	}
+}
+
+bool tile_scheduler::state::take_own(worker& self, tile& next)
+{
+	// Take from the back. The most recently queued tile is the one
+	// neighbouring whatever this worker just finished.
+	std::lock_guard<std::mutex> lock(self.mutex);
+
+	if (self.tiles.empty())
+		return false;
+
+	next = self.tiles.back();
+	self.tiles.pop_back();
+	return true;
+}
+
+bool tile_scheduler::state::steal(uint32_t index, tile& next)
+{
+	worker& self = *workers[index];
+	uint32_t count = (uint32_t)workers.size();
+
+	// Start at a pseudo-random victim so thieves don't all pile onto the same worker.
+	self.victimSeed ^= self.victimSeed << 13;
+	self.victimSeed ^= self.victimSeed >> 17;
+	self.victimSeed ^= self.victimSeed << 5;
+
+	uint32_t first = self.victimSeed % count;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t victimIndex = (first + i) % count;
+
+		if (victimIndex == index)
+			continue;
+
+		worker& victim = *workers[victimIndex];
+
+		// Steal from the front, away from where the victim is working.
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.tiles.empty())
+		{
+			next = victim.tiles.front();
+			victim.tiles.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+tile_scheduler::tile_scheduler(const tile_scheduler_options& options)
+	: _options(options), _state(new state())
+{
+	if (_options.tile_width == 0 || _options.tile_height == 0)
+	{
+		throw std::runtime_error("Tile dimensions must be non-zero.");
+	}
+
+	if (_options.thread_count == 0)
+		_options.thread_count = logical_core_count();
+
+	for (uint32_t i = 0; i < _options.thread_count; i++)
+	{
+		_state->workers.emplace_back(new state::worker());
+		_state->workers.back()->victimSeed = 0x9E3779B9u * (i + 1);
+	}
+
+	for (uint32_t i = 0; i < _options.thread_count; i++)
+	{
+		state* s = _state.get();
+		bool pin = _options.pin_threads;
+		_state->workers[i]->thread = std::thread([s, i, pin] { s->worker_loop(i, pin); });
+	}
+
+	_statistics.resize(_options.thread_count);
+}
+
+tile_scheduler::~tile_scheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(_state->mutex);
+		_state->shutdown = true;
+	}
+
+	_state->start.notify_all();
+
+	for (auto& worker : _state->workers)
+	{
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+std::vector<tile> tile_scheduler::split(uint32_t width, uint32_t height, uint32_t tileWidth, uint32_t tileHeight)
+{
+	std::vector<tile> tiles;
+
+	for (uint32_t top = 0; top < height; top += tileHeight)
+	{
+		for (uint32_t left = 0; left < width; left += tileWidth)
+		{
+			tile t;
+			t.left = left;
+			t.top = top;
+			t.width = std::min(tileWidth, width - left);
+			t.height = std::min(tileHeight, height - top);
+			tiles.push_back(t);
+		}
+	}
+
+	return tiles;
+}
+
+void tile_scheduler::run(uint32_t width, uint32_t height, const std::function<void(const tile&)>& work)
+{
+	run(split(width, height, _options.tile_width, _options.tile_height), work);
+}
+
+void tile_scheduler::run(const std::vector<tile>& tiles, const std::function<void(const tile&)>& work)
+{
+	std::lock_guard<std::mutex> runLock(_state->runMutex);
+
+	uint32_t count = (uint32_t)_state->workers.size();
+
+	// Deal the tiles out round-robin. Neighbouring tiles tend to cost about
+	// the same, so this spreads any expensive region across every worker
+	// from the start, leaving less to steal later on.
+	for (uint32_t i = 0; i < count; i++)
+	{
+		_state->workers[i]->tiles.clear();
+		_state->workers[i]->statistics = worker_statistics();
+	}
+
+	for (size_t i = 0; i < tiles.size(); i++)
+		_state->workers[i % count]->tiles.push_back(tiles[i]);
+
+	auto runStart = std::chrono::steady_clock::now();
+
+	{
+		std::unique_lock<std::mutex> lock(_state->mutex);
+
+		_state->work = &work;
+		_state->abandoned = false;
+		_state->error = nullptr;
+		_state->running = count;
+		_state->generation++;
+		_state->start.notify_all();
+
+		_state->finished.wait(lock, [&] { return _state->running == 0; });
+	}
+
+	auto runEnd = std::chrono::steady_clock::now();
+	_lastRunMilliseconds = std::chrono::duration<double, std::milli>(runEnd - runStart).count();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		worker_statistics& statistics = _state->workers[i]->statistics;
+
+		statistics.utilisation = _lastRunMilliseconds > 0.0
+			? statistics.busy_milliseconds / _lastRunMilliseconds
+			: 0.0;
+
+		_statistics[i] = statistics;
+	}
+
+	_state->work = nullptr;
+
+	if (_state->error)
+		std::rethrow_exception(_state->error);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+// A rectangle of pixels handed to one worker at a time.
+struct tile
+{
+	uint32_t left;
+	uint32_t top;
+	uint32_t width;
+	uint32_t height;
+};
+
+struct tile_scheduler_options
+{
+	uint32_t tile_width = 64;
+	uint32_t tile_height = 64;
+
+	// 0 means one worker per hardware thread.
+	uint32_t thread_count = 0;
+
+	// Pin worker i to logical core i, counting through each of Windows' processor
+	// groups in turn. Only worth it when nothing else is competing for the cores,
+	// e.g. on a dedicated render node.
+	bool pin_threads = false;
+};
+
+// What each worker did during the most recent run().
+struct worker_statistics
+{
+	uint32_t tiles_completed = 0;
+	uint32_t tiles_stolen = 0;
+	double busy_milliseconds = 0.0;
+
+	// busy_milliseconds as a fraction of the run's wall-clock time.
+	double utilisation = 0.0;
+};
+
+// Spreads tiles of work across a pool of worker threads.
+//
+// Escape-time cost is wildly uneven across an image - interior pixels run
+// all max_iterations while exterior pixels bail out after a handful - so
+// any fixed split of the image leaves most workers idle while one finishes
+// the expensive part. Instead, each worker gets its own deque of tiles.
+// A worker takes tiles from the back of its own deque, and once that runs
+// dry it steals from the front of someone else's.
+//
+// The threads live as long as the scheduler and sleep between runs.
+// The threading internals are kept out of this header, since it's
+// included from C++/CLI code where <thread> and <mutex> aren't available.
+class tile_scheduler
+{
+public:
+
+	tile_scheduler(const tile_scheduler_options& options = tile_scheduler_options());
+	~tile_scheduler();
+
+	tile_scheduler(const tile_scheduler&) = delete;
+	tile_scheduler& operator=(const tile_scheduler&) = delete;
+
+	const tile_scheduler_options& options() const { return _options; }
+	uint32_t thread_count() const { return _options.thread_count; }
+
+	// Cuts a width x height area into tiles and runs work on each of them.
+	// Blocks until every tile is done. If any tile throws, the remaining
+	// tiles are abandoned and the first exception is rethrown here.
+	void run(uint32_t width, uint32_t height, const std::function<void(const tile&)>& work);
+
+	// Same as above for an arbitrary list of tiles.
+	void run(const std::vector<tile>& tiles, const std::function<void(const tile&)>& work);
+
+	// Statistics for the most recent run(), one entry per worker.
+	const std::vector<worker_statistics>& statistics() const { return _statistics; }
+	double last_run_milliseconds() const { return _lastRunMilliseconds; }
+
+	static std::vector<tile> split(uint32_t width, uint32_t height, uint32_t tileWidth, uint32_t tileHeight);
+
+private:
+
+	struct state;
+
+	tile_scheduler_options _options;
+	std::unique_ptr<state> _state;
+
+	std::vector<worker_statistics> _statistics;
+	double _lastRunMilliseconds = 0.0;
+};
@@ -0,0 +1,639 @@
+#include "pch.h"
+#include "tile_store.h"
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+	const char STORE_MAGIC[8] = { 'M', 'B', 'T', 'I', 'L', 'E', 'S', '\0' };
+
+	// The tile file's header gets a page to itself, so that records start page aligned.
+	const uint64_t TILES_HEADER_BYTES = 4096;
+
+	// The tile file grows this many records at a time, to save remapping it for every tile.
+	const uint64_t GROWTH_RECORDS = 64;
+
+	enum store_file_kind : uint32_t
+	{
+		STORE_TILES = 0,
+		STORE_INDEX = 1
+	};
+
+	struct store_header
+	{
+		char magic[8];
+		uint32_t format_version;
+		uint32_t file_kind;
+		uint32_t tile_size;
+		uint32_t tile_bytes;
+		uint64_t kernel;
+		char precision[16];
+	};
+
+	// One entry in the index file. Laid out by hand so that there's no padding
+	// for the compiler to fill with whatever happened to be on the stack.
+	struct index_record
+	{
+		int32_t zoom_level;
+		float bailout_radius;
+		int64_t tile_x;
+		int64_t tile_y;
+		double pixel_size;
+		uint32_t max_iterations;
+		uint32_t checksum;
+		uint64_t record;
+	};
+
+	static_assert(sizeof(store_header) == 48, "store_header must have no padding.");
+	static_assert(sizeof(index_record) == 48, "index_record must have no padding.");
+
+	store_header make_header(store_file_kind kind, uint64_t kernel, const std::string& precision, uint32_t tileBytes)
+	{
+		store_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+		header.format_version = tile_store::FORMAT_VERSION;
+		header.file_kind = kind;
+		header.tile_size = tile_cache::TILE_SIZE;
+		header.tile_bytes = tileBytes;
+		header.kernel = kernel;
+		memcpy(header.precision, precision.data(), precision.size());
+		return header;
+	}
+
+	// 32-bit FNV-1a, for telling whether a record made it to the disk whole.
+	uint32_t record_checksum(const uint8_t* data, size_t length)
+	{
+		uint32_t hash = 0x811c9dc5u;
+
+		for (size_t i = 0; i < length; i++)
+		{
+			hash ^= data[i];
+			hash *= 0x01000193u;
+		}
+
+		return hash;
+	}
+}
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+void mapped_file::open(const std::string& path)
+{
+	close();
+
+	int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+	std::vector<wchar_t> widePath(std::max(length, 1));
+	MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, widePath.data(), length);
+
+	HANDLE file = CreateFileW(widePath.data(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	// Sharing it for reading only keeps any other writer out.
+	if (file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_SHARING_VIOLATION)
+	{
+		throw std::runtime_error("Tile store file " + path + " is in use by another instance of the program.");
+	}
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to open tile store file " + path);
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+
+	_file = file;
+	_size = (uint64_t)size.QuadPart;
+}
+
+void mapped_file::close()
+{
+	unmap();
+
+	if (_file != nullptr)
+	{
+		CloseHandle(_file);
+		_file = nullptr;
+	}
+
+	_size = 0;
+}
+
+bool mapped_file::is_open() const
+{
+	return _file != nullptr;
+}
+
+void mapped_file::resize(uint64_t size)
+{
+	unmap();
+
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG)size;
+
+	if (!SetFilePointerEx(_file, position, nullptr, FILE_BEGIN) || !SetEndOfFile(_file))
+	{
+		throw std::runtime_error("Failed to resize tile store file.");
+	}
+
+	_size = size;
+}
+
+void mapped_file::read(uint64_t offset, void* data, size_t length)
+{
+	OVERLAPPED overlapped{};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD done = 0;
+
+	if (!ReadFile(_file, data, (DWORD)length, &done, &overlapped) || done != length)
+	{
+		throw std::runtime_error("Failed to read tile store file.");
+	}
+}
+
+void mapped_file::write(uint64_t offset, const void* data, size_t length)
+{
+	OVERLAPPED overlapped{};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD done = 0;
+
+	if (!WriteFile(_file, data, (DWORD)length, &done, &overlapped) || done != length)
+	{
+		throw std::runtime_error("Failed to write tile store file.");
+	}
+
+	_size = std::max(_size, offset + length);
+}
+
+uint8_t* mapped_file::map()
+{
+	if (_view != nullptr || _size == 0)
+		return _view;
+
+	_mapping = CreateFileMappingW(_file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+
+	if (_mapping == nullptr)
+	{
+		throw std::runtime_error("Failed to map tile store file.");
+	}
+
+	_view = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+
+	if (_view == nullptr)
+	{
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+		throw std::runtime_error("Failed to map tile store file.");
+	}
+
+	return _view;
+}
+
+void mapped_file::unmap()
+{
+	if (_view != nullptr)
+	{
+		UnmapViewOfFile(_view);
+		_view = nullptr;
+	}
+
+	if (_mapping != nullptr)
+	{
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+	}
+}
+
+#else
+
+void mapped_file::open(const std::string& path)
+{
+	close();
+
+	int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (file < 0)
+	{
+		throw std::runtime_error("Failed to open tile store file " + path);
+	}
+
+	// An advisory lock, which every mapped_file takes, keeps any other writer out.
+	// It goes when the file's closed.
+	if (flock(file, LOCK_EX | LOCK_NB) != 0)
+	{
+		bool inUse = errno == EWOULDBLOCK;
+		::close(file);
+
+		if (inUse)
+			throw std::runtime_error("Tile store file " + path + " is in use by another instance of the program.");
+
+		throw std::runtime_error("Failed to lock tile store file " + path);
+	}
+
+	struct stat status;
+	fstat(file, &status);
+
+	_file = file;
+	_size = (uint64_t)status.st_size;
+}
+
+void mapped_file::close()
+{
+	unmap();
+
+	if (_file >= 0)
+	{
+		::close(_file);
+		_file = -1;
+	}
+
+	_size = 0;
+}
+
+bool mapped_file::is_open() const
+{
+	return _file >= 0;
+}
+
+void mapped_file::resize(uint64_t size)
+{
+	unmap();
+
+	if (ftruncate(_file, (off_t)size) != 0)
+	{
+		throw std::runtime_error("Failed to resize tile store file.");
+	}
+
+	_size = size;
+}
+
+void mapped_file::read(uint64_t offset, void* data, size_t length)
+{
+	if (pread(_file, data, length, (off_t)offset) != (ssize_t)length)
+	{
+		throw std::runtime_error("Failed to read tile store file.");
+	}
+}
+
+void mapped_file::write(uint64_t offset, const void* data, size_t length)
+{
+	if (pwrite(_file, data, length, (off_t)offset) != (ssize_t)length)
+	{
+		throw std::runtime_error("Failed to write tile store file.");
+	}
+
+	_size = std::max(_size, offset + length);
+}
+
+uint8_t* mapped_file::map()
+{
+	if (_view != nullptr || _size == 0)
+		return _view;
+
+	void* view = mmap(nullptr, (size_t)_size, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+
+	if (view == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to map tile store file.");
+	}
+
+	_view = (uint8_t*)view;
+	return _view;
+}
+
+void mapped_file::unmap()
+{
+	if (_view != nullptr)
+	{
+		munmap(_view, (size_t)_size);
+		_view = nullptr;
+	}
+}
+
+#endif
+
+void tile_store::open(const std::string& directory, uint64_t kernel, const std::string& precision, uint32_t tileBytes)
+{
+	close();
+
+	if (precision.empty() || precision.size() >= sizeof(store_header::precision))
+	{
+		throw std::runtime_error("Tile store precision names must be 1 to 15 characters long.");
+	}
+
+	if (tileBytes == 0)
+	{
+		throw std::runtime_error("Tile store tiles must hold at least one byte.");
+	}
+
+	_kernel = kernel;
+	_precision = precision;
+	_tileBytes = tileBytes;
+
+	char kernelName[17];
+	snprintf(kernelName, sizeof(kernelName), "%016llx", (unsigned long long)kernel);
+
+	std::string path = directory + "/" + precision + "-" + kernelName;
+
+	try
+	{
+		_tiles.open(path + ".tiles");
+		_indexFile.open(path + ".index");
+
+		if (!read_index())
+			start_afresh();
+	}
+	catch (...)
+	{
+		close();
+		throw;
+	}
+}
+
+void tile_store::close()
+{
+	_tileData = nullptr;
+	_tiles.close();
+	_indexFile.close();
+	_index.clear();
+	_tilesByUse.clear();
+	_freeRecords.clear();
+	_records = 0;
+	_recordCapacity = 0;
+}
+
+const uint8_t* tile_store::find(const tile_key& key)
+{
+	auto found = _index.find(key);
+
+	if (found == _index.end())
+	{
+		_statistics.misses++;
+		return nullptr;
+	}
+
+	stored_tile& stored = *found->second;
+	const uint8_t* data = _tileData + TILES_HEADER_BYTES + stored.record * _tileBytes;
+
+	// A record that didn't make it to the disk whole before the program last stopped
+	// is as good as missing, and free for the next tile.
+	if (!stored.verified)
+	{
+		if (record_checksum(data, _tileBytes) != stored.checksum)
+		{
+			_freeRecords.push_back(stored.record);
+			_tilesByUse.erase(found->second);
+			_index.erase(found);
+			_statistics.misses++;
+			return nullptr;
+		}
+
+		stored.verified = true;
+	}
+
+	// Move it to the front, as the most recently used.
+	_tilesByUse.splice(_tilesByUse.begin(), _tilesByUse, found->second);
+
+	_statistics.hits++;
+	return data;
+}
+
+void tile_store::insert(const tile_key& key, const uint8_t* data)
+{
+	if (!is_open() || _index.find(key) != _index.end())
+		return;
+
+	uint64_t record = take_record();
+
+	if (record == UINT64_MAX)
+		return;
+
+	// The OS writes the record back in its own time. The checksum in its index entry
+	// catches it if it doesn't get there before the entry does.
+	memcpy(_tileData + TILES_HEADER_BYTES + record * _tileBytes, data, _tileBytes);
+	uint32_t checksum = record_checksum(data, _tileBytes);
+
+	write_index_entry(key, record, checksum);
+
+	// Written from memory just now, so there's nothing to check.
+	stored_tile stored = { key, record, checksum, true };
+	_tilesByUse.push_front(stored);
+	_index[key] = _tilesByUse.begin();
+	_statistics.writes++;
+}
+
+uint64_t tile_store::take_record()
+{
+	if (!_freeRecords.empty())
+	{
+		uint64_t record = _freeRecords.back();
+		_freeRecords.pop_back();
+		return record;
+	}
+
+	// Grow the file while there's room for another record.
+	if (TILES_HEADER_BYTES + (_records + 1) * _tileBytes <= _capacityBytes)
+	{
+		if (_records >= _recordCapacity)
+			grow_tiles(_records + 1);
+
+		return _records++;
+	}
+
+	// Otherwise the least recently used tile makes way.
+	if (_tilesByUse.empty())
+		return UINT64_MAX;
+
+	uint64_t record = _tilesByUse.back().record;
+	_index.erase(_tilesByUse.back().key);
+	_tilesByUse.pop_back();
+	_statistics.evictions++;
+	return record;
+}
+
+void tile_store::write_index_entry(const tile_key& key, uint64_t record, uint32_t checksum)
+{
+	index_record entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.zoom_level = key.zoom_level;
+	entry.bailout_radius = key.bailout_radius;
+	entry.tile_x = key.tile_x;
+	entry.tile_y = key.tile_y;
+	entry.pixel_size = key.pixel_size;
+	entry.max_iterations = key.max_iterations;
+	entry.checksum = checksum;
+	entry.record = record;
+
+	_indexFile.write(_indexFile.size(), &entry, sizeof(entry));
+}
+
+void tile_store::clear()
+{
+	if (is_open())
+		start_afresh();
+}
+
+void tile_store::start_afresh()
+{
+	_index.clear();
+	_tilesByUse.clear();
+	_freeRecords.clear();
+	_records = 0;
+	_recordCapacity = 0;
+	_tileData = nullptr;
+
+	_tiles.resize(0);
+	_indexFile.resize(0);
+
+	store_header header = make_header(STORE_TILES, _kernel, _precision, _tileBytes);
+	_tiles.resize(TILES_HEADER_BYTES);
+	_tiles.write(0, &header, sizeof(header));
+
+	header.file_kind = STORE_INDEX;
+	_indexFile.write(0, &header, sizeof(header));
+}
+
+bool tile_store::read_index()
+{
+	if (_tiles.size() < TILES_HEADER_BYTES || _indexFile.size() < sizeof(store_header))
+		return false;
+
+	// Anything written by another version, kernel or precision is no use.
+	store_header expected = make_header(STORE_TILES, _kernel, _precision, _tileBytes);
+	store_header header;
+
+	_tiles.read(0, &header, sizeof(header));
+
+	if (memcmp(&header, &expected, sizeof(header)) != 0)
+		return false;
+
+	expected.file_kind = STORE_INDEX;
+	_indexFile.read(0, &header, sizeof(header));
+
+	if (memcmp(&header, &expected, sizeof(header)) != 0)
+		return false;
+
+	_recordCapacity = (_tiles.size() - TILES_HEADER_BYTES) / _tileBytes;
+
+	uint64_t count = (_indexFile.size() - sizeof(store_header)) / sizeof(index_record);
+	std::vector<index_record> entries((size_t)count);
+
+	if (count > 0)
+		_indexFile.read(sizeof(store_header), entries.data(), entries.size() * sizeof(index_record));
+
+	// Which tile each record holds, for when a later entry reuses it.
+	std::unordered_map<uint64_t, tile_key> owners;
+
+	for (const index_record& entry : entries)
+	{
+		if (entry.record >= _recordCapacity)
+		{
+			_index.clear();
+			_tilesByUse.clear();
+			_records = 0;
+			return false;
+		}
+
+		tile_key key = { entry.zoom_level, entry.pixel_size, entry.tile_x, entry.tile_y, entry.max_iterations, entry.bailout_radius };
+
+		// A later entry replaces whatever the record or the key had before.
+		auto owner = owners.find(entry.record);
+
+		if (owner != owners.end())
+		{
+			auto previous = _index.find(owner->second);
+			_tilesByUse.erase(previous->second);
+			_index.erase(previous);
+		}
+
+		auto existing = _index.find(key);
+
+		if (existing != _index.end())
+		{
+			owners.erase(existing->second->record);
+			_tilesByUse.erase(existing->second);
+			_index.erase(existing);
+		}
+
+		// Entries come in the order they were written, so the last is the most recent.
+		stored_tile stored = { key, entry.record, entry.checksum, false };
+		_tilesByUse.push_front(stored);
+		_index[key] = _tilesByUse.begin();
+		owners[entry.record] = key;
+		_records = std::max(_records, entry.record + 1);
+	}
+
+	// Drop an entry left half written when the program last stopped.
+	uint64_t wholeEntries = sizeof(store_header) + count * sizeof(index_record);
+
+	if (_indexFile.size() != wholeEntries)
+		_indexFile.resize(wholeEntries);
+
+	// Records no entry holds any more are free for new tiles.
+	for (uint64_t record = 0; record < _records; record++)
+	{
+		if (owners.find(record) == owners.end())
+			_freeRecords.push_back(record);
+	}
+
+	if (count > 2 * _index.size() + GROWTH_RECORDS)
+		compact_index();
+
+	_tileData = _tiles.map();
+	return true;
+}
+
+void tile_store::compact_index()
+{
+	// Least recently used first, so that reading it back gives the same order.
+	_indexFile.resize(sizeof(store_header));
+
+	for (auto stored = _tilesByUse.rbegin(); stored != _tilesByUse.rend(); ++stored)
+		write_index_entry(stored->key, stored->record, stored->checksum);
+}
+
+void tile_store::grow_tiles(uint64_t records)
+{
+	uint64_t capacity = (records + GROWTH_RECORDS - 1) / GROWTH_RECORDS * GROWTH_RECORDS;
+
+	_tileData = nullptr;
+	_tiles.resize(TILES_HEADER_BYTES + capacity * _tileBytes);
+	_tileData = _tiles.map();
+	_recordCapacity = capacity;
+}
+
+uint64_t kernel_hash(const std::string& source)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (char c : source)
+	{
+		hash ^= (uint8_t)c;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
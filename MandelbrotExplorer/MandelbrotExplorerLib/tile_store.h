@@ -0,0 +1,169 @@
+#pragma once
+#include "pch.h"
+#include "tile_cache.h"
+#include <string>
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <cstdint>
+
+struct tile_store_statistics
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t writes = 0;
+	uint64_t evictions = 0;
+};
+
+// A file that can be read, written and grown, and mapped into memory whole.
+class mapped_file
+{
+public:
+
+	mapped_file() = default;
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// Opens the file for reading and writing, creating it if it doesn't exist. Path is UTF-8.
+	// Only one mapped_file at a time, in any process, can have a given file open.
+	void open(const std::string& path);
+	void close();
+	bool is_open() const;
+
+	uint64_t size() const { return _size; }
+
+	// Grows or shrinks the file. Unmaps it first.
+	void resize(uint64_t size);
+
+	void read(uint64_t offset, void* data, size_t length);
+	void write(uint64_t offset, const void* data, size_t length);
+
+	// Maps the whole file. The pointer is good until the next resize() or close().
+	// Changes made through the mapping are written back whenever the OS sees fit.
+	uint8_t* map();
+	void unmap();
+
+private:
+
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _file = -1;
+#endif
+
+	uint64_t _size = 0;
+	uint8_t* _view = nullptr;
+};
+
+// Keeps computed tiles on disk, so they outlive the program. Where tile_cache
+// saves recomputing places visited earlier in a session, this saves recomputing
+// them the next day.
+//
+// A store is two files in a directory, named after the kernel and precision
+// that computed the tiles:
+//
+//   <precision>-<kernel>.tiles holds the tiles' data, one fixed-size record after another,
+//   and is kept memory-mapped so that finding a tile costs no copying at all.
+//
+//   <precision>-<kernel>.index lists which tile is in which record. It's read whole when
+//   the store's opened, and appended to from then on. A later entry for a record replaces
+//   any earlier one. Once most of the entries have been replaced, opening the store
+//   rewrites the index with just the rest.
+//
+// Both start with a header recording the format version, kernel, precision and
+// tile size. A store whose header doesn't match what's asked for is started afresh,
+// as is one that was cut short part way through writing.
+//
+// Once the tile file's as big as its capacity allows, each new tile takes the place of the
+// least recently used one. Uses are only tracked while the store's open; between runs,
+// the order the tiles were stored in stands in for them.
+//
+// Writing to the disk is left to the OS, which does it in its own time, so after a crash
+// the index can list records that never got there (or were overwritten by tiles whose
+// entries didn't). Each index entry carries a checksum of its record's data, and a record
+// that doesn't match is dropped the first time it's looked for, and used again.
+//
+// A store has a single writer: opening one that another store (e.g. another instance of
+// the program) already has open fails, and throws saying so.
+class tile_store
+{
+public:
+
+	static const uint32_t FORMAT_VERSION = 2;
+
+	tile_store() = default;
+	~tile_store() { close(); }
+
+	tile_store(const tile_store&) = delete;
+	tile_store& operator=(const tile_store&) = delete;
+
+	// kernel identifies the code that computes the tiles (any change to it should change
+	// the kernel), and precision the number format it computes in. tileBytes is the size
+	// of one tile's data. The directory must already exist.
+	void open(const std::string& directory, uint64_t kernel, const std::string& precision, uint32_t tileBytes);
+	void close();
+	bool is_open() const { return _tiles.is_open(); }
+
+	// The tile file doesn't grow past this many bytes. After that, new tiles replace old ones.
+	void set_capacity(uint64_t capacityBytes) { _capacityBytes = capacityBytes; }
+	uint64_t capacity_bytes() const { return _capacityBytes; }
+
+	size_t tile_count() const { return _index.size(); }
+	uint32_t tile_bytes() const { return _tileBytes; }
+	const tile_store_statistics& statistics() const { return _statistics; }
+
+	// The tile's data, straight out of the mapped file, or null if it isn't stored.
+	// The pointer is good until the next insert() or close().
+	const uint8_t* find(const tile_key& key);
+
+	// Adds tile_bytes() bytes of data for the tile, unless it's already stored,
+	// in place of the least recently used tile if the store's full.
+	void insert(const tile_key& key, const uint8_t* data);
+
+	// Deletes every tile.
+	void clear();
+
+private:
+
+	void start_afresh();
+	bool read_index();
+	void compact_index();
+	void write_index_entry(const tile_key& key, uint64_t record, uint32_t checksum);
+	uint64_t take_record();
+	void grow_tiles(uint64_t records);
+
+	mapped_file _tiles;
+	mapped_file _indexFile;
+	uint8_t* _tileData = nullptr;
+
+	uint64_t _kernel = 0;
+	std::string _precision;
+	uint32_t _tileBytes = 0;
+	uint64_t _capacityBytes = 4ull * 1024 * 1024 * 1024;
+
+	// Records in use, and records the tile file has room for.
+	uint64_t _records = 0;
+	uint64_t _recordCapacity = 0;
+
+	struct stored_tile
+	{
+		tile_key key;
+		uint64_t record;
+		uint32_t checksum;
+		bool verified;	// whether the record's been checked against the checksum yet.
+	};
+
+	// Most recently used at the front.
+	std::list<stored_tile> _tilesByUse;
+	std::unordered_map<tile_key, std::list<stored_tile>::iterator, tile_key_hash> _index;
+
+	// Records whose tiles were dropped, to be used again before the file grows.
+	std::vector<uint64_t> _freeRecords;
+	tile_store_statistics _statistics;
+};
+
+// 64-bit FNV-1a, for turning a kernel's source into an identifier for tile_store.
+uint64_t kernel_hash(const std::string& source);
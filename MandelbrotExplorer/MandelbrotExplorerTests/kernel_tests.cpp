@@ -0,0 +1,146 @@
+#include "test.h"
+#include "kernel_selector.h"
+#include "mandelbrot_cpu.h"
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+	// A view width wide and three quarters as high, centered on (centerReal, centerImag).
+	mandelbrot_precise_bounds view(const double_double& centerReal, const double_double& centerImag, double width)
+	{
+		double_double halfWidth = double_double(width / 2);
+		double_double halfHeight = double_double(width * 3 / 8);
+
+		return mandelbrot_precise_bounds(centerImag + halfHeight, centerReal - halfWidth,
+			centerReal + halfWidth, centerImag - halfHeight);
+	}
+
+	escape_kernel chosen(const mandelbrot_precise_bounds& bounds, const kernel_selection_options& options = kernel_selection_options())
+	{
+		return kernel_selector(options).choose(bounds, 1024, 768).kernel;
+	}
+
+	mandelbrot_parameter_info parameters(const mandelbrot_precise_bounds& bounds, uint32_t width, uint32_t height, uint32_t maxIterations)
+	{
+		mandelbrot_parameter_info info;
+		info.top = (float)bounds.top.hi;
+		info.left = (float)bounds.left.hi;
+		info.right = (float)bounds.right.hi;
+		info.bottom = (float)bounds.bottom.hi;
+		info.surface_width = (float)width;
+		info.surface_height = (float)height;
+		info.bailout_radius = 4.0f;
+		info.max_iterations = maxIterations;
+		info.fill_color = 0;
+		info.gradient_period_factor = 1.0f;
+		info.gradient_length = 1;
+		return info;
+	}
+
+	// Every instruction set has to produce exactly what the scalar kernel does, bit for bit.
+	// An odd-sized surface leaves every row with a partial vector at the end.
+	void check_matches_scalar(cpu_precision precision, const mandelbrot_precise_bounds& bounds, uint32_t maxIterations)
+	{
+		const uint32_t width = 101;
+		const uint32_t height = 67;
+		mandelbrot_parameter_info info = parameters(bounds, width, height, maxIterations);
+
+		cpu_renderer scalar(cpu_instruction_set::scalar);
+		scalar.set_precision(precision);
+		iteration_buffer expected;
+		scalar.iterate(info, bounds, expected);
+
+		// Something other than interior everywhere, or there's nothing to compare.
+		size_t escaped = 0;
+
+		for (float value : expected.values)
+			escaped += value != iteration_buffer::INTERIOR;
+
+		CHECK(escaped > expected.values.size() / 10);
+
+		const cpu_instruction_set simd[] = { cpu_instruction_set::sse2, cpu_instruction_set::avx2, cpu_instruction_set::avx512 };
+
+		for (cpu_instruction_set instructionSet : simd)
+		{
+			if (!cpu_renderer::supports(instructionSet))
+			{
+				printf("        (%s isn't supported here)\n", cpu_renderer::instruction_set_name(instructionSet));
+				continue;
+			}
+
+			cpu_renderer renderer(instructionSet);
+			renderer.set_precision(precision);
+			iteration_buffer actual;
+			renderer.iterate(info, bounds, actual);
+
+			CHECK(actual.values.size() == expected.values.size());
+			CHECK(memcmp(actual.values.data(), expected.values.data(), actual.values.size() * sizeof(float)) == 0);
+		}
+	}
+}
+
+TEST(kernel_selector_picks_the_cheapest_precise_enough)
+{
+	// The whole set, then deeper and deeper into the seahorse valley.
+	CHECK(chosen(view(-0.5, 0.0, 3.0)) == escape_kernel::float32);
+	CHECK(chosen(view(-0.75, 0.1, 1e-6)) == escape_kernel::float_float);
+	CHECK(chosen(view(-0.75, 0.1, 1e-9)) == escape_kernel::float64);
+	CHECK(chosen(view(-0.75, 0.1, 1e-12)) == escape_kernel::double_double);
+	CHECK(chosen(view(-0.75, 0.1, 1e-30)) == escape_kernel::perturbation);
+	CHECK(chosen(view(-0.75, 0.1, 1e-300)) == escape_kernel::perturbation);
+}
+
+TEST(kernel_selector_keeps_to_the_shaders_without_the_cpu)
+{
+	kernel_selection_options options;
+	options.allow_cpu = false;
+
+	CHECK(chosen(view(-0.5, 0.0, 3.0), options) == escape_kernel::float32);
+	CHECK(chosen(view(-0.75, 0.1, 1e-9), options) == escape_kernel::float_float);
+	CHECK(chosen(view(-0.75, 0.1, 1e-30), options) == escape_kernel::float_float);
+}
+
+TEST(kernel_selector_threshold_is_headroom_bits_below_the_spacing)
+{
+	// float32's error is 2^-23 for anything within |z| <= 2, so with 4 bits of headroom
+	// it's good down to a spacing of exactly 2^-19, i.e. 2^-9 across 1024 pixels.
+	double width = std::ldexp(1.0, -9);
+	mandelbrot_precise_bounds exact(width * 3 / 8, -1.0, -1.0 + width, -width * 3 / 8);
+	double narrower = width * 0.99;
+	mandelbrot_precise_bounds finer(narrower * 3 / 8, -1.0, -1.0 + narrower, -narrower * 3 / 8);
+
+	kernel_estimate estimate = kernel_selector::estimate(escape_kernel::float32, exact, 1024, 768);
+	CHECK(estimate.spacing == std::ldexp(1.0, -19));
+	CHECK(estimate.relative_error == std::ldexp(1.0, -4));
+
+	CHECK(chosen(exact) == escape_kernel::float32);
+	CHECK(chosen(finer) == escape_kernel::float_float);
+
+	kernel_selection_options options;
+	options.headroom_bits = 5;
+	CHECK(chosen(exact, options) == escape_kernel::float_float);
+}
+
+TEST(simd_float_kernels_match_scalar)
+{
+	check_matches_scalar(cpu_precision::float32, view(-0.5, 0.0, 3.0), 256);
+	check_matches_scalar(cpu_precision::float32, view(-0.7436, 0.1318, 0.01), 2000);
+}
+
+TEST(simd_double_kernels_match_scalar)
+{
+	check_matches_scalar(cpu_precision::float64, view(-0.5, 0.0, 3.0), 256);
+	check_matches_scalar(cpu_precision::float64, view(-0.743643887037151, 0.13182590420533, 1e-10), 4000);
+}
+
+TEST(simd_double_double_kernels_match_scalar)
+{
+	check_matches_scalar(cpu_precision::double_double, view(-0.5, 0.0, 3.0), 256);
+
+	// A center with more bits than a double, at a depth only double-double can draw.
+	double_double centerReal = double_double(-0.743643887037151) + double_double(1.1e-17);
+	double_double centerImag = double_double(0.13182590420533) + double_double(-2.3e-18);
+	check_matches_scalar(cpu_precision::double_double, view(centerReal, centerImag, 1e-20), 4000);
+}
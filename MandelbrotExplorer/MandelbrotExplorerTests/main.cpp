@@ -0,0 +1,41 @@
+#include "test.h"
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+std::vector<test_case>& all_tests()
+{
+	static std::vector<test_case> tests;
+	return tests;
+}
+
+// Runs every test, or just the ones whose names contain the first argument.
+// The exit code is the number that failed.
+int main(int argc, char** argv)
+{
+	const char* filter = argc > 1 ? argv[1] : "";
+	int run = 0;
+	int failed = 0;
+
+	for (const test_case& test : all_tests())
+	{
+		if (strstr(test.name, filter) == nullptr)
+			continue;
+
+		run++;
+
+		try
+		{
+			test.run();
+			printf("ok      %s\n", test.name);
+		}
+		catch (const std::exception& err)
+		{
+			failed++;
+			printf("FAILED  %s\n        %s\n", test.name, err.what());
+		}
+	}
+
+	printf("\n%d of %d tests passed.\n", run - failed, run);
+	return failed;
+}
@@ -0,0 +1,174 @@
+#include "test.h"
+#include "bignum.h"
+#include "floatexp.h"
+#include "double_double.h"
+#include <cmath>
+
+namespace
+{
+	bool close_to(double value, double expected, double relativeError)
+	{
+		return std::fabs(value - expected) <= std::fabs(expected) * relativeError;
+	}
+
+	// log2 of a floatexp's value, for values far beyond a double's range.
+	template <typename T>
+	double log2_of(const floatexp<T>& value)
+	{
+		return std::log2(std::fabs((double)value.mantissa)) + value.exponent;
+	}
+}
+
+TEST(bignum_parses_and_prints_decimals)
+{
+	CHECK(bignum::parse("-1.25", 2).to_string() == "-1.25");
+	CHECK(bignum::parse("3E+2", 2).to_double() == 300.0);
+	CHECK(bignum::parse("  0.5", 2).to_double() == 0.5);
+	CHECK(bignum::parse("0", 2).is_zero());
+	CHECK(!bignum::parse("-0", 2).negative());
+}
+
+TEST(bignum_rejects_what_it_cannot_hold)
+{
+	CHECK_THROWS(bignum::parse("abc", 2));
+	CHECK_THROWS(bignum::parse("1.5x", 2));
+	CHECK_THROWS(bignum::parse("5e9", 2));
+	CHECK_THROWS(bignum::from_double(5e9, 2));
+
+	// Operands have to agree on their precision.
+	CHECK_THROWS(bignum::from_double(1.0, 2) + bignum::from_double(1.0, 3));
+}
+
+TEST(bignum_arithmetic_is_exact)
+{
+	bignum a = bignum::from_double(1.5, 4);
+	bignum b = bignum::from_double(-0.25, 4);
+
+	CHECK((a + b).to_double() == 1.25);
+	CHECK((b - a).to_double() == -1.75);
+	CHECK((a * b).to_double() == -0.375);
+	CHECK((-a).to_double() == -1.5);
+	CHECK(a.twice().to_double() == 3.0);
+	CHECK(a * b == b * a);
+	CHECK(a + b != a);
+}
+
+TEST(bignum_keeps_digits_a_double_loses)
+{
+	// 1 + 1e-32 is just 1 to a double, but not to 128 bits of fraction.
+	bignum x = bignum::parse("1.00000000000000000000000000000001", 4);
+	bignum one = bignum::from_double(1.0, 4);
+
+	CHECK(x.to_double() == 1.0);
+	CHECK(x != one);
+	CHECK(close_to((x - one).to_double(), 1e-32, 1e-6));
+}
+
+TEST(bignum_reaches_below_a_double)
+{
+	uint32_t words = bignum::words_for_exponent(-1400);
+	bignum tiny = bignum::parse("1e-400", words);
+
+	CHECK(tiny.to_double() == 0.0);
+	CHECK(!tiny.is_zero());
+
+	int32_t exponent = 0;
+	double mantissa = tiny.to_double(exponent);
+	CHECK(std::fabs(std::log2(mantissa) + exponent - (-400.0 * std::log2(10.0))) < 1e-9);
+
+	// And back again, the way floatexps are turned into bignums.
+	bignum same = bignum::from_double(mantissa, exponent, words);
+	int32_t sameExponent = 0;
+	double sameMantissa = same.to_double(sameExponent);
+	CHECK(sameMantissa == mantissa && sameExponent == exponent);
+}
+
+TEST(floatexp_multiplies_beyond_a_double)
+{
+	floatexp<double> a = 1e-200;
+	floatexp<double> product = a * a;
+
+	CHECK(product.mantissa >= 1.0 && product.mantissa < 2.0);
+	CHECK(std::fabs(log2_of(product) - (-400.0 * std::log2(10.0))) < 1e-9);
+	CHECK(product.to_double() == 0.0);
+
+	floatexp<double> quotient = product / a;
+	CHECK(close_to(quotient.to_double(), 1e-200, 1e-14));
+}
+
+TEST(floatexp_adds_and_compares)
+{
+	floatexp<double> a = floatexp<double>(1e-300) * floatexp<double>(1e-300);
+	floatexp<double> sum = a + a;
+
+	CHECK(sum.mantissa == a.mantissa);
+	CHECK(sum.exponent == a.exponent + 1);
+	CHECK(a < sum);
+	CHECK(!(sum < a));
+	CHECK((a - a).mantissa == 0.0);
+
+	// Zero loses every comparison of exponents, so adding it changes nothing.
+	floatexp<double> zero;
+	CHECK((a + zero).mantissa == a.mantissa && (a + zero).exponent == a.exponent);
+	CHECK(zero < a);
+	CHECK(-a < zero);
+}
+
+TEST(floatexp_float_holds_doubles_out_of_float_range)
+{
+	floatexp<float> tiny = 1e-100;
+	CHECK(close_to(tiny.to_double(), 1e-100, 1e-7));
+
+	floatexp<float> huge = 1e100;
+	CHECK(close_to(huge.to_double(), 1e100, 1e-7));
+	CHECK(close_to((tiny * huge).to_double(), 1.0, 1e-6));
+}
+
+TEST(floatexp_normalizes_arrays_like_single_values)
+{
+	double mantissas[5] = { 3.0, -0.375, 0.0, 1.0, 1e-30 };
+	int32_t exponents[5] = { 10, -2000, 7, 0, -5 };
+	floatexp<double> expected[5];
+
+	for (int i = 0; i < 5; i++)
+		expected[i] = floatexp<double>::normalized(mantissas[i], exponents[i]);
+
+	normalize(mantissas, exponents, 5);
+
+	for (int i = 0; i < 5; i++)
+	{
+		CHECK(mantissas[i] == expected[i].mantissa);
+		CHECK(exponents[i] == expected[i].exponent);
+	}
+
+	CHECK(mantissas[0] == 1.5 && exponents[0] == 11);
+	CHECK(mantissas[1] == -1.5 && exponents[1] == -2002);
+	CHECK(mantissas[2] == 0.0 && exponents[2] == floatexp<double>::ZERO_EXPONENT);
+}
+
+TEST(double_double_sums_are_exact)
+{
+	double_double s = two_sum(1.0, 1e-20);
+	CHECK(s.hi == 1.0 && s.lo == 1e-20);
+
+	// Cancellation leaves nothing but what was below hi all along.
+	double_double x = double_double(1.0) + double_double(std::ldexp(1.0, -80));
+	CHECK(x.hi == 1.0);
+	CHECK((x - double_double(1.0)).hi == std::ldexp(1.0, -80));
+}
+
+TEST(double_double_products_are_exact)
+{
+	// (1 + 2^-40)^2 = 1 + 2^-39 + 2^-80, which takes both halves.
+	double_double x = double_double(1.0 + std::ldexp(1.0, -40));
+	double_double product = x * x;
+
+	CHECK(product.hi == 1.0 + std::ldexp(1.0, -39));
+	CHECK(product.lo == std::ldexp(1.0, -80));
+
+	double_double square = sqr(x);
+	CHECK(square.hi == product.hi && square.lo == product.lo);
+
+	double_double doubled = twice(product);
+	CHECK(doubled.hi == 2.0 * product.hi && doubled.lo == 2.0 * product.lo);
+}
@@ -0,0 +1,133 @@
+#include "test.h"
+#include "perturbation.h"
+#include <cmath>
+
+namespace
+{
+	// Deep in the seahorse valley, at a zoom of 1e-30, where double-double has run out.
+	// Pixels here escape after 30000 to 60000 iterations, and a few never do.
+	const char* CENTER_REAL = "-0.743643887037158704752191506114774";
+	const char* CENTER_IMAG = "0.131825904205311970493132056385139";
+	const char* HEIGHT = "1e-30";
+
+	const uint32_t WIDTH = 64;
+	const uint32_t HEIGHT_PIXELS = 48;
+	const uint32_t MAX_ITERATIONS = 60000;
+
+	mandelbrot_parameter_info parameters()
+	{
+		mandelbrot_parameter_info info;
+		info.top = 0.0f;
+		info.left = 0.0f;
+		info.right = 0.0f;
+		info.bottom = 0.0f;
+		info.surface_width = (float)WIDTH;
+		info.surface_height = (float)HEIGHT_PIXELS;
+		info.bailout_radius = 4.0f;
+		info.max_iterations = MAX_ITERATIONS;
+		info.fill_color = 0;
+		info.gradient_period_factor = 1.0f;
+		info.gradient_length = 1;
+		return info;
+	}
+
+	iteration_buffer render(iteration_skipping_method skipping, delta_format deltas = delta_format::automatic, bool stream = true,
+		perturbation_statistics* statistics = nullptr)
+	{
+		perturbation_options options;
+		options.skipping = skipping;
+		options.deltas = deltas;
+		options.stream_references = stream;
+
+		perturbation_engine engine;
+		engine.set_view(CENTER_REAL, CENTER_IMAG, HEIGHT);
+		engine.set_options(options);
+
+		iteration_buffer output;
+		engine.iterate(parameters(), output);
+
+		CHECK(engine.statistics().unresolved_pixels == 0);
+
+		if (statistics != nullptr)
+			*statistics = engine.statistics();
+
+		return output;
+	}
+
+	// Skipping iterations changes their rounding errors. After tens of thousands of iterations,
+	// that's enough to send the odd pixel right at the edge of a filament a different way, but
+	// the interior stays the interior and nearly every pixel comes out within a hair.
+	void check_matches(const iteration_buffer& actual, const iteration_buffer& expected)
+	{
+		CHECK(actual.width == expected.width && actual.height == expected.height);
+		size_t different = 0;
+
+		for (size_t i = 0; i < expected.values.size(); i++)
+		{
+			bool interior = expected.values[i] == iteration_buffer::INTERIOR;
+			CHECK((actual.values[i] == iteration_buffer::INTERIOR) == interior);
+			different += !interior && std::fabs(actual.values[i] - expected.values[i]) > 0.01f;
+		}
+
+		CHECK(different < expected.values.size() / 100);
+	}
+
+	// Most of the iterations at this depth follow the reference closely enough to skip.
+	void check_skipped(const perturbation_statistics& statistics)
+	{
+		CHECK(statistics.skipped_iterations > statistics.iterations / 2);
+	}
+}
+
+TEST(perturbation_draws_a_deep_view)
+{
+	iteration_buffer plain = render(iteration_skipping_method::none);
+
+	// Every pixel of the view is different; nothing's collapsed into blocks of the same value.
+	size_t escaped = 0;
+	size_t sameAsLeft = 0;
+
+	for (uint32_t y = 0; y < plain.height; y++)
+	{
+		const float* row = plain.row(y);
+
+		for (uint32_t x = 0; x < plain.width; x++)
+		{
+			escaped += row[x] != iteration_buffer::INTERIOR;
+			sameAsLeft += x > 0 && row[x] == row[x - 1];
+		}
+	}
+
+	CHECK(escaped > plain.values.size() * 9 / 10);
+	CHECK(sameAsLeft < plain.values.size() / 100);
+}
+
+TEST(perturbation_with_bla_matches_without)
+{
+	perturbation_statistics statistics;
+	iteration_buffer skipped = render(iteration_skipping_method::bla, delta_format::automatic, true, &statistics);
+
+	check_skipped(statistics);
+	check_matches(skipped, render(iteration_skipping_method::none));
+}
+
+TEST(perturbation_with_series_matches_without)
+{
+	perturbation_statistics statistics;
+	iteration_buffer skipped = render(iteration_skipping_method::series, delta_format::automatic, true, &statistics);
+
+	check_skipped(statistics);
+	check_matches(skipped, render(iteration_skipping_method::none));
+}
+
+TEST(perturbation_streamed_references_match_computed_first)
+{
+	check_matches(render(iteration_skipping_method::bla, delta_format::automatic, true),
+		render(iteration_skipping_method::bla, delta_format::automatic, false));
+}
+
+TEST(perturbation_extended_deltas_match_doubles)
+{
+	check_matches(render(iteration_skipping_method::none, delta_format::extended),
+		render(iteration_skipping_method::none, delta_format::float64));
+}
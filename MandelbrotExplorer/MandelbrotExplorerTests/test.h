@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Just enough of a test framework for MandelbrotExplorerTests, which runs the native
+// parts of MandelbrotExplorerLib without a GPU, a window or the CLR.
+//
+// A test is a function defined with TEST(name). It passes unless it throws, and
+// CHECK() throws a test_failure naming the condition that didn't hold.
+
+struct test_failure : std::runtime_error
+{
+	test_failure(const char* file, int line, const char* condition)
+		: std::runtime_error(std::string(file) + "(" + std::to_string(line) + "): " + condition)
+	{
+	}
+};
+
+typedef void (*test_function)();
+
+struct test_case
+{
+	const char* name;
+	test_function run;
+};
+
+// Every TEST() in the program, in no particular order.
+std::vector<test_case>& all_tests();
+
+struct test_registration
+{
+	test_registration(const char* name, test_function run)
+	{
+		test_case registered = { name, run };
+		all_tests().push_back(registered);
+	}
+};
+
+#define TEST(name) \
+	static void name(); \
+	static test_registration name##_registration(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) throw test_failure(__FILE__, __LINE__, #condition); } while (false)
+
+// Checks that the statement throws a std::runtime_error.
+#define CHECK_THROWS(statement) \
+	do { \
+		bool threw = false; \
+		try { statement; } catch (const std::runtime_error&) { threw = true; } \
+		if (!threw) throw test_failure(__FILE__, __LINE__, "Expected " #statement " to throw"); \
+	} while (false)
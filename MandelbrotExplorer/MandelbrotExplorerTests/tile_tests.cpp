@@ -0,0 +1,393 @@
+#include "test.h"
+#include "tile_cache.h"
+#include "tile_store.h"
+#include "tile_scheduler.h"
+#include "progressive_schedule.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+
+namespace
+{
+	tile_key key_at(int64_t tileX, int64_t tileY)
+	{
+		tile_key key = { 3, 1.0 / 1024, tileX, tileY, 500, 4.0f };
+		return key;
+	}
+
+	std::vector<uint8_t> tile_data(size_t bytes, uint8_t fill)
+	{
+		return std::vector<uint8_t>(bytes, fill);
+	}
+
+	// Stores are kept in the working directory, under a name no real store would have.
+	const char* STORE_DIRECTORY = ".";
+	const uint64_t STORE_KERNEL = 0x7e57;
+	const uint32_t STORE_TILE_BYTES = 256;
+
+	std::string store_path(const std::string& precision, const char* extension)
+	{
+		return std::string(STORE_DIRECTORY) + "/" + precision + "-0000000000007e57" + extension;
+	}
+
+	void delete_store(const std::string& precision)
+	{
+		std::remove(store_path(precision, ".tiles").c_str());
+		std::remove(store_path(precision, ".index").c_str());
+	}
+
+	// Overwrites part of a closed store's file, the way a crash or another version would leave it.
+	void patch_file(const std::string& path, long offset, const void* data, size_t length)
+	{
+		FILE* file = fopen(path.c_str(), "r+b");
+
+		if (file == nullptr)
+			throw std::runtime_error("Couldn't open " + path);
+
+		fseek(file, offset, SEEK_SET);
+		fwrite(data, 1, length, file);
+		fclose(file);
+	}
+
+	// Tiles' data starts a page into the tile file, after its header.
+	const long TILES_HEADER_BYTES = 4096;
+
+	// Where the format version sits in either file's header, after the magic number.
+	const long FORMAT_VERSION_OFFSET = 8;
+}
+
+TEST(tile_cache_evicts_least_recently_used)
+{
+	tile_cache cache(300);
+	cache.insert(key_at(0, 0), tile_data(100, 0));
+	cache.insert(key_at(1, 0), tile_data(100, 1));
+	cache.insert(key_at(2, 0), tile_data(100, 2));
+
+	// Using the oldest makes the second the least recently used.
+	CHECK(cache.find(key_at(0, 0)) != nullptr);
+	cache.insert(key_at(3, 0), tile_data(100, 3));
+
+	CHECK(cache.find(key_at(1, 0)) == nullptr);
+	CHECK(cache.find(key_at(0, 0)) != nullptr);
+	CHECK(cache.find(key_at(2, 0)) != nullptr);
+	CHECK((*cache.find(key_at(3, 0)))[0] == 3);
+	CHECK(cache.statistics().evictions == 1);
+	CHECK(cache.size_bytes() == 300);
+}
+
+TEST(tile_cache_replaces_and_shrinks)
+{
+	tile_cache cache(300);
+	cache.insert(key_at(0, 0), tile_data(100, 0));
+	cache.insert(key_at(0, 0), tile_data(150, 9));
+
+	CHECK(cache.tile_count() == 1);
+	CHECK(cache.size_bytes() == 150);
+	CHECK(cache.find(key_at(0, 0))->size() == 150);
+
+	// A tile bigger than the budget isn't kept at all.
+	cache.insert(key_at(1, 0), tile_data(301, 1));
+	CHECK(cache.find(key_at(1, 0)) == nullptr);
+
+	cache.insert(key_at(2, 0), tile_data(100, 2));
+	cache.set_budget(100);
+	CHECK(cache.tile_count() == 1);
+	CHECK(cache.find(key_at(2, 0)) != nullptr);
+}
+
+TEST(tile_store_keeps_tiles_between_opens)
+{
+	const std::string precision = "test-reopen";
+	delete_store(precision);
+
+	{
+		tile_store store;
+		store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+		store.insert(key_at(0, 0), tile_data(STORE_TILE_BYTES, 1).data());
+		store.insert(key_at(5, -2), tile_data(STORE_TILE_BYTES, 2).data());
+	}
+
+	tile_store store;
+	store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+	CHECK(store.tile_count() == 2);
+
+	const uint8_t* data = store.find(key_at(5, -2));
+	CHECK(data != nullptr);
+	CHECK(data[0] == 2 && data[STORE_TILE_BYTES - 1] == 2);
+	CHECK(store.find(key_at(1, 0)) == nullptr);
+
+	store.close();
+	delete_store(precision);
+}
+
+TEST(tile_store_drops_records_failing_their_checksum)
+{
+	const std::string precision = "test-checksum";
+	delete_store(precision);
+
+	{
+		tile_store store;
+		store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+		store.insert(key_at(0, 0), tile_data(STORE_TILE_BYTES, 1).data());
+		store.insert(key_at(1, 0), tile_data(STORE_TILE_BYTES, 2).data());
+	}
+
+	// As if the first record never made it to the disk.
+	uint8_t garbage = 0xee;
+	patch_file(store_path(precision, ".tiles"), TILES_HEADER_BYTES + 10, &garbage, 1);
+
+	tile_store store;
+	store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+	CHECK(store.tile_count() == 2);
+	CHECK(store.find(key_at(0, 0)) == nullptr);
+	CHECK(store.tile_count() == 1);
+	CHECK(store.find(key_at(1, 0)) != nullptr);
+
+	// The dropped record is the next one used.
+	store.insert(key_at(2, 0), tile_data(STORE_TILE_BYTES, 3).data());
+	CHECK(store.find(key_at(2, 0)) != nullptr);
+
+	store.close();
+	delete_store(precision);
+}
+
+TEST(tile_store_starts_afresh_on_another_format)
+{
+	const std::string precision = "test-version";
+	delete_store(precision);
+
+	{
+		tile_store store;
+		store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+		store.insert(key_at(0, 0), tile_data(STORE_TILE_BYTES, 1).data());
+	}
+
+	uint32_t version = tile_store::FORMAT_VERSION + 1;
+	patch_file(store_path(precision, ".tiles"), FORMAT_VERSION_OFFSET, &version, sizeof(version));
+
+	{
+		tile_store store;
+		store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+		CHECK(store.tile_count() == 0);
+		store.insert(key_at(0, 0), tile_data(STORE_TILE_BYTES, 1).data());
+	}
+
+	// Tiles of another size are no use either.
+	tile_store store;
+	store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES * 2);
+	CHECK(store.tile_count() == 0);
+
+	store.close();
+	delete_store(precision);
+}
+
+TEST(tile_store_replaces_least_recently_used_when_full)
+{
+	const std::string precision = "test-full";
+	delete_store(precision);
+
+	tile_store store;
+	store.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+	store.set_capacity(TILES_HEADER_BYTES + 2 * STORE_TILE_BYTES);
+
+	store.insert(key_at(0, 0), tile_data(STORE_TILE_BYTES, 1).data());
+	store.insert(key_at(1, 0), tile_data(STORE_TILE_BYTES, 2).data());
+	CHECK(store.find(key_at(0, 0)) != nullptr);
+
+	store.insert(key_at(2, 0), tile_data(STORE_TILE_BYTES, 3).data());
+	CHECK(store.tile_count() == 2);
+	CHECK(store.statistics().evictions == 1);
+	CHECK(store.find(key_at(1, 0)) == nullptr);
+	CHECK(store.find(key_at(0, 0))[0] == 1);
+	CHECK(store.find(key_at(2, 0))[0] == 3);
+
+	store.close();
+	delete_store(precision);
+}
+
+TEST(tile_store_has_a_single_writer)
+{
+	const std::string precision = "test-writer";
+	delete_store(precision);
+
+	tile_store first;
+	first.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+
+	tile_store second;
+	CHECK_THROWS(second.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES));
+	CHECK(!second.is_open());
+
+	first.close();
+	second.open(STORE_DIRECTORY, STORE_KERNEL, precision, STORE_TILE_BYTES);
+	CHECK(second.is_open());
+
+	second.close();
+	delete_store(precision);
+}
+
+TEST(tile_scheduler_splits_to_the_edges)
+{
+	std::vector<tile> tiles = tile_scheduler::split(100, 70, 64, 64);
+
+	CHECK(tiles.size() == 4);
+	CHECK(tiles[1].left == 64 && tiles[1].width == 36);
+	CHECK(tiles[2].top == 64 && tiles[2].height == 6);
+}
+
+TEST(tile_scheduler_runs_every_tile_once)
+{
+	tile_scheduler_options options;
+	options.tile_width = 16;
+	options.tile_height = 8;
+	options.thread_count = 4;
+	tile_scheduler scheduler(options);
+
+	const uint32_t width = 301;
+	const uint32_t height = 97;
+	std::vector<int> visits(width * height, 0);
+
+	// Run it twice, since the threads sleep between runs.
+	for (int run = 0; run < 2; run++)
+	{
+		scheduler.run(width, height, [&](const tile& t)
+		{
+			for (uint32_t y = t.top; y < t.top + t.height; y++)
+			{
+				for (uint32_t x = t.left; x < t.left + t.width; x++)
+					visits[y * width + x]++;
+			}
+		});
+	}
+
+	for (int count : visits)
+		CHECK(count == 2);
+
+	uint32_t completed = 0;
+
+	for (const worker_statistics& worker : scheduler.statistics())
+		completed += worker.tiles_completed;
+
+	CHECK(scheduler.statistics().size() == 4);
+	CHECK(completed == tile_scheduler::split(width, height, 16, 8).size());
+}
+
+TEST(tile_scheduler_rethrows_from_the_work)
+{
+	tile_scheduler_options options;
+	options.thread_count = 3;
+	tile_scheduler scheduler(options);
+
+	CHECK_THROWS(scheduler.run(640, 640, [](const tile& t)
+	{
+		if (t.left == 128 && t.top == 192)
+			throw std::runtime_error("Tile failed.");
+	}));
+
+	// And carries on as usual afterwards.
+	std::atomic<uint32_t> tiles(0);
+	scheduler.run(640, 640, [&](const tile&) { tiles++; });
+	CHECK(tiles == 100);
+}
+
+TEST(progressive_schedule_covers_the_frame)
+{
+	progressive_schedule schedule;
+	schedule.begin_frame(300, 200);
+
+	std::vector<int> visits(300 * 200, 0);
+
+	while (!schedule.finished())
+	{
+		for (const tile& t : schedule.next_batch())
+		{
+			for (uint32_t y = t.top; y < t.top + t.height; y++)
+			{
+				for (uint32_t x = t.left; x < t.left + t.width; x++)
+					visits[y * 300 + x]++;
+			}
+		}
+
+		schedule.complete_batch(1.0);
+	}
+
+	for (int count : visits)
+		CHECK(count == 1);
+
+	// With no history, every tile's a guess, and guesses go one per batch.
+	CHECK(schedule.statistics().submissions == 6);
+	CHECK(schedule.statistics().tiles == 6);
+}
+
+TEST(progressive_schedule_splits_expensive_tiles)
+{
+	progressive_options options;
+	options.budget_milliseconds = 4.0;
+	progressive_schedule schedule(options);
+
+	// The left-hand tile runs a hundred times over budget, and the right-hand one well within it.
+	const double expensive = 400.0 / (128 * 128);
+	const double cheap = 0.5 / (128 * 128);
+	schedule.begin_frame(256, 128);
+
+	while (!schedule.finished())
+	{
+		const std::vector<tile>& batch = schedule.next_batch();
+		std::vector<double> tileCosts;
+		double total = 0.0;
+
+		for (const tile& t : batch)
+		{
+			tileCosts.push_back((t.left < 128 ? expensive : cheap) * t.width * t.height);
+			total += tileCosts.back();
+		}
+
+		schedule.complete_batch(total, &tileCosts);
+	}
+
+	// Next frame, it's cut into quarters, and those into quarters, as small as tiles go.
+	schedule.begin_frame(256, 128);
+	const std::vector<tile>& first = schedule.next_batch();
+
+	CHECK(first.size() == 1);
+	CHECK(first[0].width == options.min_tile_size && first[0].height == options.min_tile_size);
+
+	// Whereas the cheap tile goes whole.
+	while (schedule.outstanding() > 0)
+		schedule.complete_batch(0.01);
+
+	bool sawWholeTile = false;
+
+	while (!schedule.finished())
+	{
+		for (const tile& t : schedule.next_batch())
+			sawWholeTile = sawWholeTile || (t.left == 128 && t.width == 128);
+
+		schedule.complete_batch(0.01);
+	}
+
+	CHECK(sawWholeTile);
+}
+
+TEST(progressive_schedule_completes_batches_in_order)
+{
+	progressive_schedule schedule;
+	schedule.begin_frame(256, 128);
+
+	schedule.next_batch();
+	schedule.next_batch();
+	CHECK(schedule.outstanding() == 2);
+	CHECK(schedule.finished());
+
+	schedule.complete_batch(2.0);
+	CHECK(schedule.outstanding() == 1);
+	CHECK(schedule.statistics().longest_submission_milliseconds == 2.0);
+
+	// A batch from the last frame still completes, but doesn't count towards this one.
+	schedule.begin_frame(256, 128);
+	schedule.complete_batch(3.0);
+	CHECK(schedule.outstanding() == 0);
+	CHECK(schedule.statistics().submissions == 0);
+	CHECK(schedule.milliseconds_per_pixel() > 0.0);
+
+	CHECK_THROWS(schedule.complete_batch(1.0));
+}
@@ -31,6 +31,14 @@ namespace WPFUI
         private int _panLastX;
         private int _panLastY;
         private bool _resizing = false;
+        private bool _recolorOnly = false;
+        private bool _refineScheduled = false;
+        private DateTime? _refineStart = null;
+        private FrameCompletion? _timedFrame = null;
+        private DateTime _timedFrameStart;
+        private string _timedFrameLabel = "";
+        private RenderKernel _timedFrameKernel;
+        private System.Windows.Threading.DispatcherTimer _frameTimer;
 
         public MainWindow()
         {
@@ -43,6 +51,13 @@ namespace WPFUI
             _viewmodel.PropertyChanged += this._viewmodel_PropertyChanged;
 
             this.DataContext = _viewmodel;
+
+            _frameTimer = new System.Windows.Threading.DispatcherTimer(System.Windows.Threading.DispatcherPriority.Background);
+            _frameTimer.Interval = TimeSpan.FromMilliseconds(1);
+            _frameTimer.Tick += (sender, e) => ShowFrameTime();
+
+            if (_viewmodel.TileStoreMessage != null)
+                outputMessageTextBlock.Text = _viewmodel.TileStoreMessage;
         }
 
         private void _viewmodel_PropertyChanged(object? sender, System.ComponentModel.PropertyChangedEventArgs e)
@@ -51,7 +66,8 @@ namespace WPFUI
             {
                 // Controls updated via data binding can make the 
                 // picturebox control refresh itself, erasing the mandelbrot.
-                DelayDraw();
+                // Only the colors changed, so there's no need to recompute anything.
+                DelayDraw(recolorOnly: true);
             }
         }
 
@@ -59,16 +75,46 @@ namespace WPFUI
         {
             DateTime start = DateTime.Now;
             _viewmodel.Draw();
-            DateTime end = DateTime.Now;
-            int time = (int) (end - start).TotalMilliseconds;
+            _refineStart = null;
 
-            // To keep the picturebox control from refreshing itself,
-            // don't use databinding for this message.
-            outputMessageTextBlock.Text = $"Render time: {time} ms.";
+            TimeFrame("Render time", start);
 
             _resizing = false;
         }
 
+        private void TimeFrame(string label, DateTime start)
+        {
+            // Drawing returns once the frame's handed over to the GPU, not once it's finished.
+            // So the time shown is until the frame's finished, checked for between other messages.
+            // A newer frame takes over from one that's still being timed.
+            _timedFrame = _viewmodel.LastFrame;
+            _timedFrameStart = start;
+            _timedFrameLabel = label;
+            _timedFrameKernel = _viewmodel.LastFrameKernel;
+            ShowFrameTime();
+        }
+
+        private void ShowFrameTime()
+        {
+            if (_timedFrame != null && !_timedFrame.IsCompleted)
+            {
+                _frameTimer.Start();
+                return;
+            }
+
+            _frameTimer.Stop();
+
+            if (_timedFrame == null)
+                return;
+
+            int time = (int) (DateTime.Now - _timedFrameStart).TotalMilliseconds;
+            _timedFrame = null;
+
+            // To keep the picturebox control from refreshing itself,
+            // don't use databinding for this message.
+            outputMessageTextBlock.Text = $"{_timedFrameLabel}: {time} ms ({_timedFrameKernel}).";
+        }
+
         private void Window_SizeChanged(object sender, SizeChangedEventArgs e)
         {
             var w1 = SystemParameters.WorkArea.Width;                   // <- dpi dependent
@@ -81,19 +127,98 @@ namespace WPFUI
             DelayDraw();
         }
 
-        private void DelayDraw()
+        private void DrawPanned()
+        {
+            DateTime start = DateTime.Now;
+            _viewmodel.DrawPanned();
+            _refineStart = null;
+
+            TimeFrame("Render time", start);
+        }
+
+        private void DrawZoomPreview()
+        {
+            DateTime start = DateTime.Now;
+            bool refine = _viewmodel.DrawZoomPreview();
+
+            TimeFrame("Preview time", start);
+
+            if (refine)
+            {
+                _refineStart = start;
+                ScheduleRefine();
+            }
+            else
+            {
+                _refineStart = null;
+            }
+        }
+
+        private void ScheduleRefine()
+        {
+            // Refine a step at a time at background priority,
+            // so that mouse input (e.g. the next zoom) gets in between steps.
+            if (!_refineScheduled)
+            {
+                _refineScheduled = true;
+                Dispatcher.BeginInvoke(RefineStep, System.Windows.Threading.DispatcherPriority.Background);
+            }
+        }
+
+        private void RefineStep()
+        {
+            _refineScheduled = false;
+
+            if (_viewmodel.Refine())
+            {
+                ScheduleRefine();
+            }
+            else if (_refineStart != null)
+            {
+                // Finished, rather than cancelled by some other drawing.
+                TimeFrame("Render time", _refineStart.Value);
+                _refineStart = null;
+            }
+        }
+
+        private void Recolor()
+        {
+            DateTime start = DateTime.Now;
+            _viewmodel.Recolor();
+
+            TimeFrame("Recolor time", start);
+
+            _resizing = false;
+        }
+
+        private void DelayDraw(bool recolorOnly = false)
         {
             // When resizing or maximizing the window, WPF somehow refreshes the pictureBox control
             // at some point after this event completes, which erases the rendering.
             // If we want the Mandelbrot to still automatically show up, 
             // the Draw call needs to be delayed a bit.
+            //
+            // A full draw that's already pending covers any recoloring too.
             if (!_resizing)
             {
                 _resizing = true;
-                Dispatcher.BeginInvoke(Draw, System.Windows.Threading.DispatcherPriority.Background);
+                _recolorOnly = recolorOnly;
+                Dispatcher.BeginInvoke(DelayedDraw, System.Windows.Threading.DispatcherPriority.Background);
+            }
+            else if (!recolorOnly)
+            {
+                _recolorOnly = false;
             }
         }
 
+        private void DelayedDraw()
+        {
+            if (_recolorOnly)
+                Recolor();
+            else
+                Draw();
+        }
+
         private void fractalSurface_MouseDown(object sender, System.Windows.Forms.MouseEventArgs e)
         {
             if (e.Button == MouseButtons.Left)
@@ -110,7 +235,7 @@ namespace WPFUI
                 _viewmodel.PanPixels(e.X - _panLastX, e.Y - _panLastY);
                 _panLastX = e.X;
                 _panLastY = e.Y;
-                Draw();
+                DrawPanned();
             }
         }
 
@@ -121,7 +246,7 @@ namespace WPFUI
             else if (e.Delta > 0)
                 _viewmodel.ZoomToPixel(e.X, e.Y, 1);
 
-            Draw();
+            DrawZoomPreview();
         }
 
         private void rbFire_Checked(object sender, RoutedEventArgs e)
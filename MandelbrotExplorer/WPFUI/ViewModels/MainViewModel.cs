@@ -2,6 +2,7 @@
 using Microsoft.Windows.Themes;
 using System;
 using System.Collections.Generic;
+using System.IO;
 using System.Linq;
 using System.Text;
 using System.Threading.Tasks;
@@ -12,6 +13,9 @@ namespace WPFUI.ViewModels
     {
         private const double ZOOM_FACTOR = 0.8;
 
+        // Beyond 2^53, doubles can no longer hold every whole number.
+        private const double MAX_GRID_ORIGIN = 9007199254740992.0;
+
         private MandelbrotRenderer _renderer;
 
         private int _surfaceWidth;
@@ -94,13 +98,33 @@ namespace WPFUI.ViewModels
             private set { SetValue(ref _bottom, value); }
         }
 
+        // Where the borders were before any panning, and how many pixels
+        // they've been panned since. See PanPixels.
+        private double _anchorLeft, _anchorRight, _anchorTop, _anchorBottom;
+        private double _anchorCenterX, _anchorCenterY;
+        private int _panX, _panY;
+
+        // Where the anchor's top-left pixel sits on the renderer's tile cache grid, and the size
+        // of the grid's pixels. See UpdateBorders.
+        private long _anchorOriginX, _anchorOriginY;
+        private double _pixelSize;
+        private bool _onGrid;
+
+        // Panning not yet drawn, and whether anything besides panning has changed since the last draw.
+        private int _undrawnPanX, _undrawnPanY;
+        private bool _needsFullDraw = true;
+
+        // A zoom not yet drawn, which can be previewed from the last frame. See ZoomToPixel.
+        private int _undrawnZoomDelta;
+        private int _zoomPixelX, _zoomPixelY;
+
         private int _gradientPeriod = 20;
         public int GradientPeriod
         {
             get { return _gradientPeriod; }
             set { 
                 SetValue(ref _gradientPeriod, value);
-                Draw();
+                Recolor();
             }
         }
 
@@ -116,12 +140,49 @@ namespace WPFUI.ViewModels
         public MainViewModel(IntPtr instanceHandle, IntPtr surfaceHandle)
         {
             _renderer = new MandelbrotRenderer(instanceHandle, surfaceHandle);
+
+            // Picks the cheapest kernel that's still precise enough for each frame, so zooming in
+            // past what the shaders can draw switches over to the CPU rather than going blocky.
+            _renderer.Engine = RenderEngine.Automatic;
             (uint width, uint height) = _renderer.GetSurfaceExtent();
             _surfaceWidth = (int)width;
             _surfaceHeight = (int)height;
             UpdateBorders();
+            OpenTileStore();
+        }
+
+        private void OpenTileStore()
+        {
+            // Tiles computed in earlier sessions are kept here, so that coming back to
+            // somewhere already explored is nearly instant. Without it, everything still
+            // works, just with each session starting from scratch.
+            string directory = Path.Combine(
+                Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+                "MandelbrotExplorer", "TileStore");
+
+            try
+            {
+                Directory.CreateDirectory(directory);
+                _renderer.OpenTileStore(directory);
+                TileStoreMessage = null;
+            }
+            catch (Exception e)
+            {
+                // E.g. another instance of the program already has it open.
+                _renderer.CloseTileStore();
+                TileStoreMessage = $"Tiles won't be saved this session: {e.Message}";
+            }
         }
 
+        // Why the tile store couldn't be opened, if it couldn't.
+        public string? TileStoreMessage { get; private set; }
+
+        // The most recently drawn frame. Drawing returns before the GPU's finished with it.
+        public FrameCompletion LastFrame => _renderer.LastFrame;
+
+        // What the Automatic engine chose for the most recently drawn frame.
+        public RenderKernel LastFrameKernel => _renderer.LastFrameKernel;
+
         public void RefreshSurface()
         {
             _renderer.RefreshSurface();
@@ -133,15 +194,88 @@ namespace WPFUI.ViewModels
 
         public void Draw()
         {
-            _renderer.Top = (float)this.Top;
-            _renderer.Left = (float)this.Left;
-            _renderer.Right = (float)this.Right;
-            _renderer.Bottom = (float)this.Bottom;
+            UpdateView();
+            UpdateColoring();
+            _renderer.Draw();
+
+            _undrawnPanX = 0;
+            _undrawnPanY = 0;
+            _undrawnZoomDelta = 0;
+            _needsFullDraw = false;
+        }
+
+        // Shows the last zoom straight away by scaling the last frame.
+        // Returns whether the view still needs refining, a step at a time, with Refine.
+        public bool DrawZoomPreview()
+        {
+            if (_undrawnZoomDelta == 0)
+            {
+                Draw();
+                return false;
+            }
+
+            UpdateView();
+            UpdateColoring();
+
+            // Each zoom level makes the view ZOOM_FACTOR times the size.
+            double scale = Math.Pow(ZOOM_FACTOR, _undrawnZoomDelta);
+            _renderer.ZoomPreview((float)scale, _zoomPixelX, _zoomPixelY);
+
+            _undrawnPanX = 0;
+            _undrawnPanY = 0;
+            _undrawnZoomDelta = 0;
+            _needsFullDraw = false;
+
+            return true;
+        }
+
+        public bool Refine()
+        {
+            return _renderer.Refine();
+        }
+
+        public void DrawPanned()
+        {
+            // The last frame can only be shifted along if panning is all that's happened since.
+            if (_needsFullDraw)
+            {
+                Draw();
+                return;
+            }
+
+            UpdateView();
+            UpdateColoring();
+            _renderer.Pan(_undrawnPanX, _undrawnPanY);
+
+            _undrawnPanX = 0;
+            _undrawnPanY = 0;
+        }
+
+        public void Recolor()
+        {
+            // Only the coloring changed, so the last frame's iteration counts can be reused.
+            UpdateColoring();
+            _renderer.Recolor();
+        }
+
+        private void UpdateView()
+        {
+            _renderer.Top = this.Top;
+            _renderer.Left = this.Left;
+            _renderer.Right = this.Right;
+            _renderer.Bottom = this.Bottom;
 
             _renderer.BailoutRadius = 256;
             _renderer.MaxIterations = 5000;
 
+            if (_onGrid)
+                _renderer.SetGridPosition(_zoomLevel, _pixelSize, _anchorOriginX - _panX, _anchorOriginY - _panY);
+            else
+                _renderer.ClearGridPosition();
+        }
 
+        private void UpdateColoring()
+        {
             double periodPercent = _gradientPeriod / 100.0;
             _renderer.GradientPeriodFactor = (float)periodPercent;
 
@@ -159,12 +293,13 @@ namespace WPFUI.ViewModels
 
             _renderer.FillColor = _gradient[0];
             _renderer.Gradient = _gradient.Skip(1).ToArray();
-            
-            _renderer.Draw();
         }
 
         public void ZoomToPixel(int x, int y, int zoomDelta)
         {
+            // The zoom can be previewed from the last frame, but only if that's still what's on screen.
+            bool previewable = !_needsFullDraw && _undrawnPanX == 0 && _undrawnPanY == 0 && _undrawnZoomDelta == 0;
+
             double r = this.Left + (this.Right - this.Left) * x / _surfaceWidth;
             double i = this.Top + (this.Bottom - this.Top) * y / _surfaceHeight;
 
@@ -174,20 +309,40 @@ namespace WPFUI.ViewModels
 
             UpdateBorders();
             PanPixels(x - _surfaceWidth / 2, y - _surfaceHeight / 2);
+
+            if (previewable)
+            {
+                _undrawnZoomDelta = zoomDelta;
+                _zoomPixelX = x;
+                _zoomPixelY = y;
+            }
         }
 
         public void PanPixels(int deltaX, int deltaY)
         {
-            double deltaR = (this.Right - this.Left) * deltaX / _surfaceWidth;
-            double deltaI = (this.Bottom - this.Top) * deltaY / _surfaceHeight;
-
-            _left -= deltaR;
-            _right -= deltaR;
-            _centerX -= deltaR;
-
-            _top -= deltaI;
-            _bottom -= deltaI;
-            _centerY -= deltaI;
+            _panX += deltaX;
+            _panY += deltaY;
+            _undrawnPanX += deltaX;
+            _undrawnPanY += deltaY;
+
+            // DrawPanned reuses the last frame's pixels, shifted over by a whole number of pixels,
+            // so the borders need to move by exactly that many pixels too.
+            // Working them out from the anchor each time, rather than nudging them along
+            // with every mouse move, keeps rounding errors from piling up into a
+            // sub-pixel drift between the reused pixels and the newly computed ones.
+            double pixelWidth = (_anchorRight - _anchorLeft) / _surfaceWidth;
+            double pixelHeight = (_anchorBottom - _anchorTop) / _surfaceHeight;
+
+            double deltaR = pixelWidth * _panX;
+            double deltaI = pixelHeight * _panY;
+
+            _left = _anchorLeft - deltaR;
+            _right = _anchorRight - deltaR;
+            _centerX = _anchorCenterX - deltaR;
+
+            _top = _anchorTop - deltaI;
+            _bottom = _anchorBottom - deltaI;
+            _centerY = _anchorCenterY - deltaI;
         }
 
         private void UpdateBorders()
@@ -200,10 +355,47 @@ namespace WPFUI.ViewModels
             double zoomedHeight = baseHeight * Math.Pow(ZOOM_FACTOR, ZoomLevel);
             double zoomedWidth = baseWidth * Math.Pow(ZOOM_FACTOR, ZoomLevel);
 
-            this.Left = this.CenterX - 0.5 * zoomedWidth;
-            this.Right = this.CenterX + 0.5 * zoomedWidth;
-            this.Top = this.CenterY + 0.5 * zoomedHeight;
-            this.Bottom = this.CenterY - 0.5 * zoomedHeight;
+            // Snap the borders onto a grid of pixels fixed to the complex plane, so that pixels
+            // computed for one view land exactly on the pixels of any other view at the same zoom.
+            // That's what lets the renderer reuse cached tiles rather than computing them again.
+            // It moves the view by under half a pixel, which nobody will notice.
+            // Once zoomed in far enough, the grid's coordinates no longer fit exactly in a double,
+            // so the view is left where it is and the cache goes unused.
+            _pixelSize = zoomedHeight / _surfaceHeight;
+            double originX = Math.Round(this.CenterX / _pixelSize - 0.5 * _surfaceWidth);
+            double originY = Math.Round(-this.CenterY / _pixelSize - 0.5 * _surfaceHeight);
+            _onGrid = Math.Abs(originX) < MAX_GRID_ORIGIN && Math.Abs(originY) < MAX_GRID_ORIGIN;
+
+            if (_onGrid)
+            {
+                _anchorOriginX = (long)originX;
+                _anchorOriginY = (long)originY;
+
+                this.Left = originX * _pixelSize;
+                this.Right = (originX + _surfaceWidth) * _pixelSize;
+                this.Top = -originY * _pixelSize;
+                this.Bottom = -(originY + _surfaceHeight) * _pixelSize;
+
+                _centerX = 0.5 * (_left + _right);
+                _centerY = 0.5 * (_top + _bottom);
+            }
+            else
+            {
+                this.Left = this.CenterX - 0.5 * zoomedWidth;
+                this.Right = this.CenterX + 0.5 * zoomedWidth;
+                this.Top = this.CenterY + 0.5 * zoomedHeight;
+                this.Bottom = this.CenterY - 0.5 * zoomedHeight;
+            }
+
+            _anchorLeft = _left;
+            _anchorRight = _right;
+            _anchorTop = _top;
+            _anchorBottom = _bottom;
+            _anchorCenterX = _centerX;
+            _anchorCenterY = _centerY;
+            _panX = 0;
+            _panY = 0;
+            _needsFullDraw = true;
         }
     }
 }